@@ -0,0 +1,86 @@
+/*
+	Copyright (C) 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../libs/pilight/core/json.h"
+#include "bench.h"
+
+static const char *arena_message = "{\"message\":{\"id\":1234567,\"unit\":3,\"state\":\"on\"},\"origin\":\"receiver\",\"protocol\":\"kaku_switch\",\"uuid\":\"0000-b8-27-eb-0f3db7\",\"repeats\":1}";
+
+/* Builds a device update the way the broadcaster does */
+static struct JsonNode *arena_update(struct JsonArena *arena) {
+	struct JsonNode *json = json_mkobject_in(arena);
+	struct JsonNode *jdevices = json_mkarray_in(arena);
+	struct JsonNode *jvalues = json_mkobject_in(arena);
+
+	json_append_element(jdevices, json_mkstring_in(arena, "weather"));
+	json_append_member(jvalues, "timestamp", json_mknumber_in(arena, 1444839281, 0));
+	json_append_member(jvalues, "temperature", json_mknumber_in(arena, 21.35, 2));
+	json_append_member(jvalues, "humidity", json_mknumber_in(arena, 56.0, 1));
+	json_append_member(jvalues, "battery", json_mknumber_in(arena, 1, 0));
+	json_append_member(json, "origin", json_mkstring_in(arena, "update"));
+	json_append_member(json, "type", json_mknumber_in(arena, 3, 0));
+	json_append_member(json, "devices", jdevices);
+	json_append_member(json, "values", jvalues);
+	return json;
+}
+
+void bench_arena(unsigned long iterations) {
+	struct bench_timer_t timer;
+	struct JsonArena *arena = NULL;
+	struct JsonNode *json = NULL;
+	size_t len = strlen(arena_message);
+	unsigned long i = 0;
+
+	if(iterations == 0) {
+		iterations = 100000;
+	}
+
+	bench_start(&timer);
+	for(i=0;i<iterations;i++) {
+		json = json_decode(arena_message);
+		json_delete(json);
+	}
+	bench_stop(&timer, "arena/decode/malloc", iterations, len);
+
+	bench_start(&timer);
+	for(i=0;i<iterations;i++) {
+		arena = json_arena_new(len*4);
+		json = json_decode_arena(arena, arena_message);
+		json_arena_free(arena);
+	}
+	bench_stop(&timer, "arena/decode/arena", iterations, len);
+
+	bench_start(&timer);
+	for(i=0;i<iterations;i++) {
+		json = arena_update(NULL);
+		json_delete(json);
+	}
+	bench_stop(&timer, "arena/build/malloc", iterations, 0);
+
+	bench_start(&timer);
+	for(i=0;i<iterations;i++) {
+		arena = json_arena_new(1024);
+		json = arena_update(arena);
+		json_arena_free(arena);
+	}
+	bench_stop(&timer, "arena/build/arena", iterations, 0);
+}
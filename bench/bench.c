@@ -0,0 +1,227 @@
+/*
+	Copyright (C) 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+/*
+ * Micro benchmarks of the hot paths of the daemon. Every benchmark
+ * prints the time per operation, the throughput when it handles bytes
+ * and, where the linker can wrap malloc, the allocations per operation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../libs/pilight/core/pilight.h"
+#include "../libs/pilight/core/common.h"
+#include "../libs/pilight/core/log.h"
+#include "../libs/pilight/core/options.h"
+#include "../libs/pilight/core/gc.h"
+#include "bench.h"
+
+static struct bench_t benchmarks[] = {
+	{ "msgpack", "socket messages encoded as MessagePack and as JSON", bench_msgpack },
+	{ "arena", "json documents allocated from the heap and from an arena", bench_arena },
+	{ "emit", "number heavy json emitted by the reference and current emitter", bench_emit },
+	{ "json", "json decoded, encoded, searched and deleted", bench_json },
+	{ "devices", "received codes resolved to one of 500 devices", bench_devices },
+	{ "control", "control requests validated against 500 devices", bench_control },
+	{ "events", "updates evaluated against 500 rules by 1, 2 and 4 threads", bench_events },
+	{ NULL, NULL, NULL }
+};
+
+#ifdef BENCH_ALLOCS
+static unsigned long allocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	__sync_fetch_and_add(&allocs, 1);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+	__sync_fetch_and_add(&allocs, 1);
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	__sync_fetch_and_add(&allocs, 1);
+	return __real_realloc(ptr, size);
+}
+
+int bench_allocs(unsigned long *out) {
+	*out = __sync_fetch_and_add(&allocs, 0);
+	return 0;
+}
+#else
+int bench_allocs(unsigned long *out) {
+	*out = 0;
+	return -1;
+}
+#endif
+
+unsigned long long bench_clock(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+void bench_start(struct bench_timer_t *timer) {
+	bench_allocs(&timer->allocs);
+	timer->start = bench_clock();
+}
+
+void bench_pause(struct bench_timer_t *timer) {
+	timer->paused = bench_clock();
+	bench_allocs(&timer->paused_allocs);
+}
+
+void bench_resume(struct bench_timer_t *timer) {
+	unsigned long allocs = 0;
+
+	bench_allocs(&allocs);
+	timer->allocs += allocs - timer->paused_allocs;
+	timer->start += bench_clock() - timer->paused;
+}
+
+void bench_stop(struct bench_timer_t *timer, const char *name, unsigned long iterations, size_t bytes) {
+	unsigned long long elapsed = bench_clock() - timer->start;
+	unsigned long allocs = 0;
+	char mbs[32], aps[32];
+
+	strcpy(mbs, "-");
+	strcpy(aps, "-");
+	if(iterations == 0) {
+		iterations = 1;
+	}
+	if(bytes > 0 && elapsed > 0) {
+		snprintf(mbs, sizeof(mbs), "%.1f", ((double)bytes * (double)iterations / (1024.0*1024.0)) / ((double)elapsed / 1.0e9));
+	}
+	if(bench_allocs(&allocs) == 0) {
+		snprintf(aps, sizeof(aps), "%.1f", (double)(allocs - timer->allocs) / (double)iterations);
+	}
+	printf("%-40s %10lu %12.1f %10s %10s\n", name, iterations,
+		(double)elapsed / (double)iterations, mbs, aps);
+	fflush(stdout);
+}
+
+int main_gc(void) {
+	log_shell_disable();
+
+	options_gc();
+	log_gc();
+	gc_clear();
+
+	FREE(progname);
+	xfree();
+
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+	atomicinit();
+	gc_attach(main_gc);
+
+	log_shell_enable();
+	log_file_disable();
+	log_level_set(LOG_ERR);
+
+	struct options_t *options = NULL;
+	char *args = NULL, *name = NULL;
+	unsigned long iterations = 0;
+	int i = 0, found = 0;
+
+	if((progname = MALLOC(14)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(progname, "pilight-bench");
+
+	options_add(&options, 'H', "help", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, 'V', "version", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, 'L', "list", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, 'b', "bench", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, 'n', "iterations", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, "^[0-9]+$");
+
+	while (1) {
+		int c;
+		c = options_parse(&options, argc, argv, 1, &args);
+		if(c == -1)
+			break;
+		if(c == -2)
+			c = 'H';
+		switch (c) {
+			case 'H':
+				printf("Usage: %s [options]\n", progname);
+				printf("\t -H --help\t\t\tdisplay usage summary\n");
+				printf("\t -V --version\t\t\tdisplay version\n");
+				printf("\t -L --list\t\t\tlist the benchmarks\n");
+				printf("\t -b --bench=name\t\tonly run this benchmark\n");
+				printf("\t -n --iterations=number\t\tnumber of iterations per benchmark\n");
+				goto clear;
+			break;
+			case 'V':
+				printf("%s v%s\n", progname, PILIGHT_VERSION);
+				goto clear;
+			break;
+			case 'L':
+				for(i=0;benchmarks[i].name != NULL;i++) {
+					printf("%-20s %s\n", benchmarks[i].name, benchmarks[i].description);
+				}
+				goto clear;
+			break;
+			case 'b':
+				if((name = REALLOC(name, strlen(args)+1)) == NULL) {
+					fprintf(stderr, "out of memory\n");
+					exit(EXIT_FAILURE);
+				}
+				strcpy(name, args);
+			break;
+			case 'n':
+				iterations = strtoul(args, NULL, 10);
+			break;
+			default:
+				printf("Usage: %s [options]\n", progname);
+				goto clear;
+			break;
+		}
+	}
+
+	printf("%-40s %10s %12s %10s %10s\n", "benchmark", "iterations", "ns/op", "MB/s", "allocs/op");
+	for(i=0;benchmarks[i].name != NULL;i++) {
+		if(name == NULL || strcmp(name, benchmarks[i].name) == 0) {
+			benchmarks[i].run(iterations);
+			found = 1;
+		}
+	}
+	if(found == 0) {
+		logprintf(LOG_ERR, "no benchmark called %s", name);
+	}
+
+clear:
+	if(name != NULL) {
+		FREE(name);
+	}
+	options_delete(options);
+	main_gc();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,54 @@
+/*
+	Copyright (C) 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stddef.h>
+
+typedef struct bench_t {
+	const char *name;
+	const char *description;
+	void (*run)(unsigned long iterations);
+} bench_t;
+
+typedef struct bench_timer_t {
+	unsigned long long start;
+	unsigned long allocs;
+	unsigned long long paused;
+	unsigned long paused_allocs;
+} bench_timer_t;
+
+unsigned long long bench_clock(void);
+void bench_start(struct bench_timer_t *timer);
+void bench_stop(struct bench_timer_t *timer, const char *name, unsigned long iterations, size_t bytes);
+/* Leaves the setup between two pause and resume calls out of the measurement */
+void bench_pause(struct bench_timer_t *timer);
+void bench_resume(struct bench_timer_t *timer);
+/* Returns -1 when the allocations can't be counted on this platform */
+int bench_allocs(unsigned long *allocs);
+
+void bench_msgpack(unsigned long iterations);
+void bench_arena(unsigned long iterations);
+void bench_emit(unsigned long iterations);
+void bench_json(unsigned long iterations);
+void bench_devices(unsigned long iterations);
+void bench_control(unsigned long iterations);
+void bench_events(unsigned long iterations);
+
+#endif
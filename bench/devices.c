@@ -0,0 +1,222 @@
+/*
+	Copyright (C) 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <regex.h>
+
+#include "../libs/pilight/core/pilight.h"
+#include "../libs/pilight/core/json.h"
+#include "../libs/pilight/core/config.h"
+#include "../libs/pilight/config/devices.h"
+#include "../libs/pilight/protocols/protocol.h"
+#include "bench.h"
+
+#define DEVICES_COUNT	500
+
+/* A configuration of devices that each listen to their own id and unit */
+static int devices_setup(const char *protocol, const char *value) {
+	struct JsonNode *json = json_mkobject();
+	struct JsonNode *jdevices = json_mkobject();
+	struct JsonNode *jdevice = NULL, *jid = NULL, *jelement = NULL;
+	char name[32];
+	int i = 0, ret = 0;
+
+	protocol_init();
+	config_init();
+
+	for(i=0;i<DEVICES_COUNT;i++) {
+		jdevice = json_mkobject();
+		jid = json_mkarray();
+		jelement = json_mkobject();
+		json_append_member(jelement, "id", json_mknumber(100000+i/16, 0));
+		json_append_member(jelement, "unit", json_mknumber(i%16, 0));
+		json_append_element(jid, jelement);
+		jelement = json_mkarray();
+		json_append_element(jelement, json_mkstring(protocol));
+		json_append_member(jdevice, "protocol", jelement);
+		json_append_member(jdevice, "id", jid);
+		json_append_member(jdevice, "state", json_mkstring("off"));
+		if(value != NULL) {
+			json_append_member(jdevice, value, json_mknumber(0, 0));
+		}
+		snprintf(name, sizeof(name), "device%d", i);
+		json_append_member(jdevices, name, jdevice);
+	}
+	json_append_member(json, "devices", jdevices);
+
+	if((ret = config_parse(json)) != EXIT_SUCCESS) {
+		fprintf(stderr, "devices: the configuration was rejected\n");
+	}
+	json_delete(json);
+	return ret;
+}
+
+static void devices_teardown(void) {
+	config_gc();
+	protocol_gc();
+}
+
+/* A received code the way the receiver hands it to the broadcaster */
+static struct JsonNode *devices_message(int id, int unit, const char *state) {
+	struct JsonNode *json = json_mkobject();
+	struct JsonNode *jmessage = json_mkobject();
+
+	json_append_member(jmessage, "id", json_mknumber(id, 0));
+	json_append_member(jmessage, "unit", json_mknumber(unit, 0));
+	json_append_member(jmessage, "state", json_mkstring(state));
+	json_append_member(json, "message", jmessage);
+	json_append_member(json, "origin", json_mkstring("receiver"));
+	json_append_member(json, "protocol", json_mkstring("arctech_switch"));
+	json_append_member(json, "repeats", json_mknumber(1, 0));
+	return json;
+}
+
+void bench_devices(unsigned long iterations) {
+	struct bench_timer_t timer;
+	struct JsonNode *messages[2][DEVICES_COUNT], *jmiss = NULL, *out = NULL;
+	unsigned long i = 0, updated = 0;
+	int x = 0;
+
+	if(iterations == 0) {
+		iterations = 100000;
+	}
+	if(devices_setup("kaku_switch", NULL) != EXIT_SUCCESS) {
+		devices_teardown();
+		return;
+	}
+
+	/* Every message switches one of the configured devices, each round the other way */
+	for(x=0;x<DEVICES_COUNT;x++) {
+		messages[0][x] = devices_message(100000+x/16, x%16, "on");
+		messages[1][x] = devices_message(100000+x/16, x%16, "off");
+	}
+	bench_start(&timer);
+	for(i=0;i<iterations;i++) {
+		out = NULL;
+		if(devices_update("arctech_switch", messages[(i/DEVICES_COUNT) % 2][i % DEVICES_COUNT], RECEIVER, &out) == 0) {
+			json_delete(out);
+			updated++;
+		}
+	}
+	bench_stop(&timer, "devices/update/configured", iterations, 0);
+	if(updated != iterations) {
+		fprintf(stderr, "devices: %lu of %lu messages updated a device\n", updated, iterations);
+	}
+
+	/* A neighbour's remote nobody configured */
+	jmiss = devices_message(9999999, 15, "on");
+	bench_start(&timer);
+	for(i=0;i<iterations;i++) {
+		out = NULL;
+		if(devices_update("arctech_switch", jmiss, RECEIVER, &out) == 0) {
+			json_delete(out);
+		}
+	}
+	bench_stop(&timer, "devices/update/unconfigured", iterations, 0);
+
+	json_delete(jmiss);
+	for(x=0;x<DEVICES_COUNT;x++) {
+		json_delete(messages[0][x]);
+		json_delete(messages[1][x]);
+	}
+	devices_teardown();
+}
+
+/*
+	Value validation as it was before the masks were compiled once:
+	every check compiles the mask of the option again.
+*/
+static int devices_valid_value_regcomp(char *sid, char *name, char *value) {
+	struct devices_t *dptr = NULL;
+	struct options_t *opt = NULL;
+	struct protocols_t *tmp_protocol = NULL;
+	regex_t regex;
+	int reti = 0;
+
+	if(devices_get(sid, &dptr) == 0) {
+		tmp_protocol = dptr->protocols;
+		while(tmp_protocol) {
+			opt = tmp_protocol->listener->options;
+			while(opt) {
+				if(opt->conftype == DEVICES_VALUE && strcmp(name, opt->name) == 0) {
+					if(opt->mask != NULL) {
+						if(regcomp(&regex, opt->mask, REG_EXTENDED) != 0) {
+							return 1;
+						}
+						reti = regexec(&regex, value, 0, NULL, 0);
+						regfree(&regex);
+						if(reti != 0) {
+							return 1;
+						}
+					}
+					return 0;
+				}
+				opt = opt->next;
+			}
+			tmp_protocol = tmp_protocol->next;
+		}
+	}
+	return 1;
+}
+
+/* The checks pilight-control and the socket do for every control request */
+void bench_control(unsigned long iterations) {
+	struct bench_timer_t timer;
+	char names[DEVICES_COUNT][32], levels[16][4];
+	unsigned long i = 0, invalid = 0;
+	int x = 0;
+
+	if(iterations == 0) {
+		iterations = 1000000;
+	}
+	if(devices_setup("kaku_dimmer", "dimlevel") != EXIT_SUCCESS) {
+		devices_teardown();
+		return;
+	}
+	for(x=0;x<DEVICES_COUNT;x++) {
+		snprintf(names[x], sizeof(names[x]), "device%d", x);
+	}
+	for(x=0;x<16;x++) {
+		snprintf(levels[x], sizeof(levels[x]), "%d", x);
+	}
+
+	bench_start(&timer);
+	for(i=0;i<iterations;i++) {
+		if(devices_valid_state(names[i % DEVICES_COUNT], "on") != 0 ||
+		   devices_valid_value(names[i % DEVICES_COUNT], "dimlevel", levels[i % 16]) != 0) {
+			invalid++;
+		}
+	}
+	bench_stop(&timer, "control/validate", iterations, 0);
+
+	bench_start(&timer);
+	for(i=0;i<iterations;i++) {
+		if(devices_valid_state(names[i % DEVICES_COUNT], "on") != 0 ||
+		   devices_valid_value_regcomp(names[i % DEVICES_COUNT], "dimlevel", levels[i % 16]) != 0) {
+			invalid++;
+		}
+	}
+	bench_stop(&timer, "control/validate/regcomp", iterations, 0);
+
+	if(invalid > 0) {
+		fprintf(stderr, "control: %lu valid requests were rejected\n", invalid);
+	}
+	devices_teardown();
+}
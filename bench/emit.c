@@ -0,0 +1,214 @@
+/*
+	Copyright (C) 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../libs/pilight/core/json.h"
+#include "bench.h"
+
+#define EMIT_DEVICES	50
+
+/*
+	The emitter as it was before it was reworked: a buffer doubling
+	from 16 bytes and every number formatted with sprintf. It is only
+	kept here to compare the current emitter against.
+*/
+typedef struct emit_sb_t {
+	char *start;
+	char *cur;
+	char *end;
+} emit_sb_t;
+
+static void emit_grow(struct emit_sb_t *sb, size_t need) {
+	size_t length = (size_t)(sb->cur - sb->start);
+	size_t alloc = (size_t)(sb->end - sb->start);
+
+	do {
+		alloc *= 2;
+	} while(alloc < length + need);
+
+	if((sb->start = realloc(sb->start, alloc + 1)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	sb->cur = sb->start + length;
+	sb->end = sb->start + alloc;
+}
+
+static void emit_put(struct emit_sb_t *sb, const char *bytes, size_t count) {
+	if((size_t)(sb->end - sb->cur) < count) {
+		emit_grow(sb, count);
+	}
+	memcpy(sb->cur, bytes, count);
+	sb->cur += count;
+}
+
+static void emit_string(struct emit_sb_t *sb, const char *str) {
+	char buf[8];
+
+	emit_put(sb, "\"", 1);
+	while(*str) {
+		if(*str == '"' || *str == '\\') {
+			buf[0] = '\\';
+			buf[1] = *str;
+			emit_put(sb, buf, 2);
+		} else if((unsigned char)*str < 0x20) {
+			snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)*str);
+			emit_put(sb, buf, 6);
+		} else {
+			emit_put(sb, str, 1);
+		}
+		str++;
+	}
+	emit_put(sb, "\"", 1);
+}
+
+static void emit_value(struct emit_sb_t *sb, const struct JsonNode *node) {
+	struct JsonNode *child = NULL;
+	char buf[64];
+
+	switch(node->tag) {
+		case JSON_NULL:
+			emit_put(sb, "null", 4);
+		break;
+		case JSON_BOOL:
+			emit_put(sb, node->bool_ ? "true" : "false", node->bool_ ? 4 : 5);
+		break;
+		case JSON_STRING:
+			emit_string(sb, node->string_);
+		break;
+		case JSON_NUMBER:
+			sprintf(buf, "%.*f", node->decimals_, node->number_);
+			if(isfinite(node->number_)) {
+				emit_put(sb, buf, strlen(buf));
+			} else {
+				emit_put(sb, "null", 4);
+			}
+		break;
+		case JSON_ARRAY:
+		case JSON_OBJECT:
+			emit_put(sb, (node->tag == JSON_ARRAY) ? "[" : "{", 1);
+			child = json_first_child(node);
+			while(child) {
+				if(node->tag == JSON_OBJECT) {
+					emit_string(sb, child->key);
+					emit_put(sb, ":", 1);
+				}
+				emit_value(sb, child);
+				if((child = child->next) != NULL) {
+					emit_put(sb, ",", 1);
+				}
+			}
+			emit_put(sb, (node->tag == JSON_ARRAY) ? "]" : "}", 1);
+		break;
+	}
+}
+
+static char *emit_reference(const struct JsonNode *node) {
+	struct emit_sb_t sb;
+
+	if((sb.start = malloc(17)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	sb.cur = sb.start;
+	sb.end = sb.start + 16;
+	emit_value(&sb, node);
+	*sb.cur = '\0';
+	return sb.start;
+}
+
+/* A /values response of number heavy weather stations */
+static struct JsonNode *emit_values(void) {
+	struct JsonNode *json = json_mkarray();
+	struct JsonNode *jdevice = NULL, *jdevices = NULL, *jvalues = NULL;
+	char name[32];
+	int i = 0;
+
+	for(i=0;i<EMIT_DEVICES;i++) {
+		jdevice = json_mkobject();
+		jdevices = json_mkarray();
+		jvalues = json_mkobject();
+		snprintf(name, sizeof(name), "weather%d", i);
+		json_append_element(jdevices, json_mkstring(name));
+		json_append_member(jvalues, "timestamp", json_mknumber(1444839281+i, 0));
+		json_append_member(jvalues, "temperature", json_mknumber(18.25+(double)i/8, 2));
+		json_append_member(jvalues, "humidity", json_mknumber(40.5+(double)i/3, 1));
+		json_append_member(jvalues, "pressure", json_mknumber(1013.125-(double)i/16, 3));
+		json_append_member(jvalues, "battery", json_mknumber(1, 0));
+		json_append_member(jdevice, "type", json_mknumber(3, 0));
+		json_append_member(jdevice, "devices", jdevices);
+		json_append_member(jdevice, "values", jvalues);
+		json_append_element(json, jdevice);
+	}
+	return json;
+}
+
+void bench_emit(unsigned long iterations) {
+	struct bench_timer_t timer;
+	struct JsonNode *json = emit_values();
+	char *out = NULL, *buffer = NULL;
+	size_t len = 0;
+	unsigned long i = 0;
+
+	if(iterations == 0) {
+		iterations = 10000;
+	}
+
+	out = json_stringify(json, NULL);
+	len = strlen(out);
+	json_free(out);
+	if((buffer = malloc(len+1)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Both emitters have to agree on the output */
+	out = emit_reference(json);
+	json_stringify_to(json, NULL, buffer, len+1);
+	if(strcmp(out, buffer) != 0) {
+		fprintf(stderr, "emit: the emitters produce different output\n");
+	}
+	free(out);
+
+	bench_start(&timer);
+	for(i=0;i<iterations;i++) {
+		out = emit_reference(json);
+		free(out);
+	}
+	bench_stop(&timer, "emit/values/reference", iterations, len);
+
+	bench_start(&timer);
+	for(i=0;i<iterations;i++) {
+		out = json_stringify(json, NULL);
+		json_free(out);
+	}
+	bench_stop(&timer, "emit/values/stringify", iterations, len);
+
+	bench_start(&timer);
+	for(i=0;i<iterations;i++) {
+		json_stringify_to(json, NULL, buffer, len+1);
+	}
+	bench_stop(&timer, "emit/values/stringify-to", iterations, len);
+
+	free(buffer);
+	json_delete(json);
+}
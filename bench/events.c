@@ -0,0 +1,164 @@
+/*
+	Copyright (C) 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include "../libs/pilight/core/pilight.h"
+#include "../libs/pilight/core/json.h"
+#include "../libs/pilight/core/config.h"
+#include "../libs/pilight/core/eventbus.h"
+#include "../libs/pilight/core/threads.h"
+#include "../libs/pilight/protocols/protocol.h"
+#ifdef EVENTS
+	#include "../libs/pilight/events/events.h"
+	#include "../libs/pilight/events/operator.h"
+	#include "../libs/pilight/events/function.h"
+	#include "../libs/pilight/events/action.h"
+#endif
+#include "bench.h"
+
+#define EVENTS_RULES	500
+
+#ifdef EVENTS
+static const char *events_update = "{\"origin\":\"update\",\"type\":1,\"devices\":[\"master\"],\"values\":{\"timestamp\":1444839281,\"state\":\"off\"}}";
+
+static struct JsonNode *events_switch(int id, int unit) {
+	struct JsonNode *jdevice = json_mkobject();
+	struct JsonNode *jid = json_mkarray();
+	struct JsonNode *jelement = json_mkobject();
+
+	json_append_member(jelement, "id", json_mknumber(id, 0));
+	json_append_member(jelement, "unit", json_mknumber(unit, 0));
+	json_append_element(jid, jelement);
+	jelement = json_mkarray();
+	json_append_element(jelement, json_mkstring("kaku_switch"));
+	json_append_member(jdevice, "protocol", jelement);
+	json_append_member(jdevice, "id", jid);
+	json_append_member(jdevice, "state", json_mkstring("off"));
+	return jdevice;
+}
+
+/*
+	A master switch and a rule for each of the other switches that
+	depends on it, so every update of the master evaluates all rules.
+	Each rule targets its own switch, so they can all run concurrently.
+*/
+static int events_setup(int threads) {
+	struct JsonNode *json = json_mkobject();
+	struct JsonNode *jdevices = json_mkobject();
+	struct JsonNode *jrules = json_mkobject();
+	struct JsonNode *jsettings = json_mkobject();
+	struct JsonNode *jrule = NULL;
+	char name[32], rule[256];
+	int i = 0, ret = 0;
+
+	eventbus_init();
+	protocol_init();
+	config_init();
+	event_operator_init();
+	event_function_init();
+	event_action_init();
+
+	json_append_member(jdevices, "master", events_switch(99999, 0));
+	for(i=0;i<EVENTS_RULES;i++) {
+		snprintf(name, sizeof(name), "device%d", i);
+		json_append_member(jdevices, name, events_switch(100000+i/16, i%16));
+
+		snprintf(rule, sizeof(rule), "IF master.state IS on AND (device%d.state IS off OR device%d.state IS on) THEN switch DEVICE device%d TO on", i, i, i);
+		jrule = json_mkobject();
+		json_append_member(jrule, "rule", json_mkstring(rule));
+		json_append_member(jrule, "active", json_mknumber(1, 0));
+		snprintf(name, sizeof(name), "rule%d", i);
+		json_append_member(jrules, name, jrule);
+	}
+	json_append_member(jsettings, "event-threads", json_mknumber(threads, 0));
+	json_append_member(json, "devices", jdevices);
+	json_append_member(json, "rules", jrules);
+	json_append_member(json, "settings", jsettings);
+
+	if((ret = config_parse(json)) != EXIT_SUCCESS) {
+		fprintf(stderr, "events: the configuration was rejected\n");
+	}
+	json_delete(json);
+	return ret;
+}
+
+/* Runs in a child of its own, the number of workers is fixed once the events loop started */
+static void events_run(int threads, unsigned long iterations) {
+	struct bench_timer_t timer;
+	struct JsonNode *json = NULL;
+	pthread_t pth;
+	char name[64], *message = NULL;
+	unsigned long i = 0;
+
+	if(events_setup(threads) != EXIT_SUCCESS) {
+		return;
+	}
+	threads_create(&pth, NULL, events_loop, NULL);
+	events_clientize(NULL);
+	/* Let the events loop set up its queue */
+	usleep(10000);
+
+	json = json_decode(events_update);
+	message = json_stringify(json, NULL);
+
+	/* Each update is evaluated before the next one is published,
+	   so none of them are coalesced */
+	bench_start(&timer);
+	for(i=0;i<iterations;i++) {
+		eventbus_publish(EVENTBUS_CONFIG, "all", json, message);
+		while(events_running() == 0) {
+			usleep(10);
+		}
+	}
+	snprintf(name, sizeof(name), "events/%d-rules/%d-threads", EVENTS_RULES, threads);
+	bench_stop(&timer, name, iterations, 0);
+
+	json_free(message);
+	json_delete(json);
+}
+#endif
+
+void bench_events(unsigned long iterations) {
+#ifdef EVENTS
+	int threads[] = { 1, 2, 4 };
+	pid_t pid = 0;
+	int i = 0, status = 0;
+
+	if(iterations == 0) {
+		iterations = 1000;
+	}
+	for(i=0;i<(int)(sizeof(threads)/sizeof(threads[0]));i++) {
+		fflush(stdout);
+		if((pid = fork()) == 0) {
+			events_run(threads[i], iterations);
+			fflush(stdout);
+			_exit(EXIT_SUCCESS);
+		} else if(pid > 0) {
+			waitpid(pid, &status, 0);
+		}
+	}
+#else
+	fprintf(stderr, "events: pilight was built without events\n");
+#endif
+}
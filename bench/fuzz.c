@@ -0,0 +1,203 @@
+/*
+	Copyright (C) 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+/*
+ * Fuzz harness for the json parser. Every input has to be accepted
+ * or rejected by json_validate and json_decode alike, a decoded tree
+ * has to pass json_check and has to encode to the same text after a
+ * second decode. Any violation aborts.
+ *
+ * Built with LIBFUZZER=ON it is a libFuzzer target. Otherwise it is a
+ * standalone driver that runs the files given on the command line, or
+ * mutates a few sample messages for the given number of rounds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../libs/pilight/core/json.h"
+
+static void fuzz_fail(const char *input, const char *reason) {
+	fprintf(stderr, "fuzz: %s\ninput: %s\n", reason, input);
+	abort();
+}
+
+static void fuzz_run(const char *input) {
+	struct JsonNode *json = NULL, *again = NULL;
+	char errmsg[256], *out = NULL, *out2 = NULL;
+	int valid = json_validate(input);
+
+	json = json_decode(input);
+	if(valid != (json != NULL)) {
+		fuzz_fail(input, valid ? "json_validate accepts what json_decode rejects" : "json_decode accepts what json_validate rejects");
+	}
+	if(json == NULL) {
+		return;
+	}
+	if(json_check(json, errmsg) == false) {
+		fuzz_fail(input, errmsg);
+	}
+
+	out = json_stringify(json, NULL);
+	if((again = json_decode(out)) == NULL) {
+		fuzz_fail(input, "the encoded tree does not decode");
+	}
+	out2 = json_stringify(again, NULL);
+	if(strcmp(out, out2) != 0) {
+		fuzz_fail(input, "the encoded tree changes after a second decode");
+	}
+
+	json_free(out);
+	json_free(out2);
+	json_delete(again);
+	json_delete(json);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	char *input = NULL;
+
+	if((input = malloc(size+1)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(input, data, size);
+	input[size] = '\0';
+	fuzz_run(input);
+	free(input);
+	return 0;
+}
+
+#ifndef LIBFUZZER
+static const char *fuzz_seeds[] = {
+	"{\"message\":{\"id\":1234567,\"unit\":3,\"state\":\"on\"},\"origin\":\"receiver\",\"protocol\":\"kaku_switch\",\"uuid\":\"0000-b8-27-eb-0f3db7\",\"repeats\":1}",
+	"{\"origin\":\"update\",\"type\":3,\"devices\":[\"weather\"],\"values\":{\"timestamp\":1444839281,\"temperature\":21.35,\"humidity\":56.0,\"battery\":1}}",
+	"{\"action\":\"control\",\"code\":{\"device\":\"dimmer\",\"state\":\"on\",\"values\":{\"dimlevel\":10}}}",
+	"[{\"America/Dominica\":[[-613,155],[-613,153]]},{\"Australia/Lord_Howe\":[[1591,-316]]}]",
+	"{\"a\":\"\\u00e9\\ud83d\\ude00\\n\\\"\\\\\",\"b\":[true,false,null,-0.5e-3,1E+2],\"c\":{}}",
+	NULL
+};
+
+/* Characters that are most likely to change the structure */
+static const char *fuzz_tokens = "{}[]\":,.-+eE0123456789\\u tfn";
+
+static unsigned int fuzz_random(unsigned int *state) {
+	*state = *state * 1103515245 + 12345;
+	return (*state >> 16) & 0x7fff;
+}
+
+static void fuzz_mutate(char *buf, size_t *len, size_t size, unsigned int *state) {
+	size_t pos = (*len > 0) ? fuzz_random(state) % *len : 0;
+	size_t n = 0;
+
+	switch(fuzz_random(state) % 5) {
+		case 0:
+			if(*len > 0) {
+				buf[pos] = (char)(fuzz_random(state) & 0xff);
+				if(buf[pos] == '\0') {
+					buf[pos] = ' ';
+				}
+			}
+		break;
+		case 1:
+			if(*len+1 < size) {
+				memmove(&buf[pos+1], &buf[pos], *len-pos);
+				buf[pos] = fuzz_tokens[fuzz_random(state) % strlen(fuzz_tokens)];
+				(*len)++;
+			}
+		break;
+		case 2:
+			if(*len > 0) {
+				memmove(&buf[pos], &buf[pos+1], *len-pos-1);
+				(*len)--;
+			}
+		break;
+		case 3:
+			n = (*len-pos < 16) ? *len-pos : 16;
+			if(*len+n < size) {
+				memmove(&buf[pos+n], &buf[pos], *len-pos);
+				(*len) += n;
+			}
+		break;
+		case 4:
+			*len = pos;
+		break;
+	}
+	buf[*len] = '\0';
+}
+
+static void fuzz_file(const char *file) {
+	char *input = NULL;
+	size_t len = 0;
+	long size = 0;
+	FILE *fp = NULL;
+
+	if((fp = fopen(file, "rb")) == NULL) {
+		fprintf(stderr, "fuzz: cannot open %s\n", file);
+		exit(EXIT_FAILURE);
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if((input = malloc((size_t)size+1)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	len = fread(input, 1, (size_t)size, fp);
+	fclose(fp);
+	LLVMFuzzerTestOneInput((uint8_t *)input, len);
+	free(input);
+}
+
+int main(int argc, char **argv) {
+	unsigned long rounds = 100000, i = 0;
+	unsigned int state = 1;
+	char buf[4096];
+	size_t len = 0;
+	int x = 0, files = 0, seed = 0;
+
+	for(x=1;x<argc;x++) {
+		if(strcmp(argv[x], "-n") == 0 && x+1 < argc) {
+			rounds = strtoul(argv[++x], NULL, 10);
+		} else {
+			fuzz_file(argv[x]);
+			files++;
+		}
+	}
+	if(files > 0) {
+		return EXIT_SUCCESS;
+	}
+
+	for(seed=0;fuzz_seeds[seed]!=NULL;seed++) {
+		fuzz_run(fuzz_seeds[seed]);
+	}
+	for(i=0;i<rounds;i++) {
+		/* Start over from a seed every few mutations */
+		if(i % 8 == 0) {
+			seed = (int)(fuzz_random(&state) % (sizeof(fuzz_seeds)/sizeof(fuzz_seeds[0])-1));
+			strcpy(buf, fuzz_seeds[seed]);
+			len = strlen(buf);
+		}
+		fuzz_mutate(buf, &len, sizeof(buf), &state);
+		fuzz_run(buf);
+	}
+	printf("%lu inputs passed\n", rounds);
+	return EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,232 @@
+/*
+	Copyright (C) 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../libs/pilight/core/json.h"
+#include "bench.h"
+
+#define PAYLOAD_DEVICES	100
+#define PAYLOAD_TZDATA		64
+#define PAYLOAD_BATCH		64
+
+static const char *payload_receiver = "{\"message\":{\"id\":1234567,\"unit\":3,\"state\":\"on\"},\"origin\":\"receiver\",\"protocol\":\"kaku_switch\",\"uuid\":\"0000-b8-27-eb-0f3db7\",\"repeats\":1}";
+
+static struct JsonNode *payload_file(const char *file) {
+	struct JsonNode *json = NULL;
+	struct JsonError error;
+	char path[1024];
+	FILE *fp = NULL;
+
+	snprintf(path, sizeof(path), "%s%s", BENCH_RESDIR, file);
+	if((fp = fopen(path, "r")) == NULL) {
+		fprintf(stderr, "json: cannot open %s\n", path);
+		return NULL;
+	}
+	if((json = json_read(fp, &error)) == NULL) {
+		fprintf(stderr, "json: %s is not valid json\n", path);
+	}
+	fclose(fp);
+	return json;
+}
+
+/* The default configuration filled with switches, their gui entries and a rule for each */
+static char *payload_config(void) {
+	struct JsonNode *json = NULL, *jdevices = NULL, *jgui = NULL, *jrules = NULL;
+	struct JsonNode *jdevice = NULL, *jid = NULL, *jelement = NULL, *jrule = NULL;
+	char name[32], rule[128], *out = NULL;
+	int i = 0;
+
+	if((json = payload_file("config/config.json-default")) == NULL) {
+		return NULL;
+	}
+	if((jdevices = json_find_member(json, "devices")) == NULL ||
+	   (jgui = json_find_member(json, "gui")) == NULL ||
+	   (jrules = json_find_member(json, "rules")) == NULL) {
+		json_delete(json);
+		return NULL;
+	}
+
+	for(i=0;i<PAYLOAD_DEVICES;i++) {
+		snprintf(name, sizeof(name), "switch%d", i);
+
+		jdevice = json_mkobject();
+		jid = json_mkarray();
+		jelement = json_mkobject();
+		json_append_member(jelement, "id", json_mknumber(1234560+i/16, 0));
+		json_append_member(jelement, "unit", json_mknumber(i%16, 0));
+		json_append_element(jid, jelement);
+		jelement = json_mkarray();
+		json_append_element(jelement, json_mkstring("kaku_switch"));
+		json_append_member(jdevice, "protocol", jelement);
+		json_append_member(jdevice, "id", jid);
+		json_append_member(jdevice, "state", json_mkstring("off"));
+		json_append_member(jdevices, name, jdevice);
+
+		jelement = json_mkobject();
+		json_append_member(jelement, "name", json_mkstring(name));
+		jid = json_mkarray();
+		json_append_element(jid, json_mkstring("Living"));
+		json_append_member(jelement, "group", jid);
+		json_append_member(jelement, "media", json_mkarray());
+		json_append_element(json_find_member(jelement, "media"), json_mkstring("all"));
+		json_append_member(jgui, name, jelement);
+
+		snprintf(rule, sizeof(rule), "IF %s.state == on THEN switch DEVICE switch%d TO off", name, (i+1)%PAYLOAD_DEVICES);
+		jrule = json_mkobject();
+		json_append_member(jrule, "rule", json_mkstring(rule));
+		json_append_member(jrule, "active", json_mknumber(1, 0));
+		snprintf(name, sizeof(name), "rule%d", i);
+		json_append_member(jrules, name, jrule);
+	}
+
+	out = json_stringify(json, "\t");
+	json_delete(json);
+	return out;
+}
+
+/* The first zones of the timezone database */
+static char *payload_tzdata(void) {
+	struct JsonNode *json = NULL, *jslice = NULL, *jchild = NULL;
+	char *out = NULL;
+	int i = 0;
+
+	if((json = payload_file("tzdata.json")) == NULL) {
+		return NULL;
+	}
+	jslice = json_mkarray();
+	while((jchild = json_first_child(json)) != NULL && i++ < PAYLOAD_TZDATA) {
+		json_remove_from_parent(jchild);
+		json_append_element(jslice, jchild);
+	}
+	out = json_stringify(jslice, NULL);
+	json_delete(jslice);
+	json_delete(json);
+	return out;
+}
+
+/* Collects every member of every object to look up */
+static void payload_members(struct JsonNode *node, struct JsonNode ***members, unsigned long *count) {
+	struct JsonNode *child = NULL;
+
+	for(child=json_first_child(node);child!=NULL;child=child->next) {
+		if(node->tag == JSON_OBJECT) {
+			if((*members = realloc(*members, sizeof(struct JsonNode *)*(*count+1))) == NULL) {
+				fprintf(stderr, "out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+			(*members)[(*count)++] = child;
+		}
+		payload_members(child, members, count);
+	}
+}
+
+static void payload_run(const char *payload, const char *text, unsigned long iterations) {
+	struct bench_timer_t timer;
+	struct JsonNode *docs[PAYLOAD_BATCH], *json = NULL, **members = NULL;
+	size_t len = strlen(text);
+	unsigned long i = 0, m = 0, count = 0;
+	char name[64], *out = NULL;
+	int x = 0, n = 0;
+
+	if(iterations == 0) {
+		/* Handle about as many bytes for every payload */
+		iterations = 15000000 / len;
+		if(iterations < 10) {
+			iterations = 10;
+		} else if(iterations > 100000) {
+			iterations = 100000;
+		}
+	}
+
+	snprintf(name, sizeof(name), "json/%s/decode", payload);
+	bench_start(&timer);
+	for(i=0;i<iterations;i+=(unsigned long)n) {
+		n = (iterations-i < PAYLOAD_BATCH) ? (int)(iterations-i) : PAYLOAD_BATCH;
+		for(x=0;x<n;x++) {
+			docs[x] = json_decode(text);
+		}
+		bench_pause(&timer);
+		for(x=0;x<n;x++) {
+			json_delete(docs[x]);
+		}
+		bench_resume(&timer);
+	}
+	bench_stop(&timer, name, iterations, len);
+
+	snprintf(name, sizeof(name), "json/%s/delete", payload);
+	bench_start(&timer);
+	for(i=0;i<iterations;i+=(unsigned long)n) {
+		n = (iterations-i < PAYLOAD_BATCH) ? (int)(iterations-i) : PAYLOAD_BATCH;
+		bench_pause(&timer);
+		for(x=0;x<n;x++) {
+			docs[x] = json_decode(text);
+		}
+		bench_resume(&timer);
+		for(x=0;x<n;x++) {
+			json_delete(docs[x]);
+		}
+	}
+	bench_stop(&timer, name, iterations, 0);
+
+	json = json_decode(text);
+	out = json_stringify(json, NULL);
+	len = strlen(out);
+	json_free(out);
+
+	snprintf(name, sizeof(name), "json/%s/encode", payload);
+	bench_start(&timer);
+	for(i=0;i<iterations;i++) {
+		out = json_stringify(json, NULL);
+		json_free(out);
+	}
+	bench_stop(&timer, name, iterations, len);
+
+	/* Reported per lookup instead of per document */
+	payload_members(json, &members, &count);
+	snprintf(name, sizeof(name), "json/%s/find_member", payload);
+	bench_start(&timer);
+	for(i=0;i<iterations;i++) {
+		for(m=0;m<count;m++) {
+			if(json_find_member(members[m]->parent, members[m]->key) != members[m]) {
+				fprintf(stderr, "json: member %s not found\n", members[m]->key);
+			}
+		}
+	}
+	bench_stop(&timer, name, iterations*count, 0);
+
+	free(members);
+	json_delete(json);
+}
+
+void bench_json(unsigned long iterations) {
+	char *text = NULL;
+
+	payload_run("receiver", payload_receiver, iterations);
+
+	if((text = payload_config()) != NULL) {
+		payload_run("config", text, iterations);
+		json_free(text);
+	}
+	if((text = payload_tzdata()) != NULL) {
+		payload_run("tzdata", text, iterations);
+		json_free(text);
+	}
+}
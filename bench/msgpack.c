@@ -0,0 +1,91 @@
+/*
+	Copyright (C) 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../libs/pilight/core/json.h"
+#include "bench.h"
+
+/* Messages as they are written to socket clients */
+static const char *msgpack_messages[][2] = {
+	{ "receiver", "{\"message\":{\"id\":1234567,\"unit\":3,\"state\":\"on\"},\"origin\":\"receiver\",\"protocol\":\"kaku_switch\",\"uuid\":\"0000-b8-27-eb-0f3db7\",\"repeats\":1}" },
+	{ "update", "{\"origin\":\"update\",\"type\":3,\"devices\":[\"weather\",\"garden\"],\"values\":{\"timestamp\":1444839281,\"temperature\":21.35,\"humidity\":56.0,\"battery\":1}}" },
+	{ "values", "[{\"type\":1,\"devices\":[\"livingroom\"],\"values\":{\"timestamp\":1444839281,\"state\":\"off\"}},{\"type\":3,\"devices\":[\"weather\"],\"values\":{\"timestamp\":1444839281,\"temperature\":21.35,\"humidity\":56.0,\"battery\":1}},{\"type\":2,\"devices\":[\"bedroom\"],\"values\":{\"timestamp\":1444839281,\"state\":\"on\",\"dimlevel\":10}},{\"type\":8,\"devices\":[\"currentdatetime\"],\"values\":{\"timestamp\":1444839281,\"longitude\":4.895168,\"latitude\":52.370216,\"year\":2015,\"month\":10,\"day\":14,\"hour\":18,\"minute\":14,\"second\":41,\"weekday\":4,\"dst\":1}}]" },
+	{ NULL, NULL }
+};
+
+void bench_msgpack(unsigned long iterations) {
+	struct bench_timer_t timer;
+	struct JsonNode *json = NULL, *tmp = NULL;
+	char name[64], *out = NULL, *packed = NULL;
+	size_t len = 0, plen = 0;
+	unsigned long i = 0;
+	int x = 0;
+
+	if(iterations == 0) {
+		iterations = 100000;
+	}
+
+	for(x=0;msgpack_messages[x][0] != NULL;x++) {
+		json = json_decode(msgpack_messages[x][1]);
+		out = json_stringify(json, NULL);
+		len = strlen(out);
+		json_free(out);
+		packed = json_encode_msgpack(json, &plen);
+
+		snprintf(name, sizeof(name), "msgpack/%s/json-encode", msgpack_messages[x][0]);
+		bench_start(&timer);
+		for(i=0;i<iterations;i++) {
+			out = json_stringify(json, NULL);
+			json_free(out);
+		}
+		bench_stop(&timer, name, iterations, len);
+
+		snprintf(name, sizeof(name), "msgpack/%s/msgpack-encode", msgpack_messages[x][0]);
+		bench_start(&timer);
+		for(i=0;i<iterations;i++) {
+			out = json_encode_msgpack(json, &plen);
+			json_free(out);
+		}
+		bench_stop(&timer, name, iterations, plen);
+
+		snprintf(name, sizeof(name), "msgpack/%s/json-decode", msgpack_messages[x][0]);
+		bench_start(&timer);
+		for(i=0;i<iterations;i++) {
+			tmp = json_decode(msgpack_messages[x][1]);
+			json_delete(tmp);
+		}
+		bench_stop(&timer, name, iterations, len);
+
+		snprintf(name, sizeof(name), "msgpack/%s/msgpack-decode", msgpack_messages[x][0]);
+		bench_start(&timer);
+		for(i=0;i<iterations;i++) {
+			tmp = json_decode_msgpack(packed, plen);
+			json_delete(tmp);
+		}
+		bench_stop(&timer, name, iterations, plen);
+
+		snprintf(name, sizeof(name), "msgpack/%s/size", msgpack_messages[x][0]);
+		printf("%-40s %zu bytes as json, %zu bytes as msgpack\n", name, len, plen);
+
+		json_free(packed);
+		json_delete(json);
+	}
+}
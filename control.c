@@ -59,7 +59,7 @@ int main(int argc, char **argv) {
 	char *device = NULL, *state = NULL, *values = NULL;
 	char *server = NULL;
 	int has_values = 0, sockfd = 0, hasconfarg = 0;
-	unsigned short port = 0, showhelp = 0, showversion = 0;
+	unsigned short port = 0, showhelp = 0, showversion = 0, profile = 0;
 
 	log_file_disable();
 	log_shell_enable();
@@ -84,6 +84,7 @@ int main(int argc, char **argv) {
 	options_add(&options, 'S', "server", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, "^(([0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5]).){3}([0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5])$");
 	options_add(&options, 'P', "port", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, "[0-9]{1,4}");
 	options_add(&options, 'C', "config", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, NULL);
+	options_add(&options, 'p', "profile", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
 
 	/* Store all CLI arguments for later usage
 	   and also check if the CLI arguments where
@@ -142,6 +143,9 @@ int main(int argc, char **argv) {
 			case 'P':
 				port = (unsigned short)atoi(optarg);
 			break;
+			case 'p':
+				profile = 1;
+			break;
 			default:
 				printf("Usage: %s -l location -d device -s state\n", progname);
 				goto close;
@@ -164,10 +168,13 @@ int main(int argc, char **argv) {
 		printf("\t -s --state=state\t\tthe new state of the device\n");
 		printf("\t -v --values=values\t\tspecific comma separated values, e.g.:\n");
 		printf("\t\t\t\t\t-v dimlevel=10\n");
+		printf("\t -p --profile\t\t\tshow how much time each rule, operator\n");
+		printf("\t\t\t\t\tand function took, the first request\n");
+		printf("\t\t\t\t\tstarts profiling\n");
 		goto close;
 	}
-	if(device == NULL || state == NULL ||
-	   strlen(device) == 0 || strlen(state) == 0) {
+	if(profile == 0 && (device == NULL || state == NULL ||
+	   strlen(device) == 0 || strlen(state) == 0)) {
 		printf("Usage: %s -d device -s state\n", progname);
 		goto close;
 	}
@@ -204,6 +211,23 @@ int main(int argc, char **argv) {
 		goto close;
 	}
 
+	if(profile == 1) {
+		socket_write(sockfd, "{\"action\":\"request profile\"}");
+		if(socket_read(sockfd, &recvBuff, 0) == 0 && (json = json_parse(NULL, recvBuff, NULL)) != NULL) {
+			if((tmp = json_find_member(json, "profile")) != NULL) {
+				output = json_stringify(tmp, "\t");
+				printf("%s\n", output);
+				json_free(output);
+			} else {
+				logprintf(LOG_ERR, "pilight-daemon did not send a rule profile");
+			}
+			json_delete(json);
+		} else {
+			logprintf(LOG_ERR, "could not request the rule profile");
+		}
+		goto close;
+	}
+
 	json = json_mkobject();
 	json_append_member(json, "action", json_mkstring("request config"));
 	output = json_stringify(json, NULL);
@@ -57,6 +57,8 @@
 #include "libs/pilight/core/log.h"
 #include "libs/pilight/core/options.h"
 #include "libs/pilight/core/socket.h"
+#include "libs/pilight/core/eventbus.h"
+#include "libs/pilight/core/replicate.h"
 #include "libs/pilight/core/json.h"
 #include "libs/pilight/core/irq.h"
 #include "libs/pilight/core/ssdp.h"
@@ -68,6 +70,7 @@
 
 #ifdef EVENTS
 	#include "libs/pilight/events/events.h"
+	#include "libs/pilight/events/profile.h"
 #endif
 
 #ifdef WEBSERVER
@@ -94,14 +97,40 @@ typedef struct clients_t {
 	int core;
 	int stats;
 	int forward;
+	enum socket_encoding_t encoding;
 	char media[8];
 	double cpu;
 	double ram;
+	/* Subscription types this client filters on and
+	   the types matched by the current broadcast */
+	int filters;
+	int matches;
+	/* Last known state of each update stream of a node */
+	struct replicas_t *replicas;
 	struct clients_t *next;
 } clients_t;
 
 static struct clients_t *clients = NULL;
 
+#define BROADCAST_BUFFER_SIZE	4096
+
+#define SUBSCRIBE_DEVICES		1
+#define SUBSCRIBE_PROTOCOLS	2
+#define SUBSCRIBE_ORIGINS		4
+#define SUBSCRIBE_VALUES		8
+
+#define SUBSCRIBE_BUCKETS		64
+
+typedef struct subscriptions_t {
+	char *name;
+	int type;
+	struct clients_t *client;
+	struct subscriptions_t *next;
+} subscriptions_t;
+
+/* Index of all client subscriptions hashed by name */
+static struct subscriptions_t *subscriptions[SUBSCRIBE_BUCKETS];
+
 typedef struct sendqueue_t {
 	unsigned int id;
 	char *protoname;
@@ -143,6 +172,8 @@ static pthread_mutexattr_t recvqueue_attr;
 static unsigned short recvqueue_init = 0;
 
 typedef struct bcqueue_t {
+	/* The message and everything added to it live in the arena */
+	struct JsonArena *arena;
 	struct JsonNode *jmessage;
 	char *protoname;
 	enum origin_t origin;
@@ -220,6 +251,177 @@ static char *webserver_root = NULL;
 static int webserver_root_free = 0;
 #endif
 
+static unsigned int subscription_hash(const char *name) {
+	unsigned int hash = 5381;
+
+	while(*name != '\0') {
+		hash = ((hash << 5) + hash) + (unsigned char)*name++;
+	}
+	return hash % SUBSCRIBE_BUCKETS;
+}
+
+static void subscription_clear(struct clients_t *client) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct subscriptions_t *currP = NULL, *prevP = NULL, *nextP = NULL;
+	int i = 0;
+
+	for(i=0;i<SUBSCRIBE_BUCKETS;i++) {
+		prevP = NULL;
+		currP = subscriptions[i];
+		while(currP) {
+			nextP = currP->next;
+			if(currP->client == client) {
+				if(prevP == NULL) {
+					subscriptions[i] = nextP;
+				} else {
+					prevP->next = nextP;
+				}
+				FREE(currP->name);
+				FREE(currP);
+			} else {
+				prevP = currP;
+			}
+			currP = nextP;
+		}
+	}
+	client->filters = 0;
+	client->matches = 0;
+}
+
+/*
+ * Replace the subscriptions of a client by those in jsubscribe, e.g.:
+ * {"devices":["lamp"],"protocols":["kaku_switch"],"origins":["receiver"],"values":["state"]}
+ * An empty object subscribes the client to all messages again.
+ */
+static int subscription_parse(struct clients_t *client, struct JsonNode *jsubscribe) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct JsonNode *jtypes = NULL;
+	struct JsonNode *jnames = NULL;
+	struct subscriptions_t *node = NULL;
+	unsigned int hash = 0;
+	int type = 0;
+
+	subscription_clear(client);
+	if(jsubscribe->tag != JSON_OBJECT) {
+		return -1;
+	}
+
+	jtypes = json_first_child(jsubscribe);
+	while(jtypes) {
+		if(strcmp(jtypes->key, "devices") == 0) {
+			type = SUBSCRIBE_DEVICES;
+		} else if(strcmp(jtypes->key, "protocols") == 0) {
+			type = SUBSCRIBE_PROTOCOLS;
+		} else if(strcmp(jtypes->key, "origins") == 0) {
+			type = SUBSCRIBE_ORIGINS;
+		} else if(strcmp(jtypes->key, "values") == 0) {
+			type = SUBSCRIBE_VALUES;
+		} else {
+			subscription_clear(client);
+			return -1;
+		}
+		if(jtypes->tag != JSON_ARRAY) {
+			subscription_clear(client);
+			return -1;
+		}
+		jnames = json_first_child(jtypes);
+		while(jnames) {
+			if(jnames->tag != JSON_STRING) {
+				subscription_clear(client);
+				return -1;
+			}
+			if((node = MALLOC(sizeof(struct subscriptions_t))) == NULL) {
+				fprintf(stderr, "out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+			if((node->name = MALLOC(strlen(jnames->string_)+1)) == NULL) {
+				fprintf(stderr, "out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+			strcpy(node->name, jnames->string_);
+			node->type = type;
+			node->client = client;
+			hash = subscription_hash(node->name);
+			node->next = subscriptions[hash];
+			subscriptions[hash] = node;
+			client->filters |= type;
+			jnames = jnames->next;
+		}
+		jtypes = jtypes->next;
+	}
+	return 0;
+}
+
+static void subscription_match_name(int type, const char *name) {
+	struct subscriptions_t *tmp = subscriptions[subscription_hash(name)];
+
+	while(tmp) {
+		if(tmp->type == type && strcmp(tmp->name, name) == 0) {
+			tmp->client->matches |= type;
+		}
+		tmp = tmp->next;
+	}
+}
+
+static void subscription_match_keys(int type, struct JsonNode *jobject) {
+	struct JsonNode *jchilds = json_first_child(jobject);
+
+	while(jchilds) {
+		if(jchilds->key != NULL) {
+			subscription_match_name(type, jchilds->key);
+		}
+		jchilds = jchilds->next;
+	}
+}
+
+/* Mark for each client which of its subscription types are matched
+   by the message that is about to be broadcasted */
+static void subscription_match(char *protoname, struct JsonNode *jmessage, struct JsonNode *jupdate) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct clients_t *tmp_clients = clients;
+	struct JsonNode *jchilds = NULL;
+	char *origin = NULL;
+	int filters = 0;
+
+	while(tmp_clients) {
+		tmp_clients->matches = 0;
+		filters |= tmp_clients->filters;
+		tmp_clients = tmp_clients->next;
+	}
+	/* Nobody subscribed to anything specific */
+	if(filters == 0) {
+		return;
+	}
+
+	if(protoname != NULL) {
+		subscription_match_name(SUBSCRIBE_PROTOCOLS, protoname);
+	}
+	if(json_find_string(jmessage, "origin", &origin) == 0) {
+		subscription_match_name(SUBSCRIBE_ORIGINS, origin);
+	}
+	subscription_match_keys(SUBSCRIBE_VALUES, json_find_member(jmessage, "message"));
+	subscription_match_keys(SUBSCRIBE_VALUES, json_find_member(jmessage, "values"));
+	if(jupdate != NULL) {
+		subscription_match_keys(SUBSCRIBE_VALUES, json_find_member(jupdate, "values"));
+		jchilds = json_first_child(json_find_member(jupdate, "devices"));
+		while(jchilds) {
+			if(jchilds->tag == JSON_STRING) {
+				subscription_match_name(SUBSCRIBE_DEVICES, jchilds->string_);
+			}
+			jchilds = jchilds->next;
+		}
+	}
+}
+
+/* A client is interested in a message when all
+   subscription types it filters on are matched */
+static int client_subscribed(struct clients_t *client) {
+	return ((client->filters & ~client->matches) == 0);
+}
+
 static void client_remove(int id) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -227,6 +429,8 @@ static void client_remove(int id) {
 
 	prevP = NULL;
 
+	/* Don't pull the client from underneath the broadcaster */
+	pthread_mutex_lock(&bcqueue_lock);
 	for(currP = clients; currP != NULL; prevP = currP, currP = currP->next) {
 
 		if(currP->id == id) {
@@ -236,10 +440,47 @@ static void client_remove(int id) {
 				prevP->next = currP->next;
 			}
 
+			subscription_clear(currP);
+			replicate_free(&currP->replicas);
 			FREE(currP);
 			break;
 		}
 	}
+	pthread_mutex_unlock(&bcqueue_lock);
+}
+
+/* Write a message to a client in the encoding it asked for
+   during identification. The stringified form is used for
+   all clients that stick to plain JSON */
+static int client_write(struct clients_t *client, struct JsonNode *json, char *str) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	if(client->encoding == ENCODING_MSGPACK && json != NULL) {
+		size_t len = 0;
+		char *buf = json_encode_msgpack(json, &len);
+		int x = socket_write_binary(client->id, buf, len);
+		json_free(buf);
+		return x;
+	} else {
+		return socket_write(client->id, str);
+	}
+}
+
+/* Decode a message from a client, which can either be plain JSON or
+   an escaped MessagePack frame */
+static struct JsonNode *client_decode(struct JsonArena *arena, char *buffer) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct JsonNode *json = NULL;
+	struct JsonError error;
+
+	if(socket_is_binary(buffer)) {
+		size_t len = socket_unescape(buffer);
+		return json_decode_msgpack(buffer, len);
+	} else if((json = json_parse(arena, buffer, &error)) == NULL) {
+		logprintf(LOG_DEBUG, "invalid json received: %s at byte %d", error.reason, (int)error.offset);
+	}
+	return json;
 }
 
 static void broadcast_queue(char *protoname, struct JsonNode *json, enum origin_t origin) {
@@ -255,9 +496,10 @@ static void broadcast_queue(char *protoname, struct JsonNode *json, enum origin_
 			}
 
 			char *jstr = json_stringify(json, NULL);
-			bnode->jmessage = json_decode(jstr);
+			bnode->arena = json_arena_new(strlen(jstr)*4);
+			bnode->jmessage = json_decode_arena(bnode->arena, jstr);
 			if(json_find_member(bnode->jmessage, "uuid") == NULL && strlen(pilight_uuid) > 0) {
-				json_append_member(bnode->jmessage, "uuid", json_mkstring(pilight_uuid));
+				json_append_member(bnode->jmessage, "uuid", json_mkstring_in(bnode->arena, pilight_uuid));
 			}
 			json_free(jstr);
 
@@ -286,10 +528,58 @@ static void broadcast_queue(char *protoname, struct JsonNode *json, enum origin_
 	}
 }
 
+/* Strip all devices from an update that are not shown on the
+   given media. Returns NULL when no device is left to be shown */
+static struct JsonNode *broadcast_media(char *message, const char *media) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct JsonNode *jtmp = json_decode(message);
+	struct JsonNode *jdevices = json_find_member(jtmp, "devices");
+	struct JsonNode *jchilds = json_first_child(jdevices);
+	struct JsonNode *jtmp1 = NULL;
+	struct gui_values_t *gui_values = NULL;
+	unsigned short match1 = 0, match2 = 0;
+
+	while(jchilds) {
+		match2 = 0;
+		if(jchilds->tag == JSON_STRING) {
+			if((gui_values = gui_media(jchilds->string_)) != NULL) {
+				while(gui_values) {
+					if(gui_values->type == JSON_STRING) {
+						if(strcmp(gui_values->string_, media) == 0 ||
+							 strcmp(gui_values->string_, "all") == 0 ||
+							 strcmp(media, "all") == 0) {
+								match1 = 1;
+								match2 = 1;
+						}
+					}
+					gui_values = gui_values->next;
+				}
+			} else {
+				match1 = 1;
+				match2 = 1;
+			}
+		}
+		jtmp1 = jchilds;
+		jchilds = jchilds->next;
+		if(match2 == 0) {
+			json_remove_from_parent(jtmp1);
+			json_delete(jtmp1);
+		}
+	}
+	if(match1 == 0) {
+		json_delete(jtmp);
+		return NULL;
+	}
+	return jtmp;
+}
+
 void *broadcast(void *param) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
+	struct timespec deadline;
 	int broadcasted = 0;
+	const char *medias[] = { "all", "mobile", "desktop", "web" };
 
 	pthread_mutex_lock(&bcqueue_lock);
 	while(main_loop) {
@@ -308,23 +598,31 @@ void *broadcast(void *param) {
 					json_find_number(bcqueue->jmessage, "type", &tmp);
 					char *conf = json_stringify(bcqueue->jmessage, NULL);
 					struct clients_t *tmp_clients = clients;
+					subscription_match(bcqueue->protoname, bcqueue->jmessage, NULL);
 					while(tmp_clients) {
-						if(((int)tmp < 0 && tmp_clients->core == 1) ||
+						if((((int)tmp < 0 && tmp_clients->core == 1) ||
 						   ((int)tmp >= 0 && tmp_clients->config == 1) ||
-							 ((int)tmp == PROCESS && tmp_clients->stats == 1)) {
-							socket_write(tmp_clients->id, conf);
+							 ((int)tmp == PROCESS && tmp_clients->stats == 1)) &&
+							 client_subscribed(tmp_clients)) {
+							client_write(tmp_clients, bcqueue->jmessage, conf);
 							broadcasted = 1;
 						}
 						tmp_clients = tmp_clients->next;
 					}
+					/* A process message goes to both the config and the
+					   stats subscribers, so every kind is published */
+					if((int)tmp < 0 && eventbus_publish(EVENTBUS_CORE, NULL, bcqueue->jmessage, conf) > 0) {
+						broadcasted = 1;
+					}
+					if((int)tmp >= 0 && eventbus_publish(EVENTBUS_CONFIG, NULL, bcqueue->jmessage, conf) > 0) {
+						broadcasted = 1;
+					}
+					if((int)tmp == PROCESS && eventbus_publish(EVENTBUS_STATS, NULL, bcqueue->jmessage, conf) > 0) {
+						broadcasted = 1;
+					}
 					if(pilight.runmode == ADHOC && sockfd > 0) {
-						struct JsonNode *jupdate = json_decode(conf);
-						json_append_member(jupdate, "action", json_mkstring("update"));
-						char *ret = json_stringify(jupdate, NULL);
-						socket_write(sockfd, ret);
+						replicate_queue(json_decode(conf));
 						broadcasted = 1;
-						json_delete(jupdate);
-						json_free(ret);
 					}
 					if(broadcasted == 1) {
 						logprintf(LOG_DEBUG, "broadcasted: %s", conf);
@@ -332,60 +630,54 @@ void *broadcast(void *param) {
 					json_free(conf);
 				} else {
 					/* Update the config */
-					if(devices_update(bcqueue->protoname, bcqueue->jmessage, bcqueue->origin, &jret) == 0) {
+					int updated = devices_update(bcqueue->protoname, bcqueue->jmessage, bcqueue->origin, &jret);
+					subscription_match(bcqueue->protoname, bcqueue->jmessage, jret);
+					if(updated == 0) {
 						char *tmp = json_stringify(jret, NULL);
 						struct clients_t *tmp_clients = clients;
-						unsigned short match1 = 0, match2 = 0;
+						struct JsonNode *jtmp = NULL;
+						int m = 0;
+
+						/* The per media messages are small, they are serialized
+						   on the stack unless they happen not to fit */
+						char buffer[BROADCAST_BUFFER_SIZE];
+						char *conf = NULL;
 
 						while(tmp_clients) {
-							if(tmp_clients->config == 1) {
-								struct JsonNode *jtmp = json_decode(tmp);
-								struct JsonNode *jdevices = json_find_member(jtmp, "devices");
-								if(jdevices != NULL) {
-									match1 = 0;
-									struct JsonNode *jchilds = json_first_child(jdevices);
-									struct gui_values_t *gui_values = NULL;
-									while(jchilds) {
-										match2 = 0;
-										if(jchilds->tag == JSON_STRING) {
-											if((gui_values = gui_media(jchilds->string_)) != NULL) {
-												while(gui_values) {
-													if(gui_values->type == JSON_STRING) {
-														if(strcmp(gui_values->string_, tmp_clients->media) == 0 ||
-															 strcmp(gui_values->string_, "all") == 0 ||
-															 strcmp(tmp_clients->media, "all") == 0) {
-																match1 = 1;
-																match2 = 1;
-														}
-													}
-													gui_values = gui_values->next;
-												}
-											} else {
-												match1 = 1;
-												match2 = 1;
-											}
-										}
-										if(match2 == 0) {
-											json_remove_from_parent(jchilds);
-										}
-										struct JsonNode *jtmp1 = jchilds;
-										jchilds = jchilds->next;
-										if(match2 == 0) {
-											json_delete(jtmp1);
-										}
+							if(tmp_clients->config == 1 && client_subscribed(tmp_clients)) {
+								if((jtmp = broadcast_media(tmp, tmp_clients->media)) != NULL) {
+									conf = buffer;
+									if(json_stringify_to(jtmp, NULL, buffer, sizeof(buffer)) >= sizeof(buffer)) {
+										conf = json_stringify(jtmp, NULL);
 									}
-								}
-								if(match1 == 1) {
-									char *conf = json_stringify(jtmp, NULL);
-									socket_write(tmp_clients->id, conf);
+									client_write(tmp_clients, jtmp, conf);
 									logprintf(LOG_DEBUG, "broadcasted: %s", conf);
-									json_free(conf);
+									if(conf != buffer) {
+										json_free(conf);
+									}
+									json_delete(jtmp);
 								}
-								json_delete(jtmp);
 							}
 							tmp_clients = tmp_clients->next;
 						}
 
+						/* In-process subscribers get the same media specific message */
+						for(m=0;m<(int)(sizeof(medias)/sizeof(medias[0]));m++) {
+							if(eventbus_subscribed(EVENTBUS_CONFIG, medias[m]) == 1) {
+								if((jtmp = broadcast_media(tmp, medias[m])) != NULL) {
+									conf = buffer;
+									if(json_stringify_to(jtmp, NULL, buffer, sizeof(buffer)) >= sizeof(buffer)) {
+										conf = json_stringify(jtmp, NULL);
+									}
+									eventbus_publish(EVENTBUS_CONFIG, medias[m], jtmp, conf);
+									if(conf != buffer) {
+										json_free(conf);
+									}
+									json_delete(jtmp);
+								}
+							}
+						}
+
 						json_free(tmp);
 						json_delete(jret);
 					}
@@ -446,23 +738,24 @@ void *broadcast(void *param) {
 					/* Write the message to all receivers */
 					struct clients_t *tmp_clients = clients;
 					while(tmp_clients) {
-						if(tmp_clients->receiver == 1 && tmp_clients->forward == 0) {
+						if(tmp_clients->receiver == 1 && tmp_clients->forward == 0 &&
+						   client_subscribed(tmp_clients)) {
 								if(strcmp(out, "{}") != 0 && nrchilds > 1) {
-									socket_write(tmp_clients->id, out);
+									client_write(tmp_clients, bcqueue->jmessage, out);
 									broadcasted = 1;
 								}
 						}
 						tmp_clients = tmp_clients->next;
 					}
+					if(strcmp(out, "{}") != 0 && nrchilds > 1) {
+						if(eventbus_publish(EVENTBUS_RECEIVER, NULL, bcqueue->jmessage, out) > 0) {
+							broadcasted = 1;
+						}
+					}
 
 					if(pilight.runmode == ADHOC && sockfd > 0) {
-						struct JsonNode *jupdate = json_decode(internal);
-						json_append_member(jupdate, "action", json_mkstring("update"));
-						char *ret = json_stringify(jupdate, NULL);
-						socket_write(sockfd, ret);
+						replicate_queue(json_decode(internal));
 						broadcasted = 1;
-						json_delete(jupdate);
-						json_free(ret);
 					}
 					if((broadcasted == 1 || nodaemon == 1) && (strcmp(out, "{}") != 0 && nrchilds > 1)) {
 						logprintf(LOG_DEBUG, "broadcasted: %s", out);
@@ -473,11 +766,24 @@ void *broadcast(void *param) {
 			}
 			struct bcqueue_t *tmp = bcqueue;
 			FREE(tmp->protoname);
-			json_delete(tmp->jmessage);
+			/* Everything in the message is allocated from its arena */
+			json_arena_free(tmp->arena);
 			bcqueue = bcqueue->next;
 			FREE(tmp);
 			bcqueue_number--;
+
+			/* Updates for the master are sent once the batch
+			   is full or its window has passed */
+			if(replicate_pending() > 0 && replicate_deadline(&deadline) == 0) {
+				replicate_flush(sockfd);
+			}
 			pthread_mutex_unlock(&bcqueue_lock);
+		} else if(replicate_pending() > 0) {
+			if(replicate_deadline(&deadline) == 0) {
+				replicate_flush(sockfd);
+			} else {
+				pthread_cond_timedwait(&bcqueue_signal, &bcqueue_lock, &deadline);
+			}
 		} else {
 			pthread_cond_wait(&bcqueue_signal, &bcqueue_lock);
 		}
@@ -525,30 +831,22 @@ static void receive_queue(int *raw, int rawlen, int plslen, int hwtype) {
 static void receiver_create_message(protocol_t *protocol) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
+	/* The message the protocol built is a valid tree already,
+	   so it's handed over as is instead of being reparsed */
 	if(protocol->message != NULL) {
-		char *valid = json_stringify(protocol->message, NULL);
-		json_delete(protocol->message);
-		if(valid != NULL && json_validate(valid) == true) {
-			struct JsonNode *jmessage = json_mkobject();
-
-			json_append_member(jmessage, "message", json_decode(valid));
-			json_append_member(jmessage, "origin", json_mkstring("receiver"));
-			json_append_member(jmessage, "protocol", json_mkstring(protocol->id));
-			if(strlen(pilight_uuid) > 0) {
-				json_append_member(jmessage, "uuid", json_mkstring(pilight_uuid));
-			}
-			if(protocol->repeats > -1) {
-				json_append_member(jmessage, "repeats", json_mknumber(protocol->repeats, 0));
-			}
-			char *output = json_stringify(jmessage, NULL);
-			struct JsonNode *json = json_decode(output);
-			broadcast_queue(protocol->id, json, RECEIVER);
-			json_free(output);
-			json_delete(json);
-			json = NULL;
-			json_delete(jmessage);
+		struct JsonNode *jmessage = json_mkobject();
+
+		json_append_member(jmessage, "message", protocol->message);
+		json_append_member(jmessage, "origin", json_mkstring("receiver"));
+		json_append_member(jmessage, "protocol", json_mkstring(protocol->id));
+		if(strlen(pilight_uuid) > 0) {
+			json_append_member(jmessage, "uuid", json_mkstring(pilight_uuid));
 		}
-		json_free(valid);
+		if(protocol->repeats > -1) {
+			json_append_member(jmessage, "repeats", json_mknumber(protocol->repeats, 0));
+		}
+		broadcast_queue(protocol->id, jmessage, RECEIVER);
+		json_delete(jmessage);
 	}
 	protocol->message = NULL;
 }
@@ -648,15 +946,19 @@ void *send_code(void *param) {
 			struct hardware_t *hw = NULL;
 
 			struct JsonNode *message = NULL;
+			struct JsonNode *jparsed = NULL;
+			struct JsonError error;
 
 			if(sendqueue->message != NULL && strcmp(sendqueue->message, "{}") != 0) {
-				if(json_validate(sendqueue->message) == true) {
+				if((jparsed = json_parse(NULL, sendqueue->message, &error)) == NULL) {
+					logprintf(LOG_ERR, "invalid message for %s: %s at byte %d", protocol->id, error.reason, (int)error.offset);
+				} else {
 					if(message == NULL) {
 						message = json_mkobject();
 					}
 					json_append_member(message, "origin", json_mkstring("sender"));
 					json_append_member(message, "protocol", json_mkstring(protocol->id));
-					json_append_member(message, "message", json_decode(sendqueue->message));
+					json_append_member(message, "message", jparsed);
 					if(strlen(sendqueue->uuid) > 0) {
 						json_append_member(message, "uuid", json_mkstring(sendqueue->uuid));
 					}
@@ -664,11 +966,13 @@ void *send_code(void *param) {
 				}
 			}
 			if(sendqueue->settings != NULL && strcmp(sendqueue->settings, "{}") != 0) {
-				if(json_validate(sendqueue->settings) == true) {
+				if((jparsed = json_parse(NULL, sendqueue->settings, &error)) == NULL) {
+					logprintf(LOG_ERR, "invalid settings for %s: %s at byte %d", protocol->id, error.reason, (int)error.offset);
+				} else {
 					if(message == NULL) {
 						message = json_mkobject();
 					}
-					json_append_member(message, "settings", json_decode(sendqueue->settings));
+					json_append_member(message, "settings", jparsed);
 				}
 			}
 
@@ -795,23 +1099,16 @@ static int send_queue(struct JsonNode *json, enum origin_t origin) {
 			jprotocol = json_first_child(jprotocols);
 			while(jprotocol && match == 0) {
 				match = 0;
-				if(jprotocol->tag == JSON_STRING) {
-					struct protocols_t *pnode = protocols;
-					/* Retrieve the used protocol */
-					while(pnode) {
-						protocol = pnode->listener;
-						/* Check if the protocol exists */
-						if(protocol_device_exists(protocol, jprotocol->string_) == 0 && match == 0) {
-							match = 1;
-							break;
-						}
-						pnode = pnode->next;
-					}
+				/* Retrieve the used protocol */
+				if(jprotocol->tag == JSON_STRING && protocol_device_get(jprotocol->string_, &protocol) == 0) {
+					match = 1;
 				}
 				jprotocol = jprotocol->next;
 			}
 			memset(raw, 0, MAXPULSESTREAMLENGTH-1);
-			protocol->raw = raw;
+			if(match == 1) {
+				protocol->raw = raw;
+			}
 			if(match == 1 && protocol->createCode != NULL) {
 				/* Let the protocol create his code */
 				if(protocol->createCode(jcode) == 0 && main_loop == 1) {
@@ -1099,14 +1396,32 @@ static int control_device(struct devices_t *dev, char *state, struct JsonNode *v
 }
 
 /* Parse the incoming buffer from the client */
+/* A single update received from a node */
+static void node_update(struct clients_t *client, struct JsonNode *json) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct JsonNode *jvalues = NULL;
+	char *pname = NULL;
+
+	if(client != NULL && (jvalues = json_find_member(json, "values")) != NULL) {
+		json_find_number(jvalues, "ram", &client->ram);
+		json_find_number(jvalues, "cpu", &client->cpu);
+	}
+	if(json_find_string(json, "protocol", &pname) == 0) {
+		broadcast_queue(pname, json, MASTER);
+	}
+}
+
 static void socket_parse_data(int i, char *buffer) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	struct sockaddr_in address;
 	struct JsonNode *json = NULL;
 	struct JsonNode *options = NULL;
+	struct JsonNode *jsubscribe = NULL;
 	struct clients_t *tmp_clients = NULL;
 	struct clients_t *client = NULL;
+	struct JsonArena *arena = NULL;
 	int sd = -1;
 	int addrlen = sizeof(address);
 	char *action = NULL, *media = NULL, *status = NULL;
@@ -1122,20 +1437,21 @@ static void socket_parse_data(int i, char *buffer) {
 	if(strcmp(buffer, "HEART") == 0) {
 		socket_write(sd, "BEAT");
 	} else {
-		if(pilight.runmode != ADHOC) {
+		if(pilight.runmode != ADHOC && socket_is_binary(buffer) == 0) {
 			logprintf(LOG_DEBUG, "socket recv: %s", buffer);
 		}
+		/* The request is gone once it has been handled */
+		arena = json_arena_new(strlen(buffer)*4);
 		/* Serve static webserver page. This is the only request that is
 		   expected not to be a json object */
 #ifdef WEBSERVER
 		if(strstr(buffer, " HTTP/")) {
 			client_webserver_parse_code(i, buffer);
 			socket_close(sd);
-		} else if(json_validate(buffer) == true) {
+		} else if((json = client_decode(arena, buffer)) != NULL) {
 #else
-		if(json_validate(buffer) == true) {
+		if((json = client_decode(arena, buffer)) != NULL) {
 #endif
-			json = json_decode(buffer);
 			if((json_find_string(json, "action", &action)) == 0) {
 				tmp_clients = clients;
 				while(tmp_clients) {
@@ -1157,6 +1473,10 @@ static void socket_parse_data(int i, char *buffer) {
 						client->config = 0;
 						client->receiver = 0;
 						client->forward = 0;
+						client->encoding = ENCODING_JSON;
+						client->filters = 0;
+						client->matches = 0;
+						client->replicas = NULL;
 						client->stats = 0;
 						client->cpu = 0;
 						client->ram = 0;
@@ -1177,6 +1497,22 @@ static void socket_parse_data(int i, char *buffer) {
 					if(json_find_string(json, "uuid", &t) == 0) {
 						strcpy(client->uuid, t);
 					}
+					if(json_find_string(json, "encoding", &t) == 0) {
+						if(strcmp(t, "msgpack") == 0) {
+							client->encoding = ENCODING_MSGPACK;
+						} else if(strcmp(t, "json") == 0) {
+							client->encoding = ENCODING_JSON;
+						} else {
+							error = 1;
+						}
+					}
+					if(error == 0 && (jsubscribe = json_find_member(json, "subscribe")) != NULL) {
+						pthread_mutex_lock(&bcqueue_lock);
+						if(subscription_parse(client, jsubscribe) != 0) {
+							error = 1;
+						}
+						pthread_mutex_unlock(&bcqueue_lock);
+					}
 					if((options = json_find_member(json, "options")) != NULL) {
 						struct JsonNode *childs = json_first_child(options);
 						while(childs) {
@@ -1224,6 +1560,9 @@ static void socket_parse_data(int i, char *buffer) {
 					}
 					if(exists == 0) {
 						if(error == 1) {
+							pthread_mutex_lock(&bcqueue_lock);
+							subscription_clear(client);
+							pthread_mutex_unlock(&bcqueue_lock);
 							FREE(client);
 						} else {
 							tmp_clients = clients;
@@ -1238,7 +1577,28 @@ static void socket_parse_data(int i, char *buffer) {
 							}
 						}
 					}
-					socket_write(sd, "{\"status\":\"success\"}");
+					/* Nodes asking for it send their updates batched */
+					if(json_find_string(json, "replicate", &t) == 0 && strcmp(t, "batch") == 0) {
+						socket_write(sd, "{\"status\":\"success\",\"replicate\":\"batch\"}");
+					} else {
+						socket_write(sd, "{\"status\":\"success\"}");
+					}
+				} else if(strcmp(action, "subscribe") == 0) {
+					if(client == NULL) {
+						logprintf(LOG_ERR, "client did not identify itself before subscribing");
+						socket_write(sd, "{\"status\":\"failed\"}");
+					} else if((jsubscribe = json_find_member(json, "subscribe")) == NULL) {
+						logprintf(LOG_ERR, "client did not send any subscriptions");
+						socket_write(sd, "{\"status\":\"failed\"}");
+					} else {
+						pthread_mutex_lock(&bcqueue_lock);
+						if(subscription_parse(client, jsubscribe) == 0) {
+							socket_write(sd, "{\"status\":\"success\"}");
+						} else {
+							socket_write(sd, "{\"status\":\"failed\"}");
+						}
+						pthread_mutex_unlock(&bcqueue_lock);
+					}
 				} else if(strcmp(action, "send") == 0) {
 					if(send_queue(json, SENDER) == 0) {
 						socket_write(sd, "{\"status\":\"success\"}");
@@ -1360,44 +1720,74 @@ static void socket_parse_data(int i, char *buffer) {
 					}
 					json_append_member(jsend, "message", json_mkstring("config"));
 					json_append_member(jsend, "config", jconfig);
-					char *output = json_stringify(jsend, NULL);
-					str_replace("%", "%%", &output);
-					socket_write(sd, output);
-					json_free(output);
+					if(client->encoding == ENCODING_MSGPACK) {
+						client_write(client, jsend, NULL);
+					} else {
+						char *output = json_stringify(jsend, NULL);
+						str_replace("%", "%%", &output);
+						socket_write(sd, output);
+						json_free(output);
+					}
 					json_delete(jsend);
 				} else if(strcmp(action, "request values") == 0) {
 					struct JsonNode *jsend = json_mkobject();
 					struct JsonNode *jvalues = devices_values(client->media);
 					json_append_member(jsend, "message", json_mkstring("values"));
 					json_append_member(jsend, "values", jvalues);
-					char *output = json_stringify(jsend, NULL);
-					socket_write(sd, output);
-					json_free(output);
+					if(client->encoding == ENCODING_MSGPACK) {
+						client_write(client, jsend, NULL);
+					} else {
+						char *output = json_stringify(jsend, NULL);
+						socket_write(sd, output);
+						json_free(output);
+					}
+					json_delete(jsend);
+#ifdef EVENTS
+				} else if(strcmp(action, "request profile") == 0) {
+					struct JsonNode *jsend = json_mkobject();
+					json_append_member(jsend, "message", json_mkstring("profile"));
+					json_append_member(jsend, "profile", event_profile_print());
+					if(client->encoding == ENCODING_MSGPACK) {
+						client_write(client, jsend, NULL);
+					} else {
+						char *output = json_stringify(jsend, NULL);
+						socket_write(sd, output);
+						json_free(output);
+					}
 					json_delete(jsend);
+#endif
 				/*
 				 * Parse received codes from nodes
 				 */
 				} else if(strcmp(action, "update") == 0) {
-					struct JsonNode *jvalues = NULL;
-					char *pname = NULL;
-					if((jvalues = json_find_member(json, "values")) != NULL) {
-						exists = 0;
-						tmp_clients = clients;
-						while(tmp_clients) {
-							if(tmp_clients->id == sd) {
-								exists = 1;
-								client = tmp_clients;
-								break;
-							}
-							tmp_clients = tmp_clients->next;
+					struct JsonNode *jbatch = NULL;
+					struct JsonNode *jitem = NULL;
+					struct JsonNode *jupdate = NULL;
+					exists = 0;
+					tmp_clients = clients;
+					while(tmp_clients) {
+						if(tmp_clients->id == sd) {
+							exists = 1;
+							client = tmp_clients;
+							break;
 						}
+						tmp_clients = tmp_clients->next;
+					}
+					/* Nodes send their updates batched and
+					   delta compressed per update stream */
+					if((jbatch = json_find_member(json, "batch")) != NULL && jbatch->tag == JSON_ARRAY) {
 						if(exists) {
-							json_find_number(jvalues, "ram", &client->ram);
-							json_find_number(jvalues, "cpu", &client->cpu);
+							struct timespec start;
+							clock_gettime(CLOCK_REALTIME, &start);
+							json_foreach(jitem, jbatch) {
+								if((jupdate = replicate_apply(&client->replicas, jitem)) != NULL) {
+									node_update(client, jupdate);
+								}
+							}
+							replicate_received(strlen(buffer), &start);
 						}
-					}
-					if(json_find_string(json, "protocol", &pname) == 0) {
-						broadcast_queue(pname, json, MASTER);
+					} else {
+						node_update((exists == 1) ? client : NULL, json);
 					}
 				} else {
 					error = 1;
@@ -1422,6 +1812,7 @@ static void socket_parse_data(int i, char *buffer) {
 			}
 			json_delete(json);
 		}
+		json_arena_free(arena);
 	}
 	if(error == 1) {
 		client_remove(sd);
@@ -1550,6 +1941,7 @@ void *clientize(void *param) {
 	struct JsonNode *joptions = NULL;
 	struct JsonNode *jchilds = NULL;
 	struct JsonNode *tmp = NULL;
+	struct JsonError error;
   char *recvBuff = NULL, *output = NULL;
 	char *message = NULL, *action = NULL;
 	char *origin = NULL, *protocol = NULL;
@@ -1593,6 +1985,8 @@ void *clientize(void *param) {
 		json_append_member(joptions, "config", json_mknumber(1, 0));
 		json_append_member(json, "uuid", json_mkstring(pilight_uuid));
 		json_append_member(json, "options", joptions);
+		/* Ask the master whether it takes batched updates */
+		json_append_member(json, "replicate", json_mkstring("batch"));
 		output = json_stringify(json, NULL);
 		if(socket_write(sockfd, output) != (strlen(output)+strlen(EOSS))) {
 			json_free(output);
@@ -1602,12 +1996,23 @@ void *clientize(void *param) {
 		json_free(output);
 		json_delete(json);
 
-		if(socket_read(sockfd, &recvBuff, 1) != 0
-		   || strcmp(recvBuff, "{\"status\":\"success\"}") != 0) {
+		if(socket_read(sockfd, &recvBuff, 1) != 0 || (json = json_parse(NULL, recvBuff, NULL)) == NULL) {
+			continue;
+		}
+		if(json_find_string(json, "status", &message) != 0 || strcmp(message, "success") != 0) {
+			json_delete(json);
 			continue;
 		}
 		logprintf(LOG_DEBUG, "socket recv: %s", recvBuff);
 
+		/* The master starts without any knowledge of our update streams.
+		   Older masters don't answer the replicate request and would
+		   silently ignore batched updates */
+		pthread_mutex_lock(&bcqueue_lock);
+		replicate_reset((json_find_string(json, "replicate", &message) == 0 && strcmp(message, "batch") == 0) ? 1 : 0);
+		pthread_mutex_unlock(&bcqueue_lock);
+		json_delete(json);
+
 		json = json_mkobject();
 		json_append_member(json, "action", json_mkstring("request config"));
 		output = json_stringify(json, NULL);
@@ -1621,8 +2026,9 @@ void *clientize(void *param) {
 
 		if(socket_read(sockfd, &recvBuff, 0) == 0) {
 			logprintf(LOG_DEBUG, "socket recv: %s", recvBuff);
-			if(json_validate(recvBuff) == true) {
-				json = json_decode(recvBuff);
+			if((json = json_parse(NULL, recvBuff, &error)) == NULL) {
+				logprintf(LOG_ERR, "invalid config received from the master: %s at byte %d", error.reason, (int)error.offset);
+			} else {
 				if(json_find_string(json, "message", &message) == 0) {
 					if(strcmp(message, "config") == 0) {
 						struct JsonNode *jconfig = NULL;
@@ -1684,8 +2090,7 @@ void *clientize(void *param) {
 			char **array = NULL;
 			unsigned int z = explode(recvBuff, "\n", &array), q = 0;
 			for(q=0;q<z;q++) {
-				if(json_validate(array[q]) == true) {
-					json = json_decode(array[q]);
+				if((json = json_parse(NULL, array[q], &error)) != NULL) {
 					if(json_find_string(json, "action", &action) == 0) {
 						if(strcmp(action, "send") == 0 ||
 						   strcmp(action, "control") == 0) {
@@ -1799,16 +2204,22 @@ int main_gc(void) {
 		pthread_cond_signal(&bcqueue_signal);
 	}
 
+	replicate_gc();
+
 	struct clients_t *tmp_clients;
 	while(clients) {
 		tmp_clients = clients;
 		clients = clients->next;
+		subscription_clear(tmp_clients);
+		replicate_free(&tmp_clients->replicas);
 		FREE(tmp_clients);
 	}
 	if(clients != NULL) {
 		FREE(clients);
 	}
 
+	eventbus_gc();
+
 #ifndef _WIN32
 	if(running == 0) {
 		/* Remove the stale pid file */
@@ -1947,6 +2358,12 @@ void *pilight_stats(void *param) {
 	while(main_loop) {
 		if(pilight.runmode == STANDALONE) {
 			registerVersion();
+			/* The broadcast thread changes the device values in
+			   devices_update while holding the bcqueue_lock, so the
+			   journal is folded into the config file under it too */
+			pthread_mutex_lock(&bcqueue_lock);
+			config_sync();
+			pthread_mutex_unlock(&bcqueue_lock);
 		}
 
 		if(stats == 1) {
@@ -2456,6 +2873,8 @@ int start_pilight(int argc, char **argv) {
 	pthread_cond_init(&bcqueue_signal, NULL);
 	bcqueue_init = 1;
 
+	eventbus_init();
+
 	/* Run certain daemon functions from the socket library */
 	socket_callback.client_disconnected_callback = &socket_client_disconnected;
 	socket_callback.client_connected_callback = NULL;
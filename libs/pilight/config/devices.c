@@ -49,6 +49,238 @@ struct config_t *config_devices;
 /* Struct to store the locations */
 static struct devices_t *devices = NULL;
 
+/* Bumped whenever a device or one of its values changes */
+static unsigned long devices_version = 0;
+/* Bumped whenever the devices are parsed or freed, so pointers
+   into their settings have to be resolved again */
+static unsigned long devices_loaded = 0;
+
+#define DEVICES_INDEX_SIZE	512
+
+/* Lookup table from a device id to the device */
+typedef struct devices_index_t {
+	struct devices_t *device;
+	struct devices_index_t *next;
+} devices_index_t;
+
+static struct devices_index_t *devices_index[DEVICES_INDEX_SIZE];
+
+static void devices_index_add(struct devices_t *dev) {
+	unsigned int i = strhash(dev->id) % DEVICES_INDEX_SIZE;
+	struct devices_index_t *node = MALLOC(sizeof(struct devices_index_t));
+	if(node == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	node->device = dev;
+	node->next = devices_index[i];
+	devices_index[i] = node;
+}
+
+static void devices_index_clear(void) {
+	struct devices_index_t *tmp = NULL;
+	int i = 0;
+
+	for(i=0;i<DEVICES_INDEX_SIZE;i++) {
+		while(devices_index[i]) {
+			tmp = devices_index[i];
+			devices_index[i] = devices_index[i]->next;
+			FREE(tmp);
+		}
+	}
+}
+
+#define DEVICES_LOOKUP_SIZE		1024
+#define DEVICES_LOOKUP_FIELDS	6
+#define DEVICES_LOOKUP_KEYLEN	256
+
+/*
+ * Lookup table from a protocol and the id fields of a received
+ * message to the devices that can match it. Each id setting of
+ * a device is added for every combination of its id fields,
+ * because a message matches as soon as all id fields it carries
+ * match. The table only narrows down the candidates, the full
+ * match is still done by devices_update.
+ */
+typedef struct devices_lookup_t {
+	char *key;
+	struct devices_t *device;
+	struct devices_lookup_t *next;
+} devices_lookup_t;
+
+static struct devices_lookup_t *devices_lookup[DEVICES_LOOKUP_SIZE];
+/* Set when a device has more id fields than we can combine */
+static int devices_lookup_full = 0;
+
+static size_t devices_lookup_field(char *key, size_t len, const char *name, int type, const char *string_, double number_) {
+	if(len < DEVICES_LOOKUP_KEYLEN) {
+		if(type == JSON_STRING) {
+			len += (size_t)snprintf(&key[len], DEVICES_LOOKUP_KEYLEN-len, ":%s=%s", name, string_);
+		} else {
+			len += (size_t)snprintf(&key[len], DEVICES_LOOKUP_KEYLEN-len, ":%s=%.4f", name, number_);
+		}
+	}
+	return len;
+}
+
+static void devices_lookup_add(struct devices_t *dev, struct protocol_t *proto, struct devices_settings_t *sptr) {
+	struct devices_values_t *fields[DEVICES_LOOKUP_FIELDS];
+	struct devices_values_t *vptr = NULL;
+	struct devices_lookup_t *node = NULL, *tmp = NULL;
+	struct options_t *opt = proto->options;
+	char key[DEVICES_LOOKUP_KEYLEN];
+	unsigned int i = 0;
+	int nrfields = 0, mask = 0, x = 0;
+	size_t len = 0;
+
+	while(opt) {
+		if(opt->conftype == DEVICES_ID) {
+			vptr = sptr->values;
+			while(vptr) {
+				if(strcmp(vptr->name, opt->name) == 0) {
+					break;
+				}
+				vptr = vptr->next;
+			}
+			if(vptr != NULL && (vptr->type == JSON_STRING || vptr->type == JSON_NUMBER)) {
+				if(nrfields == DEVICES_LOOKUP_FIELDS) {
+					devices_lookup_full = 1;
+					return;
+				}
+				fields[nrfields++] = vptr;
+			}
+		}
+		opt = opt->next;
+	}
+
+	for(mask=1;mask<(1 << nrfields);mask++) {
+		len = (size_t)snprintf(key, DEVICES_LOOKUP_KEYLEN, "%s", proto->id);
+		for(x=0;x<nrfields;x++) {
+			if((mask & (1 << x)) != 0) {
+				len = devices_lookup_field(key, len, fields[x]->name, fields[x]->type, fields[x]->string_, fields[x]->number_);
+			}
+		}
+
+		if((node = MALLOC(sizeof(struct devices_lookup_t))) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		if((node->key = MALLOC(strlen(key)+1)) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		strcpy(node->key, key);
+		node->device = dev;
+		node->next = NULL;
+
+		/* Keep the devices in config order */
+		i = strhash(key) % DEVICES_LOOKUP_SIZE;
+		if((tmp = devices_lookup[i]) != NULL) {
+			while(tmp->next != NULL) {
+				tmp = tmp->next;
+			}
+			tmp->next = node;
+		} else {
+			devices_lookup[i] = node;
+		}
+	}
+}
+
+static void devices_lookup_key(struct protocol_t *proto, JsonNode *message, char *key) {
+	struct options_t *opt = proto->options;
+	struct JsonNode *jtmp = NULL;
+	size_t len = (size_t)snprintf(key, DEVICES_LOOKUP_KEYLEN, "%s", proto->id);
+
+	while(opt) {
+		if(opt->conftype == DEVICES_ID && (jtmp = json_find_member(message, opt->name)) != NULL) {
+			if(jtmp->tag == JSON_STRING || jtmp->tag == JSON_NUMBER) {
+				len = devices_lookup_field(key, len, opt->name, jtmp->tag, jtmp->string_, jtmp->number_);
+			}
+		}
+		opt = opt->next;
+	}
+}
+
+static struct devices_t *devices_lookup_next(struct devices_lookup_t **node, const char *key, struct devices_t *prev) {
+	struct devices_t *dev = NULL;
+
+	while(*node != NULL && dev == NULL) {
+		if((*node)->device != prev && strcmp((*node)->key, key) == 0) {
+			dev = (*node)->device;
+		}
+		*node = (*node)->next;
+	}
+	return dev;
+}
+
+static void devices_lookup_clear(void) {
+	struct devices_lookup_t *tmp = NULL;
+	int i = 0;
+
+	for(i=0;i<DEVICES_LOOKUP_SIZE;i++) {
+		while(devices_lookup[i]) {
+			tmp = devices_lookup[i];
+			devices_lookup[i] = devices_lookup[i]->next;
+			FREE(tmp->key);
+			FREE(tmp);
+		}
+	}
+	devices_lookup_full = 0;
+}
+
+/* The current time as a UTC timestamp */
+static time_t devices_timestamp(void) {
+	time_t timenow = time(NULL);
+	struct tm gmt;
+	memset(&gmt, '\0', sizeof(struct tm));
+#ifdef _WIN32
+	struct tm *tm;
+	tm = gmtime(&timenow);
+	memcpy(&gmt, tm, sizeof(struct tm));
+#else
+	gmtime_r(&timenow, &gmt);
+#endif
+	char utc[] = "UTC";
+	return datetime2ts(gmt.tm_year+1900, gmt.tm_mon+1, gmt.tm_mday, gmt.tm_hour, gmt.tm_min, gmt.tm_sec, utc);
+}
+
+/*
+	Collects the values an update really changed, so only those are
+	journaled. API devices such as datetime poll their source and
+	restore themselves, so their values are not journaled at all.
+*/
+static void devices_journal_add(struct JsonNode **jchanged, struct protocol_t *protocol, struct devices_t *dev, struct devices_settings_t *sptr) {
+	struct JsonNode *jdevice = NULL, *jold = NULL;
+
+	if(protocol->hwtype == API || strcmp(sptr->name, "id") == 0 || sptr->values->next != NULL) {
+		return;
+	}
+	if(*jchanged == NULL) {
+		*jchanged = json_mkobject();
+	}
+	if((jdevice = json_find_member(*jchanged, dev->id)) == NULL) {
+		jdevice = json_mkobject();
+		json_append_member(*jchanged, dev->id, jdevice);
+	}
+	if((jold = json_find_member(jdevice, sptr->name)) != NULL) {
+		json_delete(jold);
+	}
+	if(sptr->values->type == JSON_NUMBER) {
+		json_append_member(jdevice, sptr->name, json_mknumber(sptr->values->number_, sptr->values->decimals));
+	} else if(sptr->values->type == JSON_STRING) {
+		json_append_member(jdevice, sptr->name, json_mkstring(sptr->values->string_));
+	}
+}
+
+/* Hands the changed values to the config journal, which takes them over */
+static void devices_journal(struct JsonNode *jchanged) {
+	struct JsonNode *jchanges = json_mkobject();
+
+	json_append_member(jchanges, config_devices->name, jchanged);
+	config_journal(jchanges);
+	json_delete(jchanges);
+}
+
 int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNode **out) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -70,6 +302,8 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 	JsonNode *rroot = json_mkobject();
 	JsonNode *rdev = json_mkarray();
 	JsonNode *rval = json_mkobject();
+	/* The values that actually changed */
+	JsonNode *jchanged = NULL;
 
 	/* Temporarily char pointer */
 	char *stmp = NULL;
@@ -99,34 +333,34 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 	/* Is is a valid new state / value */
 	int is_valid = 1;
 
+	/* The devices that can match this message */
+	struct devices_lookup_t *lptr = NULL;
+	char key[DEVICES_LOOKUP_KEYLEN];
+
 	/* Retrieve the used protocol */
-	struct protocols_t *pnode = protocols;
-	while(pnode) {
-		protocol = pnode->listener;
-		if(strcmp(protocol->id, protoname) == 0) {
-			break;
-		}
-		pnode = pnode->next;
+	if(protocol_get(protoname, &protocol) != 0) {
+		json_delete(rdev);
+		json_delete(rval);
+		json_delete(rroot);
+		return -1;
 	}
 
-	time_t timenow = time(NULL);
-	struct tm gmt;
-	memset(&gmt, '\0', sizeof(struct tm));
-#ifdef _WIN32
-	struct tm *tm;
-	tm = gmtime(&timenow);
-	memcpy(&gmt, tm, sizeof(struct tm));
-#else
-	gmtime_r(&timenow, &gmt);
-#endif
-	char utc[] = "UTC";
-	time_t utct = datetime2ts(gmt.tm_year+1900, gmt.tm_mon+1, gmt.tm_mday, gmt.tm_hour, gmt.tm_min, gmt.tm_sec, utc);
-	json_append_member(rval, "timestamp", json_mknumber((double)utct, 0));
+	time_t utct = 0;
 
 	json_find_string(json, "uuid", &uuid);
 
 	if((opt = protocol->options)) {
-		/* Loop through all devices */
+		/* Loop through all devices that carry the id's of this message */
+		if(devices_lookup_full == 0) {
+			devices_lookup_key(protocol, message, key);
+			lptr = devices_lookup[strhash(key) % DEVICES_LOOKUP_SIZE];
+			dptr = devices_lookup_next(&lptr, key, NULL);
+		}
+
+		/* Messages for unconfigured devices don't need a timestamp */
+		if(dptr != NULL) {
+			utct = devices_timestamp();
+		}
 
 		while(dptr) {
 			/*
@@ -333,12 +567,14 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 											}
 											strcpy(sptr->values->string_, vstring_);
 											sptr->values->type = JSON_STRING;
+											devices_journal_add(&jchanged, protocol, dptr, sptr);
 										} else if(valueType == JSON_NUMBER &&
 												  sptr->values->type == JSON_NUMBER &&
 												  fabs(sptr->values->number_-vnumber_) >= EPSILON) {
 											sptr->values->number_ = vnumber_;
 											sptr->values->decimals = vdecimals_;
 											sptr->values->type = JSON_NUMBER;
+											devices_journal_add(&jchanged, protocol, dptr, sptr);
 										}
 										if(sptr->values->type == JSON_STRING && json_find_string(rval, sptr->name, &stmp) != 0) {
 											json_append_member(rval, sptr->name, json_mkstring(sptr->values->string_));
@@ -367,6 +603,7 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 									sptr->values->type = JSON_STRING;
 									dptr->timestamp = utct;
 									update = 1;
+									devices_journal_add(&jchanged, protocol, dptr, sptr);
 								} else if((stateType == JSON_NUMBER &&
 										   sptr->values->type == JSON_NUMBER &&
 										   fabs(sptr->values->number_-snumber_) < EPSILON)) {
@@ -400,7 +637,7 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 								 * else is. We therefor need to abort the running action to let
 								 * the new state persist.
 								 */
-									if(dptr->action_thread->running == 1 && origin != ACTION) {
+									if((dptr->action_thread->running == 1 || dptr->action_thread->jobs != NULL) && origin != ACTION) {
 										event_action_thread_stop(dptr);
 									}
 
@@ -427,11 +664,18 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 					}
 				}
 			}
-			dptr = dptr->next;
+			if(devices_lookup_full == 0) {
+				dptr = devices_lookup_next(&lptr, key, dptr);
+			} else {
+				dptr = dptr->next;
+			}
 		}
 	}
 
 	if(update == 1) {
+		devices_version++;
+		json_prepend_member(rval, "timestamp", json_mknumber((double)utct, 0));
+
 		json_append_member(rroot, "origin", json_mkstring("update"));
 		json_append_member(rroot, "type",  json_mknumber((int)protocol->devtype, 0));
 		if(strlen(pilight_uuid) > 0 && (protocol->hwtype == SENSOR || protocol->hwtype == HWRELAY)) {
@@ -446,24 +690,34 @@ int devices_update(char *protoname, JsonNode *json, enum origin_t origin, JsonNo
 		json_delete(rval);
 		json_delete(rroot);
 	}
+	if(jchanged != NULL) {
+		devices_journal(jchanged);
+	}
 
 	return (update == 1) ? 0 : -1;
 }
 
+unsigned long devices_generation(void) {
+	return devices_version;
+}
+
+unsigned long devices_epoch(void) {
+	return devices_loaded;
+}
+
 int devices_get(char *sid, struct devices_t **dev) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	struct devices_t *dptr = NULL;
+	struct devices_index_t *node = devices_index[strhash(sid) % DEVICES_INDEX_SIZE];
 
-	dptr = devices;
-	while(dptr) {
-		if(strcmp(dptr->id, sid) == 0) {
+	while(node) {
+		if(strcmp(node->device->id, sid) == 0) {
 			if(dev != NULL) {
-				*dev = dptr;
+				*dev = node->device;
 			}
 			return 0;
 		}
-		dptr = dptr->next;
+		node = node->next;
 	}
 
 	return 1;
@@ -504,9 +758,7 @@ int devices_valid_value(char *sid, char *name, char *value) {
 	struct options_t *opt = NULL;
 	struct protocols_t *tmp_protocol = NULL;
 #if !defined(__FreeBSD__) && !defined(_WIN32)
-	regex_t regex;
 	int reti = 0;
-	memset(&regex, '\0', sizeof(regex));
 #endif
 
 	if(devices_get(sid, &dptr) == 0) {
@@ -516,18 +768,11 @@ int devices_valid_value(char *sid, char *name, char *value) {
 			while(opt) {
 				if(opt->conftype == DEVICES_VALUE && strcmp(name, opt->name) == 0) {
 #if !defined(__FreeBSD__) && !defined(_WIN32)
-					if(opt->mask != NULL) {
-						reti = regcomp(&regex, opt->mask, REG_EXTENDED);
-						if(reti) {
-							logprintf(LOG_ERR, "%s: could not compile %s regex", tmp_protocol->listener->id, opt->name);
-							exit(EXIT_FAILURE);
-						}
-						reti = regexec(&regex, value, 0, NULL, 0);
-						if(reti == REG_NOMATCH || reti != 0) {
-							regfree(&regex);
-							return 1;
-						}
-						regfree(&regex);
+					if((reti = options_match_mask(opt, value)) == -1) {
+						logprintf(LOG_ERR, "%s: could not compile %s regex", tmp_protocol->listener->id, opt->name);
+						exit(EXIT_FAILURE);
+					} else if(reti != 0) {
+						return 1;
 					}
 #endif
 					return 0;
@@ -1034,17 +1279,11 @@ static int devices_check_id(int i, JsonNode *jsetting, struct devices_t *device)
 
 									if(tmp_options->mask != NULL && strlen(tmp_options->mask) > 0) {
 #if !defined(__FreeBSD__) && !defined(_WIN32)
-										regex_t regex;
-										memset(&regex, '\0', sizeof(regex));
-										int reti = regcomp(&regex, tmp_options->mask, REG_EXTENDED);
-										if(reti) {
+										int reti = options_match_mask(tmp_options, ctmp);
+										if(reti == -1) {
 											logprintf(LOG_ERR, "%s: could not compile %s regex", tmp_protocols->listener->id, tmp_options->name);
-										} else {
-											reti = regexec(&regex, ctmp, 0, NULL, 0);
-											if(reti == REG_NOMATCH || reti != 0) {
-												match2--;
-											}
-											regfree(&regex);
+										} else if(reti != 0) {
+											match2--;
 										}
 #endif
 									}
@@ -1184,10 +1423,7 @@ static int devices_check_state(int i, JsonNode *jsetting, struct devices_t *devi
 	char *stmp = NULL;
 
 #if !defined(__FreeBSD__) && !defined(_WIN32)
-	/* Regex variables */
-	regex_t regex;
 	int reti = 0;
-	memset(&regex, '\0', sizeof(regex));
 #endif
 
 	/* Cast the different values */
@@ -1213,21 +1449,16 @@ static int devices_check_state(int i, JsonNode *jsetting, struct devices_t *devi
 					if(tmp_options->argtype == OPTION_HAS_VALUE) {
 						if(tmp_options->mask != NULL && strlen(tmp_options->mask) > 0) {
 #if !defined(__FreeBSD__) && !defined(_WIN32)
-							reti = regcomp(&regex, tmp_options->mask, REG_EXTENDED);
-							if(reti) {
+							if((reti = options_match_mask(tmp_options, ctmp)) == -1) {
 								logprintf(LOG_ERR, "%s: could not compile %s regex", tmp_protocols->listener->id, tmp_options->name);
 								have_error = 1;
 								goto clear;
 							}
-							reti = regexec(&regex, ctmp, 0, NULL, 0);
-
-							if(reti == REG_NOMATCH || reti != 0) {
+							if(reti != 0) {
 								logprintf(LOG_ERR, "config device setting #%d \"%s\" of \"%s\", invalid", i, jsetting->key, device->id);
 								have_error = 1;
-								regfree(&regex);
 								goto clear;
 							}
-							regfree(&regex);
 #endif
 						}
 					} else {
@@ -1520,13 +1751,11 @@ static int devices_parse(JsonNode *root) {
 					}
 				}
 				/* Check for duplicate fields */
-				tmp_devices = devices;
-				while(tmp_devices) {
-					if(strcmp(tmp_devices->id, jdevices->key) == 0) {
-						logprintf(LOG_ERR, "config device #%d \"%s\", duplicate", i, jdevices->key);
-						have_error = 1;
-					}
-					tmp_devices = tmp_devices->next;
+				int duplicate = 0;
+				if(devices_get(jdevices->key, NULL) == 0) {
+					logprintf(LOG_ERR, "config device #%d \"%s\", duplicate", i, jdevices->key);
+					have_error = 1;
+					duplicate = 1;
 				}
 
 				if((dnode = MALLOC(sizeof(struct devices_t))) == NULL) {
@@ -1559,24 +1788,16 @@ static int devices_parse(JsonNode *root) {
 				jprotocol = json_first_child(jprotocols);
 				while(jprotocol) {
 					match = 0;
-					struct protocols_t *tmp_protocols = protocols;
+					struct protocols_t *tmp_protocols = NULL;
 					/* Pointer to the match protocol */
 					struct protocol_t *protocol = NULL;
-					while(tmp_protocols) {
-						protocol = tmp_protocols->listener;
-						if(protocol_device_exists(protocol, jprotocol->string_) == 0 && match == 0
-						   && protocol->config == 1) {
-							if(ptype == -1) {
-								ptype = protocol->hwtype;
-								match = 1;
-							}
-							if(ptype > -1 && protocol->hwtype == ptype) {
-								match = 1;
-							}
-							match = 1;
-							break;
+					if(jprotocol->tag == JSON_STRING
+					   && protocol_device_get(jprotocol->string_, &protocol) == 0
+					   && protocol->config == 1) {
+						if(ptype == -1) {
+							ptype = protocol->hwtype;
 						}
-						tmp_protocols = tmp_protocols->next;
+						match = 1;
 					}
 					if(match == 1 && ptype != protocol->hwtype) {
 						logprintf(LOG_ERR, "config device #%d \"%s\", cannot combine protocols of different hardware types", i, jdevices->key);
@@ -1620,6 +1841,19 @@ static int devices_parse(JsonNode *root) {
 					have_error = 1;
 				}
 
+				/* Index the id settings for every protocol of this device */
+				struct protocols_t *tmp_protocols = dnode->protocols;
+				while(tmp_protocols) {
+					struct devices_settings_t *tmp_settings = dnode->settings;
+					while(tmp_settings) {
+						if(strcmp(tmp_settings->name, "id") == 0) {
+							devices_lookup_add(dnode, tmp_protocols->listener, tmp_settings);
+						}
+						tmp_settings = tmp_settings->next;
+					}
+					tmp_protocols = tmp_protocols->next;
+				}
+
 				tmp_devices = devices;
 				if(tmp_devices) {
 					while(tmp_devices->next != NULL) {
@@ -1630,6 +1864,9 @@ static int devices_parse(JsonNode *root) {
 					dnode->next = devices;
 					devices = dnode;
 				}
+				if(duplicate == 0) {
+					devices_index_add(dnode);
+				}
 
 				if(have_error) {
 					goto clear;
@@ -1641,6 +1878,8 @@ static int devices_parse(JsonNode *root) {
 	}
 
 clear:
+	devices_version++;
+	devices_loaded++;
 	return have_error;
 }
 
@@ -1651,6 +1890,11 @@ int devices_gc(void) {
 	struct devices_values_t *vtmp;
 	struct protocols_t *ptmp;
 
+	devices_index_clear();
+	devices_lookup_clear();
+	devices_version++;
+	devices_loaded++;
+
 	/* Free devices structure */
 	while(devices) {
 		dtmp = devices;
@@ -98,6 +98,8 @@ int devices_get(char *sid, struct devices_t **dev);
 int devices_valid_state(char *sid, char *state);
 int devices_valid_value(char *sid, char *name, char *value);
 struct JsonNode *devices_values(const char *media);
+unsigned long devices_generation(void);
+unsigned long devices_epoch(void);
 void devices_init(void);
 int devices_gc(void);
 
@@ -257,38 +257,23 @@ static int hardware_parse(JsonNode *root) {
 				} else {
 					/* Check if setting contains a valid value */
 #if !defined(__FreeBSD__) && !defined(_WIN32)
-					regex_t regex;
-					int reti;
-					char *stmp = NULL;
+					char ntmp[16];
+					char *stmp = "";
+					int reti = 0;
 
 					if(jvalues->tag == JSON_NUMBER) {
-						if((stmp = REALLOC(stmp, sizeof(jvalues->number_))) == NULL) {
-							fprintf(stderr, "out of memory\n");
-							exit(EXIT_FAILURE);
-						}
-						sprintf(stmp, "%d", (int)jvalues->number_);
+						snprintf(ntmp, sizeof(ntmp), "%d", (int)jvalues->number_);
+						stmp = ntmp;
 					} else if(jvalues->tag == JSON_STRING) {
-						if((stmp = REALLOC(stmp, strlen(jvalues->string_)+1)) == NULL) {
-							fprintf(stderr, "out of memory\n");
-							exit(EXIT_FAILURE);
-						}
-						strcpy(stmp, jvalues->string_);
+						stmp = jvalues->string_;
 					}
-					if(hw_options->mask != NULL) {
-						reti = regcomp(&regex, hw_options->mask, REG_EXTENDED);
-						if(reti) {
-							logprintf(LOG_ERR, "could not compile regex");
-							exit(EXIT_FAILURE);
-						}
-						reti = regexec(&regex, stmp, 0, NULL, 0);
-						if(reti == REG_NOMATCH || reti != 0) {
-							logprintf(LOG_ERR, "config hardware module #%d \"%s\", setting \"%s\" invalid", i, jchilds->key, hw_options->name);
-							have_error = 1;
-							regfree(&regex);
-							goto clear;
-						}
-						FREE(stmp);
-						regfree(&regex);
+					if((reti = options_match_mask(hw_options, stmp)) == -1) {
+						logprintf(LOG_ERR, "could not compile regex");
+						exit(EXIT_FAILURE);
+					} else if(reti != 0) {
+						logprintf(LOG_ERR, "config hardware module #%d \"%s\", setting \"%s\" invalid", i, jchilds->key, hw_options->name);
+						have_error = 1;
+						goto clear;
 					}
 #endif
 				}
@@ -198,6 +198,7 @@ int registry_set_string(const char *key, char *value) {
 	if(registry == NULL) {
 		registry = json_mkobject();
 	}
+	config_changed();
 	return registry_set_value_recursive(registry, key, (void *)value, 0, JSON_STRING);
 }
 
@@ -208,6 +209,7 @@ int registry_set_number(const char *key, double value, int decimals) {
 		registry = json_mkobject();
 	}
 	void *p = (void *)&value;
+	config_changed();
 	return registry_set_value_recursive(registry, key, p, decimals, JSON_NUMBER);
 }
 
@@ -217,6 +219,7 @@ int registry_remove_value(const char *key) {
 	if(registry == NULL) {
 		return -1;
 	}
+	config_changed();
 	return registry_remove_value_recursive(registry, key);
 }
 
@@ -38,7 +38,68 @@
 #include "rules.h"
 #include "gui.h"
 
+#define RULES_INDEX_SIZE	512
+
+/* Lookup table from a device id to the rules that depend on it */
+typedef struct rules_index_t {
+	char *device;
+	struct rules_t **rules;
+	int nrrules;
+	struct rules_index_t *next;
+} rules_index_t;
+
 static struct rules_t *rules = NULL;
+static struct rules_index_t *rules_index[RULES_INDEX_SIZE];
+static int nrrules = 0;
+
+static void rules_index_add(char *device, struct rules_t *rule) {
+	unsigned int i = strhash(device) % RULES_INDEX_SIZE;
+	struct rules_index_t *node = rules_index[i];
+
+	while(node) {
+		if(strcmp(node->device, device) == 0) {
+			break;
+		}
+		node = node->next;
+	}
+	if(node == NULL) {
+		if((node = MALLOC(sizeof(struct rules_index_t))) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		if((node->device = MALLOC(strlen(device)+1)) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		strcpy(node->device, device);
+		node->rules = NULL;
+		node->nrrules = 0;
+		node->next = rules_index[i];
+		rules_index[i] = node;
+	}
+	if((node->rules = REALLOC(node->rules, sizeof(struct rules_t *)*(unsigned int)(node->nrrules+1))) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	node->rules[node->nrrules++] = rule;
+}
+
+static void rules_index_clear(void) {
+	struct rules_index_t *tmp = NULL;
+	int i = 0;
+
+	for(i=0;i<RULES_INDEX_SIZE;i++) {
+		while(rules_index[i]) {
+			tmp = rules_index[i];
+			rules_index[i] = rules_index[i]->next;
+			FREE(tmp->device);
+			if(tmp->rules != NULL) {
+				FREE(tmp->rules);
+			}
+			FREE(tmp);
+		}
+	}
+}
 
 static int rules_parse(JsonNode *root) {
 	int have_error = 0, match = 0, x = 0;
@@ -92,7 +153,15 @@ static int rules_parse(JsonNode *root) {
 					node->nrdevices = 0;
 					node->status = 0;
 					node->devices = NULL;
+					node->nrtargets = 0;
+					node->targets = NULL;
 					node->actions = NULL;
+					node->condition = NULL;
+					node->granularity = 0;
+					node->datetime = NULL;
+					node->parked = 0;
+					event_timer_init(&node->schedule, node);
+					memset(&node->profile, 0, sizeof(struct event_rule_profile_t));
 					node->nr = i;
 					if((node->name = MALLOC(strlen(jrules->key)+1)) == NULL) {
 						fprintf(stderr, "out of memory\n");
@@ -100,7 +169,7 @@ static int rules_parse(JsonNode *root) {
 					}
 					strcpy(node->name, jrules->key);
 					clock_gettime(CLOCK_MONOTONIC, &node->timestamp.first);
-					if(event_parse_rule(rule, node, 0, 1) == -1) {
+					if(event_parse_rule(rule, node, 1) == -1) {
 						have_error = 1;
 					}
 					clock_gettime(CLOCK_MONOTONIC, &node->timestamp.second);
@@ -115,6 +184,10 @@ static int rules_parse(JsonNode *root) {
 					}
 					strcpy(node->rule, rule);
 					node->active = (unsigned short)active;
+					for(x=0;x<node->nrdevices;x++) {
+						rules_index_add(node->devices[x], node);
+					}
+					nrrules++;
 
 					tmp = rules;
 					if(tmp) {
@@ -189,6 +262,26 @@ struct rules_t *rules_get(void) {
 	return rules;
 }
 
+/* Returns the number of rules that depend on a device, in the order
+   in which they were configured, and stores them in out */
+int rules_get_by_device(char *device, struct rules_t ***out) {
+	struct rules_index_t *node = rules_index[strhash(device) % RULES_INDEX_SIZE];
+
+	while(node) {
+		if(strcmp(node->device, device) == 0) {
+			*out = node->rules;
+			return node->nrrules;
+		}
+		node = node->next;
+	}
+	*out = NULL;
+	return 0;
+}
+
+int rules_count(void) {
+	return nrrules;
+}
+
 int rules_gc(void) {
 	struct rules_t *tmp_rules = NULL;
 	struct rules_values_t *tmp_values = NULL;
@@ -199,9 +292,16 @@ int rules_gc(void) {
 		tmp_rules = rules;
 		FREE(tmp_rules->name);
 		FREE(tmp_rules->rule);
+		event_free_condition(tmp_rules);
 		for(i=0;i<tmp_rules->nrdevices;i++) {
 			FREE(tmp_rules->devices[i]);
 		}
+		for(i=0;i<tmp_rules->nrtargets;i++) {
+			FREE(tmp_rules->targets[i]);
+		}
+		if(tmp_rules->targets != NULL) {
+			FREE(tmp_rules->targets);
+		}
 		while(tmp_rules->values) {
 			tmp_values = tmp_rules->values;
 			FREE(tmp_values->name);
@@ -238,6 +338,8 @@ int rules_gc(void) {
 		FREE(rules);
 	}
 	rules = NULL;
+	rules_index_clear();
+	nrrules = 0;
 
 	logprintf(LOG_DEBUG, "garbage collected config rules library");
 	return 1;
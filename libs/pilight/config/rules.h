@@ -22,11 +22,14 @@
 #include "../core/json.h"
 #include "../core/config.h"
 #include "../events/action.h"
+#include "../events/profile.h"
 
 typedef struct rules_values_t {
 	char *device;
 	char *name;
-	struct devices_settings_t *settings;
+	/* Value of the device setting as of devices_epoch() == epoch */
+	struct devices_values_t *values;
+	unsigned long epoch;
 	struct rules_values_t *next;
 } rules_values_t;
 
@@ -44,6 +47,10 @@ typedef struct rules_t {
 	char *name;
 	char **devices;
 	int nrdevices;
+	/* Devices the actions of the rule act upon,
+	   nrtargets is -1 when they are only known at runtime */
+	char **targets;
+	int nrtargets;
 	int nr;
 	int status;
 	struct {
@@ -51,9 +58,19 @@ typedef struct rules_t {
 		struct timespec second;
 	}	timestamp;
 	unsigned short active;
+	/* Condition compiled by event_parse_rule */
+	struct event_node_t *condition;
 	/* Arguments to be send to the action */
 	struct rules_actions_t *actions;
 	struct rules_values_t *values;
+	/* Seconds between changes of the datetime fields the condition
+	   reads, 0 when the rule cannot be parked on the events wheel */
+	int granularity;
+	char *datetime;
+	/* Timer that marks a parked rule due again */
+	struct event_timer_t schedule;
+	int parked;
+	struct event_rule_profile_t profile;
 	struct rules_t *next;
 } rules_t;
 
@@ -62,5 +79,7 @@ struct config_t *config_rules;
 void rules_init(void);
 int rules_gc(void);
 struct rules_t *rules_get(void);
+int rules_get_by_device(char *device, struct rules_t ***out);
+int rules_count(void);
 
 #endif
@@ -216,7 +216,8 @@ static int settings_parse(JsonNode *root) {
 			}
 		} else if(strcmp(jsettings->key, "standalone") == 0 ||
 							strcmp(jsettings->key, "watchdog-enable") == 0 ||
-							strcmp(jsettings->key, "stats-enable") == 0) {
+							strcmp(jsettings->key, "stats-enable") == 0 ||
+							strcmp(jsettings->key, "event-profile") == 0) {
 			if(jsettings->tag != JSON_NUMBER) {
 				logprintf(LOG_ERR, "config setting \"%s\" must be either 0 or 1", jsettings->key);
 				have_error = 1;
@@ -228,6 +229,19 @@ static int settings_parse(JsonNode *root) {
 			} else {
 				settings_add_number(jsettings->key, (int)jsettings->number_);
 			}
+		} else if(strcmp(jsettings->key, "action-threads") == 0
+			|| strcmp(jsettings->key, "event-threads") == 0) {
+			if(jsettings->tag != JSON_NUMBER) {
+				logprintf(LOG_ERR, "config setting \"%s\" must contain a number larger than 0", jsettings->key);
+				have_error = 1;
+				goto clear;
+			} else if((int)jsettings->number_ <= 0) {
+				logprintf(LOG_ERR, "config setting \"%s\" must contain a number larger than 0", jsettings->key);
+				have_error = 1;
+				goto clear;
+			} else {
+				settings_add_number(jsettings->key, (int)jsettings->number_);
+			}
 		} else if(strcmp(jsettings->key, "log-level") == 0) {
 			if(jsettings->tag != JSON_NUMBER) {
 				logprintf(LOG_ERR, "config setting \"%s\" must contain a number from 0 till 6", jsettings->key);
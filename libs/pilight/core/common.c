@@ -992,3 +992,13 @@ int stricmp(char const *a, char const *b) {
 				return d;
 	}
 }
+
+/* djb2, used to spread names over the lookup indexes */
+unsigned int strhash(const char *str) {
+	unsigned int hash = 5381;
+
+	while(*str != '\0') {
+		hash = ((hash << 5) + hash) + (unsigned char)*str++;
+	}
+	return hash;
+}
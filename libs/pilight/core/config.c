@@ -25,6 +25,7 @@
 #include <sys/stat.h>
 #include <time.h>
 #include <libgen.h>
+#include <pthread.h>
 
 #include "pilight.h"
 #include "common.h"
@@ -84,6 +85,308 @@ static void sort_list(int r) {
 /* The location of the config file */
 static char *configfile = NULL;
 
+/*
+ * Device values that changed are collected in memory, a newer value
+ * of the same device setting replaces the pending one. The pending
+ * changes are appended to a journal next to the config file as a
+ * single entry once the oldest of them is CONFIG_JOURNAL_DELAY
+ * seconds old. The journal is only folded into the config file once
+ * it grew large or when pilight stops, so state changes hardly ever
+ * rewrite the whole config file. The journal is replayed after a
+ * crash, which loses at most the changes of the last delay.
+ */
+#define CONFIG_JOURNAL_DELAY		30
+#define CONFIG_JOURNAL_MAXSIZE	262144
+
+static char *journalfile = NULL;
+static FILE *journal = NULL;
+static size_t journal_size = 0;
+static struct JsonNode *journal_pending = NULL;
+static time_t journal_pending_since = 0;
+
+/* Bytes written to storage since startup */
+static unsigned long journal_bytes = 0;
+static unsigned long config_bytes = 0;
+
+static pthread_mutex_t config_lock;
+static pthread_mutexattr_t config_attr;
+
+/*
+ * The serialized config and device values are kept per level and
+ * media together with the generation they were built from, so they
+ * only have to be rebuilt after something changed.
+ */
+#define CONFIG_SNAPSHOTS	8
+
+typedef struct config_snapshot_t {
+	char media[16];
+	int level;
+	unsigned long generation;
+	unsigned long used;
+	char *content;
+	size_t len;
+} config_snapshot_t;
+
+static struct config_snapshot_t config_snapshots[CONFIG_SNAPSHOTS];
+static struct config_snapshot_t values_snapshots[CONFIG_SNAPSHOTS];
+static unsigned long config_snapshot_used = 0;
+
+/* Bumped whenever a config section other than the devices changes */
+static unsigned long config_version = 0;
+
+static void config_journal_close(void) {
+	if(journal != NULL) {
+		fclose(journal);
+		journal = NULL;
+	}
+	journal_size = 0;
+}
+
+static void config_journal_discard(void) {
+	if(journal_pending != NULL) {
+		json_delete(journal_pending);
+		journal_pending = NULL;
+	}
+	journal_pending_since = 0;
+}
+
+/* Replace a member of an object without moving it */
+static void config_journal_replace(struct JsonNode *object, struct JsonNode *jold, struct JsonNode *jnew, const char *key) {
+	struct JsonNode *jnext = jold->next, *jtmp = NULL;
+	int nrnext = 0, i = 0;
+
+	for(jtmp = jnext; jtmp != NULL; jtmp = jtmp->next) {
+		nrnext++;
+	}
+
+	json_remove_from_parent(jold);
+	json_delete(jold);
+	json_append_member(object, key, jnew);
+
+	/* Move the members that followed behind the new value */
+	for(i=0;i<nrnext;i++) {
+		jtmp = jnext->next;
+		char name[strlen(jnext->key)+1];
+		strcpy(name, jnext->key);
+		json_remove_from_parent(jnext);
+		json_append_member(object, name, jnext);
+		jnext = jtmp;
+	}
+}
+
+static void config_journal_merge(struct JsonNode *root, struct JsonNode *changes) {
+	struct JsonNode *jchange = json_first_child(changes);
+	struct JsonNode *jnext = NULL, *jold = NULL;
+
+	while(jchange) {
+		jnext = jchange->next;
+		char key[strlen(jchange->key)+1];
+		strcpy(key, jchange->key);
+
+		/* Members that are no longer in the config are not brought back */
+		if((jold = json_find_member(root, key)) != NULL) {
+			if(jold->tag == JSON_OBJECT && jchange->tag == JSON_OBJECT) {
+				config_journal_merge(jold, jchange);
+			} else {
+				json_remove_from_parent(jchange);
+				config_journal_replace(root, jold, jchange, key);
+			}
+		}
+		jchange = jnext;
+	}
+}
+
+/* Apply the changes of a previous run that didn't make it into the config file */
+static void config_journal_replay(struct JsonNode *root) {
+	FILE *fp = NULL;
+	struct JsonNode *jchanges = NULL;
+	char *content = NULL, *line = NULL, *end = NULL;
+	long size = 0;
+	int nrlines = 0;
+
+	if(journalfile == NULL || (fp = fopen(journalfile, "rb")) == NULL) {
+		return;
+	}
+	fseek(fp, 0L, SEEK_END);
+	if((size = ftell(fp)) <= 0) {
+		fclose(fp);
+		return;
+	}
+	rewind(fp);
+
+	if((content = MALLOC((size_t)size+1)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	size = (long)fread(content, sizeof(char), (size_t)size, fp);
+	content[size] = '\0';
+	fclose(fp);
+
+	/* A line cut short by a power failure simply doesn't parse */
+	line = content;
+	while(*line != '\0') {
+		if((end = strchr(line, '\n')) != NULL) {
+			*end = '\0';
+		}
+		if((jchanges = json_decode(line)) != NULL) {
+			config_journal_merge(root, jchanges);
+			json_delete(jchanges);
+			nrlines++;
+		}
+		if(end == NULL) {
+			break;
+		}
+		line = end+1;
+	}
+	FREE(content);
+
+	if(nrlines > 0) {
+		logprintf(LOG_DEBUG, "replayed %d config journal entries", nrlines);
+		journal_size = (size_t)size;
+	}
+}
+
+/* Like config_journal_merge, but takes over changes the pending ones lack */
+static void config_journal_pend(struct JsonNode *pending, struct JsonNode *changes) {
+	struct JsonNode *jchange = json_first_child(changes);
+	struct JsonNode *jnext = NULL, *jold = NULL;
+
+	while(jchange) {
+		jnext = jchange->next;
+		char key[strlen(jchange->key)+1];
+		strcpy(key, jchange->key);
+
+		json_remove_from_parent(jchange);
+		if((jold = json_find_member(pending, key)) == NULL) {
+			json_append_member(pending, key, jchange);
+		} else if(jold->tag == JSON_OBJECT && jchange->tag == JSON_OBJECT) {
+			config_journal_pend(jold, jchange);
+			json_delete(jchange);
+		} else {
+			config_journal_replace(pending, jold, jchange, key);
+		}
+		jchange = jnext;
+	}
+}
+
+/* Appends the pending changes to the journal, called with config_lock held */
+static int config_journal_flush(void) {
+	char *content = NULL;
+	size_t len = 0;
+	int ret = EXIT_SUCCESS;
+
+	if(journal_pending == NULL) {
+		return EXIT_SUCCESS;
+	}
+	if(journal == NULL && (journal = fopen(journalfile, "ab")) == NULL) {
+		logprintf(LOG_ERR, "cannot write config journal: %s", journalfile);
+		return EXIT_FAILURE;
+	}
+	if((content = json_stringify(journal_pending, NULL)) != NULL) {
+		len = strlen(content);
+		if(fwrite(content, sizeof(char), len, journal) != len ||
+		   fputc('\n', journal) == EOF || fflush(journal) != 0) {
+			logprintf(LOG_ERR, "cannot write config journal: %s", journalfile);
+			ret = EXIT_FAILURE;
+		}
+		json_free(content);
+
+		journal_size += len+1;
+		journal_bytes += (unsigned long)(len+1);
+	}
+	config_journal_discard();
+	return ret;
+}
+
+static void config_snapshot_clear(struct config_snapshot_t *snapshots) {
+	int i = 0;
+
+	for(i=0;i<CONFIG_SNAPSHOTS;i++) {
+		if(snapshots[i].content != NULL) {
+			json_free(snapshots[i].content);
+		}
+		memset(&snapshots[i], '\0', sizeof(struct config_snapshot_t));
+	}
+}
+
+/* Returns a copy of the cached serialization, rebuilding it when outdated */
+static char *config_snapshot_get(struct config_snapshot_t *snapshots, int level, const char *media, unsigned long generation) {
+	struct config_snapshot_t *snapshot = NULL;
+	struct JsonNode *jsnapshot = NULL;
+	char *content = NULL;
+	int i = 0;
+
+	pthread_mutex_lock(&config_lock);
+	for(i=0;i<CONFIG_SNAPSHOTS;i++) {
+		if(snapshots[i].content != NULL && snapshots[i].level == level &&
+		   strncmp(snapshots[i].media, media, sizeof(snapshots[i].media)) == 0) {
+			snapshot = &snapshots[i];
+			break;
+		}
+		if(snapshot == NULL || snapshots[i].used < snapshot->used) {
+			snapshot = &snapshots[i];
+		}
+	}
+
+	if(snapshot->content == NULL || snapshot->generation != generation ||
+	   snapshot->level != level || strncmp(snapshot->media, media, sizeof(snapshot->media)) != 0) {
+		if(snapshots == values_snapshots) {
+			jsnapshot = devices_values(media);
+		} else {
+			jsnapshot = config_print(level, media);
+		}
+		if(snapshot->content != NULL) {
+			json_free(snapshot->content);
+		}
+		snapshot->content = json_stringify(jsnapshot, NULL);
+		snapshot->len = strlen(snapshot->content);
+		snapshot->level = level;
+		snapshot->generation = generation;
+		snprintf(snapshot->media, sizeof(snapshot->media), "%s", media);
+		json_delete(jsnapshot);
+	}
+	snapshot->used = ++config_snapshot_used;
+
+	if((content = MALLOC(snapshot->len+1)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(content, snapshot->content, snapshot->len+1);
+	pthread_mutex_unlock(&config_lock);
+
+	return content;
+}
+
+void config_changed(void) {
+	config_version++;
+}
+
+unsigned long config_generation(void) {
+	return config_version + devices_generation();
+}
+
+char *config_snapshot(int level, const char *media, unsigned long *generation) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	unsigned long current = config_generation();
+
+	if(generation != NULL) {
+		*generation = current;
+	}
+	return config_snapshot_get(config_snapshots, level, media, current);
+}
+
+char *config_values_snapshot(const char *media, unsigned long *generation) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	unsigned long current = devices_generation();
+
+	if(generation != NULL) {
+		*generation = current;
+	}
+	return config_snapshot_get(values_snapshots, 0, media, current);
+}
+
 int config_gc(void) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -101,6 +404,19 @@ int config_gc(void) {
 	if(configfile != NULL) {
 		FREE(configfile);
 	}
+	/* Changes that did not make it into the config file */
+	if(journalfile != NULL && journal_pending != NULL) {
+		config_journal_flush();
+	}
+	config_journal_discard();
+	config_journal_close();
+	if(journalfile != NULL) {
+		FREE(journalfile);
+	}
+	config_snapshot_clear(config_snapshots);
+	config_snapshot_clear(values_snapshots);
+	config_version++;
+	logprintf(LOG_DEBUG, "config journal wrote %lu bytes, config file %lu bytes", journal_bytes, config_bytes);
 	logprintf(LOG_DEBUG, "garbage collected config library");
 	return 1;
 }
@@ -125,6 +441,7 @@ int config_parse(JsonNode *root) {
 		listeners = listeners->next;
 	}
 
+	config_version++;
 	if(error == 1) {
 		config_gc();
 		return EXIT_FAILURE;
@@ -156,9 +473,19 @@ JsonNode *config_print(int level, const char *media) {
 int config_write(int level, const char *media) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	struct JsonNode *root = json_mkobject();
+	struct JsonNode *root = NULL;
+#ifndef _WIN32
+	struct stat st;
+#endif
 	FILE *fp;
+	char *content = NULL;
+	size_t len = 0;
+
+	/* Keep device updates out of the journal until the new config
+	   file is in place, otherwise they would be thrown away with it */
+	pthread_mutex_lock(&config_lock);
 
+	root = json_mkobject();
 	sort_list(0);
 	struct config_t *listeners = config;
 	while(listeners) {
@@ -171,19 +498,104 @@ int config_write(int level, const char *media) {
 		listeners = listeners->next;
 	}
 
-	/* Overwrite config file with proper format */
-	if((fp = fopen(configfile, "w+")) == NULL) {
-		logprintf(LOG_ERR, "cannot write config file: %s", configfile);
+	if((content = json_stringify(root, "\t")) == NULL) {
+		json_delete(root);
+		pthread_mutex_unlock(&config_lock);
 		return EXIT_FAILURE;
 	}
-	fseek(fp, 0L, SEEK_SET);
-	char *content = NULL;
-	if((content = json_stringify(root, "\t")) != NULL) {
-		fwrite(content, sizeof(char), strlen(content), fp);
+	json_delete(root);
+	len = strlen(content);
+
+	/* Write a new config file next to the old one and swap them
+	   so an interrupted write never leaves a truncated config */
+	char tmpfile[strlen(configfile)+5];
+	sprintf(tmpfile, "%s.tmp", configfile);
+
+	if((fp = fopen(tmpfile, "wb")) == NULL) {
+		logprintf(LOG_ERR, "cannot write config file: %s", tmpfile);
+		pthread_mutex_unlock(&config_lock);
 		json_free(content);
-		json_delete(root);
+		return EXIT_FAILURE;
+	}
+	if(fwrite(content, sizeof(char), len, fp) != len || fflush(fp) != 0) {
+		logprintf(LOG_ERR, "cannot write config file: %s", tmpfile);
+		fclose(fp);
+		unlink(tmpfile);
+		pthread_mutex_unlock(&config_lock);
+		json_free(content);
+		return EXIT_FAILURE;
+	}
+#ifndef _WIN32
+	fsync(fileno(fp));
+	if(stat(configfile, &st) == 0) {
+		fchmod(fileno(fp), st.st_mode);
 	}
+#endif
 	fclose(fp);
+	json_free(content);
+
+#ifdef _WIN32
+	unlink(configfile);
+#endif
+	if(rename(tmpfile, configfile) != 0) {
+		logprintf(LOG_ERR, "cannot write config file: %s", configfile);
+		unlink(tmpfile);
+		pthread_mutex_unlock(&config_lock);
+		return EXIT_FAILURE;
+	}
+	config_bytes += (unsigned long)len;
+
+	/* Everything in the journal is part of the config file now */
+	config_journal_discard();
+	config_journal_close();
+	if(journalfile != NULL) {
+		unlink(journalfile);
+	}
+	pthread_mutex_unlock(&config_lock);
+
+	return EXIT_SUCCESS;
+}
+
+int config_journal(struct JsonNode *changes) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	if(journalfile == NULL || pilight.runmode != STANDALONE) {
+		return EXIT_FAILURE;
+	}
+
+	pthread_mutex_lock(&config_lock);
+	if(journal_pending == NULL) {
+		journal_pending = json_mkobject();
+		journal_pending_since = time(NULL);
+	}
+	config_journal_pend(journal_pending, changes);
+	pthread_mutex_unlock(&config_lock);
+
+	return EXIT_SUCCESS;
+}
+
+int config_sync(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	time_t now = time(NULL);
+	int fold = 0;
+
+	pthread_mutex_lock(&config_lock);
+	if(journal_pending != NULL && (now - journal_pending_since) >= CONFIG_JOURNAL_DELAY) {
+		config_journal_flush();
+	}
+	if(journal_size >= CONFIG_JOURNAL_MAXSIZE) {
+		fold = 1;
+	}
+	pthread_mutex_unlock(&config_lock);
+
+	if(fold == 1) {
+		if(config_write(1, "all") != EXIT_SUCCESS) {
+			return EXIT_FAILURE;
+		}
+		logprintf(LOG_DEBUG, "config journal folded into %s, %lu bytes journaled and %lu bytes written in total",
+			configfile, journal_bytes, config_bytes);
+	}
 	return EXIT_SUCCESS;
 }
 
@@ -191,10 +603,10 @@ int config_read(void) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	FILE *fp = NULL;
-	char *content = NULL;
-	size_t bytes = 0;
 	struct JsonNode *root = NULL;
-	struct stat st;
+	struct JsonError error;
+	size_t i = 0;
+	int line = 1, c = 0;
 
 	/* Read JSON config file */
 	if((fp = fopen(configfile, "rb")) == NULL) {
@@ -202,36 +614,27 @@ int config_read(void) {
 		return EXIT_FAILURE;
 	}
 
-	fstat(fileno(fp), &st);
-	bytes = (size_t)st.st_size;
-
-	if((content = CALLOC(bytes+1, sizeof(char))) == NULL) {
-		fprintf(stderr, "out of memory\n");
+	/* Validate JSON and turn into JSON object while it's read */
+	if((root = json_read(fp, &error)) == NULL) {
+		rewind(fp);
+		for(i=0;i<error.offset && (c = fgetc(fp)) != EOF;i++) {
+			if(c == '\n') {
+				line++;
+			}
+		}
 		fclose(fp);
-		exit(EXIT_FAILURE);
-	}
-
-	if(fread(content, sizeof(char), bytes, fp) == -1) {
-		logprintf(LOG_ERR, "cannot read config file: %s", configfile);
+		logprintf(LOG_ERR, "config is not in a valid json format: %s on line %d", error.reason, line);
+		return EXIT_FAILURE;
 	}
 	fclose(fp);
 
-	/* Validate JSON and turn into JSON object */
-	if(json_validate(content) == false) {
-		logprintf(LOG_ERR, "config is not in a valid json format");
-		FREE(content);
-		return EXIT_FAILURE;
-	}
-	root = json_decode(content);
+	config_journal_replay(root);
 
 	if(config_parse(root) != EXIT_SUCCESS) {
-		FREE(content);
 		json_delete(root);
 		return EXIT_FAILURE;
 	}
 	json_delete(root);
-	config_write(1, "all");
-	FREE(content);
 	return EXIT_SUCCESS;
 }
 
@@ -264,6 +667,11 @@ int config_set_file(char *settfile) {
 			exit(EXIT_FAILURE);
 		}
 		strcpy(configfile, settfile);
+		if((journalfile = REALLOC(journalfile, strlen(settfile)+9)) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		sprintf(journalfile, "%s.journal", settfile);
 	} else {
 		logprintf(LOG_ERR, "the config file %s does not exists", settfile);
 		return EXIT_FAILURE;
@@ -281,6 +689,10 @@ char *config_get_file(void) {
 void config_init() {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
+	pthread_mutexattr_init(&config_attr);
+	pthread_mutexattr_settype(&config_attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&config_lock, &config_attr);
+
 	hardware_init();
 	settings_init();
 	devices_init();
@@ -36,6 +36,12 @@ typedef struct config_t {
 } config_t;
 
 int config_write(int level, const char *media);
+int config_journal(struct JsonNode *changes);
+int config_sync(void);
+void config_changed(void);
+unsigned long config_generation(void);
+char *config_snapshot(int level, const char *media, unsigned long *generation);
+char *config_values_snapshot(const char *media, unsigned long *generation);
 int config_read(void);
 int config_parse(struct JsonNode *root);
 struct JsonNode *config_print(int level, const char *media);
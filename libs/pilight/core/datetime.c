@@ -66,6 +66,56 @@ static int tz_lock_initialized = 0;
 static int fillingtzdata = 0;
 static int searchingtz = 0;
 
+typedef struct tzreader_t {
+	unsigned int country;
+	unsigned int poly;
+	unsigned int coord;
+} tzreader_t;
+
+/*
+ * The tzdata file is an array of single member objects, each holding
+ * the polygon of a timezone: [{"Europe/Amsterdam":[[lon,lat],...]},...]
+ */
+static int tzdata_event(void *userdata, JsonSaxEvent event, const char *key, const JsonNode *value, int depth) {
+	struct tzreader_t *reader = userdata;
+	unsigned int i = reader->country, x = reader->poly;
+
+	if(event == JSON_SAX_ARRAY_START && depth == 2) {
+		if(i >= NRCOUNTRIES) {
+			return -1;
+		}
+		snprintf(tznames[i], sizeof(tznames[i]), "%s", key);
+		if((tzcoords = realloc(tzcoords, sizeof(int **)*(i+1))) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		tzcoords[i] = NULL;
+		reader->poly = 0;
+	} else if(event == JSON_SAX_ARRAY_START && depth == 3) {
+		if((tzcoords[i] = realloc(tzcoords[i], sizeof(int *)*(x+1))) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		if((tzcoords[i][x] = malloc(sizeof(int)*2)) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		tzcoords[i][x][0] = 0;
+		tzcoords[i][x][1] = 0;
+		reader->coord = 0;
+	} else if(event == JSON_SAX_VALUE && depth == 4) {
+		if(reader->coord < 2 && value->tag == JSON_NUMBER) {
+			tzcoords[i][x][reader->coord++] = (int)value->number_;
+		}
+	} else if(event == JSON_SAX_ARRAY_END && depth == 3) {
+		reader->poly++;
+	} else if(event == JSON_SAX_ARRAY_END && depth == 2) {
+		tznrpolys[i] = x;
+		reader->country++;
+	}
+	return 0;
+}
+
 static int fillTZData(void) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -91,11 +141,9 @@ static int fillTZData(void) {
 		}
 		return EXIT_SUCCESS;
 	}
-	char *content = NULL;
-	JsonNode *root = NULL;
+	struct tzreader_t reader;
+	JsonError error;
 	FILE *fp;
-	size_t bytes;
-	struct stat st;
 
 	char tzdatafile[] = TZDATA_FILE;
 	/* Read JSON tzdata file */
@@ -104,73 +152,18 @@ static int fillTZData(void) {
 		return EXIT_FAILURE;
 	}
 
-	fstat(fileno(fp), &st);
-	bytes = (size_t)st.st_size;
-
-	if((content = calloc(bytes+1, sizeof(char))) == NULL) {
-		fprintf(stderr, "out of memory\n");
+	/* The coordinates are stored as soon as they are read,
+	   there is no need for the whole file or tree in memory */
+	logprintf(LOG_DEBUG, "loading timezone database...");
+	memset(&reader, 0, sizeof(struct tzreader_t));
+	if(json_sax_read(fp, tzdata_event, &reader, &error) != 0) {
+		logprintf(LOG_ERR, "tzdata is not in a valid json format: %s at byte %d", error.reason, (int)error.offset);
 		fclose(fp);
 		fillingtzdata = 0;
-		exit(EXIT_FAILURE);
-	}
-
-	if(fread(content, sizeof(char), bytes, fp) == -1) {
-		logprintf(LOG_ERR, "cannot read tzdata file: %s", tzdatafile);
-	}
-	fclose(fp);
-
-	/* Validate JSON and turn into JSON object */
-	if(json_validate(content) == false) {
-		logprintf(LOG_ERR, "tzdata is not in a valid json format");
-		free(content);
-		fillingtzdata = 0;
 		return EXIT_FAILURE;
 	}
+	fclose(fp);
 
-	logprintf(LOG_DEBUG, "loading timezone database...");
-	root = json_decode(content);
-
-	JsonNode *alist = json_first_child(root);
-	unsigned int i = 0, x = 0, y = 0;
-	while(alist) {
-		JsonNode *country = json_first_child(alist);
-		while(country) {
-			strcpy(tznames[i], country->key);
-			if((tzcoords = realloc(tzcoords, sizeof(int **)*(i+1))) == NULL) {
-				fprintf(stderr, "out of memory\n");
-				exit(EXIT_FAILURE);
-			}
-			tzcoords[i] = NULL;
-			JsonNode *coords = json_first_child(country);
-			x = 0;
-			while(coords) {
-				y = 0;
-				if((tzcoords[i] = realloc(tzcoords[i], sizeof(int *)*(x+1))) == NULL) {
-					fprintf(stderr, "out of memory\n");
-					exit(EXIT_FAILURE);
-				}
-				tzcoords[i][x] = NULL;
-				if((tzcoords[i][x] = malloc(sizeof(int)*2)) == NULL) {
-					fprintf(stderr, "out of memory\n");
-					exit(EXIT_FAILURE);
-				}
-				JsonNode *lonlat = json_first_child(coords);
-				while(lonlat) {
-					tzcoords[i][x][y] = (int)lonlat->number_;
-					y++;
-					lonlat = lonlat->next;
-				}
-				x++;
-				coords = coords->next;
-			}
-			tznrpolys[i] = x;
-			i++;
-			country = country->next;
-		}
-		alist = alist->next;
-	}
-	json_delete(root);
-	free(content);
 	tzdatafilled = 1;
 	fillingtzdata = 0;
 	if(tz_lock_initialized == 1) {
@@ -0,0 +1,188 @@
+/*
+	Copyright (C) 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+	#ifdef __mips__
+		#define __USE_UNIX98
+	#endif
+#endif
+#include <pthread.h>
+
+#include "eventbus.h"
+#include "log.h"
+#include "mem.h"
+
+static struct eventbus_t *eventbus = NULL;
+
+static pthread_mutex_t eventbus_lock;
+static pthread_mutexattr_t eventbus_attr;
+static unsigned short eventbus_init_done = 0;
+
+/* Called by the daemon so in-process modules know they can
+   subscribe directly instead of connecting over TCP */
+void eventbus_init(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	if(eventbus_init_done == 0) {
+		pthread_mutexattr_init(&eventbus_attr);
+		pthread_mutexattr_settype(&eventbus_attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&eventbus_lock, &eventbus_attr);
+		eventbus_init_done = 1;
+	}
+}
+
+int eventbus_running(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	return (eventbus_init_done == 1) ? 0 : -1;
+}
+
+int eventbus_subscribe(const char *name, const char *media, int topics, void (*callback)(struct JsonNode *, char *)) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	if(eventbus_init_done == 0) {
+		return -1;
+	}
+
+	struct eventbus_t *node = MALLOC(sizeof(struct eventbus_t));
+	if(node == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	if((node->name = MALLOC(strlen(name)+1)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(node->name, name);
+	memset(node->media, '\0', sizeof(node->media));
+	strncpy(node->media, media, sizeof(node->media)-1);
+	node->topics = topics;
+	node->callback = callback;
+
+	pthread_mutex_lock(&eventbus_lock);
+	node->next = eventbus;
+	eventbus = node;
+	pthread_mutex_unlock(&eventbus_lock);
+
+	logprintf(LOG_DEBUG, "%s subscribed to the eventbus", name);
+
+	return 0;
+}
+
+void eventbus_unsubscribe(const char *name) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct eventbus_t *currP, *prevP;
+
+	if(eventbus_init_done == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&eventbus_lock);
+	prevP = NULL;
+	for(currP = eventbus; currP != NULL; prevP = currP, currP = currP->next) {
+		if(strcmp(currP->name, name) == 0) {
+			if(prevP == NULL) {
+				eventbus = currP->next;
+			} else {
+				prevP->next = currP->next;
+			}
+			FREE(currP->name);
+			FREE(currP);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&eventbus_lock);
+}
+
+/* Check if there is anybody to publish to before the publisher
+   spends time on preparing a message for a specific media */
+int eventbus_subscribed(int topic, const char *media) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct eventbus_t *tmp = NULL;
+	int x = 0;
+
+	if(eventbus_init_done == 0) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&eventbus_lock);
+	tmp = eventbus;
+	while(tmp) {
+		if((tmp->topics & topic) == topic && (media == NULL || strcmp(tmp->media, media) == 0)) {
+			x = 1;
+			break;
+		}
+		tmp = tmp->next;
+	}
+	pthread_mutex_unlock(&eventbus_lock);
+
+	return x;
+}
+
+/* Hand a message to all subscribers of a topic. When media
+   is NULL the message goes to the subscribers of all media */
+int eventbus_publish(int topic, const char *media, struct JsonNode *json, char *message) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct eventbus_t *tmp = NULL;
+	int x = 0;
+
+	if(eventbus_init_done == 0) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&eventbus_lock);
+	tmp = eventbus;
+	while(tmp) {
+		if((tmp->topics & topic) == topic && (media == NULL || strcmp(tmp->media, media) == 0)) {
+			tmp->callback(json, message);
+			x++;
+		}
+		tmp = tmp->next;
+	}
+	pthread_mutex_unlock(&eventbus_lock);
+
+	return x;
+}
+
+int eventbus_gc(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct eventbus_t *tmp = NULL;
+
+	if(eventbus_init_done == 1) {
+		pthread_mutex_lock(&eventbus_lock);
+	}
+	while(eventbus) {
+		tmp = eventbus;
+		eventbus = eventbus->next;
+		FREE(tmp->name);
+		FREE(tmp);
+	}
+	if(eventbus_init_done == 1) {
+		pthread_mutex_unlock(&eventbus_lock);
+	}
+
+	logprintf(LOG_DEBUG, "garbage collected eventbus library");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,49 @@
+/*
+	Copyright (C) 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#ifndef _EVENTBUS_H_
+#define _EVENTBUS_H_
+
+#include "json.h"
+
+/* The kind of broadcasts a subscriber is interested in,
+   these mirror the identify options of socket clients */
+#define EVENTBUS_CORE			1
+#define EVENTBUS_CONFIG		2
+#define EVENTBUS_STATS		4
+#define EVENTBUS_RECEIVER	8
+
+typedef struct eventbus_t {
+	char *name;
+	char media[8];
+	int topics;
+	/* The message and its stringified form are only
+	   valid for the duration of the callback */
+	void (*callback)(struct JsonNode *json, char *message);
+	struct eventbus_t *next;
+} eventbus_t;
+
+void eventbus_init(void);
+int eventbus_running(void);
+int eventbus_subscribe(const char *name, const char *media, int topics, void (*callback)(struct JsonNode *, char *));
+void eventbus_unsubscribe(const char *name);
+int eventbus_subscribed(int topic, const char *media);
+int eventbus_publish(int topic, const char *media, struct JsonNode *json, char *message);
+int eventbus_gc(void);
+
+#endif
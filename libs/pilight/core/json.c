@@ -22,6 +22,7 @@
 */
 
 #include <assert.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -46,6 +47,266 @@ static char *json_strdup(const char *str)
 	return ret;
 }
 
+/* Arena */
+
+#define ARENA_ALIGN			8
+#define ARENA_BLOCK_SIZE	4096
+
+typedef struct JsonArenaBlock
+{
+	struct JsonArenaBlock *next;
+	size_t size;
+	size_t used;
+} JsonArenaBlock;
+
+struct JsonArena
+{
+	JsonArenaBlock *head;
+};
+
+#define arena_header_size() \
+	((sizeof(JsonArenaBlock) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static JsonArenaBlock *arena_block(JsonArena *arena, size_t size)
+{
+	JsonArenaBlock *block = (JsonArenaBlock*) malloc(arena_header_size() + size);
+	if (block == NULL)
+		out_of_memory();
+	block->size = size;
+	block->used = 0;
+	block->next = arena->head;
+	arena->head = block;
+	return block;
+}
+
+static void *arena_alloc(JsonArena *arena, size_t size)
+{
+	JsonArenaBlock *block = arena->head;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if (block == NULL || block->size - block->used < size)
+		block = arena_block(arena, size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+
+	block->used += size;
+	return (char *)block + arena_header_size() + block->used - size;
+}
+
+static char *arena_strdup(JsonArena *arena, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *ret = (char*) arena_alloc(arena, len);
+	memcpy(ret, str, len);
+	return ret;
+}
+
+/* Strings of nodes follow the allocator of the node itself */
+static char *node_strdup(JsonArena *arena, const char *str)
+{
+	if (arena != NULL)
+		return arena_strdup(arena, str);
+	return json_strdup(str);
+}
+
+JsonArena *json_arena_new(size_t size)
+{
+	JsonArena *arena = (JsonArena*) malloc(sizeof(JsonArena));
+	if (arena == NULL)
+		out_of_memory();
+	arena->head = NULL;
+	if (size > 0)
+		arena_block(arena, size);
+	return arena;
+}
+
+void json_arena_free(JsonArena *arena)
+{
+	JsonArenaBlock *block, *next;
+
+	if (arena == NULL)
+		return;
+
+	for (block = arena->head; block != NULL; block = next) {
+		next = block->next;
+		free(block);
+	}
+	free(arena);
+}
+
+/*
+ * Member index
+ *
+ * Looking up a member walks all children of an object. Once an object
+ * holds more than INDEX_THRESHOLD members it gets an open addressing
+ * hash table of its members. The table is built while the members are
+ * added, so a lookup never modifies the tree and several threads can
+ * look up members of the same tree at once. It is kept up to date when
+ * members are added or removed, and dropped with the object. The index
+ * of an object allocated from an arena is allocated from the same arena.
+ * Like the linear walk it always resolves to the first member with a
+ * given key.
+ */
+
+#define INDEX_THRESHOLD		16
+
+struct JsonIndex
+{
+	JsonNode **slots;
+	size_t mask;
+	size_t count;
+	/* Some key is used more than once */
+	bool duplicates;
+	/* The index of an arena object lives in the same arena */
+	JsonArena *arena;
+};
+
+static size_t index_hash(const char *key)
+{
+	size_t hash = 5381;
+	while (*key)
+		hash = ((hash << 5) + hash) + (unsigned char)*key++;
+	return hash;
+}
+
+static JsonNode **index_slot(JsonIndex *index, const char *key)
+{
+	size_t i = index_hash(key) & index->mask;
+
+	while (index->slots[i] != NULL && strcmp(index->slots[i]->key, key) != 0)
+		i = (i + 1) & index->mask;
+	return &index->slots[i];
+}
+
+static void index_resize(JsonIndex *index, size_t size)
+{
+	JsonNode **old = index->slots;
+	size_t i, oldsize = index->mask + 1;
+
+	if (index->arena != NULL) {
+		/* Outgrown slots stay in the arena until it is freed */
+		index->slots = (JsonNode**) arena_alloc(index->arena, size * sizeof(JsonNode*));
+		memset(index->slots, 0, size * sizeof(JsonNode*));
+	} else {
+		index->slots = (JsonNode**) calloc(size, sizeof(JsonNode*));
+		if (index->slots == NULL)
+			out_of_memory();
+	}
+	index->mask = size - 1;
+
+	if (old != NULL) {
+		for (i = 0; i < oldsize; i++) {
+			if (old[i] != NULL)
+				*index_slot(index, old[i]->key) = old[i];
+		}
+		if (index->arena == NULL)
+			free(old);
+	}
+}
+
+/* first is set when the member is the first one carrying its key */
+static void index_add(JsonIndex *index, JsonNode *member, bool first)
+{
+	JsonNode **slot;
+
+	if ((index->count + 1) * 2 > index->mask + 1)
+		index_resize(index, (index->mask + 1) * 2);
+
+	slot = index_slot(index, member->key);
+	if (*slot == NULL) {
+		*slot = member;
+		index->count++;
+	} else {
+		index->duplicates = true;
+		if (first)
+			*slot = member;
+	}
+}
+
+static void index_remove(JsonIndex *index, JsonNode *object, JsonNode *member)
+{
+	JsonNode **slot = index_slot(index, member->key);
+	JsonNode *child;
+	size_t i, j, k;
+
+	if (*slot != member)
+		return;
+
+	/* Another member with the same key takes over */
+	if (index->duplicates) {
+		for (child = object->children.head; child != NULL; child = child->next) {
+			if (child != member && strcmp(child->key, member->key) == 0) {
+				*slot = child;
+				return;
+			}
+		}
+	}
+
+	/* Shift back the members that probed past this slot */
+	i = (size_t)(slot - index->slots);
+	index->slots[i] = NULL;
+	index->count--;
+	for (j = (i + 1) & index->mask; index->slots[j] != NULL; j = (j + 1) & index->mask) {
+		k = index_hash(index->slots[j]->key) & index->mask;
+		if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+			index->slots[i] = index->slots[j];
+			index->slots[j] = NULL;
+			i = j;
+		}
+	}
+}
+
+static void index_build(JsonNode *object)
+{
+	JsonIndex *index;
+	JsonNode *child;
+	size_t count = 0, size = 64;
+
+	if (object->arena != NULL) {
+		index = (JsonIndex*) arena_alloc(object->arena, sizeof(JsonIndex));
+	} else if ((index = (JsonIndex*) malloc(sizeof(JsonIndex))) == NULL) {
+		out_of_memory();
+	}
+	index->arena = object->arena;
+	index->slots = NULL;
+	index->mask = 0;
+	index->count = 0;
+	index->duplicates = false;
+
+	for (child = object->children.head; child != NULL; child = child->next)
+		count++;
+	while (size < count * 2)
+		size *= 2;
+	index_resize(index, size);
+
+	for (child = object->children.head; child != NULL; child = child->next)
+		index_add(index, child, false);
+
+	object->index_ = index;
+}
+
+static void index_grow(JsonNode *object)
+{
+	JsonNode *child;
+	int count = 0;
+
+	for (child = object->children.head; child != NULL; child = child->next) {
+		if (++count > INDEX_THRESHOLD) {
+			index_build(object);
+			return;
+		}
+	}
+}
+
+static void index_free(JsonNode *object)
+{
+	if (object->index_ != NULL) {
+		if (object->index_->arena == NULL) {
+			free(object->index_->slots);
+			free(object->index_);
+		}
+		object->index_ = NULL;
+	}
+}
+
 /* String buffer */
 
 typedef struct
@@ -53,16 +314,32 @@ typedef struct
 	char *cur;
 	char *end;
 	char *start;
+	/* start is memory of the caller until the buffer has to grow */
+	bool borrowed;
 } SB;
 
-static void sb_init(SB *sb)
+static void sb_init_size(SB *sb, size_t size)
 {
-	sb->start = (char*) malloc(17);
-	memset(sb->start, 0, 17);
+	sb->start = (char*) malloc(size + 1);
 	if (sb->start == NULL)
 		out_of_memory();
+	memset(sb->start, 0, size + 1);
 	sb->cur = sb->start;
-	sb->end = sb->start + 16;
+	sb->end = sb->start + size;
+	sb->borrowed = false;
+}
+
+static void sb_init(SB *sb)
+{
+	sb_init_size(sb, 16);
+}
+
+static void sb_init_buffer(SB *sb, char *buf, size_t size)
+{
+	sb->start = buf;
+	sb->cur = buf;
+	sb->end = buf + size - 1;
+	sb->borrowed = true;
 }
 
 /* sb and need may be evaluated multiple times. */
@@ -76,13 +353,24 @@ static void sb_grow(SB *sb, int need)
 	size_t length = sb->cur - sb->start;
 	size_t alloc = sb->end - sb->start;
 
+	if (alloc == 0)
+		alloc = 16;
 	do {
 		alloc *= 2;
 	} while (alloc < length + need);
 
-	sb->start = (char*) realloc(sb->start, alloc + 1);
-	if (sb->start == NULL)
-		out_of_memory();
+	if (sb->borrowed) {
+		char *start = (char*) malloc(alloc + 1);
+		if (start == NULL)
+			out_of_memory();
+		memcpy(start, sb->start, length);
+		sb->start = start;
+		sb->borrowed = false;
+	} else {
+		sb->start = (char*) realloc(sb->start, alloc + 1);
+		if (sb->start == NULL)
+			out_of_memory();
+	}
 	sb->cur = sb->start + length;
 	sb->end = sb->start + alloc;
 }
@@ -114,7 +402,8 @@ static char *sb_finish(SB *sb)
 
 static void sb_free(SB *sb)
 {
-	free(sb->start);
+	if (!sb->borrowed)
+		free(sb->start);
 }
 
 /*
@@ -331,11 +620,20 @@ static void to_surrogate_pair(uchar_t unicode, uint16_t *uc, uint16_t *lc)
 #define is_space(c) ((c) == '\t' || (c) == '\n' || (c) == '\r' || (c) == ' ')
 #define is_digit(c) ((c) >= '0' && (c) <= '9')
 
-static bool parse_value     (const char **sp, JsonNode        **out);
-static bool parse_string    (const char **sp, char            **out);
+/* State shared by one run of the parser */
+typedef struct
+{
+	JsonArena *arena;
+	const char *json;
+	JsonError *error;
+} JsonParser;
+
+static bool parse_value     (const char **sp, JsonNode        **out, JsonParser *p);
+static bool parse_string    (const char **sp, char            **out, JsonParser *p);
 static bool parse_number    (const char **sp, double           *out, int *decimals);
-static bool parse_array     (const char **sp, JsonNode        **out);
-static bool parse_object    (const char **sp, JsonNode        **out);
+static bool parse_array     (const char **sp, JsonNode        **out, JsonParser *p);
+static bool parse_object    (const char **sp, JsonNode        **out, JsonParser *p);
+static bool parse_fail      (JsonParser *p, const char *s, const char *reason);
 static bool parse_hex16     (const char **sp, uint16_t         *out);
 
 static bool expect_literal  (const char **sp, const char *str);
@@ -345,6 +643,7 @@ static void emit_value              (SB *out, const JsonNode *node);
 static void emit_value_indented     (SB *out, const JsonNode *node, const char *space, int indent_level);
 static void emit_string             (SB *out, const char *str);
 static void emit_number             (SB *out, double num, int decimals);
+static size_t emit_estimate         (const JsonNode *node, const char *space);
 static void emit_array              (SB *out, const JsonNode *array);
 static void emit_array_indented     (SB *out, const JsonNode *array, const char *space, int indent_level);
 static void emit_object             (SB *out, const JsonNode *object);
@@ -352,7 +651,7 @@ static void emit_object_indented    (SB *out, const JsonNode *object, const char
 
 static int write_hex16(char *out, uint16_t val);
 
-static JsonNode *mknode(JsonTag tag);
+static JsonNode *mknode(JsonArena *arena, JsonTag tag);
 static void append_node(JsonNode *parent, JsonNode *child);
 static void prepend_node(JsonNode *parent, JsonNode *child);
 static void append_member(JsonNode *object, char *key, JsonNode *value);
@@ -363,15 +662,40 @@ static bool number_is_valid(const char *num);
 
 JsonNode *json_decode(const char *json)
 {
+	return json_parse(NULL, json, NULL);
+}
+
+JsonNode *json_decode_arena(JsonArena *arena, const char *json)
+{
+	return json_parse(arena, json, NULL);
+}
+
+JsonNode *json_parse(JsonArena *arena, const char *json, JsonError *error)
+{
+	JsonParser p;
 	const char *s = json;
 	JsonNode *ret;
 
+	p.arena = arena;
+	p.json = json;
+	p.error = error;
+	if (error != NULL) {
+		error->offset = 0;
+		error->reason = NULL;
+	}
+
+	if (json == NULL) {
+		parse_fail(&p, json, "no input");
+		return NULL;
+	}
+
 	skip_space(&s);
-	if (!parse_value(&s, &ret))
+	if (!parse_value(&s, &ret, &p))
 		return NULL;
 
 	skip_space(&s);
 	if (*s != 0) {
+		parse_fail(&p, s, "trailing characters after the document");
 		json_delete(ret);
 		return NULL;
 	}
@@ -397,7 +721,7 @@ char *json_encode_string(const char *str)
 char *json_stringify(const JsonNode *node, const char *space)
 {
 	SB sb;
-	sb_init(&sb);
+	sb_init_size(&sb, emit_estimate(node, space));
 
 	if (space != NULL)
 		emit_value_indented(&sb, node, space, 0);
@@ -407,6 +731,31 @@ char *json_stringify(const JsonNode *node, const char *space)
 	return sb_finish(&sb);
 }
 
+size_t json_stringify_to(const JsonNode *node, const char *space, char *buf, size_t size)
+{
+	size_t len;
+	SB sb;
+
+	assert(size > 0);
+	sb_init_buffer(&sb, buf, size);
+
+	if (space != NULL)
+		emit_value_indented(&sb, node, space, 0);
+	else
+		emit_value(&sb, node);
+
+	/* The buffer had to grow, hand back what fits like snprintf */
+	len = (size_t)(sb.cur - sb.start);
+	if (!sb.borrowed) {
+		memcpy(buf, sb.start, len < size ? len : size - 1);
+		buf[len < size ? len : size - 1] = 0;
+		sb_free(&sb);
+	} else {
+		*sb.cur = 0;
+	}
+	return len;
+}
+
 void json_delete(JsonNode *node)
 {
 	if (node != NULL) {
@@ -414,12 +763,14 @@ void json_delete(JsonNode *node)
 
 		switch (node->tag) {
 			case JSON_STRING:
-				free(node->string_);
+				if (node->arena == NULL)
+					free(node->string_);
 				break;
 			case JSON_ARRAY:
 			case JSON_OBJECT:
 			{
 				JsonNode *child, *next;
+				index_free(node);
 				for (child = node->children.head; child != NULL; child = next) {
 					next = child->next;
 					json_delete(child);
@@ -429,16 +780,18 @@ void json_delete(JsonNode *node)
 			default:;
 		}
 
-		free(node);
+		if (node->arena == NULL)
+			free(node);
 	}
 }
 
 bool json_validate(const char *json)
 {
+	JsonParser p = { NULL, json, NULL };
 	const char *s = json;
 
 	skip_space(&s);
-	if (!parse_value(&s, NULL))
+	if (!parse_value(&s, NULL, &p))
 		return false;
 
 	skip_space(&s);
@@ -472,9 +825,13 @@ JsonNode *json_find_member(JsonNode *object, const char *name)
 	if (object == NULL || object->tag != JSON_OBJECT)
 		return NULL;
 
-	json_foreach(member, object)
+	if (object->index_ != NULL)
+		return *index_slot(object->index_, name);
+
+	json_foreach(member, object) {
 		if (strcmp(member->key, name) == 0)
 			return member;
+	}
 
 	return NULL;
 }
@@ -486,42 +843,70 @@ JsonNode *json_first_child(const JsonNode *node)
 	return NULL;
 }
 
-static JsonNode *mknode(JsonTag tag)
+static JsonNode *mknode(JsonArena *arena, JsonTag tag)
 {
-	JsonNode *ret = (JsonNode*) calloc(1, sizeof(JsonNode));
-	if (ret == NULL)
-		out_of_memory();
+	JsonNode *ret;
+
+	if (arena != NULL) {
+		ret = (JsonNode*) arena_alloc(arena, sizeof(JsonNode));
+		memset(ret, 0, sizeof(JsonNode));
+		ret->arena = arena;
+	} else {
+		ret = (JsonNode*) calloc(1, sizeof(JsonNode));
+		if (ret == NULL)
+			out_of_memory();
+	}
 	ret->tag = tag;
 	return ret;
 }
 
 JsonNode *json_mknull(void)
 {
-	return mknode(JSON_NULL);
+	return mknode(NULL, JSON_NULL);
+}
+
+JsonNode *json_mknull_in(JsonArena *arena)
+{
+	return mknode(arena, JSON_NULL);
 }
 
 JsonNode *json_mkbool(bool b)
 {
-	JsonNode *ret = mknode(JSON_BOOL);
+	return json_mkbool_in(NULL, b);
+}
+
+JsonNode *json_mkbool_in(JsonArena *arena, bool b)
+{
+	JsonNode *ret = mknode(arena, JSON_BOOL);
 	ret->bool_ = b;
 	return ret;
 }
 
-static JsonNode *mkstring(char *s)
+static JsonNode *mkstring(JsonArena *arena, char *s)
 {
-	JsonNode *ret = mknode(JSON_STRING);
+	JsonNode *ret = mknode(arena, JSON_STRING);
 	ret->string_ = s;
 	return ret;
 }
 
 JsonNode *json_mkstring(const char *s)
 {
-	return mkstring(json_strdup(s));
+	return mkstring(NULL, json_strdup(s));
+}
+
+JsonNode *json_mkstring_in(JsonArena *arena, const char *s)
+{
+	return mkstring(arena, node_strdup(arena, s));
 }
 
 JsonNode *json_mknumber(double n, int decimals)
 {
-	JsonNode *node = mknode(JSON_NUMBER);
+	return json_mknumber_in(NULL, n, decimals);
+}
+
+JsonNode *json_mknumber_in(JsonArena *arena, double n, int decimals)
+{
+	JsonNode *node = mknode(arena, JSON_NUMBER);
 	node->number_ = n;
 	node->decimals_ = decimals;
 	return node;
@@ -529,12 +914,22 @@ JsonNode *json_mknumber(double n, int decimals)
 
 JsonNode *json_mkarray(void)
 {
-	return mknode(JSON_ARRAY);
+	return mknode(NULL, JSON_ARRAY);
+}
+
+JsonNode *json_mkarray_in(JsonArena *arena)
+{
+	return mknode(arena, JSON_ARRAY);
 }
 
 JsonNode *json_mkobject(void)
 {
-	return mknode(JSON_OBJECT);
+	return mknode(NULL, JSON_OBJECT);
+}
+
+JsonNode *json_mkobject_in(JsonArena *arena)
+{
+	return mknode(arena, JSON_OBJECT);
 }
 
 static void append_node(JsonNode *parent, JsonNode *child)
@@ -567,6 +962,10 @@ static void append_member(JsonNode *object, char *key, JsonNode *value)
 {
 	value->key = key;
 	append_node(object, value);
+	if (object->index_ != NULL)
+		index_add(object->index_, value, false);
+	else
+		index_grow(object);
 }
 
 void json_append_element(JsonNode *array, JsonNode *element)
@@ -590,7 +989,7 @@ void json_append_member(JsonNode *object, const char *key, JsonNode *value)
 	assert(object->tag == JSON_OBJECT);
 	assert(value->parent == NULL);
 
-	append_member(object, json_strdup(key), value);
+	append_member(object, node_strdup(value->arena, key), value);
 }
 
 void json_prepend_member(JsonNode *object, const char *key, JsonNode *value)
@@ -598,8 +997,12 @@ void json_prepend_member(JsonNode *object, const char *key, JsonNode *value)
 	assert(object->tag == JSON_OBJECT);
 	assert(value->parent == NULL);
 
-	value->key = json_strdup(key);
+	value->key = node_strdup(value->arena, key);
 	prepend_node(object, value);
+	if (object->index_ != NULL)
+		index_add(object->index_, value, true);
+	else
+		index_grow(object);
 }
 
 void json_remove_from_parent(JsonNode *node)
@@ -607,6 +1010,9 @@ void json_remove_from_parent(JsonNode *node)
 	JsonNode *parent = node->parent;
 
 	if (parent != NULL) {
+		if (parent->index_ != NULL)
+			index_remove(parent->index_, parent, node);
+
 		if (node->prev != NULL)
 			node->prev->next = node->next;
 		else
@@ -616,7 +1022,8 @@ void json_remove_from_parent(JsonNode *node)
 		else
 			parent->children.tail = node->prev;
 
-		free(node->key);
+		if (node->arena == NULL)
+			free(node->key);
 
 		node->parent = NULL;
 		node->prev = node->next = NULL;
@@ -624,7 +1031,7 @@ void json_remove_from_parent(JsonNode *node)
 	}
 }
 
-static bool parse_value(const char **sp, JsonNode **out)
+static bool parse_value(const char **sp, JsonNode **out, JsonParser *p)
 {
 	const char *s = *sp;
 
@@ -632,35 +1039,35 @@ static bool parse_value(const char **sp, JsonNode **out)
 		case 'n':
 			if (expect_literal(&s, "null")) {
 				if (out)
-					*out = json_mknull();
+					*out = json_mknull_in(p->arena);
 				*sp = s;
 				return true;
 			}
-			return false;
+			return parse_fail(p, s, "invalid literal");
 
 		case 'f':
 			if (expect_literal(&s, "false")) {
 				if (out)
-					*out = json_mkbool(false);
+					*out = json_mkbool_in(p->arena, false);
 				*sp = s;
 				return true;
 			}
-			return false;
+			return parse_fail(p, s, "invalid literal");
 
 		case 't':
 			if (expect_literal(&s, "true")) {
 				if (out)
-					*out = json_mkbool(true);
+					*out = json_mkbool_in(p->arena, true);
 				*sp = s;
 				return true;
 			}
-			return false;
+			return parse_fail(p, s, "invalid literal");
 
 		case '"': {
 			char *str;
-			if (parse_string(&s, out ? &str : NULL)) {
+			if (parse_string(&s, out ? &str : NULL, p)) {
 				if (out)
-					*out = mkstring(str);
+					*out = mkstring(p->arena, str);
 				*sp = s;
 				return true;
 			}
@@ -668,14 +1075,14 @@ static bool parse_value(const char **sp, JsonNode **out)
 		}
 
 		case '[':
-			if (parse_array(&s, out)) {
+			if (parse_array(&s, out, p)) {
 				*sp = s;
 				return true;
 			}
 			return false;
 
 		case '{':
-			if (parse_object(&s, out)) {
+			if (parse_object(&s, out, p)) {
 				*sp = s;
 				return true;
 			}
@@ -686,19 +1093,19 @@ static bool parse_value(const char **sp, JsonNode **out)
 			int decimals = 0;
 			if (parse_number(&s, out ? &num : NULL, &decimals)) {
 				if (out)
-					*out = json_mknumber(num, decimals);
+					*out = json_mknumber_in(p->arena, num, decimals);
 				*sp = s;
 				return true;
 			}
-			return false;
+			return parse_fail(p, s, (*s == 0) ? "unexpected end of input" : "unexpected character");
 		}
 	}
 }
 
-static bool parse_array(const char **sp, JsonNode **out)
+static bool parse_array(const char **sp, JsonNode **out, JsonParser *p)
 {
 	const char *s = *sp;
-	JsonNode *ret = out ? json_mkarray() : NULL;
+	JsonNode *ret = out ? json_mkarray_in(p->arena) : NULL;
 	JsonNode *element;
 
 	if (*s++ != '[')
@@ -711,7 +1118,7 @@ static bool parse_array(const char **sp, JsonNode **out)
 	}
 
 	for (;;) {
-		if (!parse_value(&s, out ? &element : NULL))
+		if (!parse_value(&s, out ? &element : NULL, p))
 			goto failure;
 		skip_space(&s);
 
@@ -723,8 +1130,10 @@ static bool parse_array(const char **sp, JsonNode **out)
 			goto success;
 		}
 
-		if (*s++ != ',')
+		if (*s++ != ',') {
+			parse_fail(p, s - 1, "expected ',' or ']'");
 			goto failure;
+		}
 		skip_space(&s);
 	}
 
@@ -739,10 +1148,10 @@ failure:
 	return false;
 }
 
-static bool parse_object(const char **sp, JsonNode **out)
+static bool parse_object(const char **sp, JsonNode **out, JsonParser *p)
 {
 	const char *s = *sp;
-	JsonNode *ret = out ? json_mkobject() : NULL;
+	JsonNode *ret = out ? json_mkobject_in(p->arena) : NULL;
 	char *key;
 	JsonNode *value;
 
@@ -756,15 +1165,19 @@ static bool parse_object(const char **sp, JsonNode **out)
 	}
 
 	for (;;) {
-		if (!parse_string(&s, out ? &key : NULL))
+		if (!parse_string(&s, out ? &key : NULL, p)) {
+			parse_fail(p, s, "expected a string key");
 			goto failure;
+		}
 		skip_space(&s);
 
-		if (*s++ != ':')
+		if (*s++ != ':') {
+			parse_fail(p, s - 1, "expected ':'");
 			goto failure_free_key;
+		}
 		skip_space(&s);
 
-		if (!parse_value(&s, out ? &value : NULL))
+		if (!parse_value(&s, out ? &value : NULL, p))
 			goto failure_free_key;
 		skip_space(&s);
 
@@ -776,8 +1189,10 @@ static bool parse_object(const char **sp, JsonNode **out)
 			goto success;
 		}
 
-		if (*s++ != ',')
+		if (*s++ != ',') {
+			parse_fail(p, s - 1, "expected ',' or '}'");
 			goto failure;
+		}
 		skip_space(&s);
 	}
 
@@ -788,25 +1203,39 @@ success:
 	return true;
 
 failure_free_key:
-	if (out)
+	if (out && p->arena == NULL)
 		free(key);
 failure:
 	json_delete(ret);
 	return false;
 }
 
-bool parse_string(const char **sp, char **out)
+bool parse_string(const char **sp, char **out, JsonParser *p)
 {
 	const char *s = *sp;
 	SB sb;
 	char throwaway_buffer[4];
 		/* enough space for a UTF-8 character */
-	char *b;
+	char *b, *start = NULL;
+	const char *mark = s;
+	const char *reason = NULL;
 
 	if (*s++ != '"')
 		return false;
 
-	if (out) {
+	if (out && p->arena != NULL) {
+		/*
+		 * Unescaping never makes a string longer, so the raw
+		 * literal tells how much room the result needs.
+		 */
+		const char *e = s;
+		while (*e != '"' && *e != 0) {
+			if (*e == '\\' && e[1] != 0)
+				e++;
+			e++;
+		}
+		start = b = (char*) arena_alloc(p->arena, (size_t)(e - s) + 1);
+	} else if (out) {
 		sb_init(&sb);
 		sb_need(&sb, 4);
 		b = sb.cur;
@@ -815,7 +1244,10 @@ bool parse_string(const char **sp, char **out)
 	}
 
 	while (*s != '"') {
-		unsigned char c = *s++;
+		unsigned char c;
+
+		mark = s;
+		c = *s++;
 
 		/* Parse next character, and write it to b. */
 		if (c == '\\') {
@@ -846,17 +1278,24 @@ bool parse_string(const char **sp, char **out)
 					uint16_t uc, lc;
 					uchar_t unicode;
 
-					if (!parse_hex16(&s, &uc))
+					if (!parse_hex16(&s, &uc)) {
+						reason = "invalid unicode escape";
 						goto failed;
+					}
 
 					if (uc >= 0xD800 && uc <= 0xDFFF) {
 						/* Handle UTF-16 surrogate pair. */
-						if (*s++ != '\\' || *s++ != 'u' || !parse_hex16(&s, &lc))
-							goto failed; /* Incomplete surrogate pair. */
-						if (!from_surrogate_pair(uc, lc, &unicode))
-							goto failed; /* Invalid surrogate pair. */
+						if (*s++ != '\\' || *s++ != 'u' || !parse_hex16(&s, &lc)) {
+							reason = "incomplete surrogate pair";
+							goto failed;
+						}
+						if (!from_surrogate_pair(uc, lc, &unicode)) {
+							reason = "invalid surrogate pair";
+							goto failed;
+						}
 					} else if (uc == 0) {
 						/* Disallow "\u0000". */
+						reason = "\\u0000 is not allowed";
 						goto failed;
 					} else {
 						unicode = uc;
@@ -866,11 +1305,15 @@ bool parse_string(const char **sp, char **out)
 					break;
 				}
 				default:
-					/* Invalid escape */
+					reason = "invalid escape";
 					goto failed;
 			}
+		} else if (c == 0) {
+			reason = "unterminated string";
+			goto failed;
 		} else if (c <= 0x1F) {
 			/* Control characters are not allowed in string literals. */
+			reason = "control character in string";
 			goto failed;
 		} else {
 			/* Validate and echo a UTF-8 character. */
@@ -878,8 +1321,10 @@ bool parse_string(const char **sp, char **out)
 
 			s--;
 			len = utf8_validate_cz(s);
-			if (len == 0)
-				goto failed; /* Invalid UTF-8 character. */
+			if (len == 0) {
+				reason = "invalid UTF-8";
+				goto failed;
+			}
 
 			while (len--)
 				*b++ = *s++;
@@ -889,7 +1334,9 @@ bool parse_string(const char **sp, char **out)
 		 * Update sb to know about the new bytes,
 		 * and set up b to write another character.
 		 */
-		if (out) {
+		if (out && p->arena != NULL) {
+			/* b already points past the new bytes */
+		} else if (out) {
 			sb.cur = b;
 			sb_need(&sb, 4);
 			b = sb.cur;
@@ -899,15 +1346,19 @@ bool parse_string(const char **sp, char **out)
 	}
 	s++;
 
-	if (out)
+	if (out && p->arena != NULL) {
+		*b = 0;
+		*out = start;
+	} else if (out) {
 		*out = sb_finish(&sb);
+	}
 	*sp = s;
 	return true;
 
 failed:
-	if (out)
+	if (out && p->arena == NULL)
 		sb_free(&sb);
-	return false;
+	return parse_fail(p, mark, reason);
 }
 
 /*
@@ -974,6 +1425,16 @@ bool parse_number(const char **sp, double *out, int *decimals)
 	return true;
 }
 
+/* Remember the first, innermost, reason the parse failed */
+static bool parse_fail(JsonParser *p, const char *s, const char *reason)
+{
+	if (p->error != NULL && p->error->reason == NULL) {
+		p->error->offset = (s != NULL) ? (size_t)(s - p->json) : 0;
+		p->error->reason = reason;
+	}
+	return false;
+}
+
 static void skip_space(const char **sp)
 {
 	const char *s = *sp;
@@ -1146,6 +1607,25 @@ void emit_string(SB *out, const char *str)
 
 	assert(utf8_validate(str));
 
+	/*
+	 * Most strings need no escaping at all. Those are copied in one
+	 * go and only take the space they need, so a buffer sized from
+	 * emit_estimate doesn't have to grow for them.
+	 */
+	while (*s != 0 && (unsigned char)*s >= 0x20 && (unsigned char)*s < 0x80 && *s != '"' && *s != '\\')
+		s++;
+	if (*s == 0) {
+		sb_need(out, (int)(s - str) + 2);
+		b = out->cur;
+		*b++ = '"';
+		memcpy(b, str, (size_t)(s - str));
+		b += s - str;
+		*b++ = '"';
+		out->cur = b;
+		return;
+	}
+	s = str;
+
 	/*
 	 * 14 bytes is enough space to write up to two
 	 * \uXXXX escapes and two quotation marks.
@@ -1257,6 +1737,54 @@ void emit_string(SB *out, const char *str)
 	out->cur = b;
 }
 
+static const double pow10_table[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+
+/*
+ * Formats the number the way "%.*f" does for the values sensors
+ * and devices use. The scaled value stays below 1e9 so it is exact
+ * to well within 1e-6, only values that are about halfway between
+ * two outputs are left to sprintf for its round-half-even.
+ */
+static bool emit_number_fast(SB *out, double num, int decimals)
+{
+	char buf[24], *b = buf + sizeof(buf);
+	double scaled, frac;
+	uint32_t value;
+	int i;
+
+	if (decimals < 0 || decimals > 9)
+		return false;
+
+	scaled = fabs(num) * pow10_table[decimals];
+	if (!(scaled < 1e9))
+		return false;
+
+	value = (uint32_t)scaled;
+	frac = scaled - value;
+	if (frac > 0.5 - 1e-6 && frac < 0.5 + 1e-6)
+		return false;
+	if (frac > 0.5)
+		value++;
+
+	for (i = 0; i < decimals; i++) {
+		*--b = '0' + (value % 10);
+		value /= 10;
+	}
+	if (decimals > 0)
+		*--b = '.';
+	do {
+		*--b = '0' + (value % 10);
+		value /= 10;
+	} while (value > 0);
+	if (signbit(num))
+		*--b = '-';
+
+	sb_put(out, b, (int)(buf + sizeof(buf) - b));
+	return true;
+}
+
 static void emit_number(SB *out, double num, int decimals)
 {
 	/*
@@ -1266,7 +1794,19 @@ static void emit_number(SB *out, double num, int decimals)
 	 * like 0.3 -> 0.299999999999999988898 .
 	 */
 	char buf[64];
-	sprintf(buf, "%.*f", decimals, num);
+	int len;
+
+	if (emit_number_fast(out, num, decimals))
+		return;
+
+	/* Huge numbers or many decimals are written in the output directly */
+	len = snprintf(buf, sizeof(buf), "%.*f", decimals, num);
+	if (len >= (int)sizeof(buf)) {
+		sb_need(out, len + 1);
+		snprintf(out->cur, len + 1, "%.*f", decimals, num);
+		out->cur += len;
+		return;
+	}
 
 	if (number_is_valid(buf))
 		sb_puts(out, buf);
@@ -1274,6 +1814,40 @@ static void emit_number(SB *out, double num, int decimals)
 		sb_puts(out, "null");
 }
 
+/*
+ * A cheap guess of the output size so the buffer doesn't have to grow
+ * while emitting. Escapes and indentation may still make it grow.
+ */
+static size_t emit_estimate(const JsonNode *node, const char *space)
+{
+	const JsonNode *child;
+	size_t size = 0;
+
+	switch (node->tag) {
+		case JSON_STRING:
+			size = strlen(node->string_) + 2;
+			break;
+		case JSON_NUMBER:
+			size = 8 + (node->decimals_ > 0 ? node->decimals_ : 0);
+			break;
+		case JSON_ARRAY:
+		case JSON_OBJECT:
+			size = 2;
+			for (child = node->children.head; child != NULL; child = child->next) {
+				size += emit_estimate(child, space) + 1;
+				if (node->tag == JSON_OBJECT)
+					size += strlen(child->key) + 3;
+				if (space != NULL)
+					size += 8;
+			}
+			break;
+		default:
+			size = 5;
+			break;
+	}
+	return size;
+}
+
 static bool tag_is_valid(unsigned int tag)
 {
 	return (/* tag >= JSON_NULL && */ tag <= JSON_OBJECT);
@@ -1408,6 +1982,43 @@ bool json_check(const JsonNode *node, char errmsg[256])
 			if (last != tail)
 				problem("tail does not match pointer found by starting at head and following next links");
 		}
+
+		/* Lookups rely on large objects having their index already */
+		if (node->tag == JSON_OBJECT && node->index_ == NULL) {
+			JsonNode *child;
+			int count = 0;
+
+			for (child = node->children.head; child != NULL; child = child->next)
+				count++;
+			if (count > INDEX_THRESHOLD)
+				problem("Object of %d members has no member index", count);
+		}
+
+		/* The member index has to agree with a plain walk */
+		if (node->index_ != NULL) {
+			JsonIndex *index = node->index_;
+			JsonNode *child, *first;
+			size_t i, count = 0;
+
+			if (node->tag != JSON_OBJECT)
+				problem("Array has a member index");
+
+			for (i = 0; i <= index->mask; i++) {
+				if (index->slots[i] == NULL)
+					continue;
+				if (index->slots[i]->parent != node)
+					problem("Member index points to a node of another parent");
+				count++;
+			}
+			if (count != index->count)
+				problem("Member index counts %zu keys, but holds %zu", index->count, count);
+
+			for (child = node->children.head; child != NULL; child = child->next) {
+				for (first = node->children.head; strcmp(first->key, child->key) != 0; first = first->next);
+				if (*index_slot(index, child->key) != first)
+					problem("Member index does not resolve \"%s\" to its first member", child->key);
+			}
+		}
 	}
 
 	return true;
@@ -1415,6 +2026,686 @@ bool json_check(const JsonNode *node, char errmsg[256])
 	#undef problem
 }
 
+/*
+ * MessagePack encoding
+ *
+ * A compact binary form of the same document model. Numbers that carry
+ * decimals are written as extension type 1 (one byte of decimals followed
+ * by a big-endian IEEE double) so a round trip keeps their formatting.
+ */
+
+#define MSGPACK_EXT_DECIMAL 1
+
+static void mp_put_be(SB *out, uint64_t val, int bytes)
+{
+	int i;
+
+	sb_need(out, bytes);
+	for (i = bytes - 1; i >= 0; i--)
+		*out->cur++ = (char)((val >> (i * 8)) & 0xFF);
+}
+
+static void mp_put_double(SB *out, double num)
+{
+	uint64_t bits;
+
+	memcpy(&bits, &num, sizeof(bits));
+	mp_put_be(out, bits, 8);
+}
+
+static void mp_put_length(SB *out, size_t len, unsigned char fix, int fixmax, unsigned char base)
+{
+	if (fixmax > 0 && len <= (size_t)fixmax) {
+		sb_putc(out, (char)(fix | len));
+	} else if (base == 0xd9 && len <= 0xFF) {
+		sb_putc(out, (char)base);
+		mp_put_be(out, len, 1);
+	} else if (len <= 0xFFFF) {
+		sb_putc(out, (char)(base == 0xd9 ? 0xda : base));
+		mp_put_be(out, len, 2);
+	} else {
+		sb_putc(out, (char)(base == 0xd9 ? 0xdb : base + 1));
+		mp_put_be(out, len, 4);
+	}
+}
+
+static void mp_put_string(SB *out, const char *str)
+{
+	size_t len = strlen(str);
+
+	mp_put_length(out, len, 0xa0, 31, 0xd9);
+	sb_put(out, str, (int)len);
+}
+
+static void mp_put_number(SB *out, double num, int decimals)
+{
+	if (decimals > 0) {
+		sb_putc(out, (char)0xc7);
+		sb_putc(out, 9);
+		sb_putc(out, MSGPACK_EXT_DECIMAL);
+		sb_putc(out, (char)(decimals > 0xFF ? 0xFF : decimals));
+		mp_put_double(out, num);
+	} else if (num >= 0 && num <= 18446744073709549568.0 && num == (double)(uint64_t)num) {
+		uint64_t val = (uint64_t)num;
+		if (val <= 0x7F) {
+			sb_putc(out, (char)val);
+		} else if (val <= 0xFF) {
+			sb_putc(out, (char)0xcc);
+			mp_put_be(out, val, 1);
+		} else if (val <= 0xFFFF) {
+			sb_putc(out, (char)0xcd);
+			mp_put_be(out, val, 2);
+		} else if (val <= 0xFFFFFFFF) {
+			sb_putc(out, (char)0xce);
+			mp_put_be(out, val, 4);
+		} else {
+			sb_putc(out, (char)0xcf);
+			mp_put_be(out, val, 8);
+		}
+	} else if (num < 0 && num >= -9223372036854775808.0 && num == (double)(int64_t)num) {
+		int64_t val = (int64_t)num;
+		if (val >= -32) {
+			sb_putc(out, (char)(0xe0 | (val + 32)));
+		} else if (val >= -128) {
+			sb_putc(out, (char)0xd0);
+			mp_put_be(out, (uint64_t)val, 1);
+		} else if (val >= -32768) {
+			sb_putc(out, (char)0xd1);
+			mp_put_be(out, (uint64_t)val, 2);
+		} else if (val >= -2147483648LL) {
+			sb_putc(out, (char)0xd2);
+			mp_put_be(out, (uint64_t)val, 4);
+		} else {
+			sb_putc(out, (char)0xd3);
+			mp_put_be(out, (uint64_t)val, 8);
+		}
+	} else {
+		sb_putc(out, (char)0xcb);
+		mp_put_double(out, num);
+	}
+}
+
+static void mp_put_value(SB *out, const JsonNode *node)
+{
+	const JsonNode *child;
+	size_t count = 0;
+
+	switch (node->tag) {
+		case JSON_NULL:
+			sb_putc(out, (char)0xc0);
+			break;
+		case JSON_BOOL:
+			sb_putc(out, (char)(node->bool_ ? 0xc3 : 0xc2));
+			break;
+		case JSON_STRING:
+			mp_put_string(out, node->string_);
+			break;
+		case JSON_NUMBER:
+			mp_put_number(out, node->number_, node->decimals_);
+			break;
+		case JSON_ARRAY:
+		case JSON_OBJECT:
+			for (child = node->children.head; child != NULL; child = child->next)
+				count++;
+			if (node->tag == JSON_ARRAY)
+				mp_put_length(out, count, 0x90, 15, 0xdc);
+			else
+				mp_put_length(out, count, 0x80, 15, 0xde);
+			for (child = node->children.head; child != NULL; child = child->next) {
+				if (node->tag == JSON_OBJECT)
+					mp_put_string(out, child->key);
+				mp_put_value(out, child);
+			}
+			break;
+		default:
+			assert(false);
+	}
+}
+
+char *json_encode_msgpack(const JsonNode *node, size_t *len)
+{
+	SB sb;
+	sb_init(&sb);
+
+	mp_put_value(&sb, node);
+
+	*len = (size_t)(sb.cur - sb.start);
+	*sb.cur = 0;
+	return sb.start;
+}
+
+static bool mp_get_be(const unsigned char **sp, const unsigned char *end, int bytes, uint64_t *out)
+{
+	const unsigned char *s = *sp;
+	uint64_t val = 0;
+	int i;
+
+	if (end - s < bytes)
+		return false;
+	for (i = 0; i < bytes; i++)
+		val = (val << 8) | s[i];
+
+	*sp = s + bytes;
+	*out = val;
+	return true;
+}
+
+static bool mp_get_double(const unsigned char **sp, const unsigned char *end, double *out)
+{
+	uint64_t bits;
+
+	if (!mp_get_be(sp, end, 8, &bits))
+		return false;
+	memcpy(out, &bits, sizeof(bits));
+	return true;
+}
+
+static bool mp_get_string(const unsigned char **sp, const unsigned char *end, size_t len, char **out)
+{
+	const unsigned char *s = *sp;
+	char *str;
+
+	if ((size_t)(end - s) < len || memchr(s, 0, len) != NULL)
+		return false;
+
+	str = (char*) malloc(len + 1);
+	if (str == NULL)
+		out_of_memory();
+	memcpy(str, s, len);
+	str[len] = 0;
+
+	if (!utf8_validate(str)) {
+		free(str);
+		return false;
+	}
+
+	*sp = s + len;
+	*out = str;
+	return true;
+}
+
+static bool mp_get_value(const unsigned char **sp, const unsigned char *end, JsonNode **out);
+
+static bool mp_get_container(const unsigned char **sp, const unsigned char *end, size_t count, bool object, JsonNode **out)
+{
+	JsonNode *ret = object ? json_mkobject() : json_mkarray();
+	JsonNode *value;
+	char *key;
+	uint64_t len;
+	unsigned char c;
+
+	while (count-- > 0) {
+		key = NULL;
+		if (object) {
+			if (*sp >= end)
+				goto failure;
+			c = *(*sp)++;
+			if ((c & 0xe0) == 0xa0)
+				len = c & 0x1f;
+			else if (c == 0xd9 && mp_get_be(sp, end, 1, &len))
+				;
+			else if (c == 0xda && mp_get_be(sp, end, 2, &len))
+				;
+			else if (c == 0xdb && mp_get_be(sp, end, 4, &len))
+				;
+			else
+				goto failure;
+			if (!mp_get_string(sp, end, (size_t)len, &key))
+				goto failure;
+		}
+		if (!mp_get_value(sp, end, &value)) {
+			free(key);
+			goto failure;
+		}
+		if (object)
+			append_member(ret, key, value);
+		else
+			append_node(ret, value);
+	}
+
+	*out = ret;
+	return true;
+
+failure:
+	json_delete(ret);
+	return false;
+}
+
+static bool mp_get_value(const unsigned char **sp, const unsigned char *end, JsonNode **out)
+{
+	const unsigned char *s = *sp;
+	unsigned char c;
+	uint64_t val = 0;
+	double num = 0;
+	char *str = NULL;
+	bool ok = false;
+
+	if (s >= end)
+		return false;
+	c = *s++;
+
+	if (c <= 0x7f) {
+		*out = json_mknumber(c, 0);
+		ok = true;
+	} else if (c >= 0xe0) {
+		*out = json_mknumber((signed char)c, 0);
+		ok = true;
+	} else if ((c & 0xf0) == 0x80) {
+		ok = mp_get_container(&s, end, c & 0x0f, true, out);
+	} else if ((c & 0xf0) == 0x90) {
+		ok = mp_get_container(&s, end, c & 0x0f, false, out);
+	} else if ((c & 0xe0) == 0xa0) {
+		if ((ok = mp_get_string(&s, end, c & 0x1f, &str)))
+			*out = mkstring(NULL, str);
+	} else {
+		switch (c) {
+			case 0xc0:
+				*out = json_mknull();
+				ok = true;
+				break;
+			case 0xc2:
+			case 0xc3:
+				*out = json_mkbool(c == 0xc3);
+				ok = true;
+				break;
+			case 0xca:
+				if ((ok = mp_get_be(&s, end, 4, &val))) {
+					uint32_t bits = (uint32_t)val;
+					float f;
+					memcpy(&f, &bits, sizeof(f));
+					*out = json_mknumber(f, 0);
+				}
+				break;
+			case 0xcb:
+				if ((ok = mp_get_double(&s, end, &num)))
+					*out = json_mknumber(num, 0);
+				break;
+			case 0xcc:
+			case 0xcd:
+			case 0xce:
+			case 0xcf:
+				if ((ok = mp_get_be(&s, end, 1 << (c - 0xcc), &val)))
+					*out = json_mknumber((double)val, 0);
+				break;
+			case 0xd0:
+				if ((ok = mp_get_be(&s, end, 1, &val)))
+					*out = json_mknumber((int8_t)val, 0);
+				break;
+			case 0xd1:
+				if ((ok = mp_get_be(&s, end, 2, &val)))
+					*out = json_mknumber((int16_t)val, 0);
+				break;
+			case 0xd2:
+				if ((ok = mp_get_be(&s, end, 4, &val)))
+					*out = json_mknumber((int32_t)val, 0);
+				break;
+			case 0xd3:
+				if ((ok = mp_get_be(&s, end, 8, &val)))
+					*out = json_mknumber((double)(int64_t)val, 0);
+				break;
+			case 0xc7:
+				if (end - s >= 3 && s[0] == 9 && s[1] == MSGPACK_EXT_DECIMAL) {
+					int decimals = s[2];
+					s += 3;
+					if ((ok = mp_get_double(&s, end, &num)))
+						*out = json_mknumber(num, decimals);
+				}
+				break;
+			case 0xd9:
+			case 0xda:
+			case 0xdb:
+				if (mp_get_be(&s, end, 1 << (c - 0xd9), &val) &&
+				    (ok = mp_get_string(&s, end, (size_t)val, &str)))
+					*out = mkstring(NULL, str);
+				break;
+			case 0xdc:
+			case 0xdd:
+				if (mp_get_be(&s, end, c == 0xdc ? 2 : 4, &val))
+					ok = mp_get_container(&s, end, (size_t)val, false, out);
+				break;
+			case 0xde:
+			case 0xdf:
+				if (mp_get_be(&s, end, c == 0xde ? 2 : 4, &val))
+					ok = mp_get_container(&s, end, (size_t)val, true, out);
+				break;
+			default:
+				/* bin, ext and reserved types have no JSON equivalent */
+				break;
+		}
+	}
+
+	if (ok)
+		*sp = s;
+	return ok;
+}
+
+JsonNode *json_decode_msgpack(const char *buf, size_t len)
+{
+	const unsigned char *s = (const unsigned char *)buf;
+	const unsigned char *end = s + len;
+	JsonNode *ret;
+
+	if (!mp_get_value(&s, end, &ret))
+		return NULL;
+
+	if (s != end) {
+		json_delete(ret);
+		return NULL;
+	}
+
+	return ret;
+}
+
+/*
+ * Streaming reader
+ *
+ * Reads a document from a file in small chunks and reports it as a
+ * sequence of events instead of building a tree, so loaders can fill
+ * their own structures without holding the text or a JsonNode tree in
+ * memory. Scalars are passed as a JsonNode on the stack, keys and
+ * strings are only valid during the callback.
+ */
+
+#define SAX_BUFFER_SIZE		4096
+#define SAX_NUMBER_SIZE		64
+
+typedef struct
+{
+	FILE *fp;
+	char buffer[SAX_BUFFER_SIZE];
+	size_t pos;
+	size_t len;
+	/* Bytes of the file before buffer[0] */
+	size_t offset;
+	JsonSaxCallback callback;
+	void *userdata;
+	JsonError *error;
+} SaxReader;
+
+static int sax_peek(SaxReader *r)
+{
+	if (r->pos >= r->len) {
+		r->offset += r->len;
+		r->pos = 0;
+		r->len = fread(r->buffer, 1, SAX_BUFFER_SIZE, r->fp);
+		if (r->len == 0)
+			return EOF;
+	}
+	return (unsigned char)r->buffer[r->pos];
+}
+
+static int sax_next(SaxReader *r)
+{
+	int c = sax_peek(r);
+	if (c != EOF)
+		r->pos++;
+	return c;
+}
+
+static void sax_skip_space(SaxReader *r)
+{
+	int c;
+	while ((c = sax_peek(r)) == '\t' || c == '\n' || c == '\r' || c == ' ')
+		r->pos++;
+}
+
+static bool sax_fail(SaxReader *r, size_t offset, const char *reason)
+{
+	if (r->error != NULL && r->error->reason == NULL) {
+		r->error->offset = offset;
+		r->error->reason = reason;
+	}
+	return false;
+}
+
+static bool sax_emit(SaxReader *r, JsonSaxEvent event, const char *key, const JsonNode *value, int depth)
+{
+	if (r->callback(r->userdata, event, key, value, depth) != 0)
+		return sax_fail(r, r->offset + r->pos, "aborted by the reader");
+	return true;
+}
+
+/* Collect the raw literal and let parse_string do the unescaping */
+static bool sax_string(SaxReader *r, char **out)
+{
+	JsonParser p;
+	JsonError error;
+	size_t start = r->offset + r->pos;
+	const char *s;
+	char *raw;
+	bool ret;
+	int c;
+	SB sb;
+
+	sb_init(&sb);
+	sb_put(&sb, "\"", 1);
+	r->pos++;
+	for (;;) {
+		c = sax_next(r);
+		if (c == EOF) {
+			sb_free(&sb);
+			return sax_fail(r, r->offset + r->pos, "unterminated string");
+		}
+		sb_need(&sb, 2);
+		*sb.cur++ = (char)c;
+		if (c == '"')
+			break;
+		if (c == '\\' && (c = sax_next(r)) != EOF)
+			*sb.cur++ = (char)c;
+	}
+	raw = sb_finish(&sb);
+
+	p.arena = NULL;
+	p.json = raw;
+	p.error = &error;
+	error.reason = NULL;
+	s = raw;
+	if (!(ret = parse_string(&s, out, &p)))
+		sax_fail(r, start + error.offset, error.reason);
+	free(raw);
+	return ret;
+}
+
+static bool sax_scalar(SaxReader *r, const char *key, int depth)
+{
+	char token[SAX_NUMBER_SIZE];
+	size_t start = r->offset + r->pos;
+	const char *s = token;
+	JsonNode node;
+	int c, n = 0;
+
+	while ((c = sax_peek(r)) != EOF && n < SAX_NUMBER_SIZE - 1 &&
+	       ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '-' || c == '+' || c == '.' || c == 'E')) {
+		token[n++] = (char)c;
+		r->pos++;
+	}
+	token[n] = 0;
+
+	memset(&node, 0, sizeof(JsonNode));
+	if (strcmp(token, "null") == 0) {
+		node.tag = JSON_NULL;
+	} else if (strcmp(token, "true") == 0 || strcmp(token, "false") == 0) {
+		node.tag = JSON_BOOL;
+		node.bool_ = (token[0] == 't');
+	} else if (parse_number(&s, &node.number_, &node.decimals_) && *s == 0) {
+		node.tag = JSON_NUMBER;
+	} else {
+		return sax_fail(r, start, (n == 0 && c == EOF) ? "unexpected end of input" : "unexpected character");
+	}
+	return sax_emit(r, JSON_SAX_VALUE, key, &node, depth);
+}
+
+static bool sax_value(SaxReader *r, const char *key, int depth)
+{
+	JsonNode node;
+	char *str = NULL;
+	bool ret;
+
+	sax_skip_space(r);
+	switch (sax_peek(r)) {
+		case '"':
+			if (!sax_string(r, &str))
+				return false;
+			memset(&node, 0, sizeof(JsonNode));
+			node.tag = JSON_STRING;
+			node.string_ = str;
+			ret = sax_emit(r, JSON_SAX_VALUE, key, &node, depth);
+			free(str);
+			return ret;
+
+		case '[':
+			r->pos++;
+			if (!sax_emit(r, JSON_SAX_ARRAY_START, key, NULL, depth))
+				return false;
+			sax_skip_space(r);
+			if (sax_peek(r) != ']') {
+				for (;;) {
+					if (!sax_value(r, NULL, depth + 1))
+						return false;
+					sax_skip_space(r);
+					if (sax_peek(r) == ']')
+						break;
+					if (sax_next(r) != ',')
+						return sax_fail(r, r->offset + r->pos - 1, "expected ',' or ']'");
+				}
+			}
+			r->pos++;
+			return sax_emit(r, JSON_SAX_ARRAY_END, key, NULL, depth);
+
+		case '{':
+			r->pos++;
+			if (!sax_emit(r, JSON_SAX_OBJECT_START, key, NULL, depth))
+				return false;
+			sax_skip_space(r);
+			if (sax_peek(r) != '}') {
+				for (;;) {
+					sax_skip_space(r);
+					if (sax_peek(r) != '"')
+						return sax_fail(r, r->offset + r->pos, "expected a string key");
+					if (!sax_string(r, &str))
+						return false;
+					sax_skip_space(r);
+					if (sax_next(r) != ':') {
+						free(str);
+						return sax_fail(r, r->offset + r->pos - 1, "expected ':'");
+					}
+					ret = sax_value(r, str, depth + 1);
+					free(str);
+					if (!ret)
+						return false;
+					sax_skip_space(r);
+					if (sax_peek(r) == '}')
+						break;
+					if (sax_next(r) != ',')
+						return sax_fail(r, r->offset + r->pos - 1, "expected ',' or '}'");
+				}
+			}
+			r->pos++;
+			return sax_emit(r, JSON_SAX_OBJECT_END, key, NULL, depth);
+
+		default:
+			return sax_scalar(r, key, depth);
+	}
+}
+
+int json_sax_read(FILE *fp, JsonSaxCallback callback, void *userdata, JsonError *error)
+{
+	SaxReader *r = (SaxReader*) malloc(sizeof(SaxReader));
+	int ret = 0;
+
+	if (r == NULL)
+		out_of_memory();
+	r->fp = fp;
+	r->pos = 0;
+	r->len = 0;
+	r->offset = 0;
+	r->callback = callback;
+	r->userdata = userdata;
+	r->error = error;
+	if (error != NULL) {
+		error->offset = 0;
+		error->reason = NULL;
+	}
+
+	if (!sax_value(r, NULL, 0)) {
+		ret = -1;
+	} else {
+		sax_skip_space(r);
+		if (sax_peek(r) != EOF) {
+			sax_fail(r, r->offset + r->pos, "trailing characters after the document");
+			ret = -1;
+		}
+	}
+
+	free(r);
+	return ret;
+}
+
+/* Tree builder on top of the streaming reader */
+typedef struct
+{
+	JsonNode *root;
+	JsonNode *current;
+} SaxTree;
+
+static void sax_tree_add(SaxTree *t, const char *key, JsonNode *node)
+{
+	if (t->current == NULL)
+		t->root = node;
+	else if (t->current->tag == JSON_OBJECT)
+		json_append_member(t->current, key, node);
+	else
+		json_append_element(t->current, node);
+}
+
+static int sax_tree(void *userdata, JsonSaxEvent event, const char *key, const JsonNode *value, int depth)
+{
+	SaxTree *t = (SaxTree*) userdata;
+	JsonNode *node = NULL;
+
+	switch (event) {
+		case JSON_SAX_OBJECT_START:
+		case JSON_SAX_ARRAY_START:
+			node = (event == JSON_SAX_OBJECT_START) ? json_mkobject() : json_mkarray();
+			sax_tree_add(t, key, node);
+			t->current = node;
+			break;
+		case JSON_SAX_OBJECT_END:
+		case JSON_SAX_ARRAY_END:
+			t->current = t->current->parent;
+			break;
+		case JSON_SAX_VALUE:
+			switch (value->tag) {
+				case JSON_NULL:
+					node = json_mknull();
+					break;
+				case JSON_BOOL:
+					node = json_mkbool(value->bool_);
+					break;
+				case JSON_STRING:
+					node = json_mkstring(value->string_);
+					break;
+				default:
+					node = json_mknumber(value->number_, value->decimals_);
+					break;
+			}
+			sax_tree_add(t, key, node);
+			break;
+	}
+	return 0;
+}
+
+JsonNode *json_read(FILE *fp, JsonError *error)
+{
+	SaxTree t = { NULL, NULL };
+
+	if (json_sax_read(fp, sax_tree, &t, error) != 0) {
+		json_delete(t.root);
+		return NULL;
+	}
+	return t.root;
+}
+
 int json_find_number(JsonNode *object, const char *name, double *out) {
 	JsonNode *node = json_find_member(object, name);
 	if (node && node->tag == JSON_NUMBER) {
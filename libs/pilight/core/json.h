@@ -27,6 +27,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 
 #define JSON_NULL		0x1
 #define JSON_BOOL		0x2
@@ -38,6 +39,15 @@
 #define JsonTag			int
 
 typedef struct JsonNode JsonNode;
+typedef struct JsonArena JsonArena;
+typedef struct JsonIndex JsonIndex;
+
+/* Where and why a document could not be decoded */
+typedef struct JsonError
+{
+	size_t offset;
+	const char *reason;
+} JsonError;
 
 struct JsonNode
 {
@@ -66,6 +76,12 @@ struct JsonNode
 		} children;
 	};
 	int decimals_;
+
+	/* Arena the node, its key and string live in (NULL when malloc'ed) */
+	JsonArena *arena;
+
+	/* JSON_OBJECT: private member index, built once the object grows large */
+	JsonIndex *index_;
 };
 
 /*** Encoding, decoding, and validation ***/
@@ -74,10 +90,56 @@ JsonNode   *json_decode         (const char *json);
 char       *json_encode         (const JsonNode *node);
 char       *json_encode_string  (const char *str);
 char       *json_stringify      (const JsonNode *node, const char *space);
+/* Like snprintf, writes at most size-1 bytes and returns the full length */
+size_t      json_stringify_to   (const JsonNode *node, const char *space, char *buf, size_t size);
 void        json_delete         (JsonNode *node);
 
 bool        json_validate       (const char *json);
 
+/* Compact MessagePack form of the same document model */
+JsonNode   *json_decode_msgpack (const char *buf, size_t len);
+char       *json_encode_msgpack (const JsonNode *node, size_t *len);
+
+/*
+ * Streaming reader, the callback is called for every container and
+ * scalar in document order. depth is 0 for the document itself and the
+ * key is only set for members of an object. A non-zero return value
+ * stops reading. json_read builds a tree from a file the same way,
+ * without reading the whole text into memory first.
+ */
+typedef enum
+{
+	JSON_SAX_OBJECT_START,
+	JSON_SAX_OBJECT_END,
+	JSON_SAX_ARRAY_START,
+	JSON_SAX_ARRAY_END,
+	JSON_SAX_VALUE
+} JsonSaxEvent;
+
+typedef int (*JsonSaxCallback)(void *userdata, JsonSaxEvent event, const char *key, const JsonNode *value, int depth);
+
+int         json_sax_read       (FILE *fp, JsonSaxCallback callback, void *userdata, JsonError *error);
+JsonNode   *json_read           (FILE *fp, JsonError *error);
+
+/*
+ * Documents that are built and thrown away as a whole can be allocated
+ * from an arena. All nodes, keys, strings and member indexes are
+ * bump-allocated and released at once by json_arena_free, there is no
+ * need to call json_delete on such a document. Malloc'ed nodes may
+ * still be added to it. Then json_delete on its root has to release
+ * those before the arena itself is freed.
+ */
+JsonArena  *json_arena_new      (size_t size);
+void        json_arena_free     (JsonArena *arena);
+JsonNode   *json_decode_arena   (JsonArena *arena, const char *json);
+
+/*
+ * Decodes and validates in a single pass. On failure NULL is returned
+ * and error, when given, tells at which byte and why. There is no need
+ * to call json_validate first, the arena may be NULL.
+ */
+JsonNode   *json_parse          (JsonArena *arena, const char *json, JsonError *error);
+
 /*** Lookup and traversal ***/
 
 JsonNode   *json_find_element   (JsonNode *array, int index);
@@ -99,6 +161,13 @@ JsonNode *json_mknumber(double n, int decimals);
 JsonNode *json_mkarray(void);
 JsonNode *json_mkobject(void);
 
+JsonNode *json_mknull_in(JsonArena *arena);
+JsonNode *json_mkbool_in(JsonArena *arena, bool b);
+JsonNode *json_mkstring_in(JsonArena *arena, const char *s);
+JsonNode *json_mknumber_in(JsonArena *arena, double n, int decimals);
+JsonNode *json_mkarray_in(JsonArena *arena);
+JsonNode *json_mkobject_in(JsonArena *arena);
+
 void json_append_element(JsonNode *array, JsonNode *element);
 void json_prepend_element(JsonNode *array, JsonNode *element);
 void json_append_member(JsonNode *object, const char *key, JsonNode *value);
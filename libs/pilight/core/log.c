@@ -151,9 +151,15 @@ void logprintf(int prio, const char *format_str, ...) {
 	struct timeval tv;
 	struct tm tm;
 	va_list ap, apcpy;
-	char fmt[64], buf[64], *line = MALLOC(128);
+	char fmt[64], buf[64], *line = NULL;
 	int save_errno = -1, pos = 0, bytes = 0;
 
+	/* Nothing is printed or queued below the log level */
+	if(loglevel < prio) {
+		return;
+	}
+
+	line = MALLOC(128);
 	memset(&tm, '\0', sizeof(struct tm));
 
 	if(line == NULL) {
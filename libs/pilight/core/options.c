@@ -29,6 +29,27 @@
 #include "options.h"
 #include "json.h"
 
+/*
+ * Masks are compiled once when an option is added. Masks that are
+ * a single anchored character class like ^[0-9]{1,3}$ or ^[10]{1}$,
+ * or an unanchored one like [0-9], are checked without the regex
+ * engine. All other masks are handed to regcomp.
+ */
+#define MASK_CLASS		0
+#define MASK_REGEX		1
+#define MASK_INVALID	2
+
+struct options_mask_t {
+	int type;
+	int anchored;
+	size_t min;
+	size_t max;
+	unsigned char set[256];
+#if !defined(__FreeBSD__) && !defined(_WIN32)
+	regex_t regex;
+#endif
+};
+
 static int getOptPos = 0;
 static char *longarg = NULL;
 static char *shortarg = NULL;
@@ -47,6 +68,157 @@ int options_gc(void) {
 	return EXIT_SUCCESS;
 }
 
+static int options_mask_class(const char *mask, struct options_mask_t *cmask) {
+	const unsigned char *p = (const unsigned char *)mask;
+	unsigned int lo = 0, hi = 0, c = 0;
+	int group = 0;
+	char *end = NULL;
+
+	memset(cmask->set, 0, sizeof(cmask->set));
+	cmask->anchored = 0;
+	if(*p == '^') {
+		cmask->anchored = 1;
+		p++;
+		if(*p == '(') {
+			group = 1;
+			p++;
+		}
+	}
+	if(*p++ != '[' || *p == '^' || *p == ']') {
+		return -1;
+	}
+	while(*p != ']') {
+		if(*p == '\0' || *p == '[' || *p == '\\') {
+			return -1;
+		}
+		lo = hi = *p;
+		if(p[1] == '-' && p[2] != ']' && p[2] != '\0') {
+			if((hi = p[2]) < lo) {
+				return -1;
+			}
+			p += 3;
+		} else {
+			p++;
+		}
+		for(c=lo;c<=hi;c++) {
+			cmask->set[c] = 1;
+		}
+	}
+	p++;
+
+	cmask->min = 1;
+	cmask->max = 1;
+	if(*p == '+') {
+		cmask->max = (size_t)-1;
+		p++;
+	} else if(*p == '{') {
+		cmask->min = (size_t)strtoul((const char *)p+1, &end, 10);
+		if(end == (char *)p+1) {
+			return -1;
+		}
+		p = (const unsigned char *)end;
+		cmask->max = cmask->min;
+		if(*p == ',') {
+			p++;
+			if(*p == '}') {
+				cmask->max = (size_t)-1;
+			} else {
+				cmask->max = (size_t)strtoul((const char *)p, &end, 10);
+				if(end == (char *)p || cmask->max < cmask->min) {
+					return -1;
+				}
+				p = (const unsigned char *)end;
+			}
+		}
+		if(*p++ != '}') {
+			return -1;
+		}
+	}
+	if(group == 1 && *p++ != ')') {
+		return -1;
+	}
+	if(cmask->anchored == 1 && *p++ != '$') {
+		return -1;
+	}
+	/* Unanchored, only "contains one of" is simple enough */
+	if(*p != '\0' || (cmask->anchored == 0 && (cmask->min != 1 || cmask->max != 1))) {
+		return -1;
+	}
+	return 0;
+}
+
+static void options_compile_mask(struct options_t *opt) {
+	opt->cmask = NULL;
+	if(opt->mask == NULL || strlen(opt->mask) == 0) {
+		return;
+	}
+	if((opt->cmask = MALLOC(sizeof(struct options_mask_t))) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	if(options_mask_class(opt->mask, opt->cmask) == 0) {
+		opt->cmask->type = MASK_CLASS;
+		return;
+	}
+#if !defined(__FreeBSD__) && !defined(_WIN32)
+	/* Reported by whoever validates a value against it */
+	if(regcomp(&opt->cmask->regex, opt->mask, REG_EXTENDED) != 0) {
+		opt->cmask->type = MASK_INVALID;
+		return;
+	}
+#endif
+	opt->cmask->type = MASK_REGEX;
+}
+
+static void options_free_mask(struct options_t *opt) {
+	if(opt->cmask != NULL) {
+#if !defined(__FreeBSD__) && !defined(_WIN32)
+		if(opt->cmask->type == MASK_REGEX) {
+			regfree(&opt->cmask->regex);
+		}
+#endif
+		FREE(opt->cmask);
+	}
+}
+
+/* Check a value against the mask of an option. Returns 0 when the value
+   matches or there is no mask, 1 when it doesn't and -1 when the mask
+   itself could not be compiled */
+int options_match_mask(struct options_t *opt, const char *value) {
+	const unsigned char *p = (const unsigned char *)value;
+	size_t len = 0;
+
+	if(opt->cmask == NULL) {
+		return 0;
+	}
+	switch(opt->cmask->type) {
+		case MASK_CLASS:
+			if(opt->cmask->anchored == 0) {
+				while(*p != '\0') {
+					if(opt->cmask->set[*p++] == 1) {
+						return 0;
+					}
+				}
+				return 1;
+			}
+			while(*p != '\0') {
+				if(opt->cmask->set[*p++] == 0) {
+					return 1;
+				}
+				len++;
+			}
+			return (len >= opt->cmask->min && len <= opt->cmask->max) ? 0 : 1;
+		case MASK_REGEX:
+#if !defined(__FreeBSD__) && !defined(_WIN32)
+			return (regexec(&opt->cmask->regex, value, 0, NULL, 0) == 0) ? 0 : 1;
+#else
+			return 0;
+#endif
+		default:
+			return -1;
+	}
+}
+
 /* Add a value to the specific struct id */
 void options_set_string(struct options_t **opt, int id, const char *val) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
@@ -235,8 +407,8 @@ int options_parse(struct options_t **opt, int argc, char **argv, int error_check
 	int c = 0;
 	int itmp = 0;
 #if !defined(__FreeBSD__) && !defined(_WIN32)
+	struct options_t *temp = NULL;
 	char *mask;
-	regex_t regex;
 	int reti;
 #endif
 
@@ -406,13 +578,16 @@ int options_parse(struct options_t **opt, int argc, char **argv, int error_check
 				if(error_check != 2) {
 					/* If the argument has a regex mask, check if it passes */
 					if(options_get_mask(opt, c, &mask) == 0) {
-						reti = regcomp(&regex, mask, REG_EXTENDED);
-						if(reti) {
+						temp = *opt;
+						while(temp != NULL && !(temp->id == c && temp->id > 0)) {
+							temp = temp->next;
+						}
+						reti = options_match_mask(temp, *optarg);
+						if(reti == -1) {
 							logprintf(LOG_ERR, "could not compile regex");
 							goto gc;
 						}
-						reti = regexec(&regex, *optarg, 0, NULL, 0);
-						if(reti == REG_NOMATCH || reti != 0) {
+						if(reti != 0) {
 							if(error_check == 1) {
 								if(shortarg[0] == '-') {
 									logprintf(LOG_ERR, "invalid format -- '-%c'", c);
@@ -421,10 +596,8 @@ int options_parse(struct options_t **opt, int argc, char **argv, int error_check
 								}
 								logprintf(LOG_ERR, "requires %s", mask);
 							}
-							regfree(&regex);
 							goto gc;
 						}
-						regfree(&regex);
 					}
 				}
 #endif
@@ -502,6 +675,7 @@ void options_add(struct options_t **opt, int id, const char *name, int argtype,
 		} else {
 			optnode->mask = NULL;
 		}
+		options_compile_mask(optnode);
 		optnode->next = *opt;
 		*opt = optnode;
 		FREE(nname);
@@ -554,6 +728,7 @@ void options_merge(struct options_t **a, struct options_t **b) {
 		optnode->conftype = temp->conftype;
 		optnode->vartype = temp->vartype;
 		optnode->def = temp->def;
+		options_compile_mask(optnode);
 		optnode->next = *a;
 		*a = optnode;
 		temp = temp->next;
@@ -566,6 +741,7 @@ void options_delete(struct options_t *options) {
 	struct options_t *tmp;
 	while(options) {
 		tmp = options;
+		options_free_mask(tmp);
 		if(tmp->mask) {
 			FREE(tmp->mask);
 		}
@@ -32,6 +32,8 @@
 #define NROPTIONTYPES				6
 
 
+typedef struct options_mask_t options_mask_t;
+
 typedef struct options_t {
 	int id;
 	char *name;
@@ -40,6 +42,8 @@ typedef struct options_t {
 		double number_;
 	};
 	char *mask;
+	/* The mask as compiled by options_add */
+	struct options_mask_t *cmask;
 	void *def;
 	int argtype;
 	int conftype;
@@ -56,6 +60,7 @@ int options_get_argtype(struct options_t **options, int id, int *out);
 int options_get_name(struct options_t **options, int id, char **out);
 int options_get_id(struct options_t **options, char *name, int *out);
 int options_get_mask(struct options_t **options, int id, char **out);
+int options_match_mask(struct options_t *option, const char *value);
 int options_parse(struct options_t **options, int argc, char **argv, int error_check, char **optarg);
 void options_add(struct options_t **options, int id, const char *name, int argtype, int conftype, int vartype, void *def, const char *mask);
 void options_merge(struct options_t **a, struct options_t **b);
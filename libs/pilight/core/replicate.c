@@ -0,0 +1,629 @@
+/*
+	Copyright (C) 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+/*
+ * Replication of node updates to the master.
+ *
+ * A node collects its updates for REPLICATE_WINDOW milliseconds and
+ * sends them as a single batch. Every update belongs to a stream, which
+ * is the protocol together with the id values of the message. The first
+ * update of a stream is sent in full, later updates only contain the
+ * fields that changed. Because all updates travel over the same TCP
+ * connection, the state of the last batch written successfully is the
+ * state the master has, so both sides just drop their streams when the
+ * connection is reestablished. A batch that could not be written is
+ * kept and sent again.
+ *
+ * Batches are only sent when the master answered the identification
+ * with "replicate":"batch". Older masters get every update on its own.
+ *
+ * {"action":"update","batch":[
+ *   {"stream":1,"message":{"id":1,"temperature":21.5},"protocol":"...",...},
+ *   {"stream":1,"delta":{"message":{"temperature":21.6}}}
+ * ]}
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pilight.h"
+#include "replicate.h"
+#include "options.h"
+#include "socket.h"
+#include "log.h"
+#include "mem.h"
+#include "../protocols/protocol.h"
+
+#define REPLICATE_STATS_INTERVAL	60
+
+static struct replicas_t *replicas = NULL;
+static int replicas_streams = 0;
+
+/* Updates waiting to be sent, in the order they were queued */
+typedef struct replicate_pending_t {
+	struct replicas_t *replica;
+	struct JsonNode *json;
+	struct replicate_pending_t *next;
+} replicate_pending_t;
+
+static struct replicate_pending_t *pending = NULL;
+static struct replicate_pending_t *pending_head = NULL;
+static int batch_number = 0;
+static struct timespec batch_ts;
+/* The master told us it understands batches */
+static int batch_mode = 0;
+
+/* Node counters */
+static unsigned long sent_bytes = 0;
+static unsigned long sent_batches = 0;
+static unsigned long sent_messages = 0;
+static unsigned long sent_deltas = 0;
+static double sent_delay = 0;
+static double sent_delay_max = 0;
+static time_t sent_stats_ts = 0;
+
+/* Master counters */
+static unsigned long recv_bytes = 0;
+static unsigned long recv_batches = 0;
+static unsigned long recv_messages = 0;
+static unsigned long recv_deltas = 0;
+static double recv_apply = 0;
+static time_t recv_stats_ts = 0;
+
+static double replicate_elapsed(struct timespec *start) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return ((double)now.tv_sec + 1.0e-9*now.tv_nsec) -
+		((double)start->tv_sec + 1.0e-9*start->tv_nsec);
+}
+
+static struct JsonNode *replicate_copy(struct JsonNode *node) {
+	struct JsonNode *ret = NULL;
+	struct JsonNode *jchilds = NULL;
+
+	switch(node->tag) {
+		case JSON_NULL:
+			return json_mknull();
+		case JSON_BOOL:
+			return json_mkbool(node->bool_);
+		case JSON_STRING:
+			return json_mkstring(node->string_);
+		case JSON_NUMBER:
+			return json_mknumber(node->number_, node->decimals_);
+		case JSON_ARRAY:
+		case JSON_OBJECT:
+			ret = (node->tag == JSON_ARRAY) ? json_mkarray() : json_mkobject();
+			json_foreach(jchilds, node) {
+				if(node->tag == JSON_ARRAY) {
+					json_append_element(ret, replicate_copy(jchilds));
+				} else {
+					json_append_member(ret, jchilds->key, replicate_copy(jchilds));
+				}
+			}
+			return ret;
+	}
+	return json_mknull();
+}
+
+static int replicate_equal(struct JsonNode *a, struct JsonNode *b) {
+	struct JsonNode *ja = NULL, *jb = NULL;
+
+	if(a->tag != b->tag) {
+		return 0;
+	}
+	switch(a->tag) {
+		case JSON_NULL:
+			return 1;
+		case JSON_BOOL:
+			return a->bool_ == b->bool_;
+		case JSON_STRING:
+			return strcmp(a->string_, b->string_) == 0;
+		case JSON_NUMBER:
+			return a->number_ == b->number_ && a->decimals_ == b->decimals_;
+		case JSON_ARRAY:
+		case JSON_OBJECT:
+			ja = json_first_child(a);
+			jb = json_first_child(b);
+			while(ja != NULL && jb != NULL) {
+				if(a->tag == JSON_OBJECT && strcmp(ja->key, jb->key) != 0) {
+					return 0;
+				}
+				if(replicate_equal(ja, jb) == 0) {
+					return 0;
+				}
+				ja = ja->next;
+				jb = jb->next;
+			}
+			return ja == NULL && jb == NULL;
+	}
+	return 0;
+}
+
+/* The changed members of cur compared to prev. When a member
+   disappeared a delta can't describe the new state and the
+   caller has to send the message in full */
+static struct JsonNode *replicate_delta(struct JsonNode *prev, struct JsonNode *cur, int *full) {
+	struct JsonNode *ret = json_mkobject();
+	struct JsonNode *jchilds = NULL;
+	struct JsonNode *jprev = NULL;
+
+	json_foreach(jchilds, prev) {
+		if(json_find_member(cur, jchilds->key) == NULL) {
+			*full = 1;
+			return ret;
+		}
+	}
+	json_foreach(jchilds, cur) {
+		if((jprev = json_find_member(prev, jchilds->key)) == NULL) {
+			json_append_member(ret, jchilds->key, replicate_copy(jchilds));
+		} else if(jchilds->tag == JSON_OBJECT && jprev->tag == JSON_OBJECT) {
+			struct JsonNode *jdelta = replicate_delta(jprev, jchilds, full);
+			if(*full == 1) {
+				json_delete(jdelta);
+				return ret;
+			}
+			if(json_first_child(jdelta) != NULL) {
+				json_append_member(ret, jchilds->key, jdelta);
+			} else {
+				json_delete(jdelta);
+			}
+		} else if(replicate_equal(jprev, jchilds) == 0) {
+			json_append_member(ret, jchilds->key, replicate_copy(jchilds));
+		}
+	}
+	return ret;
+}
+
+static void replicate_merge(struct JsonNode *base, struct JsonNode *delta) {
+	struct JsonNode *jchilds = NULL;
+	struct JsonNode *jbase = NULL;
+
+	json_foreach(jchilds, delta) {
+		if((jbase = json_find_member(base, jchilds->key)) != NULL) {
+			if(jbase->tag == JSON_OBJECT && jchilds->tag == JSON_OBJECT) {
+				replicate_merge(jbase, jchilds);
+				continue;
+			}
+			json_remove_from_parent(jbase);
+			json_delete(jbase);
+		}
+		json_append_member(base, jchilds->key, replicate_copy(jchilds));
+	}
+}
+
+/* Messages about the same device end up in the same stream */
+static void replicate_key(struct JsonNode *json, char *key, size_t size) {
+	struct protocol_t *listener = NULL;
+	struct options_t *opt = NULL;
+	struct JsonNode *jmessage = NULL;
+	struct JsonNode *jid = NULL;
+	char *protocol = NULL, *origin = NULL;
+	double type = 0;
+	size_t len = 0;
+
+	memset(key, '\0', size);
+	if(json_find_string(json, "origin", &origin) == 0 && strcmp(origin, "core") == 0) {
+		json_find_number(json, "type", &type);
+		snprintf(key, size, "core:%d", (int)type);
+		return;
+	}
+	if(json_find_string(json, "protocol", &protocol) != 0) {
+		return;
+	}
+	snprintf(key, size, "%s", protocol);
+
+	jmessage = json_find_member(json, "message");
+	if(protocol_get(protocol, &listener) == 0) {
+		opt = listener->options;
+		while(opt) {
+			if(opt->conftype == DEVICES_ID && (jid = json_find_member(jmessage, opt->name)) != NULL) {
+				len = strlen(key);
+				if(jid->tag == JSON_NUMBER) {
+					snprintf(&key[len], size-len, ":%s=%.*f", opt->name, jid->decimals_, jid->number_);
+				} else if(jid->tag == JSON_STRING) {
+					snprintf(&key[len], size-len, ":%s=%s", opt->name, jid->string_);
+				}
+			}
+			opt = opt->next;
+		}
+	}
+}
+
+/* Add an update to the pending batch, the json is owned by the batch afterwards */
+void replicate_queue(struct JsonNode *json) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct replicas_t *tmp = replicas;
+	struct replicate_pending_t *node = NULL;
+	struct JsonNode *jaction = NULL;
+	char key[255];
+
+	if((jaction = json_find_member(json, "action")) != NULL) {
+		json_remove_from_parent(jaction);
+		json_delete(jaction);
+	}
+
+	replicate_key(json, key, sizeof(key));
+	while(tmp) {
+		if(strcmp(tmp->key, key) == 0) {
+			break;
+		}
+		tmp = tmp->next;
+	}
+
+	if(tmp == NULL) {
+		if((tmp = MALLOC(sizeof(struct replicas_t))) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		if((tmp->key = MALLOC(strlen(key)+1)) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		strcpy(tmp->key, key);
+		tmp->stream = ++replicas_streams;
+		tmp->jmessage = NULL;
+		tmp->jnext = NULL;
+		tmp->next = replicas;
+		replicas = tmp;
+	}
+
+	/* Updates are kept while the master can't be reached,
+	   but only up to a limit */
+	if(batch_number >= REPLICATE_MAX_PENDING) {
+		node = pending;
+		pending = pending->next;
+		json_delete(node->json);
+		FREE(node);
+		batch_number--;
+		logprintf(LOG_ERR, "replication queue full");
+	}
+
+	if((node = MALLOC(sizeof(struct replicate_pending_t))) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	node->replica = tmp;
+	node->json = json;
+	node->next = NULL;
+
+	if(batch_number == 0) {
+		pending = node;
+		clock_gettime(CLOCK_REALTIME, &batch_ts);
+	} else {
+		pending_head->next = node;
+	}
+	pending_head = node;
+	batch_number++;
+}
+
+int replicate_pending(void) {
+	return batch_number;
+}
+
+/* Fills the moment the pending batch has to be sent
+   and returns 0 when that moment already passed */
+int replicate_deadline(struct timespec *ts) {
+	ts->tv_sec = batch_ts.tv_sec;
+	ts->tv_nsec = batch_ts.tv_nsec + (REPLICATE_WINDOW * 1000000L);
+	if(ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec += ts->tv_nsec / 1000000000L;
+		ts->tv_nsec %= 1000000000L;
+	}
+	if(batch_number >= REPLICATE_MAX_BATCH || replicate_elapsed(&batch_ts)*1000 >= REPLICATE_WINDOW) {
+		return 0;
+	}
+	return 1;
+}
+
+static void replicate_pop(void) {
+	struct replicate_pending_t *node = pending;
+
+	pending = pending->next;
+	json_delete(node->json);
+	FREE(node);
+	batch_number--;
+}
+
+/* A master not knowing about batches gets every update on its own */
+static int replicate_flush_single(int sockfd) {
+	struct JsonNode *jaction = NULL;
+	char *out = NULL;
+	int r = 0;
+
+	while(pending) {
+		json_append_member(pending->json, "action", json_mkstring("update"));
+		out = json_stringify(pending->json, NULL);
+		if((jaction = json_find_member(pending->json, "action")) != NULL) {
+			json_remove_from_parent(jaction);
+			json_delete(jaction);
+		}
+		r = (sockfd > 0) ? socket_write(sockfd, out) : -1;
+		if(r <= 0) {
+			json_free(out);
+			return -1;
+		}
+		sent_bytes += strlen(out);
+		sent_messages++;
+		json_free(out);
+		replicate_pop();
+	}
+	sent_batches++;
+	return 0;
+}
+
+static int replicate_flush_batch(int sockfd) {
+	struct replicate_pending_t *node = NULL;
+	struct replicas_t *tmp = NULL;
+	struct JsonNode *jsend = NULL, *jbatch = NULL;
+	struct JsonNode *jitem = NULL, *jdelta = NULL, *jbase = NULL;
+	char *out = NULL;
+	int full = 0, deltas = 0, r = 0;
+
+	jbatch = json_mkarray();
+	node = pending;
+	while(node) {
+		tmp = node->replica;
+		jbase = (tmp->jnext != NULL) ? tmp->jnext : tmp->jmessage;
+		full = 0;
+		jdelta = NULL;
+		if(jbase != NULL) {
+			jdelta = replicate_delta(jbase, node->json, &full);
+		} else {
+			full = 1;
+		}
+
+		if(full == 1) {
+			if(jdelta != NULL) {
+				json_delete(jdelta);
+			}
+			jitem = replicate_copy(node->json);
+			json_append_member(jitem, "stream", json_mknumber(tmp->stream, 0));
+		} else {
+			jitem = json_mkobject();
+			json_append_member(jitem, "stream", json_mknumber(tmp->stream, 0));
+			json_append_member(jitem, "delta", jdelta);
+			deltas++;
+		}
+		json_append_element(jbatch, jitem);
+
+		if(tmp->jnext != NULL) {
+			json_delete(tmp->jnext);
+		}
+		tmp->jnext = replicate_copy(node->json);
+		node = node->next;
+	}
+
+	jsend = json_mkobject();
+	json_append_member(jsend, "action", json_mkstring("update"));
+	json_append_member(jsend, "batch", jbatch);
+	out = json_stringify(jsend, NULL);
+	r = (sockfd > 0) ? socket_write(sockfd, out) : -1;
+
+	/* The master only has the new state of a stream once the
+	   batch got through, otherwise it is sent again later on */
+	tmp = replicas;
+	while(tmp) {
+		if(tmp->jnext != NULL) {
+			if(r > 0) {
+				if(tmp->jmessage != NULL) {
+					json_delete(tmp->jmessage);
+				}
+				tmp->jmessage = tmp->jnext;
+			} else {
+				json_delete(tmp->jnext);
+			}
+			tmp->jnext = NULL;
+		}
+		tmp = tmp->next;
+	}
+
+	if(r > 0) {
+		sent_bytes += strlen(out);
+		sent_batches++;
+		sent_messages += (unsigned long)batch_number;
+		sent_deltas += (unsigned long)deltas;
+		while(pending) {
+			replicate_pop();
+		}
+	}
+	json_free(out);
+	json_delete(jsend);
+
+	return (r > 0) ? 0 : -1;
+}
+
+void replicate_flush(int sockfd) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	double delay = 0;
+	time_t now = 0;
+	int r = 0;
+
+	if(pending == NULL) {
+		return;
+	}
+
+	if(batch_mode == 1) {
+		r = replicate_flush_batch(sockfd);
+	} else {
+		r = replicate_flush_single(sockfd);
+	}
+	if(r != 0) {
+		/* Try again once another window has passed */
+		clock_gettime(CLOCK_REALTIME, &batch_ts);
+		return;
+	}
+
+	delay = replicate_elapsed(&batch_ts)*1000;
+	sent_delay += delay;
+	if(delay > sent_delay_max) {
+		sent_delay_max = delay;
+	}
+
+	now = time(NULL);
+	if(sent_stats_ts == 0) {
+		sent_stats_ts = now;
+	} else if(now-sent_stats_ts >= REPLICATE_STATS_INTERVAL && sent_batches > 0) {
+		logprintf(LOG_DEBUG, "replication: sent %lu updates (%lu deltas) in %lu batches, %.1f bytes/s, batch delay avg %.1fms max %.1fms",
+			sent_messages, sent_deltas, sent_batches, (double)sent_bytes/(double)(now-sent_stats_ts),
+			sent_delay/(double)sent_batches, sent_delay_max);
+		sent_bytes = 0;
+		sent_batches = 0;
+		sent_messages = 0;
+		sent_deltas = 0;
+		sent_delay = 0;
+		sent_delay_max = 0;
+		sent_stats_ts = now;
+	}
+}
+
+/*
+	The connection to the master was (re)established. It starts
+	without any knowledge of our streams, so their next update is
+	sent in full. Updates that could not be sent yet are kept.
+*/
+void replicate_reset(int batch) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct replicas_t *tmp = replicas;
+
+	while(tmp) {
+		if(tmp->jmessage != NULL) {
+			json_delete(tmp->jmessage);
+			tmp->jmessage = NULL;
+		}
+		if(tmp->jnext != NULL) {
+			json_delete(tmp->jnext);
+			tmp->jnext = NULL;
+		}
+		tmp = tmp->next;
+	}
+	batch_mode = batch;
+}
+
+/* Turn a batch item of a node into the full update it describes. The
+   returned message stays owned by the replicas of that node */
+struct JsonNode *replicate_apply(struct replicas_t **list, struct JsonNode *jitem) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct replicas_t *tmp = *list;
+	struct JsonNode *jdelta = NULL;
+	struct JsonNode *jstream = NULL;
+	double stream = 0;
+
+	if(json_find_number(jitem, "stream", &stream) != 0) {
+		return NULL;
+	}
+	while(tmp) {
+		if(tmp->stream == (int)stream) {
+			break;
+		}
+		tmp = tmp->next;
+	}
+
+	if((jdelta = json_find_member(jitem, "delta")) != NULL) {
+		if(tmp == NULL || tmp->jmessage == NULL) {
+			logprintf(LOG_NOTICE, "received an update for unknown stream %d", (int)stream);
+			return NULL;
+		}
+		replicate_merge(tmp->jmessage, jdelta);
+		recv_deltas++;
+	} else {
+		if(tmp == NULL) {
+			if((tmp = MALLOC(sizeof(struct replicas_t))) == NULL) {
+				fprintf(stderr, "out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+			tmp->stream = (int)stream;
+			tmp->key = NULL;
+			tmp->jnext = NULL;
+			tmp->next = *list;
+			*list = tmp;
+		} else {
+			json_delete(tmp->jmessage);
+		}
+		tmp->jmessage = replicate_copy(jitem);
+		if((jstream = json_find_member(tmp->jmessage, "stream")) != NULL) {
+			json_remove_from_parent(jstream);
+			json_delete(jstream);
+		}
+	}
+	recv_messages++;
+
+	return tmp->jmessage;
+}
+
+void replicate_free(struct replicas_t **list) {
+	struct replicas_t *tmp = NULL;
+
+	while(*list) {
+		tmp = *list;
+		*list = (*list)->next;
+		if(tmp->key != NULL) {
+			FREE(tmp->key);
+		}
+		if(tmp->jmessage != NULL) {
+			json_delete(tmp->jmessage);
+		}
+		if(tmp->jnext != NULL) {
+			json_delete(tmp->jnext);
+		}
+		FREE(tmp);
+	}
+}
+
+/* Account a batch received by the master */
+void replicate_received(size_t bytes, struct timespec *start) {
+	time_t now = time(NULL);
+
+	recv_bytes += bytes;
+	recv_batches++;
+	recv_apply += replicate_elapsed(start)*1000;
+
+	if(recv_stats_ts == 0) {
+		recv_stats_ts = now;
+	} else if(now-recv_stats_ts >= REPLICATE_STATS_INTERVAL) {
+		logprintf(LOG_DEBUG, "replication: received %lu updates (%lu deltas) in %lu batches, %.1f bytes/s, apply avg %.3fms",
+			recv_messages, recv_deltas, recv_batches, (double)recv_bytes/(double)(now-recv_stats_ts),
+			recv_apply/(double)recv_batches);
+		recv_bytes = 0;
+		recv_batches = 0;
+		recv_messages = 0;
+		recv_deltas = 0;
+		recv_apply = 0;
+		recv_stats_ts = now;
+	}
+}
+
+int replicate_gc(void) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	while(pending) {
+		replicate_pop();
+	}
+	replicate_free(&replicas);
+	replicas_streams = 0;
+	batch_mode = 0;
+
+	logprintf(LOG_DEBUG, "garbage collected replicate library");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,54 @@
+/*
+	Copyright (C) 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#ifndef _REPLICATE_H_
+#define _REPLICATE_H_
+
+#include <time.h>
+#include "json.h"
+
+/* How long a node collects updates before sending them to the master */
+#define REPLICATE_WINDOW		100
+#define REPLICATE_MAX_BATCH	32
+/* Updates kept while the master can't be reached */
+#define REPLICATE_MAX_PENDING	1024
+
+typedef struct replicas_t {
+	int stream;
+	char *key;
+	/* State the master has and the state the batch in flight will give it */
+	struct JsonNode *jmessage;
+	struct JsonNode *jnext;
+	struct replicas_t *next;
+} replicas_t;
+
+/* Node side */
+void replicate_queue(struct JsonNode *json);
+int replicate_pending(void);
+int replicate_deadline(struct timespec *ts);
+void replicate_flush(int sockfd);
+void replicate_reset(int batch);
+
+/* Master side */
+struct JsonNode *replicate_apply(struct replicas_t **replicas, struct JsonNode *jitem);
+void replicate_free(struct replicas_t **replicas);
+void replicate_received(size_t bytes, struct timespec *start);
+
+int replicate_gc(void);
+
+#endif
@@ -399,6 +399,102 @@ int socket_write(int sockfd, const char *msg, ...) {
 	return n;
 }
 
+/* Binary frames travel through the same EOSS and newline based framing
+   as the JSON messages. The bytes that would break that framing are
+   therefore escaped: 0x00 and \n become ESC 0x01 and ESC 0x02, and the
+   escape byte itself becomes ESC 0x03 */
+#define SOCKET_ESCAPE	0x1B
+
+int socket_write_binary(int sockfd, const char *buf, size_t len) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	int bytes = -1;
+	int ptr = 0, n = 0, x = BUFFER_SIZE, l = (int)strlen(EOSS);
+	char *sendBuff = NULL;
+	size_t i = 0;
+
+	if(len > 0 && sockfd > 0) {
+		/* Worst case every byte needs to be escaped */
+		if((sendBuff = MALLOC((len*2)+(size_t)l)) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		for(i=0;i<len;i++) {
+			switch(buf[i]) {
+				case '\0':
+					sendBuff[n++] = SOCKET_ESCAPE;
+					sendBuff[n++] = 0x01;
+				break;
+				case '\n':
+					sendBuff[n++] = SOCKET_ESCAPE;
+					sendBuff[n++] = 0x02;
+				break;
+				case SOCKET_ESCAPE:
+					sendBuff[n++] = SOCKET_ESCAPE;
+					sendBuff[n++] = 0x03;
+				break;
+				default:
+					sendBuff[n++] = buf[i];
+				break;
+			}
+		}
+		memcpy(&sendBuff[n], EOSS, (size_t)l);
+		n += l;
+
+		while(ptr < n) {
+			if((n-ptr) < BUFFER_SIZE) {
+				x = (n-ptr);
+			} else {
+				x = BUFFER_SIZE;
+			}
+			if((bytes = (int)send(sockfd, &sendBuff[ptr], (size_t)x, MSG_NOSIGNAL)) == -1) {
+				logprintf(LOG_DEBUG, "socket write failed: %d binary bytes", (int)len);
+				FREE(sendBuff);
+				return -1;
+			}
+			ptr += bytes;
+		}
+		logprintf(LOG_DEBUG, "socket write succeeded: %d binary bytes", (int)len);
+		FREE(sendBuff);
+	}
+	return n;
+}
+
+/* JSON messages and the pilight keywords are plain text, a binary
+   frame always starts with a MessagePack map marker */
+int socket_is_binary(const char *msg) {
+	unsigned char c = (unsigned char)msg[0];
+
+	return ((c & 0xf0) == 0x80 || c == 0xde || c == 0xdf);
+}
+
+/* Revert the escaping of socket_write_binary in place */
+size_t socket_unescape(char *msg) {
+	size_t i = 0, n = 0;
+
+	while(msg[i] != '\0') {
+		if(msg[i] == SOCKET_ESCAPE && msg[i+1] != '\0') {
+			switch(msg[i+1]) {
+				case 0x01:
+					msg[n++] = '\0';
+				break;
+				case 0x02:
+					msg[n++] = '\n';
+				break;
+				default:
+					msg[n++] = SOCKET_ESCAPE;
+				break;
+			}
+			i += 2;
+		} else {
+			msg[n++] = msg[i++];
+		}
+	}
+	msg[n] = '\0';
+
+	return n;
+}
+
 void socket_rm_client(int i, struct socket_callback_t *socket_callback) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
@@ -21,6 +21,11 @@
 
 #include <time.h>
 
+typedef enum socket_encoding_t {
+	ENCODING_JSON = 0,
+	ENCODING_MSGPACK
+} socket_encoding_t;
+
 typedef struct socket_callback_t {
     void (*client_connected_callback)(int);
     void (*client_disconnected_callback)(int);
@@ -33,6 +38,9 @@ int socket_connect(char *address, unsigned short port);
 int socket_timeout_connect(int sockfd, struct sockaddr *serv_addr, int usec);
 void socket_close(int i);
 int socket_write(int sockfd, const char *msg, ...);
+int socket_write_binary(int sockfd, const char *buf, size_t len);
+int socket_is_binary(const char *msg);
+size_t socket_unescape(char *msg);
 int socket_read(int sockfd, char **out, time_t timeout);
 void *socket_wait(void *param);
 int socket_gc(void);
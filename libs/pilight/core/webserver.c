@@ -37,6 +37,7 @@
 #endif
 
 #include "../config/settings.h"
+#include "../protocols/protocol.h"
 #include "threads.h"
 #include "sha256cache.h"
 #include "pilight.h"
@@ -46,6 +47,7 @@
 #include "log.h"
 #include "json.h"
 #include "socket.h"
+#include "eventbus.h"
 #include "webserver.h"
 #include "ssdp.h"
 #include "fcache.h"
@@ -82,9 +84,34 @@ typedef enum {
 
 typedef struct webqueue_t {
 	char *message;
+	/* Messages with the same key supersede each other */
+	char *key;
 	struct webqueue_t *next;
 } webqueue_t;
 
+/* Every websocket has its own send queue which is flushed by
+   the mongoose worker that owns the connection */
+typedef struct websocket_t {
+	struct mg_connection *conn;
+	struct webqueue_t *queue;
+	struct webqueue_t *queue_head;
+	int number;
+	struct websocket_t *next;
+} websocket_t;
+
+#define WEBSOCKET_QUEUE_MAX		128
+#define WEBSOCKET_STATS_INTERVAL	60
+
+static struct websocket_t *websockets = NULL;
+
+static pthread_mutex_t websocket_lock;
+static pthread_mutexattr_t websocket_attr;
+
+static unsigned long websocket_frames = 0;
+static unsigned long websocket_coalesced = 0;
+static unsigned long websocket_dropped = 0;
+static time_t websocket_stats_ts = 0;
+
 static struct webqueue_t *webqueue;
 static struct webqueue_t *webqueue_head;
 
@@ -95,14 +122,27 @@ static unsigned short webqueue_init = 0;
 
 static int webqueue_number = 0;
 
+static void webqueue_free(struct webqueue_t *node) {
+	FREE(node->message);
+	if(node->key != NULL) {
+		FREE(node->key);
+	}
+	FREE(node);
+}
+
 int webserver_gc(void) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	int i = 0;
 
+	eventbus_unsubscribe("webserver");
+
 	while(webqueue_number > 0) {
 		struct webqueue_t *tmp = webqueue;
 		FREE(webqueue->message);
+		if(webqueue->key != NULL) {
+			FREE(webqueue->key);
+		}
 		webqueue = webqueue->next;
 		FREE(tmp);
 		webqueue_number--;
@@ -134,12 +174,62 @@ int webserver_gc(void) {
 		mg_destroy_server(&mgserver[i]);
 	}
 
+	/* Release the send queues of the websockets still open */
+	if(webqueue_init == 1) {
+		pthread_mutex_lock(&websocket_lock);
+		while(websockets) {
+			struct websocket_t *ws = websockets;
+			while(ws->queue) {
+				struct webqueue_t *tmp = ws->queue;
+				ws->queue = ws->queue->next;
+				webqueue_free(tmp);
+			}
+			websockets = websockets->next;
+			FREE(ws);
+		}
+		pthread_mutex_unlock(&websocket_lock);
+	}
+
 	fcache_gc();
 	sha256cache_gc();
 	logprintf(LOG_DEBUG, "garbage collected webserver library");
 	return 1;
 }
 
+/* The generations restart with pilight, so the ETag carries the start time as well */
+static void webserver_etag(char *etag, size_t size, unsigned long generation) {
+	static time_t started = 0;
+
+	if(started == 0) {
+		started = time(NULL);
+	}
+	snprintf(etag, size, "\"%lx-%lx\"", (unsigned long)started, generation);
+}
+
+/* Answers with a 304 when the client already has this generation */
+static int webserver_not_modified(struct mg_connection *conn, unsigned long generation) {
+	const char *match = mg_get_header(conn, "If-None-Match");
+	char etag[64];
+
+	webserver_etag(etag, sizeof(etag), generation);
+	if(match != NULL && strcmp(match, etag) == 0) {
+		mg_send_status(conn, 304);
+		mg_send_header(conn, "ETag", etag);
+		mg_write(conn, "\r\n", 2);
+		return 0;
+	}
+	return -1;
+}
+
+static void webserver_send_snapshot(struct mg_connection *conn, char *content, unsigned long generation) {
+	char etag[64];
+
+	webserver_etag(etag, sizeof(etag), generation);
+	mg_send_header(conn, "ETag", etag);
+	mg_send_header(conn, "Cache-Control", "no-cache");
+	mg_send_data(conn, content, (int)strlen(content));
+}
+
 struct filehandler_t {
 	unsigned char *bytes;
 	FILE *fp;
@@ -387,14 +477,13 @@ static int webserver_request_handler(struct mg_connection *conn) {
 						internal = CONFIG_INTERNAL;
 					}
 				}
-				JsonNode *jsend = config_print(internal, media);
-				if(jsend != NULL) {
-					char *output = json_stringify(jsend, NULL);
-					mg_send_data(conn, output, strlen(output));
-					json_delete(jsend);
-					json_free(output);
+				if(webserver_not_modified(conn, config_generation()) == 0) {
+					return MG_TRUE;
 				}
-				jsend = NULL;
+				unsigned long generation = 0;
+				char *output = config_snapshot(internal, media, &generation);
+				webserver_send_snapshot(conn, output, generation);
+				FREE(output);
 				return MG_TRUE;
 			} else if(strcmp(conn->uri, "/values") == 0) {
 				char media[15];
@@ -402,14 +491,13 @@ static int webserver_request_handler(struct mg_connection *conn) {
 				if(conn->query_string != NULL) {
 					sscanf(conn->query_string, "media=%14s%*[ \n\r]", media);
 				}
-				JsonNode *jsend = devices_values(media);
-				if(jsend != NULL) {
-					char *output = json_stringify(jsend, NULL);
-					mg_send_data(conn, output, strlen(output));
-					json_delete(jsend);
-					json_free(output);
+				if(webserver_not_modified(conn, devices_generation()) == 0) {
+					return MG_TRUE;
 				}
-				jsend = NULL;
+				unsigned long generation = 0;
+				char *output = config_values_snapshot(media, &generation);
+				webserver_send_snapshot(conn, output, generation);
+				FREE(output);
 				return MG_TRUE;
 			} else if(strcmp(&conn->uri[(rstrstr(conn->uri, "/")-conn->uri)], "/") == 0) {
 				char indexes[255];
@@ -768,24 +856,18 @@ static int webserver_request_handler(struct mg_connection *conn) {
 		strncpy(input, conn->content, conn->content_len);
 		input[conn->content_len] = '\0';
 
-		if(json_validate(input) == true) {
-			JsonNode *json = json_decode(input);
+		JsonNode *json = NULL;
+		if((json = json_parse(NULL, input, NULL)) != NULL) {
 			char *action = NULL;
 			if(json_find_string(json, "action", &action) == 0) {
 				if(strcmp(action, "request config") == 0) {
-					JsonNode *jsend = config_print(CONFIG_INTERNAL, "web");
-					char *output = json_stringify(jsend, NULL);
-					size_t output_len = strlen(output);
-					mg_websocket_write(conn, 1, output, output_len);
-					json_free(output);
-					json_delete(jsend);
+					char *output = config_snapshot(CONFIG_INTERNAL, "web", NULL);
+					mg_websocket_write(conn, 1, output, strlen(output));
+					FREE(output);
 				} else if(strcmp(action, "request values") == 0) {
-					JsonNode *jsend = devices_values("web");
-					char *output = json_stringify(jsend, NULL);
-					size_t output_len = strlen(output);
-					mg_websocket_write(conn, 1, output, output_len);
-					json_free(output);
-					json_delete(jsend);
+					char *output = config_values_snapshot("web", NULL);
+					mg_websocket_write(conn, 1, output, strlen(output));
+					FREE(output);
 				} else if(strcmp(action, "control") == 0 || strcmp(action, "registry") == 0) {
 					/* Write all codes coming from the webserver to the daemon */
 					socket_write(sockfd, input);
@@ -831,7 +913,7 @@ static void *webserver_worker(void *param) {
 	return NULL;
 }
 
-static void webserver_queue(char *message) {
+static void webserver_queue(char *message, char *key) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	pthread_mutex_lock(&webqueue_lock);
@@ -846,6 +928,15 @@ static void webserver_queue(char *message) {
 			exit(EXIT_FAILURE);
 		}
 		strcpy(wnode->message, message);
+		wnode->key = NULL;
+		if(key != NULL) {
+			if((wnode->key = MALLOC(strlen(key)+1)) == NULL) {
+				fprintf(stderr, "out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+			strcpy(wnode->key, key);
+		}
+		wnode->next = NULL;
 
 		if(webqueue_number == 0) {
 			webqueue = wnode;
@@ -863,12 +954,248 @@ static void webserver_queue(char *message) {
 	pthread_cond_signal(&webqueue_signal);
 }
 
+static void websocket_add(struct mg_connection *conn) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct websocket_t *node = MALLOC(sizeof(struct websocket_t));
+	if(node == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	node->conn = conn;
+	node->queue = NULL;
+	node->queue_head = NULL;
+	node->number = 0;
+
+	pthread_mutex_lock(&websocket_lock);
+	node->next = websockets;
+	websockets = node;
+	conn->connection_param = node;
+	pthread_mutex_unlock(&websocket_lock);
+}
+
+static void websocket_remove(struct mg_connection *conn) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct websocket_t *currP, *prevP;
+	struct webqueue_t *tmp = NULL;
+
+	pthread_mutex_lock(&websocket_lock);
+	prevP = NULL;
+	for(currP = websockets; currP != NULL; prevP = currP, currP = currP->next) {
+		if(currP->conn == conn) {
+			if(prevP == NULL) {
+				websockets = currP->next;
+			} else {
+				prevP->next = currP->next;
+			}
+			while(currP->queue) {
+				tmp = currP->queue;
+				currP->queue = currP->queue->next;
+				webqueue_free(tmp);
+			}
+			FREE(currP);
+			conn->connection_param = NULL;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&websocket_lock);
+}
+
+static void websocket_replace(struct webqueue_t *node, char *message) {
+	FREE(node->message);
+	if((node->message = MALLOC(strlen(message)+1)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(node->message, message);
+}
+
+/* An update can carry a subset of the device values, so the
+   values of the pending update missing in the newer one are
+   carried over instead of lost */
+static void websocket_merge(struct webqueue_t *node, char *message) {
+	struct JsonNode *jold = NULL, *jnew = NULL;
+	struct JsonNode *jovalues = NULL, *jnvalues = NULL, *jchild = NULL;
+	char *out = NULL;
+
+	if((jold = json_parse(NULL, node->message, NULL)) == NULL) {
+		websocket_replace(node, message);
+		return;
+	}
+	if((jnew = json_parse(NULL, message, NULL)) == NULL) {
+		json_delete(jold);
+		websocket_replace(node, message);
+		return;
+	}
+	if((jovalues = json_find_member(jold, "values")) != NULL && jovalues->tag == JSON_OBJECT &&
+	   (jnvalues = json_find_member(jnew, "values")) != NULL && jnvalues->tag == JSON_OBJECT) {
+		jchild = json_first_child(jovalues);
+		while(jchild) {
+			if(json_find_member(jnvalues, jchild->key) == NULL) {
+				if(jchild->tag == JSON_NUMBER) {
+					json_append_member(jnvalues, jchild->key, json_mknumber(jchild->number_, jchild->decimals_));
+				} else if(jchild->tag == JSON_STRING) {
+					json_append_member(jnvalues, jchild->key, json_mkstring(jchild->string_));
+				}
+			}
+			jchild = jchild->next;
+		}
+		out = json_stringify(jnew, NULL);
+		websocket_replace(node, out);
+		json_free(out);
+	} else {
+		websocket_replace(node, message);
+	}
+	json_delete(jold);
+	json_delete(jnew);
+}
+
+/* Add a message to the send queue of a single websocket. A pending
+   message with the same key is superseded in place, because only the
+   latest state of a device is of any interest to the webgui */
+static void websocket_push(struct websocket_t *ws, struct webqueue_t *message) {
+	struct webqueue_t *tmp = NULL, *prev = NULL;
+	struct webqueue_t *wnode = NULL;
+
+	if(message->key != NULL) {
+		tmp = ws->queue;
+		while(tmp) {
+			if(tmp->key != NULL && strcmp(tmp->key, message->key) == 0) {
+				if(strncmp(message->key, "update:", 7) == 0) {
+					websocket_merge(tmp, message->message);
+				} else {
+					websocket_replace(tmp, message->message);
+				}
+				websocket_coalesced++;
+				return;
+			}
+			tmp = tmp->next;
+		}
+	}
+
+	/* When a browser can't keep up the oldest message that will be
+	   superseded anyway is dropped. Messages without a key are never
+	   dropped, so core and config messages always reach the webgui */
+	if(ws->number >= WEBSOCKET_QUEUE_MAX) {
+		tmp = ws->queue;
+		prev = NULL;
+		while(tmp && tmp->key == NULL) {
+			prev = tmp;
+			tmp = tmp->next;
+		}
+		if(tmp != NULL) {
+			if(prev == NULL) {
+				ws->queue = tmp->next;
+			} else {
+				prev->next = tmp->next;
+			}
+			if(ws->queue_head == tmp) {
+				ws->queue_head = prev;
+			}
+			webqueue_free(tmp);
+			ws->number--;
+			websocket_dropped++;
+		}
+	}
+
+	if((wnode = MALLOC(sizeof(struct webqueue_t))) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	if((wnode->message = MALLOC(strlen(message->message)+1)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(wnode->message, message->message);
+	wnode->key = NULL;
+	if(message->key != NULL) {
+		if((wnode->key = MALLOC(strlen(message->key)+1)) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		strcpy(wnode->key, message->key);
+	}
+	wnode->next = NULL;
+
+	if(ws->number == 0) {
+		ws->queue = wnode;
+	} else {
+		ws->queue_head->next = wnode;
+	}
+	ws->queue_head = wnode;
+	ws->number++;
+}
+
+/* Called from the mongoose worker owning the connection,
+   so it's safe to write to the websocket from here */
+static void websocket_flush(struct mg_connection *conn) {
+	struct websocket_t *ws = NULL;
+	struct webqueue_t *queue = NULL;
+	struct webqueue_t *tmp = NULL;
+	unsigned long frames = 0;
+
+	pthread_mutex_lock(&websocket_lock);
+	if((ws = (struct websocket_t *)conn->connection_param) != NULL) {
+		queue = ws->queue;
+		ws->queue = NULL;
+		ws->queue_head = NULL;
+		ws->number = 0;
+	}
+	pthread_mutex_unlock(&websocket_lock);
+
+	while(queue) {
+		tmp = queue;
+		queue = queue->next;
+		if(webserver_loop == 1) {
+			mg_websocket_write(conn, 1, tmp->message, strlen(tmp->message));
+			frames++;
+		}
+		webqueue_free(tmp);
+	}
+
+	if(frames > 0) {
+		pthread_mutex_lock(&websocket_lock);
+		websocket_frames += frames;
+		pthread_mutex_unlock(&websocket_lock);
+	}
+}
+
+static void websocket_stats(void) {
+	struct websocket_t *tmp = NULL;
+	time_t now = time(NULL);
+	int clients = 0, queued = 0, deepest = 0;
+
+	if(websocket_stats_ts == 0) {
+		websocket_stats_ts = now;
+	} else if(now-websocket_stats_ts >= WEBSOCKET_STATS_INTERVAL) {
+		pthread_mutex_lock(&websocket_lock);
+		tmp = websockets;
+		while(tmp) {
+			clients++;
+			queued += tmp->number;
+			if(tmp->number > deepest) {
+				deepest = tmp->number;
+			}
+			tmp = tmp->next;
+		}
+		logprintf(LOG_DEBUG, "websockets: %d clients, %d queued (deepest %d), %.1f frames/s, %lu coalesced, %lu dropped",
+			clients, queued, deepest, (double)websocket_frames/(double)(now-websocket_stats_ts),
+			websocket_coalesced, websocket_dropped);
+		websocket_frames = 0;
+		websocket_coalesced = 0;
+		websocket_dropped = 0;
+		websocket_stats_ts = now;
+		pthread_mutex_unlock(&websocket_lock);
+	}
+}
+
 void *webserver_broadcast(void *param) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
+	struct websocket_t *ws = NULL;
 	int i = 0;
 	pthread_mutex_lock(&webqueue_lock);
-	struct mg_connection *c = NULL;
 
 	while(webserver_loop) {
 		if(webqueue_number > 0) {
@@ -876,23 +1203,34 @@ void *webserver_broadcast(void *param) {
 
 			logprintf(LOG_STACK, "%s::unlocked", __FUNCTION__);
 
-#ifdef WEBSERVER_HTTPS
-			for(i=0;i<WEBSERVER_WORKERS+1;i++) {
-#else
-			for(i=0;i<WEBSERVER_WORKERS;i++) {
-#endif
-				for(c=mg_next(mgserver[i], NULL); c != NULL; c = mg_next(mgserver[i], c)) {
-					if(c->is_websocket && webserver_loop == 1) {
-						mg_websocket_write(c, 1, webqueue->message, strlen(webqueue->message));
-					}
-				}
+			/* Only fan out the message here, the actual writing is
+			   done by the workers so a slow browser can't hold up
+			   the others */
+			pthread_mutex_lock(&websocket_lock);
+			ws = websockets;
+			while(ws) {
+				websocket_push(ws, webqueue);
+				ws = ws->next;
 			}
+			pthread_mutex_unlock(&websocket_lock);
 
 			struct webqueue_t *tmp = webqueue;
-			FREE(webqueue->message);
 			webqueue = webqueue->next;
-			FREE(tmp);
+			webqueue_free(tmp);
 			webqueue_number--;
+
+			/* Let the workers flush all pending messages in one go
+			   once the burst of messages has been queued */
+			if(webqueue_number == 0 && webserver_loop == 1) {
+#ifdef WEBSERVER_HTTPS
+				for(i=0;i<WEBSERVER_WORKERS+1;i++) {
+#else
+				for(i=0;i<WEBSERVER_WORKERS;i++) {
+#endif
+					mg_wakeup_server(mgserver[i]);
+				}
+			}
+			websocket_stats();
 			pthread_mutex_unlock(&webqueue_lock);
 		} else {
 			pthread_cond_wait(&webqueue_signal, &webqueue_lock);
@@ -901,10 +1239,56 @@ void *webserver_broadcast(void *param) {
 	return (void *)NULL;
 }
 
+/* Key updates by the devices they are about and the process
+   statistics by their type, so newer messages can supersede
+   pending ones. All other messages are delivered as they are */
+static void webserver_publish(struct JsonNode *json, char *message) {
+	struct JsonNode *jchilds = NULL;
+	char key[255], *origin = NULL;
+	double type = 0;
+	size_t len = 0;
+
+	if(webgui_websockets == 0) {
+		return;
+	}
+
+	memset(key, '\0', sizeof(key));
+	if(json_find_string(json, "origin", &origin) == 0) {
+		if(strcmp(origin, "update") == 0) {
+			strcpy(key, "update");
+			len = strlen(key);
+			jchilds = json_first_child(json_find_member(json, "devices"));
+			while(jchilds) {
+				if(jchilds->tag != JSON_STRING || len+strlen(jchilds->string_)+2 > sizeof(key)) {
+					key[0] = '\0';
+					break;
+				}
+				key[len++] = ':';
+				strcpy(&key[len], jchilds->string_);
+				len += strlen(jchilds->string_);
+				jchilds = jchilds->next;
+			}
+		} else if(strcmp(origin, "core") == 0 && json_find_number(json, "type", &type) == 0 &&
+		          (int)type == PROCESS) {
+			snprintf(key, sizeof(key), "core:%d", (int)type);
+		}
+	}
+	webserver_queue(message, (strlen(key) > 0) ? key : NULL);
+}
+
 void *webserver_clientize(void *param) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	unsigned int failures = 0;
+	int inprocess = 0;
+
+	/* When running inside the daemon the broadcasts are taken
+	   directly from the eventbus. The socket connection is then
+	   only used to pass the commands of the webgui to the daemon */
+	if(eventbus_running() == 0) {
+		eventbus_subscribe("webserver", "web", EVENTBUS_CONFIG | EVENTBUS_CORE, webserver_publish);
+		inprocess = 1;
+	}
 	while(webserver_loop && failures <= 5) {
 		struct ssdp_list_t *ssdp_list = NULL;
 		int standalone = 0;
@@ -931,8 +1315,10 @@ void *webserver_clientize(void *param) {
 		struct JsonNode *jclient = json_mkobject();
 		struct JsonNode *joptions = json_mkobject();
 		json_append_member(jclient, "action", json_mkstring("identify"));
-		json_append_member(joptions, "config", json_mknumber(1, 0));
-		json_append_member(joptions, "core", json_mknumber(1, 0));
+		if(inprocess == 0) {
+			json_append_member(joptions, "config", json_mknumber(1, 0));
+			json_append_member(joptions, "core", json_mknumber(1, 0));
+		}
 		json_append_member(jclient, "options", joptions);
 		json_append_member(jclient, "media", json_mkstring("web"));
 		char *out = json_stringify(jclient, NULL);
@@ -954,7 +1340,7 @@ void *webserver_clientize(void *param) {
 					char **array = NULL;
 					unsigned int n = explode(recvBuff, "\n", &array), i = 0;
 					for(i=0;i<n;i++) {
-						webserver_queue(array[i]);
+						webserver_queue(array[i], NULL);
 					}
 					array_free(&array, n);
 				}
@@ -977,8 +1363,20 @@ void *webserver_clientize(void *param) {
 static int webserver_handler(struct mg_connection *conn, enum mg_event ev) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
+	if(ev == MG_CLOSE) {
+		if(conn->is_websocket) {
+			websocket_remove(conn);
+		}
+		return MG_FALSE;
+	}
 	if(webserver_loop == 1) {
-		if(ev == MG_REQUEST || (ev == MG_POLL && !conn->is_websocket)) {
+		if(ev == MG_WS_CONNECT) {
+			websocket_add(conn);
+			return MG_FALSE;
+		} else if(ev == MG_POLL && conn->is_websocket) {
+			websocket_flush(conn);
+			return MG_FALSE;
+		} else if(ev == MG_REQUEST || (ev == MG_POLL && !conn->is_websocket)) {
 			if(ev == MG_POLL ||
 				(conn->is_websocket == 0 && webserver_connect_handler(conn) == MG_TRUE) ||
 				conn->is_websocket == 1) {
@@ -1017,6 +1415,10 @@ int webserver_start(void) {
 		pthread_mutexattr_settype(&webqueue_attr, PTHREAD_MUTEX_RECURSIVE);
 		pthread_mutex_init(&webqueue_lock, &webqueue_attr);
 		pthread_cond_init(&webqueue_signal, NULL);
+
+		pthread_mutexattr_init(&websocket_attr);
+		pthread_mutexattr_settype(&websocket_attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&websocket_lock, &websocket_attr);
 		webqueue_init = 1;
 	}
 
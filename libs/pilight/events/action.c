@@ -18,6 +18,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -42,6 +43,43 @@
 #include "action.h"
 #include "actions/action_header.h"
 
+/* Default number of threads actions are executed on */
+#define ACTION_THREADS	8
+
+static pthread_mutex_t action_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Signalled when a device has actions waiting */
+static pthread_cond_t action_signal = PTHREAD_COND_INITIALIZER;
+/* Signalled when an action finished */
+static pthread_cond_t action_idle = PTHREAD_COND_INITIALIZER;
+
+static pthread_t *action_workers = NULL;
+static struct event_action_thread_t **action_current = NULL;
+static int action_nrworkers = 0;
+static int action_maxworkers = 0;
+static int action_waiting = 0;
+static int action_stop = 0;
+
+/* Devices with pending actions in the order they were queued */
+static struct event_action_thread_t *action_ready = NULL;
+static struct event_action_thread_t *action_ready_tail = NULL;
+
+/* Continuations of actions waiting for their delay to pass */
+static struct event_wheel_t action_wheel;
+static pthread_t action_timer;
+static pthread_cond_t action_timer_signal = PTHREAD_COND_INITIALIZER;
+/* 0: not used yet, 1: running, 2: stopped */
+static int action_timer_init = 0;
+
+static unsigned long action_nrjobs = 0;
+static unsigned long action_nrdelayed = 0;
+static unsigned long action_nrcancelled = 0;
+static unsigned long action_latency = 0;
+static unsigned long action_latency_max = 0;
+static int action_running = 0;
+static int action_running_max = 0;
+
+static void *event_action_worker(void *param);
+
 #ifndef _WIN32
 void event_action_remove(char *name) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
@@ -194,6 +232,43 @@ int event_action_gc(void) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	struct event_actions_t *tmp_action = NULL;
+	int i = 0;
+
+	/* Abort the actions that are still running so the
+	   workers can be joined */
+	pthread_mutex_lock(&action_lock);
+	action_stop = 1;
+	for(i=0;i<action_nrworkers;i++) {
+		if(action_current[i] != NULL) {
+			action_current[i]->loop = 0;
+			pthread_cond_signal(&action_current[i]->cond);
+		}
+	}
+	pthread_cond_broadcast(&action_signal);
+	pthread_cond_signal(&action_timer_signal);
+	pthread_mutex_unlock(&action_lock);
+
+	for(i=0;i<action_nrworkers;i++) {
+		pthread_join(action_workers[i], NULL);
+	}
+	/* Pending continuations stay in the wheel until their
+	   devices are freed */
+	if(action_timer_init == 1) {
+		pthread_join(action_timer, NULL);
+		action_timer_init = 2;
+	}
+	if(action_workers != NULL) {
+		FREE(action_workers);
+		FREE(action_current);
+	}
+	action_nrworkers = 0;
+	action_stop = 0;
+
+	if(action_nrjobs > 0) {
+		logprintf(LOG_DEBUG, "executed %lu action steps, %lu delayed, %lu aborted before they started", action_nrjobs, action_nrdelayed, action_nrcancelled);
+		logprintf(LOG_DEBUG, "action queue latency %lu us on average, %lu us at most, %d actions running at most", action_latency/action_nrjobs, action_latency_max, action_running_max);
+	}
+
 	while(event_actions) {
 		tmp_action = event_actions;
 		if(tmp_action->nrthreads > 0) {
@@ -226,52 +301,354 @@ void event_action_thread_init(struct devices_t *dev) {
 	pthread_cond_init(&dev->action_thread->cond, NULL);
 	dev->action_thread->running = 0;
 	dev->action_thread->obj = NULL;
+	dev->action_thread->data = NULL;
 	dev->action_thread->action = NULL;
+	dev->action_thread->device = dev;
 	dev->action_thread->loop = 0;
-	dev->action_thread->initialized = 0;
-	memset(&dev->action_thread->pth, '\0', sizeof(pthread_t));
+	dev->action_thread->jobs = NULL;
+	dev->action_thread->delayed = NULL;
+	dev->action_thread->token = 0;
+	dev->action_thread->active = 0;
+	dev->action_thread->busy = 0;
+	dev->action_thread->ready = 0;
+	dev->action_thread->next = NULL;
 }
 
-void event_action_thread_start(struct devices_t *dev, char *name, void *(*func)(void *), struct rules_actions_t *obj) {
-	struct event_action_thread_t *thread = dev->action_thread;
+/* Queues a device with pending actions for the next idle worker */
+static void event_action_ready(struct event_action_thread_t *thread) {
+	thread->ready = 1;
+	thread->next = NULL;
+	if(action_ready_tail != NULL) {
+		action_ready_tail->next = thread;
+	} else {
+		action_ready = thread;
+	}
+	action_ready_tail = thread;
+}
+
+static void event_action_unready(struct event_action_thread_t *thread) {
+	struct event_action_thread_t *tmp = action_ready, *prev = NULL;
+
+	while(tmp) {
+		if(tmp == thread) {
+			if(prev != NULL) {
+				prev->next = tmp->next;
+			} else {
+				action_ready = tmp->next;
+			}
+			if(action_ready_tail == tmp) {
+				action_ready_tail = prev;
+			}
+			break;
+		}
+		prev = tmp;
+		tmp = tmp->next;
+	}
+	thread->next = NULL;
+	thread->ready = 0;
+}
+
+/*
+	Appends a job to the queue of its device and makes sure
+	a worker picks it up. Must be called with action_lock held.
+*/
+static void event_action_queue(struct event_action_thread_t *thread, struct event_action_job_t *job) {
+	struct event_action_job_t *tmp = NULL;
+	int nr = 0;
+
+	gettimeofday(&job->queued, NULL);
+	job->next = NULL;
+	if(thread->jobs == NULL) {
+		thread->jobs = job;
+	} else {
+		tmp = thread->jobs;
+		while(tmp->next) {
+			tmp = tmp->next;
+		}
+		tmp->next = job;
+	}
+	if(thread->busy == 0 && thread->ready == 0) {
+		event_action_ready(thread);
+	}
+
+	if(action_waiting == 0) {
+		if(action_workers == NULL) {
+			if(settings_find_number("action-threads", &action_maxworkers) != 0) {
+				action_maxworkers = ACTION_THREADS;
+			}
+			if((action_workers = MALLOC(sizeof(pthread_t)*(size_t)action_maxworkers)) == NULL ||
+			   (action_current = MALLOC(sizeof(struct event_action_thread_t *)*(size_t)action_maxworkers)) == NULL) {
+				fprintf(stderr, "out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		if(action_nrworkers < action_maxworkers) {
+			nr = action_nrworkers++;
+			action_current[nr] = NULL;
+			threads_create(&action_workers[nr], NULL, event_action_worker, (void *)(intptr_t)nr);
+		} else if(thread->busy == 0) {
+			logprintf(LOG_DEBUG, "all %d action threads are busy, queueing \"%s\" action for device \"%s\"", action_maxworkers, (job->action != NULL) ? job->action : thread->action, thread->device->id);
+		}
+	}
+	pthread_cond_signal(&action_signal);
+}
+
+/*
+	Lets a delayed continuation run right away. It runs with
+	loop cleared, so the action only cleans up after itself.
+	Must be called with action_lock held.
+*/
+static void event_action_resume(struct event_action_thread_t *thread) {
+	struct event_action_job_t *job = thread->delayed;
+
+	if(job != NULL) {
+		event_wheel_del(&action_wheel, &job->timer);
+		thread->delayed = NULL;
+		event_action_queue(thread, job);
+	}
+}
+
+/*
+	Aborts the running action of a device and drops the ones
+	still waiting for it. Continuations of the running action
+	are kept so they can clean up. Must be called with
+	action_lock held.
+*/
+static void event_action_cancel(struct event_action_thread_t *thread) {
+	struct event_action_job_t *tmp = NULL, *prev = NULL, *next = NULL;
 
 	if(thread->running == 1) {
-		logprintf(LOG_DEBUG, "aborting previous \"%s\" action for device \"%s\"", thread->action, dev->id);
+		logprintf(LOG_DEBUG, "aborting running \"%s\" action for device \"%s\"", thread->action, thread->device->id);
+	}
+	thread->token++;
+	if(thread->busy == 1) {
+		thread->loop = 0;
+		pthread_cond_signal(&thread->cond);
+	}
+	tmp = thread->jobs;
+	while(tmp) {
+		next = tmp->next;
+		if(tmp->action != NULL) {
+			if(prev != NULL) {
+				prev->next = next;
+			} else {
+				thread->jobs = next;
+			}
+			action_nrcancelled++;
+			FREE(tmp);
+		} else {
+			prev = tmp;
+		}
+		tmp = next;
 	}
+	if(thread->jobs == NULL && thread->ready == 1) {
+		event_action_unready(thread);
+	}
+	event_action_resume(thread);
+}
 
-	thread->loop = 0;
+/* Runs a single step of an action with action_lock released */
+static void event_action_run(struct event_action_thread_t *thread, struct event_action_job_t *job) {
+	job->func((void *)thread);
+	FREE(job);
+}
 
-	pthread_mutex_unlock(&thread->mutex);
-	pthread_cond_signal(&thread->cond);
+/*
+	Takes the next job of a device and prepares the device for
+	it. Must be called with action_lock held.
+*/
+static struct event_action_job_t *event_action_next(struct event_action_thread_t *thread) {
+	struct event_action_job_t *job = thread->jobs;
+	struct timeval tv;
+	unsigned long latency = 0;
+
+	thread->jobs = job->next;
+	thread->busy = 1;
+
+	gettimeofday(&tv, NULL);
+	latency = (unsigned long)((tv.tv_sec - job->queued.tv_sec) * 1000000 + (tv.tv_usec - job->queued.tv_usec));
+	action_latency += latency;
+	if(latency > action_latency_max) {
+		action_latency_max = latency;
+	}
+	action_nrjobs++;
+	if(++action_running > action_running_max) {
+		action_running_max = action_running;
+	}
+
+	/* Actions superseded by a newer one on the same device
+	   still run, but start out aborted */
+	thread->obj = job->obj;
+	thread->data = job->data;
+	thread->active = job->token;
+	thread->loop = (job->token == thread->token) ? 1 : 0;
+	if(thread->loop == 0 && job->action != NULL) {
+		action_nrcancelled++;
+	}
+	if(job->action != NULL) {
+		if((thread->action = REALLOC(thread->action, strlen(job->action)+1)) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		strcpy(thread->action, job->action);
+	}
+	return job;
+}
 
-	while(thread->running > 0) {
-		usleep(10);
+static void event_action_done(struct event_action_thread_t *thread) {
+	action_running--;
+	thread->busy = 0;
+	if(thread->jobs != NULL && thread->ready == 0) {
+		event_action_ready(thread);
 	}
+	pthread_cond_broadcast(&action_idle);
+}
+
+static void *event_action_worker(void *param) {
+	struct event_action_thread_t *thread = NULL;
+	struct event_action_job_t *job = NULL;
+	int nr = (int)(intptr_t)param;
+
+	pthread_mutex_lock(&action_lock);
+	while(action_stop == 0) {
+		if(action_ready == NULL) {
+			action_waiting++;
+			pthread_cond_wait(&action_signal, &action_lock);
+			action_waiting--;
+			continue;
+		}
+
+		thread = action_ready;
+		action_ready = thread->next;
+		if(action_ready == NULL) {
+			action_ready_tail = NULL;
+		}
+		thread->next = NULL;
+		thread->ready = 0;
+
+		job = event_action_next(thread);
+		action_current[nr] = thread;
+		pthread_mutex_unlock(&action_lock);
+
+		event_action_run(thread, job);
+
+		pthread_mutex_lock(&action_lock);
+		action_current[nr] = NULL;
+		event_action_done(thread);
+	}
+	pthread_mutex_unlock(&action_lock);
+
+	return (void *)NULL;
+}
+
+/* Hands continuations whose delay passed back to the workers */
+static void *event_action_timer(void *param) {
+	struct event_timer_t *expired = NULL, *timer = NULL;
+	struct event_action_job_t *job = NULL;
+	struct timespec ts;
+	struct timeval tv;
+	unsigned long long now = 0, next = 0;
+
+	pthread_mutex_lock(&action_lock);
+	while(action_stop == 0) {
+		now = event_timer_clock();
+		expired = event_wheel_run(&action_wheel, now);
+		while(expired) {
+			timer = expired;
+			expired = expired->next;
+			job = (struct event_action_job_t *)timer->data;
+			job->thread->delayed = NULL;
+			event_action_queue(job->thread, job);
+		}
+
+		if(event_wheel_next(&action_wheel, &next) != 0) {
+			pthread_cond_wait(&action_timer_signal, &action_lock);
+		} else if(next > now) {
+			next -= now;
+			gettimeofday(&tv, NULL);
+			ts.tv_sec = tv.tv_sec + (time_t)(next / 1000);
+			ts.tv_nsec = (tv.tv_usec * 1000) + (long)((next % 1000) * 1000000);
+			if(ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&action_timer_signal, &action_lock, &ts);
+		}
+	}
+	pthread_mutex_unlock(&action_lock);
+
+	return (void *)NULL;
+}
 
-	if(thread->initialized == 1) {
-		pthread_join(thread->pth, NULL);
-		thread->initialized = 0;
+void event_action_thread_start(struct devices_t *dev, char *name, void *(*func)(void *), struct rules_actions_t *obj) {
+	struct event_action_thread_t *thread = dev->action_thread;
+	struct event_action_job_t *job = NULL;
+
+	if((job = MALLOC(sizeof(struct event_action_job_t))) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
 	}
+	job->action = name;
+	job->func = func;
+	job->obj = obj;
+	job->data = NULL;
+	job->thread = thread;
 
-	// if(thread->param != NULL) {
-		// json_delete(thread->param);
-		// thread->param = NULL;
-	// }
+	pthread_mutex_lock(&action_lock);
+	if(thread->running == 1) {
+		logprintf(LOG_DEBUG, "aborting previous \"%s\" action for device \"%s\"", thread->action, dev->id);
+	}
 
-	// if(param != NULL) {
-		// char *json = json_stringify(param, NULL);
-		// thread->param = json_decode(json);
-		// json_free(json);
-	// }
+	job->token = ++thread->token;
+	if(thread->busy == 1) {
+		thread->loop = 0;
+		pthread_cond_signal(&thread->cond);
+	}
+	/* A delayed previous action has to finish before this one */
+	event_action_resume(thread);
+	event_action_queue(thread, job);
+	pthread_mutex_unlock(&action_lock);
+}
 
-	thread->obj = obj;
-	thread->device = dev;
-	thread->loop = 1;
-	thread->action = REALLOC(thread->action, strlen(name)+1);
-	strcpy(thread->action, name);
+/*
+	Continues the running action with func after msec
+	milliseconds without occupying a thread in the meantime.
+	func gets the same thread with data set to the data passed.
+	If the action is aborted before that, func is called right
+	away with loop cleared, so it can always free its data.
+*/
+void event_action_thread_delay(struct event_action_thread_t *thread, unsigned long msec, void *(*func)(void *), void *data) {
+	struct event_action_job_t *job = NULL;
 
-	thread->initialized = 1;
-	threads_create(&thread->pth, NULL, func, (void *)thread);
+	if((job = MALLOC(sizeof(struct event_action_job_t))) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	job->action = NULL;
+	job->func = func;
+	job->obj = thread->obj;
+	job->data = data;
+	job->thread = thread;
+	job->token = thread->active;
+	event_timer_init(&job->timer, job);
+
+	pthread_mutex_lock(&action_lock);
+	if(job->token != thread->token || action_stop == 1) {
+		event_action_queue(thread, job);
+	} else {
+		if(action_timer_init != 1) {
+			if(action_timer_init == 0) {
+				event_wheel_init(&action_wheel, event_timer_clock());
+			}
+			threads_create(&action_timer, NULL, event_action_timer, NULL);
+			action_timer_init = 1;
+		}
+		event_wheel_add(&action_wheel, &job->timer, event_timer_clock() + msec);
+		thread->delayed = job;
+		action_nrdelayed++;
+		pthread_cond_signal(&action_timer_signal);
+	}
+	pthread_mutex_unlock(&action_lock);
 }
 
 int event_action_thread_wait(struct devices_t *dev, int interval) {
@@ -279,8 +656,7 @@ int event_action_thread_wait(struct devices_t *dev, int interval) {
 
 	struct timeval tp;
 	struct timespec ts;
-
-	pthread_mutex_unlock(&dev->action_thread->mutex);
+	int ret = 0;
 
 	gettimeofday(&tp, NULL);
 	ts.tv_sec = tp.tv_sec;
@@ -288,32 +664,39 @@ int event_action_thread_wait(struct devices_t *dev, int interval) {
 	ts.tv_sec += interval;
 
 	pthread_mutex_lock(&dev->action_thread->mutex);
+	ret = pthread_cond_timedwait(&dev->action_thread->cond, &dev->action_thread->mutex, &ts);
+	pthread_mutex_unlock(&dev->action_thread->mutex);
 
-	return pthread_cond_timedwait(&dev->action_thread->cond, &dev->action_thread->mutex, &ts);
+	return ret;
 }
 
 void event_action_thread_stop(struct devices_t *dev) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	struct event_action_thread_t *thread = NULL;
+	struct event_action_job_t *job = NULL;
 
 	if(dev != NULL) {
 		thread = dev->action_thread;
-		if(thread->running == 1) {
-			logprintf(LOG_DEBUG, "aborting running \"%s\" action for device \"%s\"", thread->action, dev->id);
-
-			thread->loop = 0;
-			pthread_mutex_unlock(&thread->mutex);
-			pthread_cond_signal(&thread->cond);
-
-			while(thread->running > 0) {
-				usleep(10);
+		pthread_mutex_lock(&action_lock);
+		event_action_cancel(thread);
+		while(thread->busy == 1 || thread->jobs != NULL) {
+			if(action_nrworkers == 0) {
+				/* Without workers the continuations are run here */
+				if(thread->ready == 1) {
+					event_action_unready(thread);
+				}
+				job = event_action_next(thread);
+				pthread_mutex_unlock(&action_lock);
+				event_action_run(thread, job);
+				pthread_mutex_lock(&action_lock);
+				event_action_done(thread);
+				event_action_resume(thread);
+			} else {
+				pthread_cond_wait(&action_idle, &action_lock);
 			}
 		}
-		if(thread->initialized == 1) {
-			pthread_join(thread->pth, NULL);
-			thread->initialized = 0;
-		}
+		pthread_mutex_unlock(&action_lock);
 	}
 }
 
@@ -323,28 +706,14 @@ void event_action_thread_free(struct devices_t *dev) {
 	struct event_action_thread_t *thread = NULL;
 
 	if(dev != NULL) {
+		event_action_thread_stop(dev);
 		thread = dev->action_thread;
-		if(thread->running == 1) {
-			logprintf(LOG_DEBUG, "aborting running \"%s\" action for device \"%s\"", thread->action, dev->id);
-
-			thread->loop = 0;
-			pthread_mutex_unlock(&thread->mutex);
-			pthread_cond_signal(&thread->cond);
-			while(thread->running > 0) {
-				usleep(10);
-			}
-		}
 		if(thread->action != NULL) {
 			FREE(thread->action);
 		}
-		// if(thread->param != NULL) {
-			// json_delete(thread->param);
-			// thread->param = NULL;
-		// }
-		if(thread->initialized == 1) {
-			pthread_join(thread->pth, NULL);
-			thread->initialized = 0;
-		}
+		pthread_mutex_destroy(&thread->mutex);
+		pthread_mutexattr_destroy(&thread->attr);
+		pthread_cond_destroy(&thread->cond);
 		FREE(dev->action_thread);
 	}
 }
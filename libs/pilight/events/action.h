@@ -19,11 +19,14 @@
 #ifndef _ACTION_H_
 #define _ACTION_H_
 
+#include <sys/time.h>
+
 typedef struct event_action_thread_t event_action_thread_t;
 typedef struct event_actions_t event_actions_t;
 
 #include "../core/json.h"
 #include "../core/common.h"
+#include "timer.h"
 #include "../config/devices.h"
 #include "../config/rules.h"
 
@@ -37,17 +40,44 @@ struct event_actions_t {
 	struct event_actions_t *next;
 };
 
+typedef struct event_action_job_t {
+	/* NULL for the continuation of a running action */
+	char *action;
+	void *(*func)(void *);
+	struct rules_actions_t *obj;
+	struct event_action_thread_t *thread;
+	void *data;
+	unsigned long token;
+	struct timeval queued;
+	struct event_timer_t timer;
+
+	struct event_action_job_t *next;
+} event_action_job_t;
+
 struct event_action_thread_t {
 	int running;
 	int loop;
-	int initialized;
 	char *action;
-	pthread_t pth;
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
 	pthread_mutexattr_t attr;
 	struct rules_actions_t *obj;
 	struct devices_t *device;
+	/* Passed on by event_action_thread_delay */
+	void *data;
+
+	/* Actions waiting to run on this device, oldest first */
+	struct event_action_job_t *jobs;
+	/* Continuation waiting in the timer wheel */
+	struct event_action_job_t *delayed;
+	/* Token of the latest action, older ones run cancelled */
+	unsigned long token;
+	/* Token of the action being run */
+	unsigned long active;
+	int busy;
+	int ready;
+
+	struct event_action_thread_t *next;
 };
 
 struct event_actions_t *event_actions;
@@ -58,6 +88,7 @@ int event_action_gc(void);
 void event_action_thread_init(struct devices_t *dev);
 int event_action_thread_wait(struct devices_t *dev, int interval);
 void event_action_thread_start(struct devices_t *dev, char *name, void *(*func)(void *), struct rules_actions_t *obj);
+void event_action_thread_delay(struct event_action_thread_t *thread, unsigned long msec, void *(*func)(void *), void *data);
 void event_action_thread_stop(struct devices_t *dev);
 void event_action_thread_free(struct devices_t *dev);
 void event_action_stopped(struct event_action_thread_t *thread);
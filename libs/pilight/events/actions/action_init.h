@@ -0,0 +1,8 @@
+	actionDimInit();
+	actionLabelInit();
+	actionPushbulletInit();
+	actionPushoverInit();
+	actionSendmailInit();
+	actionSwitchInit();
+	actionToggleInit();
+
@@ -440,6 +440,123 @@ static int checkArguments(struct rules_actions_t *obj) {
 	return 0;
 }
 
+/* State carried from one step of the action to the next */
+typedef struct data_t {
+	char *old_state;
+	char state[3];
+	double old_dimlevel;
+	double new_dimlevel;
+	double cur_dimlevel;
+	int direction;
+	/* Next dimlevel when dimming gently */
+	int dimlevel;
+	unsigned long msec_in;
+	unsigned long msec_for;
+} data_t;
+
+static void *finish(struct event_action_thread_t *pth, struct data_t *data) {
+	if(data->old_state != NULL) {
+		FREE(data->old_state);
+	}
+	FREE(data);
+
+	event_action_stopped(pth);
+
+	return (void *)NULL;
+}
+
+static void *restore(void *param) {
+	struct event_action_thread_t *pth = (struct event_action_thread_t *)param;
+	struct data_t *data = pth->data;
+	struct JsonNode *jvalues = NULL;
+
+	if(pth->loop == 1) {
+		jvalues = json_mkobject();
+		json_append_member(jvalues, "dimlevel", json_mknumber(data->cur_dimlevel, 0));
+		if(pilight.control != NULL) {
+			if(strcmp(data->old_state, "off") == 0) {
+				pilight.control(pth->device, data->state, json_first_child(jvalues), ACTION);
+				pilight.control(pth->device, data->old_state, NULL, ACTION);
+			} else {
+				pilight.control(pth->device, data->old_state, json_first_child(jvalues), ACTION);
+			}
+		}
+		json_delete(jvalues);
+	}
+
+	return finish(pth, data);
+}
+
+static void *changed(struct event_action_thread_t *pth, struct data_t *data) {
+	/*
+	 * We only need to restore the state if it was actually changed
+	 */
+	if(pth->loop == 1 && data->msec_for > 0 && data->old_state != NULL &&
+	   (strcmp(data->old_state, "on") != 0 || (int)data->cur_dimlevel != (int)data->new_dimlevel)) {
+		event_action_thread_delay(pth, data->msec_for, restore, data);
+		return (void *)NULL;
+	}
+
+	return finish(pth, data);
+}
+
+static void *change(void *param) {
+	struct event_action_thread_t *pth = (struct event_action_thread_t *)param;
+	struct data_t *data = pth->data;
+	struct JsonNode *jvalues = NULL;
+
+	if(pth->loop == 1) {
+		jvalues = json_mkobject();
+		json_append_member(jvalues, "dimlevel", json_mknumber(data->new_dimlevel, 0));
+		if(pilight.control != NULL) {
+			pilight.control(pth->device, data->state, json_first_child(jvalues), ACTION);
+		}
+		json_delete(jvalues);
+	}
+
+	return changed(pth, data);
+}
+
+static void *step(void *param) {
+	struct event_action_thread_t *pth = (struct event_action_thread_t *)param;
+	struct data_t *data = pth->data;
+	struct JsonNode *jvalues = NULL;
+
+	if(pth->loop == 1) {
+		jvalues = json_mkobject();
+		json_append_member(jvalues, "dimlevel", json_mknumber(data->dimlevel, 0));
+		if(pilight.control != NULL) {
+			pilight.control(pth->device, data->state, json_first_child(jvalues), ACTION);
+		}
+		json_delete(jvalues);
+
+		if(data->direction == INCREASING) {
+			data->dimlevel++;
+		} else {
+			data->dimlevel--;
+		}
+		if((data->direction == INCREASING && data->dimlevel <= (int)data->new_dimlevel) ||
+		   (data->direction == DECREASING && data->dimlevel >= (int)data->new_dimlevel)) {
+			event_action_thread_delay(pth, data->msec_in, step, data);
+			return (void *)NULL;
+		}
+	}
+
+	return changed(pth, data);
+}
+
+static void *gently(void *param) {
+	struct event_action_thread_t *pth = (struct event_action_thread_t *)param;
+	struct data_t *data = pth->data;
+
+	if(pth->loop == 1) {
+		event_action_thread_delay(pth, data->msec_in, step, data);
+		return (void *)NULL;
+	}
+
+	return finish(pth, data);
+}
+
 static void *thread(void *param) {
 	struct event_action_thread_t *pth = (struct event_action_thread_t *)param;
 	struct JsonNode *json = pth->obj->parsedargs;
@@ -457,17 +574,23 @@ static void *thread(void *param) {
 	struct JsonNode *jfvalues = NULL;
 	struct JsonNode *jaseconds = NULL;
 	struct JsonNode *jiseconds = NULL;
-	struct JsonNode *jvalues = NULL;
-	char *old_state = NULL, **array = NULL;
-	double dimlevel = 0.0, old_dimlevel = 0.0, new_dimlevel = 0.0, cur_dimlevel = 0.0;
+	struct data_t *data = NULL;
+	char **array = NULL;
 	int seconds_after = 0, seconds_for = 0, seconds_in = 0, has_in = 0, dimdiff = 0;
 	int type_for = 0, type_after = 0, type_in = 0;
-	int direction = 0, interval = 0, timer = 0;
+	int interval = 0;
 	int	l = 0, i = 0, nrunits = (sizeof(units)/sizeof(units[0]));
-	char state[3];
+	unsigned long msec_after = 0;
+	void *(*next)(void *) = NULL;
 
 	event_action_started(pth);
 
+	if((data = MALLOC(sizeof(struct data_t))) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(data, '\0', sizeof(struct data_t));
+
 	if((jfor = json_find_member(json, "FOR")) != NULL) {
 		if((jcvalues = json_find_member(jfor, "value")) != NULL) {
 			jaseconds = json_find_element(jcvalues, 0);
@@ -570,6 +693,9 @@ static void *thread(void *param) {
 		break;
 	}
 
+	msec_after = (unsigned long)seconds_after * ((type_after > 1) ? 1000 : 1);
+	data->msec_for = (unsigned long)seconds_for * ((type_for > 1) ? 1000 : 1);
+
 	if(pilight.debuglevel == 1) {
 		fprintf(stderr, "action dim: for %d:%d, after %d:%d, in: %d:%d\n", seconds_for, type_for, seconds_after, type_after, seconds_in, type_in);
 	}
@@ -581,17 +707,17 @@ static void *thread(void *param) {
 		while(opt) {
 			if(strcmp(opt->name, "state") == 0) {
 				if(opt->values->type == JSON_STRING) {
-					if((old_state = MALLOC(strlen(opt->values->string_)+1)) == NULL) {
+					if((data->old_state = MALLOC(strlen(opt->values->string_)+1)) == NULL) {
 						fprintf(stderr, "out of memory\n");
 						exit(EXIT_FAILURE);
 					}
-					strcpy(old_state, opt->values->string_);
+					strcpy(data->old_state, opt->values->string_);
 					match1 = 1;
 				}
 			}
 			if(strcmp(opt->name, "dimlevel") == 0) {
 				if(opt->values->type == JSON_NUMBER) {
-					cur_dimlevel = opt->values->number_;
+					data->cur_dimlevel = opt->values->number_;
 					match2 = 1;
 				}
 			}
@@ -617,7 +743,7 @@ static void *thread(void *param) {
 			jsdimlevel = json_find_element(jevalues, 0);
 			if(jsdimlevel != NULL) {
 				if(jsdimlevel->tag == JSON_NUMBER) {
-					old_dimlevel = (int)jsdimlevel->number_;
+					data->old_dimlevel = (int)jsdimlevel->number_;
 				}
 			}
 		}
@@ -628,182 +754,57 @@ static void *thread(void *param) {
 			jedimlevel = json_find_element(javalues, 0);
 			if(jedimlevel != NULL) {
 				if(jedimlevel->tag == JSON_NUMBER) {
-					new_dimlevel = (int)jedimlevel->number_;
-					dimlevel = (int)jedimlevel->number_;
-					strcpy(state,  "on");
+					data->new_dimlevel = (int)jedimlevel->number_;
+					strcpy(data->state,  "on");
 				}
 			}
 		}
 	}
 
 	if(pilight.debuglevel == 1) {
-		fprintf(stderr, "action dim: old %d, new %d, direction %d\n", (int)old_dimlevel, (int)new_dimlevel, direction);
+		fprintf(stderr, "action dim: old %d, new %d, direction %d\n", (int)data->old_dimlevel, (int)data->new_dimlevel, data->direction);
 	}
 
 	if(has_in == 1) {
-		if(old_dimlevel < new_dimlevel) {
-			direction = INCREASING;
-			dimdiff = (int)(new_dimlevel - old_dimlevel);
+		if(data->old_dimlevel < data->new_dimlevel) {
+			data->direction = INCREASING;
+			dimdiff = (int)(data->new_dimlevel - data->old_dimlevel);
 			interval = (int)(seconds_in / dimdiff);
-		} else if(old_dimlevel > new_dimlevel) {
-			direction = DECREASING;
-			dimdiff = (int)(old_dimlevel - new_dimlevel);
+		} else if(data->old_dimlevel > data->new_dimlevel) {
+			data->direction = DECREASING;
+			dimdiff = (int)(data->old_dimlevel - data->new_dimlevel);
 			interval = (int)(seconds_in / dimdiff);
 		} else {
 			dimdiff = 0;
 			interval = 0;
 		}
 	}
+	data->msec_in = (unsigned long)interval * ((type_in > 1) ? 1000 : 1);
+	data->dimlevel = (int)data->old_dimlevel;
 
 	/*
 	 * We'll switch from first dimlevel to second dimlevel after X seconds
 	 * and switch back after X seconds.
 	 */
 	if(has_in == 0) {
-		if(old_state == NULL || ((strcmp(old_state, "on") != 0 || (int)cur_dimlevel != (int)new_dimlevel))) {
-			timer = 0;
-			while(pth->loop == 1) {
-				if(timer == seconds_after) {
-					jvalues = json_mkobject();
-					json_append_member(jvalues, "dimlevel", json_mknumber(dimlevel, 0));
-					if(pilight.control != NULL) {
-						pilight.control(pth->device, state, json_first_child(jvalues), ACTION);
-					}
-					json_delete(jvalues);
-					break;
-				}
-				timer++;
-				if(type_after > 1) {
-					sleep(1);
-				} else {
-					usleep(1000);
-				}
-			}
-
-			/*
-			 * We only need to restore the state if it was actually changed
-			 */
-			if(seconds_for > 0 && old_state != NULL && (strcmp(old_state, "on") != 0 || (int)cur_dimlevel != (int)new_dimlevel)) {
-				timer = 0;
-				while(pth->loop == 1) {
-					if(seconds_for == timer) {
-						jvalues = json_mkobject();
-						json_append_member(jvalues, "dimlevel", json_mknumber(cur_dimlevel, 0));
-						if(pilight.control != NULL) {
-							if(strcmp(old_state, "off") == 0) {
-								pilight.control(pth->device, state, json_first_child(jvalues), ACTION);
-								pilight.control(pth->device, old_state, NULL, ACTION);
-							} else {
-								pilight.control(pth->device, old_state, json_first_child(jvalues), ACTION);
-							}
-						}
-						json_delete(jvalues);
-						break;
-					}
-					timer++;
-					if(type_for > 1) {
-						sleep(1);
-					} else {
-						usleep(1000);
-					}
-				}
-			}
+		if(data->old_state == NULL || ((strcmp(data->old_state, "on") != 0 || (int)data->cur_dimlevel != (int)data->new_dimlevel))) {
+			next = change;
 		}
 	/* We'll gently start increasing / decreasing the dimlevel after X seconds in X seconds. */
 	} else if(interval > 0) {
-		timer = 0;
-		while(pth->loop == 1) {
-			if(timer == seconds_after) {
-				break;
-			}
-			timer++;
-			if(type_after > 1) {
-				sleep(1);
-			} else {
-				usleep(1000);
-			}
-		}
-		if(direction == INCREASING) {
-			for(i=(int)old_dimlevel;i<=(int)new_dimlevel;i++) {
-				timer = 0;
-				while(pth->loop == 1) {
-					if(interval == timer) {
-						jvalues = json_mkobject();
-						json_append_member(jvalues, "dimlevel", json_mknumber(i, 0));
-						if(pilight.control != NULL) {
-							pilight.control(pth->device, state, json_first_child(jvalues), ACTION);
-						}
-						json_delete(jvalues);
-						break;
-					}
-					timer++;
-					if(type_in > 1) {
-						sleep(1);
-					} else {
-						usleep(1000);
-					}
-				}
-			}
-		} else {
-			for(i=(int)old_dimlevel;i>=(int)new_dimlevel;i--) {
-				timer = 0;
-				while(pth->loop == 1) {
-					if(interval == timer) {
-						jvalues = json_mkobject();
-						json_append_member(jvalues, "dimlevel", json_mknumber(i, 0));
-						if(pilight.control != NULL) {
-							pilight.control(pth->device, state, json_first_child(jvalues), ACTION);
-						}
-						json_delete(jvalues);
-						break;
-					}
-					timer++;
-					if(type_in > 1) {
-						sleep(1);
-					} else {
-						usleep(1000);
-					}
-				}
-			}
-		}
-		/*
-		 * We only need to restore the state if it was actually changed
-		 */
-		if(seconds_for > 0 && old_state != NULL &&
-			 (strcmp(old_state, "on") != 0 || (int)cur_dimlevel != (int)new_dimlevel)) {
-			timer = 0;
-			while(pth->loop == 1) {
-				if(timer == seconds_for) {
-					jvalues = json_mkobject();
-					json_append_member(jvalues, "dimlevel", json_mknumber(cur_dimlevel, 0));
-					if(pilight.control != NULL) {
-						if(strcmp(old_state, "off") == 0) {
-							pilight.control(pth->device, state, json_first_child(jvalues), ACTION);
-							pilight.control(pth->device, old_state, NULL, ACTION);
-						} else {
-							pilight.control(pth->device, old_state, json_first_child(jvalues), ACTION);
-						}
-					}
-					json_delete(jvalues);
-					break;
-				}
-				timer++;
-				if(type_for > 1) {
-					sleep(1);
-				} else {
-					usleep(1000);
-				}
-			}
-		}
+		next = gently;
 	}
 
-	if(old_state != NULL) {
-		FREE(old_state);
+	if(next == NULL) {
+		return finish(pth, data);
 	}
+	if(pth->loop == 1 && msec_after > 0) {
+		event_action_thread_delay(pth, msec_after, next, data);
+		return (void *)NULL;
+	}
+	pth->data = data;
 
-	event_action_stopped(pth);
-
-	return (void *)NULL;
+	return next(param);
 }
 
 static int run(struct rules_actions_t *obj) {
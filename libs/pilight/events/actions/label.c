@@ -263,38 +263,165 @@ static int checkArguments(struct rules_actions_t *obj) {
 	return 0;
 }
 
-static void *thread(void *param) {
+/* State carried from one step of the action to the next */
+typedef struct data_t {
+	char *old_label;
+	char *new_label;
+	char *old_color;
+	char *new_color;
+	unsigned long msec_for;
+} data_t;
+
+static void *finish(struct event_action_thread_t *pth, struct data_t *data) {
+	if(data->old_label != NULL) {
+		FREE(data->old_label);
+	}
+	if(data->new_label != NULL) {
+		FREE(data->new_label);
+	}
+	if(data->old_color != NULL) {
+		FREE(data->old_color);
+	}
+	if(data->new_color != NULL) {
+		FREE(data->new_color);
+	}
+	FREE(data);
+
+	event_action_stopped(pth);
+
+	return (void *)NULL;
+}
+
+static void *restore(void *param) {
 	struct event_action_thread_t *pth = (struct event_action_thread_t *)param;
+	struct data_t *data = pth->data;
+	struct JsonNode *jvalues = NULL;
+
+	if(pth->loop == 1) {
+		if(pilight.control != NULL) {
+			jvalues = json_mkobject();
+			if(data->old_color != NULL) {
+				json_append_member(jvalues, "color", json_mkstring(data->old_color));
+			}
+			json_append_member(jvalues, "label", json_mkstring(data->old_label));
+			pilight.control(pth->device, NULL, json_first_child(jvalues), ACTION);
+			json_delete(jvalues);
+		}
+	}
+
+	return finish(pth, data);
+}
+
+static void *change(void *param) {
+	struct event_action_thread_t *pth = (struct event_action_thread_t *)param;
+	struct data_t *data = pth->data;
 	struct JsonNode *json = pth->obj->parsedargs;
 	struct JsonNode *jto = NULL;
+	struct JsonNode *javalues = NULL;
+	struct JsonNode *jlabel = NULL;
+	struct JsonNode *jvalues = NULL;
+	char *label = NULL;
+	int free_label = 0;
+
+	if(pth->loop == 1) {
+		if((jto = json_find_member(json, "TO")) != NULL) {
+			if((javalues = json_find_member(jto, "value")) != NULL) {
+				jlabel = json_find_element(javalues, 0);
+				if(jlabel != NULL) {
+					if(jlabel->tag == JSON_STRING) {
+						label = jlabel->string_;
+					} else if(jlabel->tag == JSON_NUMBER) {
+						int l = snprintf(NULL, 0, "%.*f", jlabel->decimals_, jlabel->number_);
+						if((label = MALLOC(l+1)) == NULL) {
+							fprintf(stderr, "out of memory\n");
+							exit(EXIT_FAILURE);
+						}
+						memset(label, '\0', l);
+						free_label = 1;
+						snprintf(label, l, "%.*f", jlabel->decimals_, jlabel->number_);
+						label[l] = '\0';
+					}
+					if((data->new_label = MALLOC(strlen(label)+1)) == NULL) {
+						fprintf(stderr, "out of memory\n");
+						exit(EXIT_FAILURE);
+					}
+					strcpy(data->new_label, label);
+					/*
+					 * We're not switching when current label or is the same as
+					 * the old label or old color.
+					 */
+					if(data->old_label == NULL || strcmp(data->old_label, data->new_label) != 0 ||
+						(data->old_color != NULL && data->new_color != NULL && strcmp(data->old_color, data->new_color) != 0)) {
+						if(pilight.control != NULL) {
+							jvalues = json_mkobject();
+							if(data->new_color != NULL) {
+								json_append_member(jvalues, "color", json_mkstring(data->new_color));
+							}
+							json_append_member(jvalues, "label", json_mkstring(label));
+							pilight.control(pth->device, NULL, json_first_child(jvalues), ACTION);
+							json_delete(jvalues);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	if(free_label == 1) {
+		FREE(label);
+	}
+
+	/*
+	 * We only need to restore the label if it was actually changed
+	 */
+	if(pth->loop == 1 && data->msec_for > 0 &&
+	   ((data->old_label != NULL && data->new_label != NULL && strcmp(data->old_label, data->new_label) != 0) ||
+	   (data->old_color != NULL && data->new_color != NULL && strcmp(data->old_color, data->new_color) != 0))) {
+		event_action_thread_delay(pth, data->msec_for, restore, data);
+		return (void *)NULL;
+	}
+
+	return finish(pth, data);
+}
+
+static void *thread(void *param) {
+	struct event_action_thread_t *pth = (struct event_action_thread_t *)param;
+	struct JsonNode *json = pth->obj->parsedargs;
 	struct JsonNode *jafter = NULL;
 	struct JsonNode *jfor = NULL;
 	struct JsonNode *jcolor = NULL;
-	struct JsonNode *javalues = NULL;
 	struct JsonNode *jcvalues = NULL;
 	struct JsonNode *jdvalues = NULL;
 	struct JsonNode *jevalues = NULL;
-	struct JsonNode *jlabel = NULL;
 	struct JsonNode *jaseconds = NULL;
-	struct JsonNode *jvalues = NULL;
-	char *new_label = NULL, *old_label = NULL, *label = NULL, **array = NULL;
-	char *new_color = NULL, *old_color = NULL, *color = NULL;
-	int seconds_after = 0, type_after = 0, free_label = 0;
+	struct data_t *data = NULL;
+	char **array = NULL;
+	int seconds_after = 0, type_after = 0;
 	int	l = 0, i = 0, nrunits = (sizeof(units)/sizeof(units[0]));
-	int seconds_for = 0, type_for = 0, timer = 0;
+	int seconds_for = 0, type_for = 0;
+	unsigned long msec_after = 0;
 
 	event_action_started(pth);
 
+	if((data = MALLOC(sizeof(struct data_t))) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	data->old_label = NULL;
+	data->new_label = NULL;
+	data->old_color = NULL;
+	data->new_color = NULL;
+	data->msec_for = 0;
+
 	if((jcolor = json_find_member(json, "COLOR")) != NULL) {
 		if((jevalues = json_find_member(jcolor, "value")) != NULL) {
 			jcolor = json_find_element(jevalues, 0);
 			if(jcolor != NULL && jcolor->tag == JSON_STRING) {
-				color = jcolor->string_;
-				if((new_color = MALLOC(strlen(color)+1)) == NULL) {
+				if((data->new_color = MALLOC(strlen(jcolor->string_)+1)) == NULL) {
 					fprintf(stderr, "out of memory\n");
 					exit(EXIT_FAILURE);
 				}
-				strcpy(new_color, color);
+				strcpy(data->new_color, jcolor->string_);
 			}
 		}
 	}
@@ -329,7 +456,7 @@ static void *thread(void *param) {
 					if(l == 2) {
 						for(i=0;i<nrunits;i++) {
 							if(strcmp(array[1], units[i].name) == 0) {
-								seconds_after = atoi(array[1]);
+								seconds_after = atoi(array[0]);
 								type_after = units[i].id;
 								break;
 							}
@@ -365,6 +492,9 @@ static void *thread(void *param) {
 		break;
 	}
 
+	msec_after = (unsigned long)seconds_after * ((type_after > 1) ? 1000 : 1);
+	data->msec_for = (unsigned long)seconds_for * ((type_for > 1) ? 1000 : 1);
+
 	/* Store current label */
 	struct devices_t *tmp = pth->device;
 	int match1 = 0, match2 = 0;
@@ -373,21 +503,21 @@ static void *thread(void *param) {
 		while(opt) {
 			if(strcmp(opt->name, "label") == 0) {
 				if(opt->values->type == JSON_STRING) {
-					if((old_label = MALLOC(strlen(opt->values->string_)+1)) == NULL) {
+					if((data->old_label = MALLOC(strlen(opt->values->string_)+1)) == NULL) {
 						fprintf(stderr, "out of memory\n");
 						exit(EXIT_FAILURE);
 					}
-					strcpy(old_label, opt->values->string_);
+					strcpy(data->old_label, opt->values->string_);
 					match1 = 1;
 				}
 			}
 			if(strcmp(opt->name, "color") == 0) {
 				if(opt->values->type == JSON_STRING) {
-					if((old_color = MALLOC(strlen(opt->values->string_)+1)) == NULL) {
+					if((data->old_color = MALLOC(strlen(opt->values->string_)+1)) == NULL) {
 						fprintf(stderr, "out of memory\n");
 						exit(EXIT_FAILURE);
 					}
-					strcpy(old_color, opt->values->string_);
+					strcpy(data->old_color, opt->values->string_);
 					match2 = 1;
 				}
 			}
@@ -405,113 +535,13 @@ static void *thread(void *param) {
 		logprintf(LOG_NOTICE, "could not store old color of \"%s\"", pth->device->id);
 	}
 
-	timer = 0;
-	while(pth->loop == 1) {
-		if(timer == seconds_after) {
-			if((jto = json_find_member(json, "TO")) != NULL) {
-				if((javalues = json_find_member(jto, "value")) != NULL) {
-					jlabel = json_find_element(javalues, 0);
-					if(jlabel != NULL) {
-						if(jlabel->tag == JSON_STRING) {
-							label = jlabel->string_;
-						} else if(jlabel->tag == JSON_NUMBER) {
-							int l = snprintf(NULL, 0, "%.*f", jlabel->decimals_, jlabel->number_);
-							if((label = MALLOC(l+1)) == NULL) {
-								fprintf(stderr, "out of memory\n");
-								exit(EXIT_FAILURE);
-							}
-							memset(label, '\0', l);
-							free_label = 1;
-							snprintf(label, l, "%.*f", jlabel->decimals_, jlabel->number_);
-							label[l] = '\0';
-						}
-						if((new_label = MALLOC(strlen(label)+1)) == NULL) {
-							fprintf(stderr, "out of memory\n");
-							exit(EXIT_FAILURE);
-						}
-						strcpy(new_label, label);
-						/*
-						 * We're not switching when current label or is the same as
-						 * the old label or old color.
-						 */
-						if(old_label == NULL || strcmp(old_label, new_label) != 0 ||
-							(old_color != NULL && new_color != NULL && strcmp(old_color, new_color) != 0)) {
-							if(pilight.control != NULL) {
-								jvalues = json_mkobject();
-								if(color != NULL) {
-									json_append_member(jvalues, "color", json_mkstring(color));
-								}
-								json_append_member(jvalues, "label", json_mkstring(label));
-								pilight.control(pth->device, NULL, json_first_child(jvalues), ACTION);
-								json_delete(jvalues);
-								break;
-							}
-						}
-					}
-				}
-			}
-			break;
-		}
-		timer++;
-		if(type_after > 1) {
-			sleep(1);
-		} else {
-			usleep(1000);
-		}
-	}
-
-	/*
-	 * We only need to restore the label if it was actually changed
-	 */
-	if(seconds_for > 0 && ((old_label != NULL && new_label != NULL && strcmp(old_label, new_label) != 0) ||
-	   (old_color != NULL && new_color != NULL && strcmp(old_color, new_color) != 0))) {
-		timer = 0;
-		while(pth->loop == 1) {
-			if(seconds_for == timer) {
-				if(pilight.control != NULL) {
-					jvalues = json_mkobject();
-					if(old_color != NULL) {
-						json_append_member(jvalues, "color", json_mkstring(old_color));
-					}
-					json_append_member(jvalues, "label", json_mkstring(old_label));
-					pilight.control(pth->device, NULL, json_first_child(jvalues), ACTION);
-					json_delete(jvalues);
-					break;
-				}
-				break;
-			}
-			timer++;
-			if(type_for > 1) {
-				sleep(1);
-			} else {
-				usleep(1000);
-			}
-		}
+	if(pth->loop == 1 && msec_after > 0) {
+		event_action_thread_delay(pth, msec_after, change, data);
+		return (void *)NULL;
 	}
+	pth->data = data;
 
-	if(free_label == 1) {
-		FREE(label);
-	}
-
-	if(old_label != NULL) {
-		FREE(old_label);
-	}
-
-	if(new_label != NULL) {
-		FREE(new_label);
-	}
-
-	if(old_color != NULL) {
-		FREE(old_color);
-	}
-
-	if(new_color != NULL) {
-		FREE(new_color);
-	}
-
-	event_action_stopped(pth);
-
-	return (void *)NULL;
+	return change(param);
 }
 
 static int run(struct rules_actions_t *obj) {
@@ -247,24 +247,111 @@ static int checkArguments(struct rules_actions_t *obj) {
 	return 0;
 }
 
-static void *thread(void *param) {
+/* State carried from one step of the action to the next */
+typedef struct data_t {
+	char *old_state;
+	char *new_state;
+	unsigned long msec_for;
+} data_t;
+
+static void *finish(struct event_action_thread_t *pth, struct data_t *data) {
+	if(data->old_state != NULL) {
+		FREE(data->old_state);
+	}
+	if(data->new_state != NULL) {
+		FREE(data->new_state);
+	}
+	FREE(data);
+
+	event_action_stopped(pth);
+
+	return (void *)NULL;
+}
+
+static void *restore(void *param) {
 	struct event_action_thread_t *pth = (struct event_action_thread_t *)param;
+	struct data_t *data = pth->data;
+
+	if(pth->loop == 1) {
+		if(pilight.control != NULL) {
+			pilight.control(pth->device, data->old_state, NULL, ACTION);
+		}
+	}
+
+	return finish(pth, data);
+}
+
+static void *change(void *param) {
+	struct event_action_thread_t *pth = (struct event_action_thread_t *)param;
+	struct data_t *data = pth->data;
 	struct JsonNode *json = pth->obj->parsedargs;
 	struct JsonNode *jto = NULL;
+	struct JsonNode *javalues = NULL;
+	struct JsonNode *jstate = NULL;
+	char *state = NULL;
+
+	if(pth->loop == 1) {
+		if((jto = json_find_member(json, "TO")) != NULL) {
+			if((javalues = json_find_member(jto, "value")) != NULL) {
+				jstate = json_find_element(javalues, 0);
+				if(jstate != NULL && jstate->tag == JSON_STRING) {
+					state = jstate->string_;
+					if((data->new_state = MALLOC(strlen(state)+1)) == NULL) {
+						fprintf(stderr, "out of memory\n");
+						exit(EXIT_FAILURE);
+					}
+					strcpy(data->new_state, state);
+					/*
+					 * We're not switching when current state is the same as
+					 * the old state.
+					 */
+					if(data->old_state == NULL || strcmp(data->old_state, data->new_state) != 0) {
+						if(pilight.control != NULL) {
+							pilight.control(pth->device, data->new_state, NULL, ACTION);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	/*
+	 * We only need to restore the state if it was actually changed
+	 */
+	if(pth->loop == 1 && data->msec_for > 0 && data->old_state != NULL &&
+	   data->new_state != NULL && strcmp(data->old_state, data->new_state) != 0) {
+		event_action_thread_delay(pth, data->msec_for, restore, data);
+		return (void *)NULL;
+	}
+
+	return finish(pth, data);
+}
+
+static void *thread(void *param) {
+	struct event_action_thread_t *pth = (struct event_action_thread_t *)param;
+	struct JsonNode *json = pth->obj->parsedargs;
 	struct JsonNode *jafter = NULL;
 	struct JsonNode *jfor = NULL;
-	struct JsonNode *javalues = NULL;
 	struct JsonNode *jcvalues = NULL;
 	struct JsonNode *jdvalues = NULL;
-	struct JsonNode *jstate = NULL;
 	struct JsonNode *jaseconds = NULL;
-	char *new_state = NULL, *old_state = NULL, *state = NULL, **array = NULL;
+	struct data_t *data = NULL;
+	char **array = NULL;
 	int seconds_after = 0, type_after = 0;
 	int	l = 0, i = 0, nrunits = (sizeof(units)/sizeof(units[0]));
-	int seconds_for = 0, type_for = 0, timer = 0;
+	int seconds_for = 0, type_for = 0;
+	unsigned long msec_after = 0;
 
 	event_action_started(pth);
 
+	if((data = MALLOC(sizeof(struct data_t))) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	data->old_state = NULL;
+	data->new_state = NULL;
+	data->msec_for = 0;
+
 	if((jfor = json_find_member(json, "FOR")) != NULL) {
 		if((jcvalues = json_find_member(jfor, "value")) != NULL) {
 			jaseconds = json_find_element(jcvalues, 0);
@@ -331,6 +418,9 @@ static void *thread(void *param) {
 		break;
 	}
 
+	msec_after = (unsigned long)seconds_after * ((type_after > 1) ? 1000 : 1);
+	data->msec_for = (unsigned long)seconds_for * ((type_for > 1) ? 1000 : 1);
+
 	/* Store current state */
 	struct devices_t *tmp = pth->device;
 	int match = 0;
@@ -339,11 +429,11 @@ static void *thread(void *param) {
 		while(opt) {
 			if(strcmp(opt->name, "state") == 0) {
 				if(opt->values->type == JSON_STRING) {
-					if((old_state = MALLOC(strlen(opt->values->string_)+1)) == NULL) {
+					if((data->old_state = MALLOC(strlen(opt->values->string_)+1)) == NULL) {
 						fprintf(stderr, "out of memory\n");
 						exit(EXIT_FAILURE);
 					}
-					strcpy(old_state, opt->values->string_);
+					strcpy(data->old_state, opt->values->string_);
 					match = 1;
 				}
 				break;
@@ -359,73 +449,13 @@ static void *thread(void *param) {
 		logprintf(LOG_NOTICE, "could not store old state of \"%s\"\n", pth->device->id);
 	}
 
-	timer = 0;
-	while(pth->loop == 1) {
-		if(timer == seconds_after) {
-			if((jto = json_find_member(json, "TO")) != NULL) {
-				if((javalues = json_find_member(jto, "value")) != NULL) {
-					jstate = json_find_element(javalues, 0);
-					if(jstate != NULL && jstate->tag == JSON_STRING) {
-						state = jstate->string_;
-						if((new_state = MALLOC(strlen(state)+1)) == NULL) {
-							fprintf(stderr, "out of memory\n");
-							exit(EXIT_FAILURE);
-						}
-						strcpy(new_state, state);
-						/*
-						 * We're not switching when current state is the same as
-						 * the old state.
-						 */
-						if(old_state == NULL || strcmp(old_state, new_state) != 0) {
-							if(pilight.control != NULL) {
-								pilight.control(pth->device, new_state, NULL, ACTION);
-							}
-						}
-					}
-				}
-			}
-			break;
-		}
-		timer++;
-		if(type_after > 1) {
-			sleep(1);
-		} else {
-			usleep(1000);
-		}
+	if(pth->loop == 1 && msec_after > 0) {
+		event_action_thread_delay(pth, msec_after, change, data);
+		return (void *)NULL;
 	}
+	pth->data = data;
 
-	/*
-	 * We only need to restore the state if it was actually changed
-	 */
-	if(seconds_for > 0 && old_state != NULL && new_state != NULL && strcmp(old_state, new_state) != 0) {
-		timer = 0;
-		while(pth->loop == 1) {
-			if(seconds_for == timer) {
-				if(pilight.control != NULL) {
-					pilight.control(pth->device, old_state, NULL, ACTION);
-				}
-				break;
-			}
-			timer++;
-			if(type_for > 1) {
-				sleep(1);
-			} else {
-				usleep(1000);
-			}
-		}
-	}
-
-	if(old_state != NULL) {
-		FREE(old_state);
-	}
-
-	if(new_state != NULL) {
-		FREE(new_state);
-	}
-
-	event_action_stopped(pth);
-
-	return (void *)NULL;
+	return change(param);
 }
 
 static int run(struct rules_actions_t *obj) {
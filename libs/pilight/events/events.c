@@ -42,6 +42,8 @@
 #include "../core/json.h"
 #include "../core/ssdp.h"
 #include "../core/socket.h"
+#include "../core/eventbus.h"
+#include "../core/threads.h"
 
 #include "../protocols/protocol.h"
 
@@ -54,10 +56,43 @@
 #include "operator.h"
 #include "function.h"
 #include "action.h"
+#include "profile.h"
 
-#define NONE 0
-#define AND	2
-#define OR 1
+#define EVENT_THREADS		4
+
+#define EVENT_TEXT			0
+#define EVENT_OPERATOR	1
+#define EVENT_FUNCTION	2
+#define EVENT_AND				3
+#define EVENT_OR				4
+
+/*
+	A rule condition is compiled once into a tree of these
+	nodes. Text nodes hold a literal or a device.value
+	reference that is resolved against the operator it
+	belongs to, all other nodes are evaluated through
+	their children.
+*/
+typedef struct event_node_t {
+	int type;
+	char *text;
+	int vartype;
+	struct varcont_t v;
+	struct rules_values_t *value;
+	struct event_operators_t *operator;
+	struct event_functions_t *function;
+	struct JsonNode *arguments;
+	char *res;
+	int nested;
+	struct event_node_t **children;
+	int nrchildren;
+} event_node_t;
+
+typedef struct event_parser_t {
+	struct rules_t *obj;
+	char *str;
+	size_t pos;
+} event_parser_t;
 
 static unsigned short loop = 1;
 static char true_[2];
@@ -73,6 +108,7 @@ static pthread_mutexattr_t events_attr;
 static unsigned short eventslock_init = 0;
 
 typedef struct eventsqueue_t {
+	struct JsonArena *arena;
 	struct JsonNode *jconfig;
 	struct eventsqueue_t *next;
 } eventsqueue_t;
@@ -81,12 +117,76 @@ static struct eventsqueue_t *eventsqueue;
 static struct eventsqueue_t *eventsqueue_head;
 static int eventsqueue_number = 0;
 static int running = 0;
+/* Updates queued, merged into a pending update and dropped */
+static unsigned long events_queued = 0;
+static unsigned long events_coalesced = 0;
+static unsigned long events_dropped = 0;
+
+/* Rules depending on the devices of the current update */
+static struct rules_t **events_matched = NULL;
+static int events_matched_size = 0;
+static unsigned long events_evaluated = 0;
+static unsigned long events_skipped = 0;
+
+/*
+	Matched rules that share no target devices are evaluated
+	concurrently. Rules sharing a target device end up in the
+	same group, which is evaluated in rule order by a single
+	thread, so the actions for a device are always started in
+	the order the rules were configured.
+*/
+typedef struct events_target_t {
+	char *device;
+	int rule;
+} events_target_t;
+
+static pthread_mutex_t events_eval_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t events_eval_signal = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t events_eval_done = PTHREAD_COND_INITIALIZER;
+static pthread_t *events_workers = NULL;
+static int events_nrworkers = 0;
+static int events_maxworkers = -1;
+static int events_eval_stop = 0;
+
+/* First rule of each group and the next rule in the same group */
+static int *events_groups = NULL;
+static int *events_chain = NULL;
+static int events_chain_size = 0;
+static struct events_target_t *events_targets = NULL;
+static int events_targets_size = 0;
+static int events_nrgroups = 0;
+static int events_nextgroup = 0;
+static int events_pending = 0;
+static int events_group_evaluated = 0;
+static unsigned long events_parallel = 0;
+
+/*
+	A rule that only reads the minute or coarser fields of a
+	datetime device cannot change its outcome on every datetime
+	update. When such a rule did not hold, it is parked on the
+	events wheel until just before the next minute or hour starts,
+	and datetime updates pass it by until then. Updates of any
+	other device still evaluate it. Rules that hold stay due, so
+	they keep running on every datetime update as before. Day and
+	coarser fields are woken up every hour, as daylight saving
+	time can move midnight.
+*/
+#define EVENTS_WAKEUP_MARGIN	500
+
+static pthread_mutex_t events_wheel_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct event_wheel_t events_wheel;
+static int events_wheel_init = 0;
+static unsigned long events_parked = 0;
 
 int events_gc(void) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
+	int i = 0;
+
 	loop = 0;
 
+	eventbus_unsubscribe("events");
+
 	if(eventslock_init == 1) {
 		pthread_mutex_unlock(&events_lock);
 		pthread_cond_signal(&events_signal);
@@ -96,6 +196,45 @@ int events_gc(void) {
 		usleep(10);
 	}
 
+	pthread_mutex_lock(&events_eval_lock);
+	events_eval_stop = 1;
+	pthread_cond_broadcast(&events_eval_signal);
+	pthread_mutex_unlock(&events_eval_lock);
+	for(i=0;i<events_nrworkers;i++) {
+		pthread_join(events_workers[i], NULL);
+	}
+	if(events_workers != NULL) {
+		FREE(events_workers);
+		events_workers = NULL;
+	}
+	events_nrworkers = 0;
+	events_maxworkers = -1;
+	events_eval_stop = 0;
+
+	if(events_matched != NULL) {
+		FREE(events_matched);
+		events_matched = NULL;
+	}
+	events_matched_size = 0;
+	if(events_groups != NULL) {
+		FREE(events_groups);
+		events_groups = NULL;
+	}
+	if(events_chain != NULL) {
+		FREE(events_chain);
+		events_chain = NULL;
+	}
+	events_chain_size = 0;
+	if(events_targets != NULL) {
+		FREE(events_targets);
+		events_targets = NULL;
+	}
+	events_targets_size = 0;
+	logprintf(LOG_DEBUG, "events evaluated %lu updates with independent rules concurrently", events_parallel);
+	logprintf(LOG_DEBUG, "events evaluated %lu rules and skipped %lu", events_evaluated, events_skipped);
+	logprintf(LOG_DEBUG, "events passed %lu parked rules by", events_parked);
+	logprintf(LOG_DEBUG, "events queued %lu updates, coalesced %lu and dropped %lu", events_queued, events_coalesced, events_dropped);
+
 	event_operator_gc();
 	event_action_gc();
 	event_function_gc();
@@ -130,7 +269,7 @@ void event_cache_device(struct rules_t *obj, char *device) {
 	}
 }
 
-static int event_store_val_ptr(struct rules_t *obj, char *device, char *name, struct devices_settings_t *settings) {
+static int event_store_val_ptr(struct rules_t *obj, char *device, char *name, struct devices_values_t *values) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	struct rules_values_t *tmp_values = obj->values;
@@ -163,33 +302,70 @@ static int event_store_val_ptr(struct rules_t *obj, char *device, char *name, st
 			exit(EXIT_FAILURE);
 		}
 		strcpy(tmp_values->device, device);
-		tmp_values->settings = settings;
 		tmp_values->next = obj->values;
 		obj->values = tmp_values;
 	}
+	tmp_values->values = values;
+	tmp_values->epoch = devices_epoch();
 	return 0;
 }
 
-/* This functions checks if the defined event variable
-   is part of one of devices in the config. If it is,
-   replace the variable with the actual value */
-
 /*
-	Return codes:
-	-1: An error was found and abort rule parsing
-	0: Found variable and filled varcont
-	1: Did not find variable and did not fill varcont
+	Returns the current value a cached reference points to.
+	The pointer stays valid while the devices are not parsed
+	again, so only a new devices epoch triggers a new lookup.
+	NULL is returned when the device or setting is gone.
 */
-int event_lookup_variable(char *var, struct rules_t *obj, int type, struct varcont_t *varcont, int *rtype, unsigned short validate, enum origin_t origin) {
-	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+static struct devices_values_t *event_val_ptr_values(struct rules_values_t *tmp_values) {
+	struct devices_settings_t *tmp_settings = NULL;
+	struct devices_t *dev = NULL;
+	unsigned long epoch = devices_epoch();
+
+	if(tmp_values->epoch == epoch) {
+		return tmp_values->values;
+	}
+	tmp_values->values = NULL;
+	tmp_values->epoch = epoch;
+	if(devices_get(tmp_values->device, &dev) == 0) {
+		tmp_settings = dev->settings;
+		while(tmp_settings) {
+			if(strcmp(tmp_settings->name, tmp_values->name) == 0) {
+				tmp_values->values = tmp_settings->values;
+				break;
+			}
+			tmp_settings = tmp_settings->next;
+		}
+	}
+	return tmp_values->values;
+}
+
+static struct rules_values_t *event_get_val_ptr(struct rules_t *obj, char *var) {
+	struct rules_values_t *tmp_values = obj->values;
+	char *p = strstr(var, ".");
+	size_t len = 0;
+
+	if(p == NULL) {
+		return NULL;
+	}
+	len = (size_t)(p-var);
+	while(tmp_values) {
+		if(strncmp(tmp_values->device, var, len) == 0 &&
+		   tmp_values->device[len] == '\0' &&
+		   strcmp(tmp_values->name, &p[1]) == 0) {
+			return tmp_values;
+		}
+		tmp_values = tmp_values->next;
+	}
+	return NULL;
+}
 
-	int cached = 0;
+/* Converts a literal, or the intermediate result of a formula,
+   to the requested type. Return codes are the same as those of
+   event_lookup_variable */
+static int event_convert_value(char *var, struct rules_t *obj, int type, struct varcont_t *varcont, int *rtype) {
 	if(strcmp(true_, "1") != 0) {
 		strcpy(true_, "1");
 	}
-	if(strcmp(dot_, ".") != 0) {
-		strcpy(dot_, ".");
-	}
 	if(strcmp(false_, "1") != 0) {
 		strcpy(false_, "1");
 	}
@@ -219,179 +395,6 @@ int event_lookup_variable(char *var, struct rules_t *obj, int type, struct varco
 		return 0;
 	}
 
-	int len = (int)strlen(var);
-	int i = 0;
-	int nrdots = 0;
-	for(i=0;i<len;i++) {
-		if(var[i] == '.') {
-			nrdots++;
-		}
-	}
-
-	if(nrdots == 1) {
-		char **array = NULL;
-		unsigned int n = explode(var, ".", &array);
-
-		if(n < 2) {
-			varcont->string_ = dot_;
-			array_free(&array, n);
-			*rtype = JSON_STRING;
-			return 0;
-		}
-
-		char device[strlen(array[0])+1];
-		strcpy(device, array[0]);
-
-		char name[strlen(array[1])+1];
-		strcpy(name, array[1]);
-
-		array_free(&array, n);
-
-		/* Check if the values are not already cached */
-		if(obj != NULL) {
-			struct rules_values_t *tmp_values = obj->values;
-			while(tmp_values) {
-				if(strcmp(tmp_values->device, device) == 0 &&
-					 strcmp(tmp_values->name, name) == 0) {
-						if(tmp_values->settings->values->type != type && (type != (JSON_NUMBER | JSON_STRING))) {
-							if(type == JSON_STRING) {
-								logprintf(LOG_ERR, "rule #%d invalid: trying to compare a integer variable \"%s.%s\" to a string", obj->nr, device, name);
-								*rtype = -1;
-								return -1;
-							} else if(type == JSON_NUMBER) {
-								logprintf(LOG_ERR, "rule #%d invalid: trying to compare a string variable \"%s.%s\" to an integer", obj->nr, device, name);
-								*rtype = -1;
-								return -1;
-							}
-						}
-						if(tmp_values->settings->values->type == JSON_STRING) {
-							varcont->string_ = tmp_values->settings->values->string_;
-							*rtype = JSON_STRING;
-						} else if(tmp_values->settings->values->type == JSON_NUMBER) {
-							varcont->number_ = tmp_values->settings->values->number_;
-							varcont->decimals_ = tmp_values->settings->values->decimals;
-							*rtype = JSON_NUMBER;
-						}
-						cached = 1;
-						return 0;
-				}
-				tmp_values = tmp_values->next;
-			}
-		}
-		struct devices_t *dev = NULL;
-		if(cached == 0) {
-			if(devices_get(device, &dev) == 0) {
-				if(validate == 1) {
-					if(origin == RULE) {
-						event_cache_device(obj, device);
-					}
-					struct protocols_t *tmp = dev->protocols;
-					unsigned int match1 = 0, match2 = 0, match3 = 0;
-					while(tmp) {
-						struct options_t *opt = tmp->listener->options;
-						while(opt) {
-							if(opt->conftype == DEVICES_STATE && strcmp("state", name) == 0) {
-								match1 = 1;
-								match2 = 1;
-								match3 = 1;
-								break;
-							} else if(strcmp(opt->name, name) == 0) {
-								match1 = 1;
-								if(opt->vartype == (JSON_NUMBER | JSON_STRING)) {
-									break;
-								}
-								if(opt->conftype == DEVICES_VALUE || opt->conftype == DEVICES_STATE || opt->conftype == DEVICES_SETTING) {
-									match2 = 1;
-									if(type == (JSON_STRING | JSON_NUMBER)) {
-										match3 = 1;
-									} else if(opt->vartype == JSON_STRING && type == JSON_STRING) {
-										match3 = 1;
-									} else if(opt->vartype == JSON_NUMBER && type == JSON_NUMBER) {
-										match3 = 1;
-									}
-									break;
-								}
-							}
-							opt = opt->next;
-						}
-						tmp = tmp->next;
-					}
-					if(match1 == 0) {
-						logprintf(LOG_ERR, "rule #%d invalid: device \"%s\" has no variable \"%s\"", obj->nr, device, name);
-					} else if(match2 == 0) {
-						logprintf(LOG_ERR, "rule #%d invalid: variable \"%s\" of device \"%s\" cannot be used in event rules", obj->nr, name, device);
-					} else if(match3 == 0) {
-						logprintf(LOG_ERR, "rule #%d invalid: trying to compare a integer variable \"%s.%s\" to a string", obj->nr, device, name);
-					}
-					if(match1 == 0 || match2 == 0 || match3 == 0) {
-						varcont->string_ = NULL;
-						varcont->number_ = 0;
-						varcont->decimals_ = 0;
-						*rtype = -1;
-						return -1;
-					}
-				}
-				struct devices_settings_t *tmp_settings = dev->settings;
-				while(tmp_settings) {
-					if(strcmp(tmp_settings->name, name) == 0) {
-						if(tmp_settings->values->type == JSON_STRING) {
-							if(type == JSON_STRING || type == (JSON_NUMBER | JSON_STRING)) {
-								/* Cache values for faster future lookup */
-								if(obj != NULL) {
-									event_store_val_ptr(obj, device, name, tmp_settings);
-								}
-								varcont->string_ = tmp_settings->values->string_;
-								*rtype = JSON_STRING;
-								return 0;
-							} else {
-								logprintf(LOG_ERR, "rule #%d invalid: trying to compare integer variable \"%s.%s\" to a string", obj->nr, device, name);
-								varcont->string_ = NULL;
-								*rtype = -1;
-								return -1;
-							}
-						} else if(tmp_settings->values->type == JSON_NUMBER) {
-							if(type == JSON_NUMBER || type == (JSON_NUMBER | JSON_STRING)) {
-								/* Cache values for faster future lookup */
-								if(obj != NULL) {
-									event_store_val_ptr(obj, device, name, tmp_settings);
-								}
-								varcont->number_ = tmp_settings->values->number_;
-								varcont->decimals_ = tmp_settings->values->decimals;
-								*rtype = JSON_NUMBER;
-								return 0;
-							} else {
-								logprintf(LOG_ERR, "rule #%d invalid: trying to compare string variable \"%s.%s\" to an integer", obj->nr, device, name);
-								varcont->number_ = 0;
-								varcont->decimals_ = 0;
-								*rtype = -1;
-								return -1;
-							}
-						}
-					}
-					tmp_settings = tmp_settings->next;
-				}
-				logprintf(LOG_ERR, "rule #%d invalid: device \"%s\" has no variable \"%s\"", obj->nr, device, name);
-				varcont->string_ = NULL;
-				varcont->number_ = 0;
-				varcont->decimals_ = 0;
-				*rtype = -1;
-				return -1;
-			} /*else {
-				logprintf(LOG_ERR, "rule #%d invalid: device \"%s\" does not exist in the config", obj->nr, device);
-				varcont->string_ = NULL;
-				varcont->number_ = 0;
-				varcont->decimals_ = 0;
-				return -1;
-			}*/
-		}
-	}/* else if(nrdots > 2) {
-		logprintf(LOG_ERR, "rule #%d invalid: variable \"%s\" is invalid", obj->nr, var);
-		varcont->string_ = NULL;
-		varcont->number_ = 0;
-		varcont->decimals_ = 0;
-		return -1;
-	} */
-
 	if(type == JSON_STRING) {
 		if(isNumeric(var) == 0) {
 			varcont->string_ = NULL;
@@ -421,104 +424,183 @@ int event_lookup_variable(char *var, struct rules_t *obj, int type, struct varco
 	return 0;
 }
 
-static int event_parse_hooks(char **rule, struct rules_t *obj, int depth, unsigned short validate) {
-	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+/* This functions checks if the defined event variable
+   is part of one of devices in the config. If it is,
+   replace the variable with the actual value */
 
-	int hooks = 0, res = 0;
-	unsigned long buflen = MEMBUFFER, len = 0, i = 0;
-	char *subrule = MALLOC(buflen);
-	char *tmp = *rule;
+/*
+	Return codes:
+	-1: An error was found and abort rule parsing
+	0: Found variable and filled varcont
+	1: Did not find variable and did not fill varcont
+*/
+int event_lookup_variable(char *var, struct rules_t *obj, int type, struct varcont_t *varcont, int *rtype, unsigned short validate, enum origin_t origin) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	if(subrule == NULL) {
-		fprintf(stderr, "out of memory\n");
-		exit(EXIT_FAILURE);
+	struct devices_values_t *values = NULL;
+	struct rules_values_t *tmp_values = NULL;
+	char *p = NULL;
+	if(strcmp(dot_, ".") != 0) {
+		strcpy(dot_, ".");
 	}
 
-	while(tmp[i] != '\0') {
-		if(tmp[i] == '(') {
-			hooks++;
-		}
-		if(tmp[i] == ')') {
-			hooks--;
-		}
-
-		if(hooks > 0) {
-			subrule[len++] = tmp[i+1];
-			if(buflen <= len) {
-				buflen *= 2;
-				if((subrule = REALLOC(subrule, buflen)) == NULL) {
-					fprintf(stderr, "out of memory\n");
-					exit(EXIT_FAILURE);
-				}
-				memset(&subrule[len], '\0', buflen-(unsigned long)len);
-			}
-		} else {
-			if(len > 0) {
-				unsigned long z = 1;
-				char *replace = MALLOC(len+3);
-
-				subrule[len-1] = '\0';
-
-				sprintf(replace, "(%s)", subrule);
-				replace[len+2] = '\0';
-				/* If successful, the variable subrule will be
-				   replaced with the outcome of the formula */
-				if((res = event_parse_rule(subrule, obj, depth, validate)) > -1) {
-					z = strlen(subrule);
-					/* Remove the hooks and the content within.
-						 Replace this content with the result of the sum.
-
-					   e.g.: ((1 + 2) + (3 + 4))
-									 (   3    +    7   )
-					*/
-					if(pilight.debuglevel == 1) {
-						fprintf(stderr, "replace %s with %s in %s\n", replace, subrule, tmp);
-					}
-					str_replace(replace, subrule, &tmp);
-
-					FREE(replace);
-					break;
-				} else {
-					FREE(subrule);
-					FREE(replace);
+	if((p = strchr(var, '.')) != NULL && strchr(&p[1], '.') == NULL) {
+		/* Check if the values are not already cached */
+		if(obj != NULL && (tmp_values = event_get_val_ptr(obj, var)) != NULL &&
+		   (values = event_val_ptr_values(tmp_values)) != NULL) {
+			if(values->type != type && (type != (JSON_NUMBER | JSON_STRING))) {
+				if(type == JSON_STRING) {
+					logprintf(LOG_ERR, "rule #%d invalid: trying to compare a integer variable \"%s\" to a string", obj->nr, var);
+					*rtype = -1;
+					return -1;
+				} else if(type == JSON_NUMBER) {
+					logprintf(LOG_ERR, "rule #%d invalid: trying to compare a string variable \"%s\" to an integer", obj->nr, var);
+					*rtype = -1;
 					return -1;
 				}
-				memset(subrule, '\0', (unsigned long)len);
-				i -= (len-z);
-				len = 0;
 			}
+			if(values->type == JSON_STRING) {
+				varcont->string_ = values->string_;
+				*rtype = JSON_STRING;
+			} else if(values->type == JSON_NUMBER) {
+				varcont->number_ = values->number_;
+				varcont->decimals_ = values->decimals;
+				*rtype = JSON_NUMBER;
+			}
+			return 0;
 		}
-		i++;
-	}
-	FREE(subrule);
-	return 0;
-}
 
+		char **array = NULL;
+		unsigned int n = explode(var, ".", &array);
+
+		if(n < 2) {
+			varcont->string_ = dot_;
+			array_free(&array, n);
+			*rtype = JSON_STRING;
+			return 0;
+		}
 
-static int event_remove_hooks(char **rule, struct rules_t *obj, int depth) {
-	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+		char device[strlen(array[0])+1];
+		strcpy(device, array[0]);
 
-	int hooks = 0;
-	char *tmp = *rule;
-	unsigned long len = strlen(tmp), i = 0;
+		char name[strlen(array[1])+1];
+		strcpy(name, array[1]);
 
-	while(tmp[i] != '\0') {
-		if(tmp[i] == '(') {
-			hooks++;
-		}
-		if(tmp[i] == ')') {
-			hooks--;
-		}
+		array_free(&array, n);
 
-		if(hooks == 0) {
-			memmove(&tmp[0], &tmp[i], len-i);
-			tmp[0] = '0';
-			tmp[len-i] = '\0';
-			break;
-		}
-		i++;
-	}
-	return 0;
+		struct devices_t *dev = NULL;
+		if(devices_get(device, &dev) == 0) {
+			if(validate == 1) {
+				if(origin == RULE) {
+					event_cache_device(obj, device);
+				}
+				struct protocols_t *tmp = dev->protocols;
+				unsigned int match1 = 0, match2 = 0, match3 = 0;
+				while(tmp) {
+					struct options_t *opt = tmp->listener->options;
+					while(opt) {
+						if(opt->conftype == DEVICES_STATE && strcmp("state", name) == 0) {
+							match1 = 1;
+							match2 = 1;
+							match3 = 1;
+							break;
+						} else if(strcmp(opt->name, name) == 0) {
+							match1 = 1;
+							if(opt->vartype == (JSON_NUMBER | JSON_STRING)) {
+								break;
+							}
+							if(opt->conftype == DEVICES_VALUE || opt->conftype == DEVICES_STATE || opt->conftype == DEVICES_SETTING) {
+								match2 = 1;
+								if(type == (JSON_STRING | JSON_NUMBER)) {
+									match3 = 1;
+								} else if(opt->vartype == JSON_STRING && type == JSON_STRING) {
+									match3 = 1;
+								} else if(opt->vartype == JSON_NUMBER && type == JSON_NUMBER) {
+									match3 = 1;
+								}
+								break;
+							}
+						}
+						opt = opt->next;
+					}
+					tmp = tmp->next;
+				}
+				if(match1 == 0) {
+					logprintf(LOG_ERR, "rule #%d invalid: device \"%s\" has no variable \"%s\"", obj->nr, device, name);
+				} else if(match2 == 0) {
+					logprintf(LOG_ERR, "rule #%d invalid: variable \"%s\" of device \"%s\" cannot be used in event rules", obj->nr, name, device);
+				} else if(match3 == 0) {
+					logprintf(LOG_ERR, "rule #%d invalid: trying to compare a integer variable \"%s.%s\" to a string", obj->nr, device, name);
+				}
+				if(match1 == 0 || match2 == 0 || match3 == 0) {
+					varcont->string_ = NULL;
+					varcont->number_ = 0;
+					varcont->decimals_ = 0;
+					*rtype = -1;
+					return -1;
+				}
+			}
+			struct devices_settings_t *tmp_settings = dev->settings;
+			while(tmp_settings) {
+				if(strcmp(tmp_settings->name, name) == 0) {
+					if(tmp_settings->values->type == JSON_STRING) {
+						if(type == JSON_STRING || type == (JSON_NUMBER | JSON_STRING)) {
+							/* Cache values for faster future lookup */
+							if(obj != NULL) {
+								event_store_val_ptr(obj, device, name, tmp_settings->values);
+							}
+							varcont->string_ = tmp_settings->values->string_;
+							*rtype = JSON_STRING;
+							return 0;
+						} else {
+							logprintf(LOG_ERR, "rule #%d invalid: trying to compare integer variable \"%s.%s\" to a string", obj->nr, device, name);
+							varcont->string_ = NULL;
+							*rtype = -1;
+							return -1;
+						}
+					} else if(tmp_settings->values->type == JSON_NUMBER) {
+						if(type == JSON_NUMBER || type == (JSON_NUMBER | JSON_STRING)) {
+							/* Cache values for faster future lookup */
+							if(obj != NULL) {
+								event_store_val_ptr(obj, device, name, tmp_settings->values);
+							}
+							varcont->number_ = tmp_settings->values->number_;
+							varcont->decimals_ = tmp_settings->values->decimals;
+							*rtype = JSON_NUMBER;
+							return 0;
+						} else {
+							logprintf(LOG_ERR, "rule #%d invalid: trying to compare string variable \"%s.%s\" to an integer", obj->nr, device, name);
+							varcont->number_ = 0;
+							varcont->decimals_ = 0;
+							*rtype = -1;
+							return -1;
+						}
+					}
+				}
+				tmp_settings = tmp_settings->next;
+			}
+			logprintf(LOG_ERR, "rule #%d invalid: device \"%s\" has no variable \"%s\"", obj->nr, device, name);
+			varcont->string_ = NULL;
+			varcont->number_ = 0;
+			varcont->decimals_ = 0;
+			*rtype = -1;
+			return -1;
+		} /*else {
+			logprintf(LOG_ERR, "rule #%d invalid: device \"%s\" does not exist in the config", obj->nr, device);
+			varcont->string_ = NULL;
+			varcont->number_ = 0;
+			varcont->decimals_ = 0;
+			return -1;
+		}*/
+	}/* else if(nrdots > 2) {
+		logprintf(LOG_ERR, "rule #%d invalid: variable \"%s\" is invalid", obj->nr, var);
+		varcont->string_ = NULL;
+		varcont->number_ = 0;
+		varcont->decimals_ = 0;
+		return -1;
+	} */
+
+	return event_convert_value(var, obj, type, varcont, rtype);
 }
 
 static int event_parse_function(char **rule, struct rules_t *obj, unsigned short validate, enum origin_t origin) {
@@ -529,6 +611,7 @@ static int event_parse_function(char **rule, struct rules_t *obj, unsigned short
 	char *subfunction = NULL, *function = NULL, *name = NULL, *output = NULL;
 	size_t pos1 = 0, pos2 = 0, pos3 = 0, pos4 = 0, pos5 = 0;
 	unsigned long buflen = MEMBUFFER;
+	unsigned long long start = 0;
 	int	error = 0, i = 0, fl = 0, nl = 0;
 	int hooks = 0, len = 0, nested = 0;
 
@@ -688,7 +771,11 @@ static int event_parse_function(char **rule, struct rules_t *obj, unsigned short
 		if(error == 0) {
 			if(strcmp(name, tmp_function->name) == 0) {
 				if(tmp_function->run != NULL) {
+					start = event_profile_clock();
 					error = tmp_function->run(obj, arguments, &output, origin);
+					if(validate == 0) {
+						event_profile_add(&tmp_function->profile, start);
+					}
 					match = 1;
 					break;
 				}
@@ -719,227 +806,19 @@ close:
 	return error;
 }
 
-static int event_parse_formula(char **rule, struct rules_t *obj, int depth, unsigned short validate) {
-	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
-
-	struct varcont_t v1;
-	struct varcont_t v2;
-	char *var1 = NULL, *func = NULL, *var2 = NULL, *tmp = *rule, *search = NULL;
-	int element = 0, i = 0, match = 0, error = 0, hasquote = 0, hadquote = 0, rtype = 0;
-	char var1quotes[2], var2quotes[2], funcquotes[2];
-	unsigned long len = strlen(tmp), pos = 0, word = 0;
-	char *res = MALLOC(255);
-
-	memset(res, '\0', 255);
-	var1quotes[0] = '\0';
-	var2quotes[0] = '\0';
-	funcquotes[0] = '\0';
-
-	/* If there are no hooks, we are going to solve the whole (sub)formula.
-	   This formula can be as simple as:
-	   e.g.: 1 + 2
-	   or more complex as:
-	   e.g.: 1 AND 1 AND 0 AND 1
-			 1 AND location.device.state IS on
-	*/
-	if(event_parse_function(&tmp, obj, validate, RULE) == -1) {
-		return -1;
-	}
+static int event_parse_action_arguments(char *arguments, struct rules_t *obj, int validate) {
+	struct varcont_t v;
+	char *tmp = NULL;
+	int i = 0, error = 0, a = 0, b = 0, len = strlen(arguments);
+	int vallen = 0, ret = 0, nlen = 0, type = 0;
 
-	while(pos <= len) {
-		/* If we encounter a space we have the formula part */
-		if(tmp[pos] == '"') {
-			hasquote ^= 1;
-			if(hasquote == 1) {
-				word++;
-			} else {
-				hadquote = 1;
-			}
-		}
-		if(hasquote == 0 && (tmp[pos] == ' ' || pos == len)) {
-			switch(element) {
-				/* The first value of three is always the first variable.
-				   The second value is always the function.
-				   The third value of the three is always the second variable (or second formula).
-				*/
-				case 0:
-					if(hadquote == 1) {
-						strcpy(var1quotes, "\"");
-					}
-					var1 = REALLOC(var1, ((pos-word)+1));
-					memset(var1, '\0', ((pos-word)+1));
-					strncpy(var1, &tmp[word], (pos-word)-hadquote);
-				break;
-				case 1:
-					if(hadquote == 1) {
-						strcpy(funcquotes, "\"");
-					}
-					func = REALLOC(func, ((pos-word)+1));
-					memset(func, '\0', ((pos-word)+1));
-					strncpy(func, &tmp[word], (pos-word)-hadquote);
-				break;
-				case 2:
-					if(hadquote == 1) {
-						strcpy(var2quotes, "\"");
-					}
-					var2 = REALLOC(var2, ((pos-word)+1));
-					memset(var2, '\0', ((pos-word)+1));
-					strncpy(var2, &tmp[word], (pos-word)-hadquote);
-
-					unsigned long l = (strlen(var1)+strlen(var2)+strlen(func))+2;
-					/* search parameter, null-terminator, and potential quotes */
-					search = REALLOC(search, (l+1+6));
-					memset(search, '\0', l+1);
-					l = (unsigned long)sprintf(search, "%s%s%s %s%s%s %s%s%s",
-						var1quotes, var1, var1quotes,
-						funcquotes, func, funcquotes,
-						var2quotes, var2, var2quotes);
-				break;
-				default:;
-			}
-			hadquote = 0;
-			word = pos+1;
-			element++;
-			if(element > 2) {
-				element = 0;
-			}
-		}
-
-		if(func != NULL && strlen(func) > 0 &&
-		   var1 != NULL  && strlen(var1) > 0 &&
-		   var2 != NULL  && strlen(var2) > 0) {
-				var1quotes[0] = '\0';
-				var2quotes[0] = '\0';
-				funcquotes[0] = '\0';
-			// printf("%s / %s / %s\n", var1, func, var2);
-			i = 0;
-			/* Check if the operator exists */
-			match = 0;
-			struct event_operators_t *tmp_operator = event_operators;
-			while(tmp_operator) {
-				int type = 0;
-				if(tmp_operator->callback_number) {
-					type = JSON_NUMBER;
-				} else {
-					type = JSON_STRING;
-				}
-
-				if(strcmp(func, tmp_operator->name) == 0) {
-					match = 1;
-					int ret1 = 0, ret2 = 0;
-					if(tmp_operator->callback_string != NULL) {
-						ret1 = event_lookup_variable(var1, obj, type, &v1, &rtype, validate, RULE);
-						ret2 = event_lookup_variable(var2, obj, type, &v2, &rtype, validate, RULE);
-						if(rtype != type) {
-							error = -1;
-							goto close;
-						} else if(ret1 == -1 || ret2 == -1) {
-							error = -1;
-							goto close;
-						} else if(v1.string_ != NULL && v2.string_ != NULL) {
-							/* Solve the formula */
-							tmp_operator->callback_string(v1.string_, v2.string_, &res);
-						} else {
-							error = 0;
-							goto close;
-						}
-					} else if(tmp_operator->callback_number != NULL) {
-						/* Continue with regular numeric operator parsing */
-						ret1 = event_lookup_variable(var1, obj, type, &v1, &rtype, validate, RULE);
-						ret2 = event_lookup_variable(var2, obj, type, &v2, &rtype, validate, RULE);
-						if(rtype != type) {
-							error = -1;
-							goto close;
-						} else if(ret1 == -1 || ret2 == -1) {
-							error = -1;
-							goto close;
-						} else if(ret1 == 1 || ret2 == 1) {
-							error = 0;
-							goto close;
-						} else {
-							/* Solve the formula */
-							tmp_operator->callback_number(v1.number_, v2.number_, &res);
-						}
-					}
-					if(res != 0) {
-						/* Replace the subpart of the formula with the solutions in case of simple AND's
-						   e.g.: 0 AND 1 AND 1 AND 0
-								     0 AND 1 AND 0
-						*/
-						char *p = MALLOC(strlen(res)+1);
-						strcpy(p, res);
-						unsigned long r = 0;
-						// printf("replace %s with %s in %s\n", search, p, tmp);
-						if((r = (unsigned long)str_replace(search, p, &tmp)) == -1) {
-							logprintf(LOG_ERR, "rule #%d: an unexpected error occured while parsing", obj->nr);
-							FREE(p);
-							error = -1;
-							goto close;
-						}
-						len = r;
-						FREE(p);
-					}
-					pos = 0, word = 0, element = 0;
-					break;
-				}
-				i++;
-				tmp_operator = tmp_operator->next;
-			}
-			if(match == 0) {
-				logprintf(LOG_ERR, "rule #%d invalid: operator \"%s\" does not exist", obj->nr, func);
-				error = -1;
-				goto close;
-			}
-			if(var1 != NULL ) {
-				memset(var1, '\0', strlen(var1));
-			} if(func != NULL ) {
-				memset(func, '\0', strlen(func));
-			} if(var2 != NULL ) {
-				memset(var2, '\0', strlen(var2));
-			} if(search != NULL ) {
-				memset(search, '\0', strlen(search));
-			}
-		}
-		pos++;
-	}
-	if(element == 2) {
-		logprintf(LOG_ERR, "rule #%d invalid: could not parse \"%s\"", obj->nr, *rule);
-		error = -1;
-		goto close;
-	}
-
-close:
-	FREE(res);
-	if(var1 != NULL ) {
-		FREE(var1);
-		var1 = NULL;
-	} if(func != NULL ) {
-		FREE(func);
-		func = NULL;
-	} if(var2 != NULL ) {
-		FREE(var2);
-		var2 = NULL;
-	} if(search != NULL ) {
-		FREE(search);
-		search = NULL;
-	}
-
-	return error;
-}
-
-static int event_parse_action_arguments(char *arguments, struct rules_t *obj, int validate) {
-	struct varcont_t v;
-	char *tmp = NULL;
-	int i = 0, error = 0, a = 0, b = 0, len = strlen(arguments);
-	int vallen = 0, ret = 0, nlen = 0, type = 0;
-
-	while(arguments[i] != '\0' && i < len) {
-		if(arguments[i] == '(') {
-			if(!(arguments[i-1] == '(' || arguments[i-1] == ' ' || i == 0)) {
-				/* Function */
-				error = event_parse_function(&arguments, obj, validate, ACTION);
-				int z = strlen(arguments);
-				len -= (len-z);
+	while(arguments[i] != '\0' && i < len) {
+		if(arguments[i] == '(') {
+			if(!(arguments[i-1] == '(' || arguments[i-1] == ' ' || i == 0)) {
+				/* Function */
+				error = event_parse_function(&arguments, obj, validate, ACTION);
+				int z = strlen(arguments);
+				len -= (len-z);
 			}
 		}
 		if(arguments[i] == '.') {
@@ -1016,15 +895,55 @@ static int event_parse_action_arguments(char *arguments, struct rules_t *obj, in
 	return error;
 }
 
+static int event_parse_action_values(struct rules_actions_t *node, struct rules_t *obj, int validate) {
+	struct JsonNode *jchild = NULL;
+	struct JsonNode *jchild1 = NULL;
+	struct JsonNode *jvalue = NULL;
+	char *output = json_stringify(node->arguments, NULL);
+	int error = 0;
+
+	if(node->parsedargs != NULL) {
+		json_delete(node->parsedargs);
+		node->parsedargs = NULL;
+	}
+	node->parsedargs = json_decode(output);
+	jchild = json_first_child(node->parsedargs);
+	while(jchild) {
+		if((jvalue = json_find_member(jchild, "value")) != NULL) {
+			jchild1 = json_first_child(jvalue);
+			while(jchild1) {
+				if(jchild1->tag == JSON_STRING) {
+					if((error = event_parse_action_arguments(jchild1->string_, obj, validate)) == 0) {
+						if(isNumeric(jchild1->string_) == 0) {
+							int dec = nrDecimals(jchild1->string_);
+							int nr = atof(jchild1->string_);
+							json_free(jchild1->string_);
+							jchild1->tag = JSON_NUMBER;
+							jchild1->number_ = nr;
+							jchild1->decimals_ = dec;
+						}
+					} else {
+						break;
+					}
+				}
+				jchild1 = jchild1->next;
+			}
+		}
+		jchild = jchild->next;
+	}
+	json_free(output);
+
+	return error;
+}
+
 static int event_parse_action(char *action, struct rules_t *obj, int validate) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
-	struct JsonNode *jchild = NULL;
 	struct JsonNode *jchild1 = NULL;
 	struct JsonNode *jvalue = NULL;
 	struct options_t *opt = NULL;
 	struct event_actions_t *tmp_actions = NULL;
 	struct rules_actions_t *node = NULL;
-	char *tmp = action, *search = NULL, *output = NULL;
+	char *tmp = action, *search = NULL;
 	char *p = NULL, *name = NULL, *value = NULL, **array = NULL, *func = NULL;
 	unsigned long len = strlen(tmp), pos = 0, pos1 = 0, offset = 0;
 	int error = 0, order = 1, l = 0, i = 0, x = 0, nractions = 1, match = 0;
@@ -1214,36 +1133,7 @@ static int event_parse_action(char *action, struct rules_t *obj, int validate) {
 			memset(value, '\0', strlen(value));
 			offset = len;
 			if(error == 0) {
-				output = json_stringify(node->arguments, NULL);
-				if(node->parsedargs != NULL) {
-					json_delete(node->parsedargs);
-					node->parsedargs = NULL;
-				}
-				node->parsedargs = json_decode(output);
-				jchild = json_first_child(node->parsedargs);
-				while(jchild) {
-					if((jvalue = json_find_member(jchild, "value")) != NULL) {
-						jchild1 = json_first_child(jvalue);
-						while(jchild1) {
-							if(jchild1->tag == JSON_STRING) {
-								if((error = event_parse_action_arguments(jchild1->string_, obj, validate)) == 0) {
-									if(isNumeric(jchild1->string_) == 0) {
-										int dec = nrDecimals(jchild1->string_);
-										int nr = atof(jchild1->string_);
-										json_free(jchild1->string_);
-										jchild1->tag = JSON_NUMBER;
-										jchild1->number_ = nr;
-										jchild1->decimals_ = dec;
-									}
-								} else {
-									break;
-								}
-							}
-							jchild1 = jchild1->next;
-						}
-					}
-					jchild = jchild->next;
-				}
+				error = event_parse_action_values(node, obj, validate);
 				if(error == 0) {
 					struct options_t *opt = node->action->options;
 					struct JsonNode *joption = NULL;
@@ -1313,7 +1203,6 @@ static int event_parse_action(char *action, struct rules_t *obj, int validate) {
 						}
 					}
 				}
-				json_free(output);
 			}
 
 			if(error != 0) {
@@ -1325,37 +1214,7 @@ static int event_parse_action(char *action, struct rules_t *obj, int validate) {
 		if(error != 0) {
 			break;
 		} else {
-			output = json_stringify(node->arguments, NULL);
-			if(node->parsedargs != NULL) {
-				json_delete(node->parsedargs);
-				node->parsedargs = NULL;
-			}
-			node->parsedargs = json_decode(output);
-			jchild = json_first_child(node->parsedargs);
-			while(jchild) {
-				if((jvalue = json_find_member(jchild, "value")) != NULL) {
-					jchild1 = json_first_child(jvalue);
-					while(jchild1) {
-						if(jchild1->tag == JSON_STRING) {
-							if((error = event_parse_action_arguments(jchild1->string_, obj, validate)) == 0) {
-								if(isNumeric(jchild1->string_) == 0) {
-									int dec = nrDecimals(jchild1->string_);
-									int nr = atof(jchild1->string_);
-									json_free(jchild1->string_);
-									jchild1->tag = JSON_NUMBER;
-									jchild1->number_ = nr;
-									jchild1->decimals_ = dec;
-								}
-							} else {
-								break;
-							}
-						}
-						jchild1 = jchild1->next;
-					}
-				}
-				jchild = jchild->next;
-			}
-
+			error = event_parse_action_values(node, obj, validate);
 			if(error == 0) {
 				if(validate == 1) {
 					if(node->action != NULL) {
@@ -1371,7 +1230,6 @@ static int event_parse_action(char *action, struct rules_t *obj, int validate) {
 					}
 				}
 			}
-			json_free(output);
 		}
 		if(error != 0) {
 			break;
@@ -1387,363 +1245,1366 @@ static int event_parse_action(char *action, struct rules_t *obj, int validate) {
 	return error;
 }
 
-int event_parse_condition(char **rule, struct rules_t *obj, int depth, unsigned short validate) {
-	char *tmp = *rule;
-	char *and = strstr(tmp, "AND");
-	char *or = strstr(tmp, "OR");
-	char *subrule = NULL;
-	size_t pos = 0;
-	int	type = 0, error = 0/*, i = 0, nrspaces = 0, hasquote = 0*/;
-
-	if(or == NULL) {
-		type = AND;
-	} else if(and == NULL) {
-		type = OR;
-	} else if((and-tmp) < (or-tmp)) {
-		type = AND;
-	} else {
-		type = OR;
+static int event_run_actions(struct rules_t *obj) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	struct rules_actions_t *node = NULL;
+	int x = 0, error = 0, match = 1;
+
+	/* Actions were already validated and split when the rule
+	   was compiled, so only their arguments need to be filled in */
+	for(x=0;match == 1;x++) {
+		match = 0;
+		node = obj->actions;
+		while(node) {
+			if(node->nr == x) {
+				match = 1;
+				break;
+			}
+			node = node->next;
+		}
+		if(match == 1 && node->action != NULL) {
+			if((error = event_parse_action_values(node, obj, 0)) == 0) {
+				if(node->action->run != NULL) {
+					error = node->action->run(node);
+				}
+			}
+			if(error != 0) {
+				break;
+			}
+		}
 	}
-	if(type == AND) {
-		pos = (size_t)(and-tmp);
-	} else {
-		pos = (size_t)(or-tmp);
+	return error;
+}
+
+static struct event_node_t *event_node_new(int type) {
+	struct event_node_t *node = MALLOC(sizeof(struct event_node_t));
+	if(node == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
 	}
+	memset(node, 0, sizeof(struct event_node_t));
+	node->type = type;
+	return node;
+}
 
-	if((subrule = MALLOC(pos+1)) == NULL) {
+static struct event_node_t *event_node_text(char *str, size_t len) {
+	struct event_node_t *node = event_node_new(EVENT_TEXT);
+	if((node->text = MALLOC(len+1)) == NULL) {
 		fprintf(stderr, "out of memory\n");
 		exit(EXIT_FAILURE);
 	}
+	strncpy(node->text, str, len);
+	node->text[len] = '\0';
+	return node;
+}
 
-	strncpy(subrule, tmp, pos);
-	subrule[pos-1] = '\0';
-	// for(i=0;i<pos;i++) {
-		// if(subrule[i] == '"') {
-			// hasquote ^= 1;
-		// }
-		// if(hasquote == 0 && (subrule[i] == ' ')) {
-			// nrspaces++;
-		// }
-	// }
-	/*
-	 * Only "1", "0", "True", "False" or
-	 * "1 == 1", "datetime.hour < 18.00" is valid here.
-	 */
-	// if(nrspaces != 2 && nrspaces != 0) {
-		// logprintf(LOG_ERR, "rule #%d invalid: could not parse \"%s\"", obj->nr, subrule);
-		// error = -1;
-	// } else {
-		if(event_parse_formula(&subrule, obj, depth, validate) == -1) {
-			error = -1;
-		} else {
-			size_t len = strlen(tmp);
-			if(type == AND) {
-				pos += 4;
-			} else {
-				pos += 3;
-			}
-			memmove(tmp, &tmp[pos], len-pos);
-			tmp[len-pos] = '\0';
-			error = atoi(subrule);
-		}
-	// }
-	FREE(subrule);
-	return error;
+static void event_node_add(struct event_node_t *node, struct event_node_t *child) {
+	if((node->children = REALLOC(node->children, sizeof(struct event_node_t *)*(unsigned int)(node->nrchildren+1))) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	node->children[node->nrchildren++] = child;
 }
 
-int event_parse_rule(char *rule, struct rules_t *obj, int depth, unsigned short validate) {
-	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+static void event_node_free(struct event_node_t *node) {
+	int i = 0;
+
+	if(node == NULL) {
+		return;
+	}
+	for(i=0;i<node->nrchildren;i++) {
+		event_node_free(node->children[i]);
+	}
+	if(node->children != NULL) {
+		FREE(node->children);
+	}
+	if(node->text != NULL) {
+		FREE(node->text);
+	}
+	if(node->res != NULL) {
+		FREE(node->res);
+	}
+	if(node->arguments != NULL) {
+		json_delete(node->arguments);
+	}
+	FREE(node);
+}
 
-	char *tloc = 0, *condition = NULL, *action = NULL;
-	unsigned int tpos = 0, rlen = strlen(rule), tlen = 0;
-	int x = 0, nrhooks = 0, error = 0, i = 0;
-	int type_or = 0, type_and = 0;
+void event_free_condition(struct rules_t *obj) {
+	event_node_free(obj->condition);
+	obj->condition = NULL;
 
-	/* Replace all dual+ spaces with a single space */
-	rule = uniq_space(rule);
-	while(x < rlen) {
-		// if(strncmp(&rule[x], "  ", 2) == 0) {
-			// logprintf(LOG_ERR, "rule #%d invalid: multiple spaces in a row", nr);
-			// error = -1;
-			// goto close;
-		// }
-		if(rule[x] == '(') {
-			nrhooks++;
-		}
-		if(rule[x] == ')') {
-			nrhooks--;
-		}
-		x++;
+	pthread_mutex_lock(&events_wheel_lock);
+	if(event_timer_pending(&obj->schedule)) {
+		event_wheel_del(&events_wheel, &obj->schedule);
 	}
+	obj->parked = 0;
+	obj->granularity = 0;
+	obj->datetime = NULL;
+	pthread_mutex_unlock(&events_wheel_lock);
+}
 
-	if(depth == 0) {
-		if(strncmp(&rule[0], "IF ", 3) != 0) {
-			logprintf(LOG_ERR, "rule #%d invalid: missing IF", obj->nr);
-			error = -1;
-			goto close;
-		}
+static void event_free_targets(struct rules_t *obj) {
+	int i = 0;
 
-		if((tloc = strstr(rule, " THEN ")) == NULL) {
-			logprintf(LOG_ERR, "rule #%d invalid: missing THEN", obj->nr);
-			error = -1;
-			goto close;
-		}
+	for(i=0;i<obj->nrtargets;i++) {
+		FREE(obj->targets[i]);
+	}
+	if(obj->targets != NULL) {
+		FREE(obj->targets);
+	}
+	obj->targets = NULL;
+	obj->nrtargets = 0;
+}
 
-		tpos = (size_t)(tloc-rule);
+/* Collects the devices named by the DEVICE argument of the actions */
+static void event_rule_targets(struct rules_t *obj) {
+	struct rules_actions_t *node = obj->actions;
+	struct JsonNode *jdevice = NULL, *jvalue = NULL, *jchild = NULL;
+	int i = 0;
 
-		if((action = MALLOC((rlen-tpos)+6+1)) == NULL) {
-			fprintf(stderr, "out of memory\n");
-			exit(EXIT_FAILURE);
+	event_free_targets(obj);
+	while(node) {
+		if(node->arguments != NULL &&
+		   (jdevice = json_find_member(node->arguments, "DEVICE")) != NULL &&
+		   (jvalue = json_find_member(jdevice, "value")) != NULL) {
+			jchild = json_first_child(jvalue);
+			while(jchild) {
+				/* Devices taken from a variable or function are unknown until
+				   the rule runs, so the rule can't be evaluated next to others */
+				if(jchild->tag != JSON_STRING ||
+				   strchr(jchild->string_, '.') != NULL ||
+				   strchr(jchild->string_, '(') != NULL) {
+					event_free_targets(obj);
+					obj->nrtargets = -1;
+					return;
+				}
+				for(i=0;i<obj->nrtargets;i++) {
+					if(strcmp(obj->targets[i], jchild->string_) == 0) {
+						break;
+					}
+				}
+				if(i == obj->nrtargets) {
+					if((obj->targets = REALLOC(obj->targets, sizeof(char *)*(size_t)(obj->nrtargets+1))) == NULL ||
+					   (obj->targets[obj->nrtargets] = MALLOC(strlen(jchild->string_)+1)) == NULL) {
+						fprintf(stderr, "out of memory\n");
+						exit(EXIT_FAILURE);
+					}
+					strcpy(obj->targets[obj->nrtargets++], jchild->string_);
+				}
+				jchild = jchild->next;
+			}
 		}
+		node = node->next;
+	}
+}
 
-		strncpy(action, &rule[tpos+6], rlen-tpos);
-		action[rlen-tpos+6] = '\0';
-		tlen = rlen-tpos+6;
+static void event_skip_spaces(struct event_parser_t *p) {
+	while(p->str[p->pos] == ' ') {
+		p->pos++;
+	}
+}
 
-		/* Extract the command part between the IF and THEN
-		   ("IF " length = 3) */
-		if((condition = MALLOC(rlen-tlen+3+1)) == NULL) {
-			fprintf(stderr, "out of memory\n");
-			exit(EXIT_FAILURE);
-		}
+static size_t event_word_length(struct event_parser_t *p) {
+	size_t len = 0;
+	char c = 0;
 
-		strncpy(condition, &rule[3], rlen-tlen+3);
-		condition[rlen-tlen+3] = '\0';
+	while((c = p->str[p->pos+len]) != '\0' && c != ' ' && c != '(' && c != ')') {
+		len++;
 	}
+	return len;
+}
 
-	if(nrhooks > 0) {
-		logprintf(LOG_ERR, "rule #%d invalid: missing one or more )", obj->nr);
-		error = -1;
-		goto close;
-	} else if(nrhooks < 0) {
-		logprintf(LOG_ERR, "rule #%d invalid: missing one or more (", obj->nr);
-		error = -1;
-		goto close;
+static int event_is_word(struct event_parser_t *p, const char *word) {
+	size_t len = strlen(word);
+	char c = 0;
+
+	if(strncmp(&p->str[p->pos], word, len) != 0) {
+		return 0;
 	}
+	c = p->str[p->pos+len];
+	return (c == ' ' || c == '(' || c == '\0');
+}
+
+static void event_parse_error(struct event_parser_t *p) {
+	logprintf(LOG_ERR, "rule #%d invalid: could not parse \"%s\"", p->obj->nr, p->str);
+}
 
-	if(depth > 0) {
-		condition = rule;
+/*
+	Resolves a literal or device.value operand once for the
+	type the operator it belongs to works on. Device values
+	stay bound to the cached value pointer so every evaluation
+	reads their current value.
+*/
+static int event_bind_operand(struct rules_t *obj, struct event_node_t *node, int type) {
+	int rtype = 0;
+
+	if(node->type != EVENT_TEXT) {
+		return 0;
 	}
+	if(event_lookup_variable(node->text, obj, type, &node->v, &rtype, 1, RULE) == -1 || rtype != type) {
+		return -1;
+	}
+	node->vartype = type;
+	node->value = event_get_val_ptr(obj, node->text);
+	return 0;
+}
 
-	int pass = 0, ltype = NONE, skip = 0;
-	while(condition[i] != '\0') {
-		if(condition[i] == '(') {
-			/* Subcondition */
-			if(i == 0 || condition[i-1] == '(' || condition[i-1] == ' ') {
-				if(ltype == AND && skip == 1 && validate == 0) {
-					error = event_remove_hooks(&condition, obj, depth+1);
-				} else {
-					error = event_parse_hooks(&condition, obj, depth+1, validate);
-				}
-			/* Function */
-			} else {
-				error = event_parse_function(&condition, obj, validate, RULE);
-			}
+static struct event_node_t *event_compile_condition(struct event_parser_t *p, int type);
+
+static struct event_node_t *event_compile_function(struct event_parser_t *p, size_t len) {
+	struct event_functions_t *tmp_function = event_functions;
+	struct event_node_t *node = NULL, *arg = NULL;
+	size_t start = 0;
+	int hooks = 0, i = 0;
+	char name[len+1];
+
+	strncpy(name, &p->str[p->pos], len);
+	name[len] = '\0';
+
+	while(tmp_function) {
+		if(strcmp(tmp_function->name, name) == 0 && tmp_function->run != NULL) {
+			break;
 		}
-		if((type_and = strncmp(&condition[i], " AND ", 5)) == 0 || (type_or = strncmp(&condition[i], " OR ", 4)) == 0) {
-			i--;
-			ltype = (type_and == 0) ? AND : OR;
-			if(skip == 0) {
-				if(pilight.debuglevel == 1) {
-					fprintf(stderr, "evaluate (%s) %s\n", (type_and == 0) ? "AND" : "OR", condition);
-				}
-				pass = event_parse_condition(&condition, obj, depth, validate);
-				error = pass;
-				i = -1;
-			} else {
-				if(pilight.debuglevel == 1) {
-					fprintf(stderr, "skip (%s) %s\n", (type_and == 0) ? "AND" : "OR", condition);
-				}
-				size_t y = (type_and == 0) ? 6 : 5;
-				size_t z = strlen(condition)-((size_t)i + (size_t)y);
-				memmove(condition, &condition[(size_t)i + (size_t)y], (size_t)z);
-				condition[z] = '\0';
-				i = -1;
+		tmp_function = tmp_function->next;
+	}
+	if(tmp_function == NULL) {
+		logprintf(LOG_ERR, "rule #%d invalid: function \"%s\" does not exist", p->obj->nr, name);
+		return NULL;
+	}
+
+	node = event_node_new(EVENT_FUNCTION);
+	node->function = tmp_function;
+	if((node->res = MALLOC(BUFFER_SIZE)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(node->res, '\0', BUFFER_SIZE);
+
+	p->pos += len+1;
+	while(1) {
+		event_skip_spaces(p);
+		start = p->pos;
+		len = event_word_length(p);
+		/*
+			Nested functions are evaluated first and passed
+			as argument to the outer function e.g.
+
+			DATE_FORMAT(DATE_ADD(2014-01-01 23:59:59, 1 SECOND), %Y-%m-%d %H:%M:%S, %H.%M)
+		*/
+		if(len > 0 && p->str[p->pos+len] == '(') {
+			if((arg = event_compile_function(p, len)) == NULL) {
+				event_node_free(node);
+				return NULL;
 			}
-			if(validate == 0) {
-				if(pass == 1 && type_or == 0) {
-					condition[0] = '1';
-					condition[1] = '\0';
+			event_skip_spaces(p);
+			node->nested = 1;
+		} else {
+			hooks = 0;
+			while(p->str[p->pos] != '\0') {
+				if(p->str[p->pos] == '(') {
+					hooks++;
+				} else if(p->str[p->pos] == ')') {
+					if(hooks == 0) {
+						break;
+					}
+					hooks--;
+				} else if(p->str[p->pos] == ',' && hooks == 0) {
 					break;
-				} else if(pass == 0 && type_and == 0) {
-					skip = 1;
-				} else {
-					skip = 0;
 				}
+				p->pos++;
 			}
+			arg = event_node_text(&p->str[start], p->pos-start);
 		}
-		if(error == -1) {
-			goto close;
-		}
-		i++;
-	}
-	if(error > 0) {
-		error = 0;
-	}
+		event_node_add(node, arg);
 
-	if((ltype == AND && pass == 0) && validate == 0) {
-		if(pilight.debuglevel == 1) {
-			fprintf(stderr, "skip (%s) %s\n", (ltype == AND) ? "AND" : "OR", condition);
-		}
-		condition[0] = '0';
-		condition[1] = '\0';
-	/* Skip this part when the condition only contains "1" or "0" */
-	} else if(strlen(condition) > 1) {
-		if(pilight.debuglevel == 1) {
-			fprintf(stderr, "evaluate (%s) %s\n", (ltype == AND) ? "AND" : "OR", condition);
-		}
-		if(event_parse_formula(&condition, obj, depth, validate) == -1) {
-			error = -1;
-			goto close;
-		}
-	} else {
-		if(pilight.debuglevel == 1) {
-			fprintf(stderr, "skip (%s) %s\n", (ltype == AND) ? "AND" : "OR", condition);
+		if(p->str[p->pos] == ',') {
+			p->pos++;
+		} else if(p->str[p->pos] == ')') {
+			p->pos++;
+			break;
+		} else {
+			event_parse_error(p);
+			event_node_free(node);
+			return NULL;
 		}
 	}
-	obj->status = atoi(condition);
-	if(validate == 1 && depth == 0 && event_parse_action(action, obj, validate) != 0) {
-		logprintf(LOG_ERR, "rule #%d invalid: invalid action", obj->nr);
-		error = -1;
-		goto close;
-	} else {
-		if(obj->status > 0 && depth == 0) {
-			if(validate == 0 && event_parse_action(action, obj, validate) != 0) {
-				error = -1;
-				goto close;
-			}
-			obj->status = 1;
+
+	if(node->nested == 0) {
+		node->arguments = json_mkarray();
+		for(i=0;i<node->nrchildren;i++) {
+			json_append_element(node->arguments, json_mkstring(node->children[i]->text));
 		}
 	}
 
-close:
-	if(error != 0 && depth == 0) {
-		logprintf(LOG_INFO, "rule #%d was parsed until: ... %s THEN %s", obj->nr, condition, action);
+	return node;
+}
+
+static struct event_node_t *event_compile_operand(struct event_parser_t *p) {
+	struct event_node_t *node = NULL;
+	char *quote = NULL;
+	size_t len = 0;
+
+	event_skip_spaces(p);
+	if(p->str[p->pos] == '(') {
+		p->pos++;
+		if((node = event_compile_condition(p, EVENT_OR)) == NULL) {
+			return NULL;
+		}
+		event_skip_spaces(p);
+		if(p->str[p->pos] != ')') {
+			logprintf(LOG_ERR, "rule #%d invalid: missing one or more )", p->obj->nr);
+			event_node_free(node);
+			return NULL;
+		}
+		p->pos++;
+		return node;
 	}
-	if(depth == 0) {
-		if(condition != NULL) {
-			FREE(condition);
+
+	if(p->str[p->pos] == '"') {
+		if((quote = strstr(&p->str[p->pos+1], "\"")) == NULL) {
+			event_parse_error(p);
+			return NULL;
 		}
+		len = (size_t)(quote-&p->str[p->pos+1]);
+		node = event_node_text(&p->str[p->pos+1], len);
+		p->pos += len+2;
+		return node;
 	}
-	if(action != NULL) {
-		FREE(action);
+
+	if((len = event_word_length(p)) == 0) {
+		event_parse_error(p);
+		return NULL;
+	}
+	if(p->str[p->pos+len] == '(') {
+		return event_compile_function(p, len);
 	}
+	node = event_node_text(&p->str[p->pos], len);
+	p->pos += len;
 
-	return error;
+	return node;
 }
 
-void *events_loop(void *param) {
-	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+/*
+	A formula is one or more operands separated by operators,
+	which are solved from left to right without precedence e.g.
 
-	if(eventslock_init == 0) {
-		pthread_mutexattr_init(&events_attr);
-		pthread_mutexattr_settype(&events_attr, PTHREAD_MUTEX_RECURSIVE);
-		pthread_mutex_init(&events_lock, &events_attr);
-		pthread_cond_init(&events_signal, NULL);
-		eventslock_init = 1;
+	1 + 2 == 3
+	location.device.state IS on
+*/
+static struct event_node_t *event_compile_formula(struct event_parser_t *p) {
+	struct event_operators_t *tmp_operator = NULL;
+	struct event_node_t *node = NULL, *left = NULL, *right = NULL;
+	size_t len = 0;
+	int type = 0;
+
+	if((left = event_compile_operand(p)) == NULL) {
+		return NULL;
+	}
+	while(1) {
+		event_skip_spaces(p);
+		if(p->str[p->pos] == '\0' || p->str[p->pos] == ')' ||
+		   event_is_word(p, "AND") == 1 || event_is_word(p, "OR") == 1) {
+			break;
+		}
+		if((len = event_word_length(p)) == 0) {
+			event_parse_error(p);
+			event_node_free(left);
+			return NULL;
+		}
+		tmp_operator = event_operators;
+		while(tmp_operator) {
+			if(strncmp(tmp_operator->name, &p->str[p->pos], len) == 0 && tmp_operator->name[len] == '\0') {
+				break;
+			}
+			tmp_operator = tmp_operator->next;
+		}
+		if(tmp_operator == NULL) {
+			char name[len+1];
+			strncpy(name, &p->str[p->pos], len);
+			name[len] = '\0';
+			logprintf(LOG_ERR, "rule #%d invalid: operator \"%s\" does not exist", p->obj->nr, name);
+			event_node_free(left);
+			return NULL;
+		}
+		p->pos += len;
+		if((right = event_compile_operand(p)) == NULL) {
+			event_node_free(left);
+			return NULL;
+		}
+
+		node = event_node_new(EVENT_OPERATOR);
+		node->operator = tmp_operator;
+		if((node->res = MALLOC(255)) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+		memset(node->res, '\0', 255);
+		event_node_add(node, left);
+		event_node_add(node, right);
+		left = node;
+
+		if(tmp_operator->callback_number != NULL) {
+			type = JSON_NUMBER;
+		} else {
+			type = JSON_STRING;
+		}
+		if(event_bind_operand(p->obj, node->children[0], type) == -1 ||
+		   event_bind_operand(p->obj, node->children[1], type) == -1) {
+			event_node_free(node);
+			return NULL;
+		}
+	}
+	return left;
+}
+
+/*
+	A condition is a list of formulas combined by AND and OR.
+	AND binds stronger than OR, so the OR level is built from
+	lists of AND'ed formulas.
+*/
+static struct event_node_t *event_compile_condition(struct event_parser_t *p, int type) {
+	struct event_node_t *node = NULL, *child = NULL;
+	const char *word = (type == EVENT_OR) ? "OR" : "AND";
+
+	while(1) {
+		if(type == EVENT_OR) {
+			child = event_compile_condition(p, EVENT_AND);
+		} else {
+			child = event_compile_formula(p);
+		}
+		if(child == NULL) {
+			event_node_free(node);
+			return NULL;
+		}
+		event_skip_spaces(p);
+		if(node == NULL) {
+			if(event_is_word(p, word) == 0) {
+				return child;
+			}
+			node = event_node_new(type);
+		}
+		event_node_add(node, child);
+		if(event_is_word(p, word) == 0) {
+			break;
+		}
+		p->pos += strlen(word);
 	}
+	return node;
+}
+
+/*
+	Compiles the condition of a rule into obj->condition and
+	returns a copy of the action part, or NULL on errors.
+*/
+static char *event_compile_rule(char *rule, struct rules_t *obj) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
+	struct event_parser_t p;
+	char *tloc = NULL, *action = NULL;
+	size_t len = 0, i = 0;
+	int nrhooks = 0, hasquote = 0;
+
+	/* Replace all dual+ spaces with a single space */
+	rule = uniq_space(rule);
+
+	if(strncmp(&rule[0], "IF ", 3) != 0) {
+		logprintf(LOG_ERR, "rule #%d invalid: missing IF", obj->nr);
+		return NULL;
+	}
+	if((tloc = strstr(rule, " THEN ")) == NULL) {
+		logprintf(LOG_ERR, "rule #%d invalid: missing THEN", obj->nr);
+		return NULL;
+	}
+
+	len = (size_t)(tloc-rule)-3;
+	if((p.str = MALLOC(len+1)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	strncpy(p.str, &rule[3], len);
+	p.str[len] = '\0';
+	p.pos = 0;
+	p.obj = obj;
+
+	for(i=0;i<len;i++) {
+		if(p.str[i] == '"') {
+			hasquote ^= 1;
+		} else if(hasquote == 0 && p.str[i] == '(') {
+			nrhooks++;
+		} else if(hasquote == 0 && p.str[i] == ')') {
+			nrhooks--;
+		}
+	}
+	if(nrhooks > 0) {
+		logprintf(LOG_ERR, "rule #%d invalid: missing one or more )", obj->nr);
+		FREE(p.str);
+		return NULL;
+	} else if(nrhooks < 0) {
+		logprintf(LOG_ERR, "rule #%d invalid: missing one or more (", obj->nr);
+		FREE(p.str);
+		return NULL;
+	}
+
+	if((obj->condition = event_compile_condition(&p, EVENT_OR)) != NULL) {
+		event_skip_spaces(&p);
+		if(p.str[p.pos] != '\0') {
+			event_parse_error(&p);
+			event_free_condition(obj);
+		}
+	}
+	if(obj->condition == NULL) {
+		if(p.str[p.pos] != '\0') {
+			logprintf(LOG_INFO, "rule #%d was parsed until: ... %s", obj->nr, &p.str[p.pos]);
+		}
+		FREE(p.str);
+		return NULL;
+	}
+	FREE(p.str);
+
+	if((action = MALLOC(strlen(&tloc[6])+1)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(action, &tloc[6]);
+
+	return action;
+}
+
+static int event_node_eval(struct event_node_t *node, struct rules_t *obj, unsigned short validate, struct varcont_t *out, int *rtype);
+
+/* Prints a number result the way it is shown as text */
+static char *event_node_string(struct event_node_t *node, struct varcont_t *v, int type) {
+	if(type == JSON_STRING) {
+		return v->string_;
+	}
+	snprintf(node->res, 255, "%.*f", v->decimals_, v->number_);
+	return node->res;
+}
+
+static int event_node_int(struct varcont_t *v, int type) {
+	return (type == JSON_NUMBER) ? (int)v->number_ : atoi(v->string_);
+}
+
+static double event_node_round(double number, int decimals) {
+	static const double scale[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+
+	/* Beyond 1e15 a double has no decimals left to round */
+	if(decimals < 0 || decimals >= (int)(sizeof(scale)/sizeof(scale[0])) || fabs(number) >= 1e15) {
+		return number;
+	}
+	return round(number*scale[decimals])/scale[decimals];
+}
+
+static int event_node_value(struct event_node_t *node, struct rules_t *obj, int type, unsigned short validate, struct varcont_t *v) {
+	struct devices_values_t *values = NULL;
+	struct varcont_t r;
+	char *res = NULL;
+	int rtype = 0;
+
+	if(node->type == EVENT_TEXT && node->vartype == type) {
+		if(node->value != NULL) {
+			if((values = event_val_ptr_values(node->value)) == NULL) {
+				logprintf(LOG_ERR, "rule #%d: variable \"%s\" no longer exists", obj->nr, node->text);
+				return -1;
+			}
+			if(values->type == JSON_STRING) {
+				v->string_ = values->string_;
+			} else {
+				v->number_ = values->number_;
+				v->decimals_ = values->decimals;
+			}
+		} else {
+			*v = node->v;
+		}
+		return 0;
+	}
+
+	memset(&r, 0, sizeof(struct varcont_t));
+	if(event_node_eval(node, obj, validate, &r, &rtype) != 0) {
+		return -1;
+	}
+	/* Numbers are passed on rounded to their decimals, as if
+	   they were printed and read back, anything else is
+	   converted like a literal */
+	if(rtype == JSON_NUMBER && type == JSON_NUMBER && isfinite(r.number_)) {
+		v->number_ = event_node_round(r.number_, r.decimals_);
+		v->decimals_ = r.decimals_;
+		return 0;
+	}
+	res = event_node_string(node, &r, rtype);
+	if(event_convert_value(res, obj, type, v, &rtype) != 0 || rtype != type) {
+		return -1;
+	}
+	return 0;
+}
+
+static int event_node_eval(struct event_node_t *node, struct rules_t *obj, unsigned short validate, struct varcont_t *out, int *rtype) {
+	struct event_operators_t *operator = NULL;
+	struct JsonNode *arguments = NULL;
+	struct varcont_t v1, v2, r;
+	unsigned long long start = 0;
+	int i = 0, type = 0, error = 0;
+
+	switch(node->type) {
+		case EVENT_TEXT:
+			out->string_ = node->text;
+			*rtype = JSON_STRING;
+		break;
+		case EVENT_OPERATOR:
+			operator = node->operator;
+			if(operator->callback_number != NULL) {
+				type = JSON_NUMBER;
+			} else {
+				type = JSON_STRING;
+			}
+			memset(&v1, 0, sizeof(struct varcont_t));
+			memset(&v2, 0, sizeof(struct varcont_t));
+			if(event_node_value(node->children[0], obj, type, validate, &v1) != 0 ||
+			   event_node_value(node->children[1], obj, type, validate, &v2) != 0) {
+				return -1;
+			}
+			memset(out, 0, sizeof(struct varcont_t));
+			start = event_profile_clock();
+			if(operator->callback_string != NULL) {
+				if(v1.string_ != NULL && v2.string_ != NULL) {
+					operator->callback_string(v1.string_, v2.string_, out);
+				}
+			} else {
+				operator->callback_number(v1.number_, v2.number_, out);
+			}
+			if(validate == 0) {
+				event_profile_add(&operator->profile, start);
+			}
+			*rtype = JSON_NUMBER;
+			if(pilight.debuglevel == 1) {
+				fprintf(stderr, "evaluate %s: %.*f\n", operator->name, out->decimals_, out->number_);
+			}
+		break;
+		case EVENT_FUNCTION:
+			if(node->nested == 1) {
+				arguments = json_mkarray();
+				for(i=0;i<node->nrchildren;i++) {
+					memset(&r, 0, sizeof(struct varcont_t));
+					if(event_node_eval(node->children[i], obj, validate, &r, &type) != 0) {
+						json_delete(arguments);
+						return -1;
+					}
+					json_append_element(arguments, json_mkstring(event_node_string(node->children[i], &r, type)));
+				}
+			} else {
+				arguments = node->arguments;
+			}
+			node->res[0] = '\0';
+			start = event_profile_clock();
+			error = node->function->run(obj, arguments, &node->res, RULE);
+			if(validate == 0) {
+				event_profile_add(&node->function->profile, start);
+			}
+			if(node->nested == 1) {
+				json_delete(arguments);
+			}
+			if(error != 0) {
+				return -1;
+			}
+			if(pilight.debuglevel == 1) {
+				fprintf(stderr, "evaluate %s: %s\n", node->function->name, node->res);
+			}
+			out->string_ = node->res;
+			*rtype = JSON_STRING;
+		break;
+		case EVENT_AND:
+		case EVENT_OR:
+			/*
+				Stop as soon as the outcome is known, except while
+				validating where every formula has to be checked.
+			*/
+			for(i=0;i<node->nrchildren;i++) {
+				if(event_node_eval(node->children[i], obj, validate, out, rtype) != 0) {
+					return -1;
+				}
+				if(validate == 0 && i < node->nrchildren-1) {
+					if((node->type == EVENT_AND && event_node_int(out, *rtype) == 0) ||
+					   (node->type == EVENT_OR && event_node_int(out, *rtype) == 1)) {
+						if(pilight.debuglevel == 1) {
+							fprintf(stderr, "skip (%s) after %d\n", (node->type == EVENT_AND) ? "AND" : "OR", event_node_int(out, *rtype));
+						}
+						break;
+					}
+				}
+			}
+		break;
+		default:
+			return -1;
+	}
+	return 0;
+}
+
+static int events_is_datetime(struct devices_t *dev) {
+	struct protocols_t *tmp = dev->protocols;
+
+	while(tmp) {
+		if(tmp->listener->devtype == DATETIME) {
+			return 1;
+		}
+		tmp = tmp->next;
+	}
+	return 0;
+}
+
+/* Returns -1 when the condition calls a function */
+static int event_node_functions(struct event_node_t *node) {
+	int i = 0;
+
+	if(node == NULL) {
+		return 0;
+	}
+	if(node->type == EVENT_FUNCTION) {
+		return -1;
+	}
+	for(i=0;i<node->nrchildren;i++) {
+		if(event_node_functions(node->children[i]) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+	Finds how often the outcome of the rule can change by time alone.
+	Rules reading the second of a datetime device, or the outcome
+	of a function, are never parked.
+*/
+static void event_rule_granularity(struct rules_t *obj) {
+	struct rules_values_t *tmp_values = obj->values;
 	struct devices_t *dev = NULL;
-	struct JsonNode *jdevices = NULL, *jchilds = NULL;
-	struct rules_t *tmp_rules = NULL;
-	char *str = NULL;
-	unsigned short match = 0;
-	unsigned int i = 0;
+	int granularity = 0;
 
-	pthread_mutex_lock(&events_lock);
-	while(loop) {
-		if(eventsqueue_number > 0) {
-			pthread_mutex_lock(&events_lock);
+	obj->granularity = 0;
+	obj->datetime = NULL;
+	if(event_node_functions(obj->condition) != 0) {
+		return;
+	}
+	while(tmp_values) {
+		if(devices_get(tmp_values->device, &dev) == 0 && events_is_datetime(dev) == 1) {
+			if(strcmp(tmp_values->name, "minute") == 0) {
+				granularity = 60;
+			} else if(strcmp(tmp_values->name, "hour") == 0 || strcmp(tmp_values->name, "dst") == 0 ||
+				strcmp(tmp_values->name, "day") == 0 || strcmp(tmp_values->name, "weekday") == 0 ||
+				strcmp(tmp_values->name, "month") == 0 || strcmp(tmp_values->name, "year") == 0) {
+				granularity = 3600;
+			} else {
+				obj->granularity = 0;
+				obj->datetime = NULL;
+				return;
+			}
+			/* All datetime devices follow the same clock */
+			if(obj->granularity == 0 || granularity < obj->granularity) {
+				obj->granularity = granularity;
+				obj->datetime = tmp_values->device;
+			}
+		}
+		tmp_values = tmp_values->next;
+	}
+}
 
-			logprintf(LOG_STACK, "%s::unlocked", __FUNCTION__);
+/*
+	When validating, the rule is compiled into obj->condition
+	and its actions are checked. Otherwise the compiled
+	condition is evaluated and the actions are run when
+	it holds.
+*/
+int event_parse_rule(char *rule, struct rules_t *obj, unsigned short validate) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-			running = 1;
+	struct varcont_t out;
+	char *action = NULL;
+	int error = 0, type = 0;
 
-			jdevices = json_find_member(eventsqueue->jconfig, "devices");
-			tmp_rules = rules_get();
-			while(tmp_rules) {
-				if(tmp_rules->active == 1) {
-					match = 0;
-					if((str = MALLOC(strlen(tmp_rules->rule)+1)) == NULL) {
+	if(validate == 1) {
+		event_free_condition(obj);
+		if((action = event_compile_rule(rule, obj)) == NULL) {
+			return -1;
+		}
+		if(event_node_eval(obj->condition, obj, validate, &out, &type) != 0) {
+			error = -1;
+		} else if(event_parse_action(action, obj, validate) != 0) {
+			logprintf(LOG_ERR, "rule #%d invalid: invalid action", obj->nr);
+			error = -1;
+		} else {
+			event_rule_targets(obj);
+			event_rule_granularity(obj);
+		}
+		FREE(action);
+		return error;
+	}
+
+	if(obj->condition == NULL) {
+		return -1;
+	}
+	if(event_node_eval(obj->condition, obj, validate, &out, &type) != 0) {
+		return -1;
+	}
+	obj->status = event_node_int(&out, type);
+	if(obj->status > 0) {
+		if(event_run_actions(obj) != 0) {
+			return -1;
+		}
+		obj->status = 1;
+	}
+
+	return 0;
+}
+
+static int events_sort_rules(const void *a, const void *b) {
+	return (*(struct rules_t **)a)->nr - (*(struct rules_t **)b)->nr;
+}
+
+/* Collects the rules depending on the devices of an update,
+   ordered as they were configured */
+static int events_match_rules(struct JsonNode *jdevices) {
+	struct devices_t *dev = NULL;
+	struct JsonNode *jchilds = NULL;
+	struct rules_t **tmp_rules = NULL;
+	struct event_timer_t *expired = NULL;
+	int nrrules = 0, nrmatched = 0, i = 0, x = 0, datetime = 0;
+
+	/* Parked rules whose fields are about to change are due again */
+	pthread_mutex_lock(&events_wheel_lock);
+	if(events_wheel_init == 1) {
+		expired = event_wheel_run(&events_wheel, event_timer_clock());
+		while(expired) {
+			((struct rules_t *)expired->data)->parked = 0;
+			expired = expired->next;
+		}
+	}
+
+	jchilds = json_first_child(jdevices);
+	while(jchilds) {
+		if(jchilds->tag == JSON_STRING &&
+		   (nrrules = rules_get_by_device(jchilds->string_, &tmp_rules)) > 0) {
+			if(devices_get(jchilds->string_, &dev) != 0) {
+				dev = NULL;
+			}
+			datetime = (dev != NULL && events_is_datetime(dev) == 1);
+			for(i=0;i<nrrules;i++) {
+				if(datetime == 1 && tmp_rules[i]->parked == 1) {
+					events_parked++;
+					continue;
+				}
+				if(dev != NULL &&
+				   dev->lastrule == tmp_rules[i]->nr &&
+				   tmp_rules[i]->nr == dev->prevrule &&
+				   dev->lastrule == dev->prevrule) {
+					logprintf(LOG_ERR, "skipped rule #%d because of an infinite loop triggered by device %s", tmp_rules[i]->nr, jchilds->string_);
+					continue;
+				}
+				for(x=0;x<nrmatched;x++) {
+					if(events_matched[x] == tmp_rules[i]) {
+						break;
+					}
+				}
+				if(x < nrmatched) {
+					continue;
+				}
+				if(nrmatched >= events_matched_size) {
+					events_matched_size += 16;
+					if((events_matched = REALLOC(events_matched, sizeof(struct rules_t *)*(unsigned int)events_matched_size)) == NULL) {
 						fprintf(stderr, "out of memory\n");
 						exit(EXIT_FAILURE);
 					}
-					strcpy(str, tmp_rules->rule);
-					/* Only run those events that affect the updates devices */
-					if(jdevices != NULL) {
-						jchilds = json_first_child(jdevices);
-						while(jchilds) {
-							for(i=0;i<tmp_rules->nrdevices;i++) {
-								if(jchilds->tag == JSON_STRING &&
-								   strcmp(jchilds->string_, tmp_rules->devices[i]) == 0) {
-									if(devices_get(jchilds->string_, &dev) == 0) {
-										if(dev->lastrule == tmp_rules->nr &&
-											 tmp_rules->nr == dev->prevrule &&
-											 dev->lastrule == dev->prevrule) {
-											logprintf(LOG_ERR, "skipped rule #%d because of an infinite loop triggered by device %s", tmp_rules->nr, jchilds->string_);
-										} else {
-											match = 1;
-										}
-									} else {
-										match = 1;
-									}
-									break;
-								}
-							}
-							jchilds = jchilds->next;
-						}
-					}
-					if(match == 1 && tmp_rules->status == 0) {
-						clock_gettime(CLOCK_MONOTONIC, &tmp_rules->timestamp.first);
-						if(event_parse_rule(str, tmp_rules, 0, 0) == 0) {
-							if(tmp_rules->status == 1) {
-								logprintf(LOG_INFO, "executed rule: %s", tmp_rules->name);
-							}
-						}
-						clock_gettime(CLOCK_MONOTONIC, &tmp_rules->timestamp.second);
-						logprintf(LOG_DEBUG, "rule #%d %s was parsed in %.6f seconds", tmp_rules->nr, tmp_rules->name,
-							((double)tmp_rules->timestamp.second.tv_sec + 1.0e-9*tmp_rules->timestamp.second.tv_nsec) -
-							((double)tmp_rules->timestamp.first.tv_sec + 1.0e-9*tmp_rules->timestamp.first.tv_nsec));
+				}
+				events_matched[nrmatched++] = tmp_rules[i];
+			}
+		}
+		jchilds = jchilds->next;
+	}
+	pthread_mutex_unlock(&events_wheel_lock);
+	if(nrmatched > 1) {
+		qsort(events_matched, (size_t)nrmatched, sizeof(struct rules_t *), events_sort_rules);
+	}
+	return nrmatched;
+}
+
+static int events_sort_targets(const void *a, const void *b) {
+	const struct events_target_t *x = a, *y = b;
+	int r = strcmp(x->device, y->device);
+
+	return (r != 0) ? r : x->rule - y->rule;
+}
+
+static int events_find_group(int *parent, int i) {
+	while(parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+/*
+	Splits the matched rules into groups of rules sharing target
+	devices. Groups are ordered by their first rule, the rules
+	within a group by their number.
+*/
+static int events_group_rules(int nrmatched) {
+	struct rules_t *tmp_rules = NULL;
+	int *parent = NULL, *tail = NULL;
+	int nrtargets = 0, nrgroups = 0, serial = 0, i = 0, x = 0, a = 0, b = 0;
 
-						tmp_rules->status = 0;
+	if(nrmatched > events_chain_size) {
+		events_chain_size = nrmatched;
+		if((events_chain = REALLOC(events_chain, sizeof(int)*3*(size_t)events_chain_size)) == NULL ||
+		   (events_groups = REALLOC(events_groups, sizeof(int)*(size_t)events_chain_size)) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	/* The chain is followed by the union-find parents
+	   and the last rule of each group */
+	parent = &events_chain[events_chain_size];
+	tail = &events_chain[events_chain_size*2];
+
+	for(i=0;i<nrmatched;i++) {
+		parent[i] = i;
+		tmp_rules = events_matched[i];
+		if(tmp_rules->nrtargets < 0) {
+			/* Unknown targets serialize with every other rule */
+			serial = 1;
+			continue;
+		}
+		for(x=0;x<tmp_rules->nrtargets;x++) {
+			if(nrtargets >= events_targets_size) {
+				events_targets_size += 16;
+				if((events_targets = REALLOC(events_targets, sizeof(struct events_target_t)*(size_t)events_targets_size)) == NULL) {
+					fprintf(stderr, "out of memory\n");
+					exit(EXIT_FAILURE);
+				}
+			}
+			events_targets[nrtargets].device = tmp_rules->targets[x];
+			events_targets[nrtargets].rule = i;
+			nrtargets++;
+		}
+	}
+	if(serial == 1) {
+		for(i=0;i<nrmatched;i++) {
+			parent[i] = 0;
+		}
+	} else if(nrtargets > 1) {
+		qsort(events_targets, (size_t)nrtargets, sizeof(struct events_target_t), events_sort_targets);
+		for(i=1;i<nrtargets;i++) {
+			if(strcmp(events_targets[i-1].device, events_targets[i].device) == 0) {
+				a = events_find_group(parent, events_targets[i-1].rule);
+				b = events_find_group(parent, events_targets[i].rule);
+				if(a != b) {
+					/* Keep the lowest rule as root */
+					if(a < b) {
+						parent[b] = a;
+					} else {
+						parent[a] = b;
 					}
-					FREE(str);
 				}
-				tmp_rules = tmp_rules->next;
 			}
-			struct eventsqueue_t *tmp = eventsqueue;
-			json_delete(tmp->jconfig);
+		}
+	}
+
+	/* The root of a group is its first rule, so walking the
+	   rules in order chains every group in rule order */
+	for(i=0;i<nrmatched;i++) {
+		a = events_find_group(parent, i);
+		events_chain[i] = -1;
+		if(a == i) {
+			events_groups[nrgroups++] = i;
+			tail[i] = i;
+		} else {
+			events_chain[tail[a]] = i;
+			tail[a] = i;
+		}
+	}
+	return nrgroups;
+}
+
+static int events_datetime_field(struct devices_t *dev, const char *name, int *out) {
+	struct devices_settings_t *tmp_settings = dev->settings;
+
+	while(tmp_settings) {
+		if(strcmp(tmp_settings->name, name) == 0 && tmp_settings->values->type == JSON_NUMBER) {
+			*out = (int)tmp_settings->values->number_;
+			return 0;
+		}
+		tmp_settings = tmp_settings->next;
+	}
+	return -1;
+}
+
+/*
+	Parks a rule that did not hold until just before the datetime
+	fields it reads change, or makes it due again.
+*/
+static void events_schedule_rule(struct rules_t *obj, int held) {
+	struct devices_t *dev = NULL;
+	struct timeval tv;
+	long long delay = 0;
+	int minute = 0, second = 0;
+
+	pthread_mutex_lock(&events_wheel_lock);
+	if(event_timer_pending(&obj->schedule)) {
+		event_wheel_del(&events_wheel, &obj->schedule);
+	}
+	obj->parked = 0;
+
+	if(held == 0 && obj->datetime != NULL && devices_get(obj->datetime, &dev) == 0 &&
+	   events_datetime_field(dev, "second", &second) == 0 && second < 60 &&
+	   (obj->granularity == 60 || events_datetime_field(dev, "minute", &minute) == 0)) {
+		if(obj->granularity == 60) {
+			delay = 60 - second;
+		} else {
+			delay = 3600 - minute*60 - second;
+		}
+		/* The fields are as old as the update that set them */
+		gettimeofday(&tv, NULL);
+		delay = delay*1000 - ((long long)tv.tv_sec - (long long)dev->timestamp)*1000 - tv.tv_usec/1000 - EVENTS_WAKEUP_MARGIN;
+		if(delay > 0) {
+			if(events_wheel_init == 0) {
+				event_wheel_init(&events_wheel, event_timer_clock());
+				events_wheel_init = 1;
+			}
+			event_wheel_add(&events_wheel, &obj->schedule, event_timer_clock()+(unsigned long long)delay);
+			obj->parked = 1;
+		}
+	}
+	pthread_mutex_unlock(&events_wheel_lock);
+}
+
+/* Returns 1 when the rule was evaluated */
+static int events_eval_rule(struct rules_t *tmp_rules) {
+	struct rules_actions_t *tmp_actions = NULL;
+	unsigned long long start = 0;
+	int actions = 0;
+
+	if(tmp_rules->active != 1 || tmp_rules->status != 0) {
+		return 0;
+	}
+	start = event_profile_clock();
+	clock_gettime(CLOCK_MONOTONIC, &tmp_rules->timestamp.first);
+	if(event_parse_rule(tmp_rules->rule, tmp_rules, 0) == 0) {
+		if(tmp_rules->status == 1) {
+			logprintf(LOG_INFO, "executed rule: %s", tmp_rules->name);
+			tmp_actions = tmp_rules->actions;
+			while(tmp_actions) {
+				if(tmp_actions->action != NULL) {
+					actions++;
+				}
+				tmp_actions = tmp_actions->next;
+			}
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &tmp_rules->timestamp.second);
+	event_profile_rule(&tmp_rules->profile, start, (tmp_rules->status > 0), actions);
+	if(tmp_rules->granularity > 0) {
+		events_schedule_rule(tmp_rules, (tmp_rules->status > 0));
+	}
+	logprintf(LOG_DEBUG, "rule #%d %s was evaluated in %.6f seconds", tmp_rules->nr, tmp_rules->name,
+		((double)tmp_rules->timestamp.second.tv_sec + 1.0e-9*tmp_rules->timestamp.second.tv_nsec) -
+		((double)tmp_rules->timestamp.first.tv_sec + 1.0e-9*tmp_rules->timestamp.first.tv_nsec));
+
+	tmp_rules->status = 0;
+	return 1;
+}
+
+static int events_eval_group(int group) {
+	int i = events_groups[group], evaluated = 0;
+
+	while(i != -1) {
+		evaluated += events_eval_rule(events_matched[i]);
+		i = events_chain[i];
+	}
+	return evaluated;
+}
+
+/* Takes groups until none are left. Called with events_eval_lock held */
+static void events_eval_take(void) {
+	int group = 0, evaluated = 0;
+
+	while(events_nextgroup < events_nrgroups) {
+		group = events_nextgroup++;
+		pthread_mutex_unlock(&events_eval_lock);
+		evaluated = events_eval_group(group);
+		pthread_mutex_lock(&events_eval_lock);
+		events_group_evaluated += evaluated;
+		if(--events_pending == 0) {
+			pthread_cond_signal(&events_eval_done);
+		}
+	}
+}
+
+static void *events_worker(void *param) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	pthread_mutex_lock(&events_eval_lock);
+	while(events_eval_stop == 0) {
+		if(events_nextgroup < events_nrgroups) {
+			events_eval_take();
+		} else {
+			pthread_cond_wait(&events_eval_signal, &events_eval_lock);
+		}
+	}
+	pthread_mutex_unlock(&events_eval_lock);
+
+	return (void *)NULL;
+}
+
+/* Evaluates the matched rules and returns how many were evaluated */
+static int events_eval_rules(int nrmatched) {
+	int nrgroups = 0, evaluated = 0, i = 0;
+
+	if(nrmatched == 0) {
+		return 0;
+	}
+	nrgroups = events_group_rules(nrmatched);
+	if(nrgroups == 1) {
+		return events_eval_group(0);
+	}
+
+	pthread_mutex_lock(&events_eval_lock);
+	if(events_maxworkers == -1) {
+		if(settings_find_number("event-threads", &events_maxworkers) != 0) {
+			events_maxworkers = EVENT_THREADS;
+		}
+		/* The events thread itself evaluates as well */
+		events_maxworkers--;
+		if(events_maxworkers > 0 &&
+		   (events_workers = MALLOC(sizeof(pthread_t)*(size_t)events_maxworkers)) == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for(i=events_nrworkers;i<events_maxworkers && i<nrgroups-1;i++) {
+		threads_create(&events_workers[events_nrworkers++], NULL, events_worker, NULL);
+	}
+	events_nrgroups = nrgroups;
+	events_nextgroup = 0;
+	events_pending = nrgroups;
+	events_group_evaluated = 0;
+	if(events_nrworkers > 0) {
+		events_parallel++;
+		pthread_cond_broadcast(&events_eval_signal);
+	}
+
+	events_eval_take();
+	while(events_pending > 0) {
+		pthread_cond_wait(&events_eval_done, &events_eval_lock);
+	}
+	evaluated = events_group_evaluated;
+	events_nrgroups = 0;
+	events_nextgroup = 0;
+	pthread_mutex_unlock(&events_eval_lock);
+
+	return evaluated;
+}
+
+void *events_loop(void *param) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	if(eventslock_init == 0) {
+		pthread_mutexattr_init(&events_attr);
+		pthread_mutexattr_settype(&events_attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&events_lock, &events_attr);
+		pthread_cond_init(&events_signal, NULL);
+		eventslock_init = 1;
+	}
+
+	struct eventsqueue_t *tmp = NULL;
+	struct JsonNode *jdevices = NULL;
+	int nrmatched = 0, evaluated = 0, profile = 0;
+
+	if(settings_find_number("event-profile", &profile) == 0 && profile == 1) {
+		event_profile_enable();
+	}
+
+	/*
+		The events_lock only guards the queue. The update is taken
+		off the queue before the rules are evaluated, so the broadcast
+		thread can keep queueing and coalescing updates meanwhile
+		without waiting for the rules or their actions.
+	*/
+	pthread_mutex_lock(&events_lock);
+	while(loop) {
+		if(eventsqueue_number > 0) {
+			logprintf(LOG_STACK, "%s::unlocked", __FUNCTION__);
+
+			running = 1;
+
+			tmp = eventsqueue;
 			eventsqueue = eventsqueue->next;
-			FREE(tmp);
 			eventsqueue_number--;
 			pthread_mutex_unlock(&events_lock);
+
+			/* Only run those events that affect the updates devices */
+			nrmatched = 0;
+			evaluated = 0;
+			if((jdevices = json_find_member(tmp->jconfig, "devices")) != NULL) {
+				nrmatched = events_match_rules(jdevices);
+			}
+			evaluated = events_eval_rules(nrmatched);
+			events_evaluated += (unsigned long)evaluated;
+			events_skipped += (unsigned long)(rules_count()-evaluated);
+			if(nrmatched > 0) {
+				logprintf(LOG_DEBUG, "evaluated %d of %d rules", evaluated, rules_count());
+			}
+
+			/* Everything in the update is allocated from its arena */
+			json_arena_free(tmp->arena);
+			FREE(tmp);
+
+			pthread_mutex_lock(&events_lock);
 		} else {
 			running = 0;
 			pthread_cond_wait(&events_signal, &events_lock);
 		}
 	}
+	pthread_mutex_unlock(&events_lock);
 	return (void *)NULL;
 }
 
+/* Returns 0 while an update is being evaluated or waiting in the queue */
 int events_running(void) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
-	return (running == 1) ? 0 : -1;
+	int ret = -1;
+
+	if(eventslock_init == 1) {
+		pthread_mutex_lock(&events_lock);
+	}
+	if(running == 1 || eventsqueue_number > 0) {
+		ret = 0;
+	}
+	if(eventslock_init == 1) {
+		pthread_mutex_unlock(&events_lock);
+	}
+	return ret;
+}
+static int events_same_devices(struct JsonNode *a, struct JsonNode *b) {
+	struct JsonNode *x = json_first_child(a), *y = json_first_child(b);
+
+	while(x != NULL && y != NULL) {
+		if(x->tag != JSON_STRING || y->tag != JSON_STRING ||
+		   strcmp(x->string_, y->string_) != 0) {
+			return -1;
+		}
+		x = x->next;
+		y = y->next;
+	}
+	return (x == NULL && y == NULL) ? 0 : -1;
+}
+
+static int events_has_device(struct JsonNode *jdevices, struct JsonNode *jdevice) {
+	struct JsonNode *jchild = json_first_child(jdevices);
+
+	while(jchild) {
+		if(jchild->tag == JSON_STRING && jdevice->tag == JSON_STRING &&
+		   strcmp(jchild->string_, jdevice->string_) == 0) {
+			return 0;
+		}
+		jchild = jchild->next;
+	}
+	return -1;
+}
+
+static int events_same_value(struct JsonNode *a, struct JsonNode *b) {
+	if(a == NULL || b == NULL) {
+		return (a == b) ? 0 : -1;
+	}
+	if(a->tag == JSON_STRING && b->tag == JSON_STRING) {
+		return (strcmp(a->string_, b->string_) == 0) ? 0 : -1;
+	}
+	if(a->tag == JSON_NUMBER && b->tag == JSON_NUMBER) {
+		return (fabs(a->number_-b->number_) < EPSILON) ? 0 : -1;
+	}
+	return -1;
 }
+
+/*
+	Merges an update into the latest pending update of the same
+	devices. Rules read the device values when they are evaluated,
+	so the pending update will already act upon the newest values.
+	An update changing the state is never merged, every state change
+	still triggers its own evaluation in the order it was received.
+	The update being evaluated is no longer on the queue and is never
+	merged into. Must be called with events_lock held.
+*/
+static int events_coalesce(struct JsonNode *jconfig) {
+	struct eventsqueue_t *tmp = eventsqueue, *last = NULL;
+	struct JsonNode *jdevices = NULL, *jvalues = NULL, *jchild = NULL;
+	struct JsonNode *jpending = NULL, *jold = NULL;
+	int i = 0;
+
+	if(jconfig == NULL ||
+	   (jdevices = json_find_member(jconfig, "devices")) == NULL || jdevices->tag != JSON_ARRAY ||
+	   (jvalues = json_find_member(jconfig, "values")) == NULL || jvalues->tag != JSON_OBJECT) {
+		return -1;
+	}
+
+	for(i=0;i<eventsqueue_number;i++) {
+		if(tmp->jconfig != NULL && (jpending = json_find_member(tmp->jconfig, "devices")) != NULL) {
+			jchild = json_first_child(jdevices);
+			while(jchild) {
+				if(events_has_device(jpending, jchild) == 0) {
+					last = tmp;
+					break;
+				}
+				jchild = jchild->next;
+			}
+		}
+		tmp = tmp->next;
+	}
+	if(last == NULL ||
+	   events_same_devices(json_find_member(last->jconfig, "devices"), jdevices) != 0 ||
+	   (jpending = json_find_member(last->jconfig, "values")) == NULL || jpending->tag != JSON_OBJECT ||
+	   events_same_value(json_find_member(jpending, "state"), json_find_member(jvalues, "state")) != 0) {
+		return -1;
+	}
+
+	jchild = json_first_child(jvalues);
+	while(jchild) {
+		jold = json_find_member(jpending, jchild->key);
+		if(jold != NULL && jold->tag == JSON_NUMBER && jchild->tag == JSON_NUMBER) {
+			jold->number_ = jchild->number_;
+			jold->decimals_ = jchild->decimals_;
+		} else if(events_same_value(jold, jchild) != 0 &&
+		          (jchild->tag == JSON_NUMBER || jchild->tag == JSON_STRING)) {
+			if(jold != NULL) {
+				json_delete(jold);
+			}
+			if(jchild->tag == JSON_NUMBER) {
+				json_append_member(jpending, jchild->key, json_mknumber_in(last->arena, jchild->number_, jchild->decimals_));
+			} else {
+				json_append_member(jpending, jchild->key, json_mkstring_in(last->arena, jchild->string_));
+			}
+		}
+		jchild = jchild->next;
+	}
+	return 0;
+}
+
 static void events_queue(char *message) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
 	if(eventslock_init == 1) {
 		pthread_mutex_lock(&events_lock);
 	}
-	if(eventsqueue_number < 1024) {
-		struct eventsqueue_t *enode = MALLOC(sizeof(eventsqueue_t));
-		if(enode == NULL) {
-			fprintf(stderr, "out of memory\n");
-			exit(EXIT_FAILURE);
-		}
-		enode->jconfig = json_decode(message);
+	struct eventsqueue_t *enode = MALLOC(sizeof(eventsqueue_t));
+	if(enode == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	enode->arena = json_arena_new(strlen(message)*4);
+	enode->jconfig = json_decode_arena(enode->arena, message);
+	enode->next = NULL;
 
+	if(events_coalesce(enode->jconfig) == 0) {
+		events_coalesced++;
+	} else if(eventsqueue_number < 1024) {
 		if(eventsqueue_number == 0) {
 			eventsqueue = enode;
 			eventsqueue_head = enode;
@@ -1751,20 +2612,50 @@ static void events_queue(char *message) {
 			eventsqueue_head->next = enode;
 			eventsqueue_head = enode;
 		}
+		enode = NULL;
 
 		eventsqueue_number++;
+		events_queued++;
 	} else {
+		events_dropped++;
 		logprintf(LOG_ERR, "event queue full");
 	}
+	if(enode != NULL) {
+		json_arena_free(enode->arena);
+		FREE(enode);
+	}
 	if(eventslock_init == 1) {
 		pthread_mutex_unlock(&events_lock);
 		pthread_cond_signal(&events_signal);
 	}
 }
 
+void events_queue_stats(unsigned long *queued, unsigned long *coalesced, unsigned long *dropped) {
+	if(eventslock_init == 1) {
+		pthread_mutex_lock(&events_lock);
+	}
+	*queued = events_queued;
+	*coalesced = events_coalesced;
+	*dropped = events_dropped;
+	if(eventslock_init == 1) {
+		pthread_mutex_unlock(&events_lock);
+	}
+}
+
+static void events_publish(struct JsonNode *json, char *message) {
+	events_queue(message);
+}
+
 void *events_clientize(void *param) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
 
+	/* When running inside the daemon the broadcasts are taken
+	   directly from the eventbus instead of over a TCP socket */
+	if(eventbus_running() == 0) {
+		eventbus_subscribe("events", "all", EVENTBUS_CONFIG, events_publish);
+		return (void *)NULL;
+	}
+
 	struct JsonNode *jclient = NULL;
 	struct JsonNode *joptions = NULL;
 	struct ssdp_list_t *ssdp_list = NULL;
@@ -31,10 +31,12 @@ typedef struct varcont_t {
 
 void event_cache_device(struct rules_t *obj, char *device);
 int event_lookup_variable(char *var, struct rules_t *obj, int type, struct varcont_t *varcont, int *rtype, unsigned short validate, enum origin_t origin);
-int event_parse_rule(char *rule, struct rules_t *obj, int depth, unsigned short validate);
+int event_parse_rule(char *rule, struct rules_t *obj, unsigned short validate);
+void event_free_condition(struct rules_t *obj);
 void *events_clientize(void *param);
 int events_gc(void);
 void *events_loop(void *param);
 int events_running(void);
+void events_queue_stats(unsigned long *queued, unsigned long *coalesced, unsigned long *dropped);
 
 #endif
@@ -181,6 +181,7 @@ void event_function_register(struct event_functions_t **act, const char *name) {
 	strcpy((*act)->name, name);
 
 	(*act)->run = NULL;
+	memset(&(*act)->profile, 0, sizeof(struct event_profile_t));
 	(*act)->next = event_functions;
 	event_functions = (*act);
 }
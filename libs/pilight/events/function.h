@@ -21,10 +21,12 @@
 
 #include "../core/json.h"
 #include "../core/common.h"
+#include "profile.h"
 
 struct event_functions_t {
 	char *name;
 	int (*run)(struct rules_t *obj, struct JsonNode *arguments, char **out, enum origin_t origin);
+	struct event_profile_t profile;
 
 	struct event_functions_t *next;
 };
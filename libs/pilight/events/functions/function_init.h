@@ -0,0 +1,4 @@
+	functionDateAddInit();
+	functionDateFormatInit();
+	functionRandomInit();
+
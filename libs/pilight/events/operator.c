@@ -63,6 +63,10 @@ void event_operator_remove(char *name) {
 		}
 	}
 }
+
+/* Operators built for older versions return their
+   result as a string instead of a struct varcont_t */
+#define OPERATOR_REQVERSION	"7.0"
 #endif
 
 void event_operator_init(void) {
@@ -78,6 +82,7 @@ void event_operator_init(void) {
 	struct module_t module;
 	char pilight_version[strlen(PILIGHT_VERSION)+1];
 	char pilight_commit[3];
+	char abi[] = OPERATOR_REQVERSION;
 	char *operator_root = NULL;
 	int check1 = 0, check2 = 0, valid = 1, operator_root_free = 0;
 	strcpy(pilight_version, PILIGHT_VERSION);
@@ -124,6 +129,10 @@ void event_operator_init(void) {
 									if((check1 = vercmp(ver, pilight_version)) > 0) {
 										valid = 0;
 									}
+									if(valid == 1 && vercmp(ver, abi) < 0) {
+										logprintf(LOG_ERR, "event operator %s was built for pilight v%s and is incompatible", file->d_name, module.reqversion);
+										continue;
+									}
 
 									if(check1 == 0 && module.reqcommit != NULL) {
 										char com[strlen(module.reqcommit)+1];
@@ -179,6 +188,7 @@ void event_operator_register(struct event_operators_t **op, const char *name) {
 
 	(*op)->callback_string = NULL;
 	(*op)->callback_number = NULL;
+	memset(&(*op)->profile, 0, sizeof(struct event_profile_t));
 
 	(*op)->next = event_operators;
 	event_operators = (*op);
@@ -19,11 +19,18 @@
 #ifndef _EVENT_OPERATOR_H_
 #define _EVENT_OPERATOR_H_
 
+#include "profile.h"
+
+struct varcont_t;
+
 typedef struct event_operators_t {
 	char *name;
-	void (*callback_string)(char *a, char *b, char **ret);
-	void (*callback_number)(double a, double b, char **ret);
+	/* Operators get their operands in the type they
+	   ask for and return their result as a number */
+	void (*callback_string)(char *a, char *b, struct varcont_t *ret);
+	void (*callback_number)(double a, double b, struct varcont_t *ret);
 	unsigned short type;
+	struct event_profile_t profile;
 	struct event_operators_t *next;
 } event_operators_t;
 
@@ -21,12 +21,15 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "../../core/pilight.h"
 #include "../operator.h"
+#include "../events.h"
 #include "../../core/dso.h"
 #include "divide.h"
 
-static void operatorDivideCallback(double a, double b, char **ret) {
-	sprintf(*ret, "%f", (a / b));
+static void operatorDivideCallback(double a, double b, struct varcont_t *ret) {
+	ret->number_ = (a / b);
+	ret->decimals_ = 6;
 }
 
 #if !defined(MODULE) && !defined(_WIN32)
@@ -40,9 +43,9 @@ void operatorDivideInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "/";
-	module->version = "1.0";
-	module->reqversion = "5.0";
-	module->reqcommit = "87";
+	module->version = "2.0";
+	module->reqversion = "7.0";
+	module->reqcommit = "0";
 }
 
 void init(void) {
@@ -21,16 +21,19 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "../../core/pilight.h"
 #include "../operator.h"
+#include "../events.h"
 #include "../../core/dso.h"
 #include "ge.h"
 
-static void operatorGeCallback(double a, double b, char **ret) {
+static void operatorGeCallback(double a, double b, struct varcont_t *ret) {
 	if(a >= b) {
-		strcpy(*ret, "1");
+		ret->number_ = 1;
 	} else {
-		strcpy(*ret, "0");
+		ret->number_ = 0;
 	}
+	ret->decimals_ = 0;
 }
 
 #if !defined(MODULE) && !defined(_WIN32)
@@ -44,9 +47,9 @@ void operatorGeInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = ">=";
-	module->version = "1.0";
-	module->reqversion = "5.0";
-	module->reqcommit = "87";
+	module->version = "2.0";
+	module->reqversion = "7.0";
+	module->reqcommit = "0";
 }
 
 void init(void) {
@@ -23,13 +23,16 @@
 #include <math.h>
 
 #include "../../core/log.h"
+#include "../../core/pilight.h"
 #include "../operator.h"
+#include "../events.h"
 #include "../../core/dso.h"
 #include "intdivide.h"
 
 
-static void operatorIntDivideCallback(double a, double b, char **ret) {
-	sprintf(*ret, "%f", (a < 0 ? -floor(-a / b) : floor(a / b)));
+static void operatorIntDivideCallback(double a, double b, struct varcont_t *ret) {
+	ret->number_ = (a < 0 ? -floor(-a / b) : floor(a / b));
+	ret->decimals_ = 6;
 }
 
 #if !defined(MODULE) && !defined(_WIN32)
@@ -43,9 +46,9 @@ void operatorIntDivideInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "\\";
-	module->version = "1.0";
-	module->reqversion = "5.0";
-	module->reqcommit = "84";
+	module->version = "2.0";
+	module->reqversion = "7.0";
+	module->reqcommit = "0";
 }
 
 void init(void) {
@@ -22,13 +22,16 @@
 #include <unistd.h>
 #include <math.h>
 
+#include "../../core/pilight.h"
 #include "../operator.h"
+#include "../events.h"
 #include "../../core/dso.h"
 #include "../../core/log.h"
 #include "modulus.h"
 
-static void operatorModulusCallback(double a, double b, char **ret) {
-	sprintf(*ret, "%f",  a - b * floor(a / b));
+static void operatorModulusCallback(double a, double b, struct varcont_t *ret) {
+	ret->number_ = a - b * floor(a / b);
+	ret->decimals_ = 6;
 }
 
 #if !defined(MODULE) && !defined(_WIN32)
@@ -42,9 +45,9 @@ void operatorModulusInit(void) {
 #if defined(MODULE) && !defined(_WIN32)
 void compatibility(struct module_t *module) {
 	module->name = "%";
-	module->version = "1.0";
-	module->reqversion = "5.0";
-	module->reqcommit = "87";
+	module->version = "2.0";
+	module->reqversion = "7.0";
+	module->reqcommit = "0";
 }
 
 void init(void) {
@@ -0,0 +1,16 @@
+	#include "and.h"
+	#include "divide.h"
+	#include "eq.h"
+	#include "ge.h"
+	#include "gt.h"
+	#include "intdivide.h"
+	#include "is.h"
+	#include "le.h"
+	#include "lt.h"
+	#include "minus.h"
+	#include "modulus.h"
+	#include "multiply.h"
+	#include "ne.h"
+	#include "or.h"
+	#include "plus.h"
+
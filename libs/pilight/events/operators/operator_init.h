@@ -0,0 +1,16 @@
+	operatorAndInit();
+	operatorDivideInit();
+	operatorEqInit();
+	operatorGeInit();
+	operatorGtInit();
+	operatorIntDivideInit();
+	operatorIsInit();
+	operatorLeInit();
+	operatorLtInit();
+	operatorMinusInit();
+	operatorModulusInit();
+	operatorMultiplyInit();
+	operatorNeInit();
+	operatorOrInit();
+	operatorPlusInit();
+
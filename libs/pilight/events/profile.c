@@ -0,0 +1,241 @@
+/*
+	Copyright (C) 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+/*
+ * Rule evaluation profiler.
+ *
+ * Keeps counters and a latency histogram for every rule, operator
+ * and function. The histogram has a bucket per power of two
+ * nanoseconds, so percentiles are reported as the upper bound of
+ * the bucket they fall in. The counters of the event queue are
+ * reported alongside.
+ *
+ * Profiling is off until the event-profile setting is set or the
+ * profile is requested for the first time. Rules are evaluated on
+ * several threads, so the counters are updated atomically.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../core/mem.h"
+#include "../core/json.h"
+#include "../core/log.h"
+
+#include "profile.h"
+#include "action.h"
+#include "events.h"
+#include "operator.h"
+#include "function.h"
+
+typedef struct profile_entry_t {
+	char *name;
+	int nr;
+	struct event_rule_profile_t profile;
+} profile_entry_t;
+
+static volatile int profile_enabled = 0;
+static unsigned long long profile_started = 0;
+
+static unsigned long long event_profile_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+void event_profile_enable(void) {
+	if(__sync_bool_compare_and_swap(&profile_enabled, 0, 1)) {
+		profile_started = event_profile_now();
+		logprintf(LOG_INFO, "started profiling the rules");
+	}
+}
+
+/* Returns 0 when profiling is off, which the
+   other event_profile functions then ignore */
+unsigned long long event_profile_clock(void) {
+	if(profile_enabled == 0) {
+		return 0;
+	}
+	return event_profile_now();
+}
+
+static void event_profile_time(struct event_profile_t *profile, unsigned long long start) {
+	unsigned long long now = event_profile_now(), nsec = 0, x = 0, max = 0;
+	int i = 0;
+
+	nsec = (now > start) ? now - start : 0;
+	for(x=nsec;x > 1 && i < PROFILE_BUCKETS-1;x >>= 1) {
+		i++;
+	}
+	__sync_fetch_and_add(&profile->count, 1);
+	__sync_fetch_and_add(&profile->total, nsec);
+	__sync_fetch_and_add(&profile->buckets[i], 1);
+	/* Each failed swap returns the current maximum */
+	while(nsec > max) {
+		max = __sync_val_compare_and_swap(&profile->max, max, nsec);
+	}
+}
+
+void event_profile_add(struct event_profile_t *profile, unsigned long long start) {
+	if(start > 0) {
+		event_profile_time(profile, start);
+	}
+}
+
+void event_profile_rule(struct event_rule_profile_t *profile, unsigned long long start, int matched, int actions) {
+	if(start == 0) {
+		return;
+	}
+	event_profile_time(&profile->time, start);
+	if(matched == 1) {
+		__sync_fetch_and_add(&profile->matches, 1);
+	}
+	if(actions > 0) {
+		__sync_fetch_and_add(&profile->actions, (unsigned long)actions);
+	}
+}
+
+static unsigned long long event_profile_p99(struct event_profile_t *profile) {
+	unsigned long rank = profile->count - profile->count/100, n = 0;
+	unsigned long long bound = 0;
+	int i = 0;
+
+	if(profile->count == 0) {
+		return 0;
+	}
+	for(i=0;i<PROFILE_BUCKETS;i++) {
+		n += profile->buckets[i];
+		if(n >= rank) {
+			break;
+		}
+	}
+	bound = 1ULL << (i+1);
+	return (bound < profile->max) ? bound : profile->max;
+}
+
+/* Heaviest first */
+static int event_profile_sort(const void *a, const void *b) {
+	const struct profile_entry_t *x = a, *y = b;
+
+	if(x->profile.time.total != y->profile.time.total) {
+		return (x->profile.time.total < y->profile.time.total) ? 1 : -1;
+	}
+	return x->nr - y->nr;
+}
+
+static struct JsonNode *event_profile_entries(struct profile_entry_t *entries, int nrentries, int rules) {
+	struct JsonNode *jarray = json_mkarray();
+	struct JsonNode *jentry = NULL;
+	struct event_profile_t *time = NULL;
+	int i = 0;
+
+	qsort(entries, (size_t)nrentries, sizeof(struct profile_entry_t), event_profile_sort);
+	for(i=0;i<nrentries;i++) {
+		time = &entries[i].profile.time;
+		jentry = json_mkobject();
+		json_append_member(jentry, "name", json_mkstring(entries[i].name));
+		if(rules == 1) {
+			json_append_member(jentry, "nr", json_mknumber(entries[i].nr, 0));
+			json_append_member(jentry, "evaluations", json_mknumber((double)time->count, 0));
+			json_append_member(jentry, "matches", json_mknumber((double)entries[i].profile.matches, 0));
+			json_append_member(jentry, "actions", json_mknumber((double)entries[i].profile.actions, 0));
+		} else {
+			json_append_member(jentry, "calls", json_mknumber((double)time->count, 0));
+		}
+		/* Microseconds */
+		json_append_member(jentry, "total", json_mknumber((double)time->total/1000.0, 3));
+		json_append_member(jentry, "mean", json_mknumber((time->count > 0) ? ((double)time->total/(double)time->count)/1000.0 : 0.0, 3));
+		json_append_member(jentry, "p99", json_mknumber((double)event_profile_p99(time)/1000.0, 3));
+		json_append_member(jentry, "max", json_mknumber((double)time->max/1000.0, 3));
+		json_append_element(jarray, jentry);
+	}
+	return jarray;
+}
+
+static struct profile_entry_t *event_profile_entry(struct profile_entry_t **entries, int *nrentries) {
+	if((*entries = REALLOC(*entries, sizeof(struct profile_entry_t)*(size_t)(*nrentries+1))) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(&(*entries)[*nrentries], 0, sizeof(struct profile_entry_t));
+	return &(*entries)[(*nrentries)++];
+}
+
+/*
+	Lists the rules, operators and functions, those that
+	took the most time in total first. Times are in microseconds.
+	The first request starts profiling when it was off.
+*/
+struct JsonNode *event_profile_print(void) {
+	struct JsonNode *jprofile = json_mkobject();
+	struct profile_entry_t *entries = NULL, *entry = NULL;
+	struct rules_t *tmp_rules = rules_get();
+	struct event_operators_t *tmp_operators = event_operators;
+	struct event_functions_t *tmp_functions = event_functions;
+	struct JsonNode *jqueue = NULL;
+	unsigned long queued = 0, coalesced = 0, dropped = 0;
+	int nrentries = 0;
+
+	event_profile_enable();
+	/* Seconds the counters cover */
+	json_append_member(jprofile, "duration", json_mknumber((profile_started > 0) ? (double)(event_profile_now()-profile_started)/1000000000.0 : 0.0, 3));
+
+	while(tmp_rules) {
+		entry = event_profile_entry(&entries, &nrentries);
+		entry->name = tmp_rules->name;
+		entry->nr = tmp_rules->nr;
+		memcpy(&entry->profile, &tmp_rules->profile, sizeof(struct event_rule_profile_t));
+		tmp_rules = tmp_rules->next;
+	}
+	json_append_member(jprofile, "rules", event_profile_entries(entries, nrentries, 1));
+
+	nrentries = 0;
+	while(tmp_operators) {
+		entry = event_profile_entry(&entries, &nrentries);
+		entry->name = tmp_operators->name;
+		memcpy(&entry->profile.time, &tmp_operators->profile, sizeof(struct event_profile_t));
+		tmp_operators = tmp_operators->next;
+	}
+	json_append_member(jprofile, "operators", event_profile_entries(entries, nrentries, 0));
+
+	nrentries = 0;
+	while(tmp_functions) {
+		entry = event_profile_entry(&entries, &nrentries);
+		entry->name = tmp_functions->name;
+		memcpy(&entry->profile.time, &tmp_functions->profile, sizeof(struct event_profile_t));
+		tmp_functions = tmp_functions->next;
+	}
+	json_append_member(jprofile, "functions", event_profile_entries(entries, nrentries, 0));
+
+	if(entries != NULL) {
+		FREE(entries);
+	}
+
+	events_queue_stats(&queued, &coalesced, &dropped);
+	jqueue = json_mkobject();
+	json_append_member(jqueue, "queued", json_mknumber((double)queued, 0));
+	json_append_member(jqueue, "coalesced", json_mknumber((double)coalesced, 0));
+	json_append_member(jqueue, "dropped", json_mknumber((double)dropped, 0));
+	json_append_member(jprofile, "queue", jqueue);
+
+	return jprofile;
+}
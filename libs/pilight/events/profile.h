@@ -0,0 +1,48 @@
+/*
+	Copyright (C) 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#ifndef _EVENTS_PROFILE_H_
+#define _EVENTS_PROFILE_H_
+
+#include "../core/json.h"
+
+/* Bucket i counts the durations of 2^i up to 2^(i+1) nanoseconds */
+#define PROFILE_BUCKETS	40
+
+typedef struct event_profile_t {
+	unsigned long count;
+	/* Nanoseconds */
+	unsigned long long total;
+	unsigned long long max;
+	unsigned long buckets[PROFILE_BUCKETS];
+} event_profile_t;
+
+typedef struct event_rule_profile_t {
+	struct event_profile_t time;
+	/* Evaluations in which the condition held */
+	unsigned long matches;
+	unsigned long actions;
+} event_rule_profile_t;
+
+void event_profile_enable(void);
+unsigned long long event_profile_clock(void);
+void event_profile_add(struct event_profile_t *profile, unsigned long long start);
+void event_profile_rule(struct event_rule_profile_t *profile, unsigned long long start, int matched, int actions);
+struct JsonNode *event_profile_print(void);
+
+#endif
@@ -0,0 +1,254 @@
+/*
+	Copyright (C) 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+/*
+ * Hierarchical timer wheel.
+ *
+ * Timers due within the next TIMER_ROOT_SIZE ticks are kept in the root
+ * wheel, one slot per tick. Timers further away go into one of the
+ * coarser levels, each slot of which covers a whole turn of the level
+ * below it. Whenever the root wheel wraps, the next slot of the first
+ * level is cascaded down, and so on upwards. Adding and removing a
+ * timer are constant time, running the wheel costs one slot per tick.
+ *
+ * The wheel does no locking of its own, the owner serializes all calls.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "timer.h"
+
+#define TIMER_ROOT_MASK		(TIMER_ROOT_SIZE - 1)
+#define TIMER_LEVEL_MASK	(TIMER_LEVEL_SIZE - 1)
+
+/* Number of ticks the wheel can look ahead */
+#define TIMER_MAX_TICKS		((1ULL << (TIMER_ROOT_BITS + TIMER_LEVELS * TIMER_LEVEL_BITS)) - 1)
+
+unsigned long long event_timer_clock(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000 + (unsigned long long)(ts.tv_nsec / 1000000);
+}
+
+void event_timer_init(struct event_timer_t *timer, void *data) {
+	timer->expires = 0;
+	timer->data = data;
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+int event_timer_pending(struct event_timer_t *timer) {
+	return (timer->pprev != NULL);
+}
+
+void event_wheel_init(struct event_wheel_t *wheel, unsigned long long now) {
+	memset(wheel, 0, sizeof(struct event_wheel_t));
+	wheel->now = now;
+}
+
+static void event_wheel_link(struct event_timer_t **slot, struct event_timer_t *timer) {
+	timer->next = *slot;
+	if(*slot != NULL) {
+		(*slot)->pprev = &timer->next;
+	}
+	timer->pprev = slot;
+	*slot = timer;
+}
+
+static void event_wheel_unlink(struct event_timer_t *timer) {
+	*timer->pprev = timer->next;
+	if(timer->next != NULL) {
+		timer->next->pprev = timer->pprev;
+	}
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+static void event_wheel_insert(struct event_wheel_t *wheel, struct event_timer_t *timer) {
+	unsigned long long expires = timer->expires;
+	unsigned long long ticks = 0;
+	int level = 0, shift = TIMER_ROOT_BITS;
+
+	if(expires < wheel->now) {
+		expires = wheel->now;
+	}
+	ticks = expires - wheel->now;
+
+	if(ticks < TIMER_ROOT_SIZE) {
+		event_wheel_link(&wheel->root[expires & TIMER_ROOT_MASK], timer);
+		return;
+	}
+	/* Timers beyond the last level are parked in its farthest
+	   slot and moved on again once they cascade down */
+	if(ticks > TIMER_MAX_TICKS) {
+		expires = wheel->now + TIMER_MAX_TICKS;
+	}
+	for(level=0;level<TIMER_LEVELS-1;level++) {
+		if(ticks < (1ULL << (shift + TIMER_LEVEL_BITS))) {
+			break;
+		}
+		shift += TIMER_LEVEL_BITS;
+	}
+	event_wheel_link(&wheel->levels[level][(expires >> shift) & TIMER_LEVEL_MASK], timer);
+}
+
+void event_wheel_add(struct event_wheel_t *wheel, struct event_timer_t *timer, unsigned long long expires) {
+	if(timer->pprev != NULL) {
+		event_wheel_unlink(timer);
+	} else {
+		wheel->nrtimers++;
+	}
+	timer->expires = expires;
+	event_wheel_insert(wheel, timer);
+}
+
+/* Returns 0 when the timer was still pending */
+int event_wheel_del(struct event_wheel_t *wheel, struct event_timer_t *timer) {
+	if(timer->pprev == NULL) {
+		return -1;
+	}
+	event_wheel_unlink(timer);
+	wheel->nrtimers--;
+	return 0;
+}
+
+/* Spreads one slot of a level over the levels below it */
+static int event_wheel_cascade(struct event_wheel_t *wheel, int level, int shift) {
+	struct event_timer_t *timer = NULL, *next = NULL;
+	int index = (int)((wheel->now >> shift) & TIMER_LEVEL_MASK);
+
+	timer = wheel->levels[level][index];
+	wheel->levels[level][index] = NULL;
+	while(timer) {
+		next = timer->next;
+		timer->next = NULL;
+		timer->pprev = NULL;
+		event_wheel_insert(wheel, timer);
+		timer = next;
+	}
+	return index;
+}
+
+/*
+	Tells the next tick at which the wheel has work to do. That
+	is either the tick a root timer expires, or the moment a
+	slot holding timers has to be cascaded down. Ticks before
+	it can be skipped. Returns -1 when no timers are pending.
+*/
+int event_wheel_next(struct event_wheel_t *wheel, unsigned long long *next) {
+	unsigned long long tick = 0, found = 0;
+	int index = (int)(wheel->now & TIMER_ROOT_MASK), i = 0, k = 0;
+	int level = 0, shift = TIMER_ROOT_BITS;
+
+	if(wheel->nrtimers == 0) {
+		return -1;
+	}
+	/* The root wheel wrapped, so the levels have to be cascaded first */
+	if(index == 0) {
+		*next = wheel->now;
+		return 0;
+	}
+
+	for(i=index;i<TIMER_ROOT_SIZE;i++) {
+		if(wheel->root[i] != NULL) {
+			*next = wheel->now + (unsigned long long)(i - index);
+			return 0;
+		}
+	}
+	for(i=0;i<index;i++) {
+		if(wheel->root[i] != NULL) {
+			/* Due after the root wheel wrapped */
+			found = (wheel->now | TIMER_ROOT_MASK) + 1;
+			break;
+		}
+	}
+
+	/* A slot of a level is cascaded when the tick its index
+	   points to comes round again */
+	for(level=0;level<TIMER_LEVELS;level++) {
+		index = (int)((wheel->now >> shift) & TIMER_LEVEL_MASK);
+		for(k=1;k<=TIMER_LEVEL_SIZE;k++) {
+			if(wheel->levels[level][(index + k) & TIMER_LEVEL_MASK] != NULL) {
+				tick = ((wheel->now >> shift) + (unsigned long long)k) << shift;
+				if(found == 0 || tick < found) {
+					found = tick;
+				}
+				break;
+			}
+		}
+		shift += TIMER_LEVEL_BITS;
+	}
+
+	*next = found;
+	return 0;
+}
+
+/*
+	Runs the wheel up to and including tick now and returns
+	the timers that expired, linked through their next member.
+	The returned timers are no longer pending.
+*/
+struct event_timer_t *event_wheel_run(struct event_wheel_t *wheel, unsigned long long now) {
+	struct event_timer_t *expired = NULL, *timer = NULL, *next = NULL;
+	unsigned long long tick = 0;
+	int index = 0, level = 0, shift = 0;
+
+	while(wheel->now <= now) {
+		/* Skip the ticks nothing happens at */
+		if(event_wheel_next(wheel, &tick) != 0 || tick > now) {
+			wheel->now = now + 1;
+			break;
+		}
+		wheel->now = tick;
+
+		index = (int)(wheel->now & TIMER_ROOT_MASK);
+		if(index == 0) {
+			shift = TIMER_ROOT_BITS;
+			for(level=0;level<TIMER_LEVELS;level++) {
+				if(event_wheel_cascade(wheel, level, shift) != 0) {
+					break;
+				}
+				shift += TIMER_LEVEL_BITS;
+			}
+		}
+
+		timer = wheel->root[index];
+		wheel->root[index] = NULL;
+		while(timer) {
+			next = timer->next;
+			timer->pprev = NULL;
+			if(timer->expires > wheel->now) {
+				/* Parked beyond the reach of the wheel */
+				event_wheel_insert(wheel, timer);
+			} else {
+				wheel->nrtimers--;
+				timer->next = expired;
+				expired = timer;
+			}
+			timer = next;
+		}
+		wheel->now++;
+	}
+
+	return expired;
+}
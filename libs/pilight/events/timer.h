@@ -0,0 +1,55 @@
+/*
+	Copyright (C) 2015 CurlyMo
+
+	This file is part of pilight.
+
+	pilight is free software: you can redistribute it and/or modify it under the
+	terms of the GNU General Public License as published by the Free Software
+	Foundation, either version 3 of the License, or (at your option) any later
+	version.
+
+	pilight is distributed in the hope that it will be useful, but WITHOUT ANY
+	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+	A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with pilight. If not, see	<http://www.gnu.org/licenses/>
+*/
+
+#ifndef _EVENTS_TIMER_H_
+#define _EVENTS_TIMER_H_
+
+/* A tick is one millisecond */
+#define TIMER_ROOT_BITS		8
+#define TIMER_LEVEL_BITS	6
+#define TIMER_LEVELS			4
+#define TIMER_ROOT_SIZE		(1 << TIMER_ROOT_BITS)
+#define TIMER_LEVEL_SIZE	(1 << TIMER_LEVEL_BITS)
+
+typedef struct event_timer_t {
+	unsigned long long expires;
+	void *data;
+
+	struct event_timer_t *next;
+	struct event_timer_t **pprev;
+} event_timer_t;
+
+typedef struct event_wheel_t {
+	/* Next tick that has not been run */
+	unsigned long long now;
+	int nrtimers;
+	struct event_timer_t *root[TIMER_ROOT_SIZE];
+	struct event_timer_t *levels[TIMER_LEVELS][TIMER_LEVEL_SIZE];
+} event_wheel_t;
+
+unsigned long long event_timer_clock(void);
+void event_timer_init(struct event_timer_t *timer, void *data);
+int event_timer_pending(struct event_timer_t *timer);
+
+void event_wheel_init(struct event_wheel_t *wheel, unsigned long long now);
+void event_wheel_add(struct event_wheel_t *wheel, struct event_timer_t *timer, unsigned long long expires);
+int event_wheel_del(struct event_wheel_t *wheel, struct event_timer_t *timer);
+struct event_timer_t *event_wheel_run(struct event_wheel_t *wheel, unsigned long long now);
+int event_wheel_next(struct event_wheel_t *wheel, unsigned long long *next);
+
+#endif
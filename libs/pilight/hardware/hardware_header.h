@@ -0,0 +1,5 @@
+	#include "../hardware/433gpio.h"
+	#include "../hardware/433lirc.h"
+	#include "../hardware/433nano.h"
+	#include "../hardware/none.h"
+
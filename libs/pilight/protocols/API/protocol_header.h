@@ -0,0 +1,9 @@
+	#include "cpu_temp.h"
+	#include "datetime.h"
+	#include "lirc.h"
+	#include "openweathermap.h"
+	#include "program.h"
+	#include "sunriseset.h"
+	#include "wunderground.h"
+	#include "xbmc.h"
+
@@ -0,0 +1,9 @@
+	cpuTempInit();
+	datetimeInit();
+	lircInit();
+	openweathermapInit();
+	programInit();
+	sunRiseSetInit();
+	wundergroundInit();
+	xbmcInit();
+
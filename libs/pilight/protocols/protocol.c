@@ -48,6 +48,72 @@
 
 struct protocols_t *protocols;
 
+#define PROTOCOL_INDEX_SIZE	256
+
+/* Lookup tables from a protocol id and from a device
+   name (e.g. kaku_switch) to the registered protocol */
+typedef struct protocol_index_t {
+	const char *name;
+	struct protocol_t *listener;
+	struct protocol_index_t *next;
+} protocol_index_t;
+
+static struct protocol_index_t *protocol_ids[PROTOCOL_INDEX_SIZE];
+static struct protocol_index_t *protocol_devices[PROTOCOL_INDEX_SIZE];
+
+static void protocol_index_add(struct protocol_index_t **index, const char *name, protocol_t *proto) {
+	unsigned int i = strhash(name) % PROTOCOL_INDEX_SIZE;
+	struct protocol_index_t *node = MALLOC(sizeof(struct protocol_index_t));
+	if(node == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	node->name = name;
+	node->listener = proto;
+	node->next = index[i];
+	index[i] = node;
+}
+
+static void protocol_index_remove(struct protocol_index_t **index, protocol_t *proto) {
+	struct protocol_index_t *currP = NULL, *prevP = NULL, *tmp = NULL;
+	int i = 0;
+
+	for(i=0;i<PROTOCOL_INDEX_SIZE;i++) {
+		prevP = NULL;
+		currP = index[i];
+		while(currP) {
+			if(proto == NULL || currP->listener == proto) {
+				if(prevP == NULL) {
+					index[i] = currP->next;
+				} else {
+					prevP->next = currP->next;
+				}
+				tmp = currP;
+				currP = currP->next;
+				FREE(tmp);
+			} else {
+				prevP = currP;
+				currP = currP->next;
+			}
+		}
+	}
+}
+
+static int protocol_index_get(struct protocol_index_t **index, const char *name, protocol_t **proto) {
+	struct protocol_index_t *node = index[strhash(name) % PROTOCOL_INDEX_SIZE];
+
+	while(node) {
+		if(strcmp(node->name, name) == 0) {
+			if(proto != NULL) {
+				*proto = node->listener;
+			}
+			return 0;
+		}
+		node = node->next;
+	}
+	return 1;
+}
+
 #ifndef _WIN32
 void protocol_remove(char *name) {
 	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
@@ -67,6 +133,8 @@ void protocol_remove(char *name) {
 
 			struct protocol_devices_t *dtmp;
 			logprintf(LOG_DEBUG, "removed protocol %s", currP->listener->id);
+			protocol_index_remove(protocol_ids, currP->listener);
+			protocol_index_remove(protocol_devices, currP->listener);
 			if(currP->listener->threadGC) {
 				currP->listener->threadGC();
 				logprintf(LOG_DEBUG, "stopped protocol threads");
@@ -333,6 +401,13 @@ void protocol_set_id(protocol_t *proto, const char *id) {
 		exit(EXIT_FAILURE);
 	}
 	strcpy(proto->id, id);
+	protocol_index_add(protocol_ids, proto->id, proto);
+}
+
+int protocol_get(const char *id, protocol_t **proto) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	return protocol_index_get(protocol_ids, id, proto);
 }
 
 void protocol_device_add(protocol_t *proto, const char *id, const char *desc) {
@@ -355,6 +430,13 @@ void protocol_device_add(protocol_t *proto, const char *id, const char *desc) {
 	strcpy(dnode->desc, desc);
 	dnode->next	= proto->devices;
 	proto->devices = dnode;
+	protocol_index_add(protocol_devices, dnode->id, proto);
+}
+
+int protocol_device_get(const char *id, protocol_t **proto) {
+	logprintf(LOG_STACK, "%s(...)", __FUNCTION__);
+
+	return protocol_index_get(protocol_devices, id, proto);
 }
 
 int protocol_device_exists(protocol_t *proto, const char *id) {
@@ -381,6 +463,9 @@ int protocol_gc(void) {
 	struct protocols_t *ptmp;
 	struct protocol_devices_t *dtmp;
 
+	protocol_index_remove(protocol_ids, NULL);
+	protocol_index_remove(protocol_devices, NULL);
+
 	while(protocols) {
 		ptmp = protocols;
 		logprintf(LOG_DEBUG, "protocol %s", ptmp->listener->id);
@@ -121,10 +121,12 @@ int protocol_thread_wait(struct protocol_threads_t *node, int interval, int *nrl
 void protocol_thread_free(protocol_t *proto);
 void protocol_thread_stop(protocol_t *proto);
 void protocol_set_id(protocol_t *proto, const char *id);
+int protocol_get(const char *id, protocol_t **proto);
 void protocol_plslen_add(protocol_t *proto, int plslen);
 void protocol_register(protocol_t **proto);
 void protocol_device_add(protocol_t *proto, const char *id, const char *desc);
 int protocol_device_exists(protocol_t *proto, const char *id);
+int protocol_device_get(const char *id, protocol_t **proto);
 int protocol_gc(void);
 
 #endif
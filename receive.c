@@ -81,6 +81,7 @@ int main(int argc, char **argv) {
 	char *server = NULL;
 	unsigned short port = 0;
 	unsigned short stats = 0;
+	unsigned short msgpack = 0;
 
 	char *args = NULL;
 
@@ -89,6 +90,7 @@ int main(int argc, char **argv) {
 	options_add(&options, 'S', "server", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, "^(([0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5]).){3}([0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5])$");
 	options_add(&options, 'P', "port", OPTION_HAS_VALUE, 0, JSON_NULL, NULL, "[0-9]{1,4}");
 	options_add(&options, 's', "stats", OPTION_NO_VALUE, 0, JSON_NULL, NULL, "[0-9]{1,4}");
+	options_add(&options, 'm', "msgpack", OPTION_NO_VALUE, 0, JSON_NULL, NULL, NULL);
 
 	/* Store all CLI arguments for later usage
 	   and also check if the CLI arguments where
@@ -108,6 +110,7 @@ int main(int argc, char **argv) {
 				printf("\t -S --server=x.x.x.x\t\tconnect to server address\n");
 				printf("\t -P --port=xxxx\t\t\tconnect to server port\n");
 				printf("\t -s --stats\t\t\tshow CPU and RAM statistics\n");
+				printf("\t -m --msgpack\t\t\treceive messages in binary msgpack encoding\n");
 				exit(EXIT_SUCCESS);
 			break;
 			case 'V':
@@ -127,6 +130,9 @@ int main(int argc, char **argv) {
 			case 's':
 				stats = 1;
 			break;
+			case 'm':
+				msgpack = 1;
+			break;
 			default:
 				printf("Usage: %s -l location -d device\n", progname);
 				exit(EXIT_SUCCESS);
@@ -162,6 +168,9 @@ int main(int argc, char **argv) {
 	json_append_member(joptions, "receiver", json_mknumber(1, 0));
 	json_append_member(joptions, "stats", json_mknumber(stats, 0));
 	json_append_member(jclient, "options", joptions);
+	if(msgpack == 1) {
+		json_append_member(jclient, "encoding", json_mkstring("msgpack"));
+	}
 	char *out = json_stringify(jclient, NULL);
 	socket_write(sockfd, out);
 	json_free(out);
@@ -179,7 +188,16 @@ int main(int argc, char **argv) {
 		char **array = NULL;
 		unsigned int n = explode(recvBuff, "\n", &array), i = 0;
 		for(i=0;i<n;i++) {
-			struct JsonNode *jcontent = json_decode(array[i]);
+			struct JsonNode *jcontent = NULL;
+			if(socket_is_binary(array[i])) {
+				size_t len = socket_unescape(array[i]);
+				jcontent = json_decode_msgpack(array[i], len);
+			} else {
+				jcontent = json_decode(array[i]);
+			}
+			if(jcontent == NULL) {
+				continue;
+			}
 			struct JsonNode *jtype = json_find_member(jcontent, "type");
 			if(jtype != NULL) {
 				json_remove_from_parent(jtype);